@@ -0,0 +1,182 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>   // For clock_gettime()
+
+
+//
+// Constants
+//
+
+// A run has to take at least this long before we trust its timing.
+static const double kMinSeconds = 0.2;
+
+
+//
+// Global variables
+//
+
+// Updated with atomics, since the parser benchmark's worker threads allocate
+// too.
+static size_t gAllocs = 0;
+
+static const void* volatile gSink = NULL;
+
+
+//
+// Forward declarations
+//
+
+double fetchdeps_bench_now();
+
+// The benchmarks are linked with --wrap for each of these, so that calls to
+// them from our own code come here instead.
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+
+//
+// Public functions
+//
+
+void
+fetchdeps_bench_run(const char* name, size_t n, bench_fn fn, void* arg)
+{
+  benchresult_t result;
+
+  fetchdeps_bench_measure(fn, arg, &result);
+  printf("%-28s %8lu %12.1f %12.2f\n", name, (unsigned long)n,
+         result.seconds * 1e9 / result.ops, (double)result.allocs / result.ops);
+  fflush(stdout);
+}
+
+
+void
+fetchdeps_bench_measure(bench_fn fn, void* arg, benchresult_t* result)
+{
+  size_t iterations = 1;
+  double start;
+
+  for (;;) {
+    result->allocs = fetchdeps_bench_allocs();
+    start = fetchdeps_bench_now();
+    result->ops = fn(arg, iterations);
+    result->seconds = fetchdeps_bench_now() - start;
+    result->allocs = fetchdeps_bench_allocs() - result->allocs;
+
+    if (result->seconds >= kMinSeconds || result->ops == 0)
+      break;
+
+    // Aim a little past the minimum time, so we don't come up just short.
+    if (result->seconds < kMinSeconds / 100)
+      iterations *= 100;
+    else
+      iterations = (size_t)(iterations * kMinSeconds * 1.2 / result->seconds) + 1;
+  }
+
+  if (result->ops == 0)
+    result->ops = 1;
+}
+
+
+void
+fetchdeps_bench_header(const char* title)
+{
+  printf("\n%-28s %8s %12s %12s\n", title, "n", "ns/op", "allocs/op");
+}
+
+
+size_t
+fetchdeps_bench_allocs()
+{
+  return __atomic_load_n(&gAllocs, __ATOMIC_RELAXED);
+}
+
+
+void
+fetchdeps_bench_use(const void* ptr)
+{
+  gSink = ptr;
+}
+
+
+char**
+fetchdeps_bench_strings(const char* format, size_t n)
+{
+  char** strings;
+  size_t i;
+
+  strings = (char**)calloc(n + 1, sizeof(char*));
+  if (!strings)
+    goto failure;
+
+  for (i = 0; i < n; ++i) {
+    size_t len = strlen(format) + 40;
+    strings[i] = (char*)malloc(len);
+    if (!strings[i])
+      goto failure;
+    snprintf(strings[i], len, format, (unsigned long)i, (unsigned long)i);
+  }
+  return strings;
+
+failure:
+  fprintf(stderr, "Out of memory\n");
+  exit(1);
+}
+
+
+void
+fetchdeps_bench_free_strings(char** strings)
+{
+  size_t i;
+
+  for (i = 0; strings[i]; ++i)
+    free(strings[i]);
+  free(strings);
+}
+
+
+//
+// Allocation counting
+//
+
+void*
+__wrap_malloc(size_t size)
+{
+  __atomic_add_fetch(&gAllocs, 1, __ATOMIC_RELAXED);
+  return __real_malloc(size);
+}
+
+
+void*
+__wrap_calloc(size_t count, size_t size)
+{
+  __atomic_add_fetch(&gAllocs, 1, __ATOMIC_RELAXED);
+  return __real_calloc(count, size);
+}
+
+
+void*
+__wrap_realloc(void* ptr, size_t size)
+{
+  __atomic_add_fetch(&gAllocs, 1, __ATOMIC_RELAXED);
+  return __real_realloc(ptr, size);
+}
+
+
+//
+// Private functions
+//
+
+double
+fetchdeps_bench_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
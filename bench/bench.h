@@ -0,0 +1,62 @@
+#ifndef fetchdeps_bench_h
+#define fetchdeps_bench_h
+
+#include "common.h"
+
+#include <stddef.h>
+
+
+//
+// Types
+//
+
+// A benchmark body. It should repeat the operation being measured
+// 'iterations' times and return the number of operations it performed, which
+// is what the time and allocations get divided by. Any setup which shouldn't
+// be measured belongs outside of it.
+typedef size_t (*bench_fn)(void* arg, size_t iterations);
+
+
+// The totals for the final run of a benchmark.
+struct _benchresult {
+  size_t ops;
+  size_t allocs;
+  double seconds;
+};
+typedef struct _benchresult benchresult_t;
+
+
+//
+// Functions
+//
+
+// Run a benchmark, calling 'fn' with a growing number of iterations until a
+// run takes long enough to time reliably, then print a line with the time and
+// number of allocations per operation. 'n' is the size of the input, which is
+// printed alongside the name.
+void fetchdeps_bench_run(const char* name, size_t n, bench_fn fn, void* arg);
+
+// Run a benchmark as fetchdeps_bench_run does, but fill in 'result' instead
+// of printing anything, for benchmarks which report something different.
+void fetchdeps_bench_measure(bench_fn fn, void* arg, benchresult_t* result);
+
+// Print the column headings for the lines fetchdeps_bench_run prints.
+void fetchdeps_bench_header(const char* title);
+
+// Returns the number of calls to malloc, calloc and realloc so far. Only calls
+// from the objects linked into the benchmark count, not ones made inside the
+// C library itself.
+size_t fetchdeps_bench_allocs();
+
+// Stop the compiler from optimising away a result which is otherwise unused.
+void fetchdeps_bench_use(const void* ptr);
+
+// Return an array of 'n' strings followed by a NULL. Each is made by passing
+// its index to printf with 'format', which may use it up to twice as "%lu".
+// Free it with fetchdeps_bench_free_strings. Exits the program if memory runs
+// out, since there's no way to carry on.
+char** fetchdeps_bench_strings(const char* format, size_t n);
+void fetchdeps_bench_free_strings(char** strings);
+
+#endif // fetchdeps_bench_h
+
@@ -0,0 +1,295 @@
+// Microbenchmarks for the containers everything else is built on: stringset_t,
+// varmap_t and the import of variables from the environment. Each benchmark is
+// run over a range of input sizes; see bench.h for how they're timed.
+
+#include "bench.h"
+
+#include "alloc.h"
+#include "environ.h"
+#include "stringset.h"
+#include "strpool.h"
+#include "varmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+//
+// Constants
+//
+
+static const size_t kSizes[] = { 1, 4, 8, 16, 64, 256, 1024, 4096 };
+static const size_t kNumSizes = sizeof(kSizes) / sizeof(kSizes[0]);
+
+// How many variables the environment benchmarks look up, which is about what
+// a typical deps file refers to.
+static const size_t kLookups = 4;
+
+
+//
+// Types
+//
+
+struct _containerbench {
+  size_t n;
+  char** strings;   // n strings, all distinct.
+  char** others;    // Another n strings, none of which are in 'strings'.
+  char** env;       // n strings of the form NAME=VALUE, for 'environ'.
+  stringset_t* set;
+  stringset_t* other_set;
+  varmap_t* vm;
+};
+typedef struct _containerbench containerbench_t;
+
+
+//
+// Global variables
+//
+
+// Provided by the C library, each entry is a string of the form NAME=VALUE.
+extern char** environ;
+
+
+//
+// Forward declarations
+//
+
+size_t fetchdeps_bench_stringset_add(void* arg, size_t iterations);
+size_t fetchdeps_bench_stringset_add_all(void* arg, size_t iterations);
+size_t fetchdeps_bench_stringset_contains_any(void* arg, size_t iterations);
+size_t fetchdeps_bench_varmap_set(void* arg, size_t iterations);
+size_t fetchdeps_bench_varmap_get(void* arg, size_t iterations);
+size_t fetchdeps_bench_environ_lazy(void* arg, size_t iterations);
+size_t fetchdeps_bench_environ_all(void* arg, size_t iterations);
+void fetchdeps_bench_setup(containerbench_t* b, size_t n);
+void fetchdeps_bench_teardown(containerbench_t* b);
+
+
+//
+// Main
+//
+
+int
+main(int argc, char** argv)
+{
+  char** saved_environ = environ;
+  containerbench_t b;
+  allocator_t* pool;
+  size_t i;
+
+  fetchdeps_bench_header("stringset_t");
+  for (i = 0; i < kNumSizes; ++i) {
+    fetchdeps_bench_setup(&b, kSizes[i]);
+    fetchdeps_bench_run("stringset_add", b.n, fetchdeps_bench_stringset_add, &b);
+    fetchdeps_bench_run("stringset_add_all", b.n, fetchdeps_bench_stringset_add_all, &b);
+    fetchdeps_bench_run("stringset_contains_any", b.n, fetchdeps_bench_stringset_contains_any, &b);
+    fetchdeps_bench_teardown(&b);
+  }
+
+  // The same again with the sets' memory coming from the pool allocator. The
+  // allocations counted are the ones which reach the C library.
+  pool = fetchdeps_alloc_new_pool_allocator();
+  if (!pool || !fetchdeps_alloc_set_allocator(ALLOC_STRINGSET, pool)) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  fetchdeps_bench_header("stringset_t (pool)");
+  for (i = 0; i < kNumSizes; ++i) {
+    fetchdeps_bench_setup(&b, kSizes[i]);
+    fetchdeps_bench_run("stringset_add", b.n, fetchdeps_bench_stringset_add, &b);
+    fetchdeps_bench_run("stringset_add_all", b.n, fetchdeps_bench_stringset_add_all, &b);
+    fetchdeps_bench_teardown(&b);
+  }
+  fetchdeps_alloc_set_allocator(ALLOC_STRINGSET, NULL);
+  fetchdeps_alloc_free_allocator(pool);
+
+  fetchdeps_bench_header("varmap_t");
+  for (i = 0; i < kNumSizes; ++i) {
+    fetchdeps_bench_setup(&b, kSizes[i]);
+    fetchdeps_bench_run("varmap_set", b.n, fetchdeps_bench_varmap_set, &b);
+    fetchdeps_bench_run("varmap_get", b.n, fetchdeps_bench_varmap_get, &b);
+    fetchdeps_bench_teardown(&b);
+  }
+
+  // The size here is the number of variables in the environment.
+  fetchdeps_bench_header("environment");
+  for (i = 0; i < kNumSizes; ++i) {
+    fetchdeps_bench_setup(&b, kSizes[i]);
+    environ = b.env;
+    fetchdeps_bench_run("environ_init_and_lookup", b.n, fetchdeps_bench_environ_lazy, &b);
+    fetchdeps_bench_run("environ_init_and_list", b.n, fetchdeps_bench_environ_all, &b);
+    environ = saved_environ;
+    fetchdeps_bench_teardown(&b);
+  }
+
+  fetchdeps_strpool_free();
+  return 0;
+}
+
+
+//
+// Benchmarks
+//
+
+// Build a set from scratch, one string at a time. An op is one add.
+size_t
+fetchdeps_bench_stringset_add(void* arg, size_t iterations)
+{
+  containerbench_t* b = (containerbench_t*)arg;
+  size_t it, i;
+
+  for (it = 0; it < iterations; ++it) {
+    stringset_t* ss = fetchdeps_stringset_new();
+    for (i = 0; i < b->n; ++i)
+      fetchdeps_stringset_add(ss, b->strings[i]);
+    fetchdeps_bench_use(ss);
+    fetchdeps_stringset_free(ss);
+  }
+  return iterations * b->n;
+}
+
+
+// Copy a set into a new empty one. An op is one fetchdeps_stringset_add_all.
+size_t
+fetchdeps_bench_stringset_add_all(void* arg, size_t iterations)
+{
+  containerbench_t* b = (containerbench_t*)arg;
+  size_t it;
+
+  for (it = 0; it < iterations; ++it) {
+    stringset_t* ss = fetchdeps_stringset_new();
+    fetchdeps_stringset_add_all(ss, b->set);
+    fetchdeps_bench_use(ss);
+    fetchdeps_stringset_free(ss);
+  }
+  return iterations;
+}
+
+
+// Intersect two sets of the same size with nothing in common, which is the
+// worst case since every string has to be checked.
+size_t
+fetchdeps_bench_stringset_contains_any(void* arg, size_t iterations)
+{
+  containerbench_t* b = (containerbench_t*)arg;
+  size_t it, found = 0;
+
+  for (it = 0; it < iterations; ++it)
+    found += fetchdeps_stringset_contains_any(b->set, b->other_set);
+  fetchdeps_bench_use(&found);
+  return iterations;
+}
+
+
+// Replace the value of an existing variable.
+size_t
+fetchdeps_bench_varmap_set(void* arg, size_t iterations)
+{
+  containerbench_t* b = (containerbench_t*)arg;
+  size_t it;
+
+  for (it = 0; it < iterations; ++it)
+    fetchdeps_varmap_set_single(b->vm, b->strings[it % b->n], "value");
+  return iterations;
+}
+
+
+size_t
+fetchdeps_bench_varmap_get(void* arg, size_t iterations)
+{
+  containerbench_t* b = (containerbench_t*)arg;
+  size_t it;
+
+  for (it = 0; it < iterations; ++it)
+    fetchdeps_bench_use(fetchdeps_varmap_get(b->vm, b->strings[it % b->n]));
+  return iterations;
+}
+
+
+// Set up the variables the way the get and list commands do, then look up a
+// few of them, which is all that most runs need from the environment.
+size_t
+fetchdeps_bench_environ_lazy(void* arg, size_t iterations)
+{
+  containerbench_t* b = (containerbench_t*)arg;
+  char* no_args[] = { NULL };
+  size_t it, i;
+
+  for (it = 0; it < iterations; ++it) {
+    varmap_t* vm = fetchdeps_varmap_new();
+    fetchdeps_environ_init_all_vars(vm, no_args);
+    for (i = 0; i < kLookups; ++i)
+      fetchdeps_bench_use(fetchdeps_varmap_get(vm, b->strings[i % b->n]));
+    fetchdeps_varmap_free(vm);
+  }
+  return iterations;
+}
+
+
+// As above, but then list all of the variables the way the vars command does,
+// which needs every environment variable.
+size_t
+fetchdeps_bench_environ_all(void* arg, size_t iterations)
+{
+  char* no_args[] = { NULL };
+  size_t it;
+
+  for (it = 0; it < iterations; ++it) {
+    varmap_t* vm = fetchdeps_varmap_new();
+    variter_t* iter;
+
+    fetchdeps_environ_init_all_vars(vm, no_args);
+    iter = fetchdeps_variter_new(vm);
+    while (fetchdeps_variter_next(iter).name)
+      ;
+    fetchdeps_variter_free(iter);
+    fetchdeps_varmap_free(vm);
+  }
+  return iterations;
+}
+
+
+//
+// Private functions
+//
+
+void
+fetchdeps_bench_setup(containerbench_t* b, size_t n)
+{
+  size_t i;
+
+  b->n = n;
+  b->strings = fetchdeps_bench_strings("BENCH_VAR_%lu", n);
+  b->others = fetchdeps_bench_strings("OTHER_VAR_%lu", n);
+  b->env = fetchdeps_bench_strings("BENCH_VAR_%lu=%lu", n);
+  b->set = fetchdeps_stringset_new();
+  b->other_set = fetchdeps_stringset_new();
+  b->vm = fetchdeps_varmap_new();
+  if (!b->set || !b->other_set || !b->vm)
+    goto failure;
+
+  for (i = 0; i < n; ++i) {
+    if (!fetchdeps_stringset_add(b->set, b->strings[i]) ||
+        !fetchdeps_stringset_add(b->other_set, b->others[i]) ||
+        !fetchdeps_varmap_set_single(b->vm, b->strings[i], "value"))
+      goto failure;
+  }
+  return;
+
+failure:
+  fprintf(stderr, "Out of memory\n");
+  exit(1);
+}
+
+
+void
+fetchdeps_bench_teardown(containerbench_t* b)
+{
+  fetchdeps_varmap_free(b->vm);
+  fetchdeps_stringset_free(b->other_set);
+  fetchdeps_stringset_free(b->set);
+  fetchdeps_bench_free_strings(b->env);
+  fetchdeps_bench_free_strings(b->others);
+  fetchdeps_bench_free_strings(b->strings);
+}
+
@@ -0,0 +1,110 @@
+// Writes a synthetic deps file to stdout, for benchmarking the parser on
+// inputs of whatever shape is needed. See generate.h for what the options
+// control.
+
+#include "generate.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+//
+// Forward declarations
+//
+
+void fetchdeps_gendeps_usage(char* argv0);
+bool_t fetchdeps_gendeps_number(char* arg, size_t* result);
+
+
+//
+// Main
+//
+
+int
+main(int argc, char** argv)
+{
+  genconfig_t config = { 10000, 2, 2, 4, 1 };
+  genstats_t stats;
+  size_t seed;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "u:d:f:v:s:h")) != -1) {
+    switch (ch) {
+    case 'u':
+      if (!fetchdeps_gendeps_number(optarg, &config.num_urls))
+        goto usage;
+      break;
+    case 'd':
+      if (!fetchdeps_gendeps_number(optarg, &config.depth) || config.depth > kGenerateMaxDepth)
+        goto usage;
+      break;
+    case 'f':
+      if (!fetchdeps_gendeps_number(optarg, &config.fanout) || config.fanout == 0)
+        goto usage;
+      break;
+    case 'v':
+      if (!fetchdeps_gendeps_number(optarg, &config.num_vars) || config.num_vars == 0)
+        goto usage;
+      break;
+    case 's':
+      if (!fetchdeps_gendeps_number(optarg, &seed))
+        goto usage;
+      config.seed = (unsigned)seed;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc)
+    goto usage;
+
+  if (!fetchdeps_generate_deps(stdout, &config, &stats) || fflush(stdout) != 0) {
+    perror("Error writing deps file");
+    return 1;
+  }
+  fprintf(stderr, "Wrote %lu lines, %lu URLs and %lu relations\n",
+          (unsigned long)stats.lines,
+          (unsigned long)stats.urls,
+          (unsigned long)stats.relations);
+  return 0;
+
+usage:
+  fetchdeps_gendeps_usage(argv[0]);
+  return 1;
+}
+
+
+//
+// Private functions
+//
+
+void
+fetchdeps_gendeps_usage(char* argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [-u urls] [-d depth] [-f fanout] [-v vars] [-s seed] > file.deps\n"
+          "\n"
+          "  -u   Number of URLs in the file. Default 10000.\n"
+          "  -d   How deeply conditional sections nest, up to %d. Default 2.\n"
+          "  -f   Number of values in each relation. Default 2.\n"
+          "  -v   Number of distinct variables, called v0, v1, ... Default 4.\n"
+          "  -s   Random seed. The same seed always gives the same file.\n"
+          "\n"
+          "Set every variable to \"%s\" when evaluating the file.\n",
+          argv0, kGenerateMaxDepth, kGenerateValue);
+}
+
+
+bool_t
+fetchdeps_gendeps_number(char* arg, size_t* result)
+{
+  char* end;
+  unsigned long value = strtoul(arg, &end, 10);
+
+  if (*arg == '\0' || *end != '\0')
+    return 0;
+  *result = (size_t)value;
+  return 1;
+}
+
@@ -0,0 +1,180 @@
+#include "generate.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+
+//
+// Constants
+//
+
+// Each section below the deepest level has this many conditional sections
+// inside it, after its own URL.
+static const size_t kBranches = 2;
+
+// Sections at the deepest level hold up to this many URLs.
+static const size_t kUrlsPerLeaf = 4;
+
+
+//
+// Types
+//
+
+struct _generator {
+  FILE* out;
+  genconfig_t* config;
+  genstats_t stats;
+  size_t urls_left;
+  uint64_t random;
+};
+typedef struct _generator generator_t;
+
+
+//
+// Forward declarations
+//
+
+void fetchdeps_generate_section(generator_t* g, size_t depth);
+void fetchdeps_generate_condition(generator_t* g, size_t depth);
+void fetchdeps_generate_relation(generator_t* g);
+void fetchdeps_generate_url(generator_t* g, size_t depth);
+void fetchdeps_generate_indent(generator_t* g, size_t depth);
+unsigned long fetchdeps_generate_next(generator_t* g);
+
+
+//
+// Public functions
+//
+
+bool_t
+fetchdeps_generate_deps(FILE* out, genconfig_t* config, genstats_t* stats)
+{
+  generator_t g;
+
+  assert(out != NULL);
+  assert(config != NULL);
+  assert(config->depth <= kGenerateMaxDepth);
+  assert(config->fanout > 0);
+  assert(config->num_vars > 0);
+
+  g.out = out;
+  g.config = config;
+  g.stats.lines = 0;
+  g.stats.urls = 0;
+  g.stats.relations = 0;
+  g.urls_left = config->num_urls;
+  g.random = config->seed * 2654435761ULL + 1; // Must never be zero.
+
+  // A conditional section is only started when there's a URL left to put in
+  // it, since a section needs at least one statement.
+  while (g.urls_left > 0) {
+    if (config->depth == 0) {
+      fetchdeps_generate_url(&g, 0);
+    }
+    else {
+      fetchdeps_generate_condition(&g, 0);
+      fetchdeps_generate_section(&g, 1);
+    }
+  }
+
+  if (stats)
+    *stats = g.stats;
+  return !ferror(out);
+}
+
+
+//
+// Private functions
+//
+
+// Write the body of a conditional section. There is at least one URL left.
+void
+fetchdeps_generate_section(generator_t* g, size_t depth)
+{
+  size_t i;
+
+  fetchdeps_generate_url(g, depth);
+
+  if (depth < g->config->depth) {
+    for (i = 0; i < kBranches && g->urls_left > 0; ++i) {
+      fetchdeps_generate_condition(g, depth);
+      fetchdeps_generate_section(g, depth + 1);
+    }
+  }
+  else {
+    for (i = 1; i < kUrlsPerLeaf && g->urls_left > 0; ++i)
+      fetchdeps_generate_url(g, depth);
+  }
+}
+
+
+// Write a condition line, made up of one or two relations.
+void
+fetchdeps_generate_condition(generator_t* g, size_t depth)
+{
+  fetchdeps_generate_indent(g, depth);
+  fetchdeps_generate_relation(g);
+  if (fetchdeps_generate_next(g) % 2) {
+    fputs(fetchdeps_generate_next(g) % 2 ? " and " : " or ", g->out);
+    fetchdeps_generate_relation(g);
+  }
+  fputs(":\n", g->out);
+  ++g->stats.lines;
+}
+
+
+// Write a relation listing 'fanout' consecutive values, starting somewhere in
+// a range twice that size, so about half of them include kGenerateValue.
+void
+fetchdeps_generate_relation(generator_t* g)
+{
+  size_t range = g->config->fanout * 2;
+  size_t start = fetchdeps_generate_next(g) % range;
+  size_t i;
+
+  fprintf(g->out, "v%lu ", (unsigned long)(fetchdeps_generate_next(g) % g->config->num_vars));
+  if (fetchdeps_generate_next(g) % 4 == 0)
+    fputs("not ", g->out);
+  for (i = 0; i < g->config->fanout; ++i) {
+    fprintf(g->out, "%s\"x%lu\"", i > 0 ? ", " : "",
+            (unsigned long)((start + i) % range));
+  }
+  ++g->stats.relations;
+}
+
+
+void
+fetchdeps_generate_url(generator_t* g, size_t depth)
+{
+  size_t n = g->config->num_urls - g->urls_left;
+
+  fetchdeps_generate_indent(g, depth);
+  fprintf(g->out, "http://example.com/dep%lu/pkg-%lu.tar.gz\n",
+          (unsigned long)(n % 97), (unsigned long)n);
+  --g->urls_left;
+  ++g->stats.urls;
+  ++g->stats.lines;
+}
+
+
+void
+fetchdeps_generate_indent(generator_t* g, size_t depth)
+{
+  size_t i;
+
+  for (i = 0; i < depth; ++i)
+    fputs("  ", g->out);
+}
+
+
+// A xorshift generator, so the output doesn't depend on the C library's
+// rand().
+unsigned long
+fetchdeps_generate_next(generator_t* g)
+{
+  g->random ^= g->random << 13;
+  g->random ^= g->random >> 7;
+  g->random ^= g->random << 17;
+  return (unsigned long)(g->random >> 16);
+}
+
@@ -0,0 +1,59 @@
+#ifndef fetchdeps_generate_h
+#define fetchdeps_generate_h
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+
+//
+// Constants
+//
+
+// The generator's variables are called v0, v1, ... and each condition lists
+// values x0, x1, .... Setting every variable to this value makes roughly half
+// of the relations true.
+#define kGenerateValue "x0"
+
+// The deepest nesting the generator will produce. The scanner has a fixed
+// limit on the number of indent levels, and this stays well inside it.
+#define kGenerateMaxDepth 50
+
+
+//
+// Types
+//
+
+// The shape of a synthetic deps file.
+struct _genconfig {
+  size_t num_urls;  // URLs in the file.
+  size_t depth;     // How deeply conditional sections nest.
+  size_t fanout;    // Values listed in each relation, e.g. os "a", "b", "c".
+  size_t num_vars;  // Distinct variables the conditions refer to.
+  unsigned seed;    // The same seed always gives the same file.
+};
+typedef struct _genconfig genconfig_t;
+
+
+// What the generator wrote.
+struct _genstats {
+  size_t lines;
+  size_t urls;
+  size_t relations;
+};
+typedef struct _genstats genstats_t;
+
+
+//
+// Functions
+//
+
+// Write a synthetic deps file with the shape given by 'config' to 'out'. The
+// conditions refer to variables v0 .. v<num_vars - 1>, which all need to be
+// set before the file can be evaluated. If 'stats' isn't NULL it's filled in.
+// Returns false if writing to 'out' failed.
+bool_t fetchdeps_generate_deps(FILE* out, genconfig_t* config, genstats_t* stats);
+
+#endif // fetchdeps_generate_h
+
@@ -0,0 +1,218 @@
+// Parser throughput benchmark. Generates deps files of various shapes (see
+// generate.h), then times fetchdeps_parser_new plus fetchdeps_parser_parse
+// over each of them. Every file is benchmarked in a child process of its own,
+// so that the peak RSS reported for it isn't left over from a bigger one.
+//
+// Throughput in MB/s should stay roughly level as the files grow in any
+// direction; a column which falls off means something is worse than linear.
+
+#include "bench.h"
+
+#include "errors.h"
+#include "generate.h"
+#include "parse.h"
+#include "strpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h> // For getrusage()
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+//
+// Constants
+//
+
+static const genconfig_t kConfigs[] = {
+  // Growing URL counts.
+  {   1000, 2,    2,   4, 1 },
+  {  10000, 2,    2,   4, 1 },
+  { 100000, 2,    2,   4, 1 },
+  // Growing nesting depth.
+  {  10000, 0,    2,   4, 1 },
+  {  10000, 8,    2,   4, 1 },
+  {  10000, 32,   2,   4, 1 },
+  // Growing relation fan-out.
+  {   1000, 2,   16,   4, 1 },
+  {   1000, 2,  128,   4, 1 },
+  {   1000, 2, 1024,   4, 1 },
+  // Growing numbers of variables.
+  {  10000, 2,    2,  64, 1 },
+  {  10000, 2,    2, 1024, 1 },
+};
+static const size_t kNumConfigs = sizeof(kConfigs) / sizeof(kConfigs[0]);
+
+
+//
+// Types
+//
+
+struct _parserbench {
+  char* fname;
+  size_t num_vars;
+  bool_t failed;
+};
+typedef struct _parserbench parserbench_t;
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_bench_parser_config(const genconfig_t* config, char* dir);
+size_t fetchdeps_bench_parse(void* arg, size_t iterations);
+
+
+//
+// Main
+//
+
+int
+main(int argc, char** argv)
+{
+  char dir[] = "/tmp/fetchdeps-bench-XXXXXX";
+  bool_t ok = 1;
+  size_t i;
+
+  if (!mkdtemp(dir)) {
+    perror("Unable to create a temporary directory");
+    return 1;
+  }
+
+  printf("\n%8s %5s %6s %5s %8s %10s %12s %12s %8s %12s %10s\n",
+         "urls", "depth", "fanout", "vars", "lines", "ms/parse", "lines/s",
+         "URLs/s", "MB/s", "allocs/line", "peak KB");
+  for (i = 0; i < kNumConfigs; ++i) {
+    if (!fetchdeps_bench_parser_config(&kConfigs[i], dir))
+      ok = 0;
+  }
+
+  rmdir(dir);
+  return ok ? 0 : 1;
+}
+
+
+//
+// Benchmarks
+//
+
+// Generate one deps file into 'dir', then benchmark it in a child process.
+bool_t
+fetchdeps_bench_parser_config(const genconfig_t* config, char* dir)
+{
+  genconfig_t copy = *config;
+  genstats_t stats;
+  parserbench_t b;
+  benchresult_t result;
+  struct rusage usage;
+  struct stat st;
+  char fname[256];
+  FILE* out;
+  pid_t pid;
+  int status;
+
+  snprintf(fname, sizeof(fname), "%s/bench.deps", dir);
+  out = fopen(fname, "w");
+  if (!out)
+    goto failure;
+  if (!fetchdeps_generate_deps(out, &copy, &stats)) {
+    fclose(out);
+    goto failure;
+  }
+  if (fclose(out) != 0 || stat(fname, &st) != 0)
+    goto failure;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0)
+    goto failure;
+
+  if (pid == 0) {
+    b.fname = fname;
+    b.num_vars = config->num_vars;
+    b.failed = 0;
+    fetchdeps_bench_measure(fetchdeps_bench_parse, &b, &result);
+    if (b.failed) {
+      fetchdeps_errors_print(stderr);
+      exit(1);
+    }
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%8lu %5lu %6lu %5lu %8lu %10.2f %12.0f %12.0f %8.1f %12.2f %10ld\n",
+           (unsigned long)config->num_urls,
+           (unsigned long)config->depth,
+           (unsigned long)config->fanout,
+           (unsigned long)config->num_vars,
+           (unsigned long)stats.lines,
+           result.seconds * 1e3 / result.ops,
+           stats.lines * result.ops / result.seconds,
+           stats.urls * result.ops / result.seconds,
+           st.st_size * result.ops / result.seconds / (1024 * 1024),
+           (double)result.allocs / result.ops / stats.lines,
+           usage.ru_maxrss);
+    fflush(stdout);
+    fetchdeps_strpool_free();
+    exit(0);
+  }
+
+  if (waitpid(pid, &status, 0) < 0)
+    goto failure;
+  unlink(fname);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+failure:
+  perror("Unable to run the benchmark");
+  unlink(fname);
+  return 0;
+}
+
+
+// Parse and evaluate the file from scratch, the way the list command does
+// without a compiled cache. An op is one parse. The string pool is emptied
+// after each one, so that every parse pays for interning its strings rather
+// than finding them left over from the last.
+size_t
+fetchdeps_bench_parse(void* arg, size_t iterations)
+{
+  parserbench_t* b = (parserbench_t*)arg;
+  parser_t* ctx = NULL;
+  stringset_t* results = NULL;
+  char name[32];
+  size_t it, i;
+
+  for (it = 0; it < iterations; ++it) {
+    ctx = fetchdeps_parser_new(b->fname);
+    if (!ctx)
+      goto failure;
+    for (i = 0; i < b->num_vars; ++i) {
+      snprintf(name, sizeof(name), "v%lu", (unsigned long)i);
+      if (!fetchdeps_varmap_set_single(ctx->vars, name, kGenerateValue))
+        goto failure;
+    }
+
+    results = fetchdeps_stringset_new();
+    if (!results)
+      goto failure;
+    if (!fetchdeps_parser_parse(ctx, results))
+      goto failure;
+
+    fetchdeps_bench_use(results);
+    fetchdeps_stringset_free(results);
+    fetchdeps_parser_free(ctx);
+    results = NULL;
+    ctx = NULL;
+    fetchdeps_strpool_free();
+  }
+  return iterations;
+
+failure:
+  b->failed = 1;
+  if (results)
+    fetchdeps_stringset_free(results);
+  if (ctx)
+    fetchdeps_parser_free(ctx);
+  return 0;
+}
+
@@ -0,0 +1,556 @@
+#include "alloc.h"
+
+#include "arena.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Constants
+//
+
+static const char* kAllocModuleNames[] = {
+  "arena",
+  "ast",
+  "bufpool",
+  "cache",
+  "cmdline",
+  "decode",
+  "download",
+  "errors",
+  "extract",
+  "filesys",
+  "filter",
+  "main",
+  "matrix",
+  "metrics",
+  "parse",
+  "remove",
+  "stringset",
+  "strpool",
+  "template",
+  "trace",
+  "varmap",
+  "vocab",
+  "watch",
+  "writer",
+};
+
+// Room for the system allocator plus a few more.
+#define kMaxAllocators 16
+
+// The header in front of each block. It's a multiple of the alignment which
+// malloc guarantees, so the memory after it is aligned the same way.
+#define kHeaderSize 16
+
+// The pool allocator keeps free lists for blocks up to this size, header
+// included, in steps of kPoolStep bytes.
+#define kPoolStep 16
+#define kPoolMaxSize 512
+#define kPoolClasses (kPoolMaxSize / kPoolStep)
+
+
+//
+// Types
+//
+
+// Stored in the kHeaderSize bytes in front of every block we hand out, so
+// that freeing a block needs nothing but the pointer.
+struct _allocheader {
+  size_t size;            // As asked for, not counting the header.
+  unsigned short module;
+  unsigned char allocator; // Index into gAllocators.
+  unsigned char counted;   // Whether the block is included in the stats.
+};
+typedef struct _allocheader allocheader_t;
+
+
+// The state behind the arena and pool allocators. The allocator_t's arg
+// points back to this. For the arena allocator the free lists stay empty.
+struct _allocpool {
+  allocator_t allocator;
+  pthread_mutex_t lock;
+  arena_t* arena;
+  void* free_lists[kPoolClasses];
+};
+typedef struct _allocpool allocpool_t;
+
+
+//
+// Forward declarations
+//
+
+void fetchdeps_alloc_count(allocmodule_t module, size_t size);
+void fetchdeps_alloc_uncount(allocmodule_t module, size_t size);
+void fetchdeps_alloc_add(allocstats_t* stats, size_t size);
+allocpool_t* fetchdeps_alloc_new_allocpool(const char* name, bool_t is_pool);
+void* fetchdeps_alloc_system_alloc(void* arg, size_t size);
+void* fetchdeps_alloc_system_resize(void* arg, void* ptr, size_t old_size, size_t new_size);
+void fetchdeps_alloc_system_release(void* arg, void* ptr, size_t size);
+void* fetchdeps_alloc_arena_alloc(void* arg, size_t size);
+void* fetchdeps_alloc_arena_resize(void* arg, void* ptr, size_t old_size, size_t new_size);
+void fetchdeps_alloc_arena_release(void* arg, void* ptr, size_t size);
+void* fetchdeps_alloc_pool_alloc(void* arg, size_t size);
+void* fetchdeps_alloc_pool_resize(void* arg, void* ptr, size_t old_size, size_t new_size);
+void fetchdeps_alloc_pool_release(void* arg, void* ptr, size_t size);
+
+
+//
+// Global variables
+//
+
+static allocator_t gSystemAllocator = {
+  "system",
+  fetchdeps_alloc_system_alloc,
+  fetchdeps_alloc_system_resize,
+  fetchdeps_alloc_system_release,
+  NULL
+};
+
+// Allocators are given an index the first time they're set for a module, and
+// keep it for the rest of the run, since blocks refer to them by index.
+static allocator_t* gAllocators[kMaxAllocators] = { &gSystemAllocator };
+static size_t gNumAllocators = 1;
+static pthread_mutex_t gAllocatorsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The index of the allocator each module is using.
+static unsigned char gModuleAllocator[kNumAllocModules];
+
+static bool_t gCounting = 0;
+static allocstats_t gStats[kNumAllocModules];
+static allocstats_t gTotal;
+
+
+//
+// Allocation functions
+//
+
+void*
+fetchdeps_alloc_malloc(allocmodule_t module, size_t size)
+{
+  unsigned char index;
+  allocator_t* a;
+  allocheader_t* header;
+
+  assert(module < kNumAllocModules);
+
+  if (size > SIZE_MAX - kHeaderSize)
+    return NULL;
+
+  index = __atomic_load_n(&gModuleAllocator[module], __ATOMIC_ACQUIRE);
+  a = gAllocators[index];
+  header = (allocheader_t*)a->alloc(a->arg, size + kHeaderSize);
+  if (!header)
+    return NULL;
+
+  header->size = size;
+  header->module = (unsigned short)module;
+  header->allocator = index;
+  header->counted = (unsigned char)gCounting;
+  if (header->counted) {
+    __atomic_add_fetch(&gStats[module].allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gTotal.allocs, 1, __ATOMIC_RELAXED);
+    fetchdeps_alloc_count(module, size);
+  }
+
+  return (char*)header + kHeaderSize;
+}
+
+
+void*
+fetchdeps_alloc_calloc(allocmodule_t module, size_t count, size_t size)
+{
+  void* mem;
+
+  if (size != 0 && count > SIZE_MAX / size)
+    return NULL;
+
+  mem = fetchdeps_alloc_malloc(module, count * size);
+  if (mem)
+    memset(mem, 0, count * size);
+  return mem;
+}
+
+
+void*
+fetchdeps_alloc_realloc(allocmodule_t module, void* ptr, size_t size)
+{
+  allocheader_t* header;
+  allocheader_t* new_header;
+  allocator_t* a;
+  size_t old_size;
+
+  if (!ptr)
+    return fetchdeps_alloc_malloc(module, size);
+  if (size > SIZE_MAX - kHeaderSize)
+    return NULL;
+
+  // The block stays with the allocator and module it was allocated for.
+  header = (allocheader_t*)((char*)ptr - kHeaderSize);
+  old_size = header->size;
+  a = gAllocators[header->allocator];
+  new_header = (allocheader_t*)a->resize(a->arg, header, old_size + kHeaderSize, size + kHeaderSize);
+  if (!new_header)
+    return NULL;
+
+  new_header->size = size;
+  if (new_header->counted) {
+    fetchdeps_alloc_uncount(new_header->module, old_size);
+    fetchdeps_alloc_count(new_header->module, size);
+  }
+
+  return (char*)new_header + kHeaderSize;
+}
+
+
+char*
+fetchdeps_alloc_strdup(allocmodule_t module, const char* str)
+{
+  assert(str != NULL);
+
+  return fetchdeps_alloc_strndup(module, str, strlen(str));
+}
+
+
+char*
+fetchdeps_alloc_strndup(allocmodule_t module, const char* str, size_t len)
+{
+  char* copy;
+
+  assert(str != NULL);
+
+  len = strnlen(str, len);
+  copy = (char*)fetchdeps_alloc_malloc(module, len + 1);
+  if (!copy)
+    return NULL;
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+
+void
+fetchdeps_alloc_free(void* ptr)
+{
+  allocheader_t* header;
+  allocator_t* a;
+
+  if (!ptr)
+    return;
+
+  header = (allocheader_t*)((char*)ptr - kHeaderSize);
+  if (header->counted) {
+    fetchdeps_alloc_uncount(header->module, header->size);
+    __atomic_add_fetch(&gStats[header->module].frees, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gTotal.frees, 1, __ATOMIC_RELAXED);
+  }
+
+  a = gAllocators[header->allocator];
+  a->release(a->arg, header, header->size + kHeaderSize);
+}
+
+
+//
+// Instrumentation functions
+//
+
+void
+fetchdeps_alloc_enable_stats()
+{
+  gCounting = 1;
+}
+
+
+void
+fetchdeps_alloc_get_stats(allocmodule_t module, allocstats_t* stats)
+{
+  assert(module < kNumAllocModules);
+  assert(stats != NULL);
+
+  stats->allocs = __atomic_load_n(&gStats[module].allocs, __ATOMIC_RELAXED);
+  stats->frees = __atomic_load_n(&gStats[module].frees, __ATOMIC_RELAXED);
+  stats->bytes = __atomic_load_n(&gStats[module].bytes, __ATOMIC_RELAXED);
+  stats->current = __atomic_load_n(&gStats[module].current, __ATOMIC_RELAXED);
+  stats->peak = __atomic_load_n(&gStats[module].peak, __ATOMIC_RELAXED);
+}
+
+
+void
+fetchdeps_alloc_print_stats(FILE* out)
+{
+  allocstats_t stats;
+  int module;
+
+  assert(out != NULL);
+
+  fprintf(out, "%-10s %-8s %10s %10s %14s %12s %12s\n",
+          "module", "alloc", "allocs", "frees", "bytes", "peak", "in use");
+  for (module = 0; module < kNumAllocModules; ++module) {
+    fetchdeps_alloc_get_stats((allocmodule_t)module, &stats);
+    if (stats.allocs == 0)
+      continue;
+    fprintf(out, "%-10s %-8s %10lu %10lu %14lu %12lu %12lu\n",
+            kAllocModuleNames[module],
+            gAllocators[gModuleAllocator[module]]->name,
+            (unsigned long)stats.allocs,
+            (unsigned long)stats.frees,
+            (unsigned long)stats.bytes,
+            (unsigned long)stats.peak,
+            (unsigned long)stats.current);
+  }
+  fprintf(out, "%-10s %-8s %10lu %10lu %14lu %12lu %12lu\n",
+          "total", "",
+          (unsigned long)gTotal.allocs,
+          (unsigned long)gTotal.frees,
+          (unsigned long)gTotal.bytes,
+          (unsigned long)gTotal.peak,
+          (unsigned long)gTotal.current);
+}
+
+
+bool_t
+fetchdeps_alloc_set_allocator(allocmodule_t module, allocator_t* allocator)
+{
+  size_t index;
+
+  assert(module < kNumAllocModules);
+
+  if (!allocator)
+    allocator = &gSystemAllocator;
+  assert(module != ALLOC_ARENA || allocator == &gSystemAllocator);
+
+  pthread_mutex_lock(&gAllocatorsLock);
+  for (index = 0; index < gNumAllocators; ++index) {
+    if (gAllocators[index] == allocator)
+      break;
+  }
+  if (index == gNumAllocators) {
+    if (gNumAllocators == kMaxAllocators) {
+      pthread_mutex_unlock(&gAllocatorsLock);
+      return 0;
+    }
+    gAllocators[gNumAllocators++] = allocator;
+  }
+  __atomic_store_n(&gModuleAllocator[module], (unsigned char)index, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&gAllocatorsLock);
+  return 1;
+}
+
+
+allocator_t*
+fetchdeps_alloc_new_arena_allocator()
+{
+  allocpool_t* pool = fetchdeps_alloc_new_allocpool("arena", 0);
+  return pool ? &pool->allocator : NULL;
+}
+
+
+allocator_t*
+fetchdeps_alloc_new_pool_allocator()
+{
+  allocpool_t* pool = fetchdeps_alloc_new_allocpool("pool", 1);
+  return pool ? &pool->allocator : NULL;
+}
+
+
+void
+fetchdeps_alloc_free_allocator(allocator_t* allocator)
+{
+  allocpool_t* pool = (allocpool_t*)allocator->arg;
+
+  assert(pool != NULL);
+  assert(&pool->allocator == allocator);
+
+  fetchdeps_arena_free(pool->arena);
+  pthread_mutex_destroy(&pool->lock);
+  fetchdeps_alloc_free(pool);
+}
+
+
+//
+// Private functions
+//
+
+void
+fetchdeps_alloc_count(allocmodule_t module, size_t size)
+{
+  fetchdeps_alloc_add(&gStats[module], size);
+  fetchdeps_alloc_add(&gTotal, size);
+}
+
+
+void
+fetchdeps_alloc_uncount(allocmodule_t module, size_t size)
+{
+  __atomic_sub_fetch(&gStats[module].current, size, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&gTotal.current, size, __ATOMIC_RELAXED);
+}
+
+
+void
+fetchdeps_alloc_add(allocstats_t* stats, size_t size)
+{
+  size_t current, peak;
+
+  __atomic_add_fetch(&stats->bytes, size, __ATOMIC_RELAXED);
+  current = __atomic_add_fetch(&stats->current, size, __ATOMIC_RELAXED);
+
+  peak = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED);
+  while (current > peak &&
+         !__atomic_compare_exchange_n(&stats->peak, &peak, current, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+
+allocpool_t*
+fetchdeps_alloc_new_allocpool(const char* name, bool_t is_pool)
+{
+  allocpool_t* pool;
+
+  pool = (allocpool_t*)fetchdeps_alloc_calloc(ALLOC_ARENA, 1, sizeof(allocpool_t));
+  if (!pool)
+    return NULL;
+
+  pool->arena = fetchdeps_arena_new();
+  if (!pool->arena) {
+    fetchdeps_alloc_free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+
+  pool->allocator.name = name;
+  if (is_pool) {
+    pool->allocator.alloc = fetchdeps_alloc_pool_alloc;
+    pool->allocator.resize = fetchdeps_alloc_pool_resize;
+    pool->allocator.release = fetchdeps_alloc_pool_release;
+  }
+  else {
+    pool->allocator.alloc = fetchdeps_alloc_arena_alloc;
+    pool->allocator.resize = fetchdeps_alloc_arena_resize;
+    pool->allocator.release = fetchdeps_alloc_arena_release;
+  }
+  pool->allocator.arg = pool;
+  return pool;
+}
+
+
+void*
+fetchdeps_alloc_system_alloc(void* arg, size_t size)
+{
+  return malloc(size);
+}
+
+
+void*
+fetchdeps_alloc_system_resize(void* arg, void* ptr, size_t old_size, size_t new_size)
+{
+  return realloc(ptr, new_size);
+}
+
+
+void
+fetchdeps_alloc_system_release(void* arg, void* ptr, size_t size)
+{
+  free(ptr);
+}
+
+
+void*
+fetchdeps_alloc_arena_alloc(void* arg, size_t size)
+{
+  allocpool_t* pool = (allocpool_t*)arg;
+  void* mem;
+
+  pthread_mutex_lock(&pool->lock);
+  mem = fetchdeps_arena_alloc(pool->arena, size);
+  pthread_mutex_unlock(&pool->lock);
+  return mem;
+}
+
+
+void*
+fetchdeps_alloc_arena_resize(void* arg, void* ptr, size_t old_size, size_t new_size)
+{
+  void* mem;
+
+  // The old block stays in the arena until the arena goes.
+  if (new_size <= old_size)
+    return ptr;
+  mem = fetchdeps_alloc_arena_alloc(arg, new_size);
+  if (mem)
+    memcpy(mem, ptr, old_size);
+  return mem;
+}
+
+
+void
+fetchdeps_alloc_arena_release(void* arg, void* ptr, size_t size)
+{
+}
+
+
+void*
+fetchdeps_alloc_pool_alloc(void* arg, size_t size)
+{
+  allocpool_t* pool = (allocpool_t*)arg;
+  size_t cls;
+  void* mem;
+
+  if (size > kPoolMaxSize)
+    return malloc(size);
+
+  // Blocks on a free list hold a pointer to the next one in their first word.
+  cls = (size + kPoolStep - 1) / kPoolStep - 1;
+  pthread_mutex_lock(&pool->lock);
+  mem = pool->free_lists[cls];
+  if (mem)
+    pool->free_lists[cls] = *(void**)mem;
+  else
+    mem = fetchdeps_arena_alloc(pool->arena, (cls + 1) * kPoolStep);
+  pthread_mutex_unlock(&pool->lock);
+  return mem;
+}
+
+
+void*
+fetchdeps_alloc_pool_resize(void* arg, void* ptr, size_t old_size, size_t new_size)
+{
+  void* mem;
+
+  if (old_size > kPoolMaxSize && new_size > kPoolMaxSize)
+    return realloc(ptr, new_size);
+  if (old_size <= kPoolMaxSize && new_size <= kPoolMaxSize &&
+      (old_size + kPoolStep - 1) / kPoolStep == (new_size + kPoolStep - 1) / kPoolStep)
+    return ptr;
+
+  mem = fetchdeps_alloc_pool_alloc(arg, new_size);
+  if (!mem)
+    return NULL;
+  memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+  fetchdeps_alloc_pool_release(arg, ptr, old_size);
+  return mem;
+}
+
+
+void
+fetchdeps_alloc_pool_release(void* arg, void* ptr, size_t size)
+{
+  allocpool_t* pool = (allocpool_t*)arg;
+  size_t cls;
+
+  if (size > kPoolMaxSize) {
+    free(ptr);
+    return;
+  }
+
+  cls = (size + kPoolStep - 1) / kPoolStep - 1;
+  pthread_mutex_lock(&pool->lock);
+  *(void**)ptr = pool->free_lists[cls];
+  pool->free_lists[cls] = ptr;
+  pthread_mutex_unlock(&pool->lock);
+}
+
@@ -0,0 +1,133 @@
+#ifndef fetchdeps_alloc_h
+#define fetchdeps_alloc_h
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+//
+// Types
+//
+
+// Every allocation is made on behalf of one of these, so that the counts can
+// be broken down by module. Keep kAllocModuleNames in alloc.c in step.
+enum _allocmodule {
+  ALLOC_ARENA,
+  ALLOC_AST,
+  ALLOC_BUFPOOL,
+  ALLOC_CACHE,
+  ALLOC_CMDLINE,
+  ALLOC_DECODE,
+  ALLOC_DOWNLOAD,
+  ALLOC_ERRORS,
+  ALLOC_EXTRACT,
+  ALLOC_FILESYS,
+  ALLOC_FILTER,
+  ALLOC_MAIN,
+  ALLOC_MATRIX,
+  ALLOC_METRICS,
+  ALLOC_PARSE,
+  ALLOC_REMOVE,
+  ALLOC_STRINGSET,
+  ALLOC_STRPOOL,
+  ALLOC_TEMPLATE,
+  ALLOC_TRACE,
+  ALLOC_VARMAP,
+  ALLOC_VOCAB,
+  ALLOC_WATCH,
+  ALLOC_WRITER,
+  kNumAllocModules
+};
+typedef enum _allocmodule allocmodule_t;
+
+
+// Where a module's memory comes from. The system allocator is used unless
+// another one is set with fetchdeps_alloc_set_allocator. Each function is
+// given the size of the block it's dealing with, so allocators don't need to
+// keep track of sizes themselves. 'alloc' needn't zero the memory and
+// 'release' may do nothing at all.
+struct _allocator {
+  const char* name;
+  void* (*alloc)(void* arg, size_t size);
+  void* (*resize)(void* arg, void* ptr, size_t old_size, size_t new_size);
+  void (*release)(void* arg, void* ptr, size_t size);
+  void* arg;
+};
+typedef struct _allocator allocator_t;
+
+
+// The counts for one module, while counting is on.
+struct _allocstats {
+  size_t allocs;    // Blocks allocated. Resizing a block doesn't count.
+  size_t frees;
+  size_t bytes;     // Total bytes asked for, including by resizing.
+  size_t current;   // Bytes currently allocated...
+  size_t peak;      // ...and the most there have been at any one time.
+};
+typedef struct _allocstats allocstats_t;
+
+
+//
+// Allocation functions
+//
+
+// These behave like their C library equivalents, but allocate on behalf of
+// 'module' from whichever allocator it's using. Memory from any of them must
+// be freed with fetchdeps_alloc_free, by any module, and never with free();
+// equally, memory from the C library or other libraries must never be passed
+// to fetchdeps_alloc_free.
+void* fetchdeps_alloc_malloc(allocmodule_t module, size_t size);
+void* fetchdeps_alloc_calloc(allocmodule_t module, size_t count, size_t size);
+void* fetchdeps_alloc_realloc(allocmodule_t module, void* ptr, size_t size);
+char* fetchdeps_alloc_strdup(allocmodule_t module, const char* str);
+char* fetchdeps_alloc_strndup(allocmodule_t module, const char* str, size_t len);
+
+// Free memory from any of the functions above. NULL is ignored.
+void fetchdeps_alloc_free(void* ptr);
+
+
+//
+// Instrumentation functions
+//
+
+// Start counting allocations. Only allocations made after this are counted,
+// so call it before anything else.
+void fetchdeps_alloc_enable_stats();
+
+// Fill in the counts for a module. All zero unless counting is on.
+void fetchdeps_alloc_get_stats(allocmodule_t module, allocstats_t* stats);
+
+// Print a table of the counts for every module which allocated anything.
+void fetchdeps_alloc_print_stats(FILE* out);
+
+// Make future allocations for 'module' come from 'allocator'. Memory which was
+// already allocated goes back to the allocator it came from when it's freed,
+// so this can be called at any time. The allocator must stay valid for as
+// long as any of its memory is in use. Passing NULL restores the system
+// allocator. Returns false if too many different allocators are in use.
+//
+// The arena and pool allocators below take their memory from arenas, so they
+// can't be used for ALLOC_ARENA itself.
+bool_t fetchdeps_alloc_set_allocator(allocmodule_t module, allocator_t* allocator);
+
+// Create an allocator which takes memory from an arena (see arena.h). Freeing
+// memory does nothing; it all goes at once when the allocator is freed. Good
+// for a module which makes lots of allocations which all live about as long
+// as each other.
+allocator_t* fetchdeps_alloc_new_arena_allocator();
+
+// Create an allocator which keeps freed blocks of up to a few hundred bytes on
+// free lists, grouped by size, for the next allocation of that size to reuse.
+// Larger blocks come from the system. Good for a module which allocates and
+// frees lots of small objects.
+allocator_t* fetchdeps_alloc_new_pool_allocator();
+
+// Free an allocator made by one of the two functions above, along with all of
+// the memory it handed out. No module may be using it, or any memory from it,
+// any more. Blocks too big for the pool allocator's free lists must already
+// have been freed.
+void fetchdeps_alloc_free_allocator(allocator_t* allocator);
+
+#endif // fetchdeps_alloc_h
+
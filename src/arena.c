@@ -0,0 +1,164 @@
+#include "arena.h"
+
+#include "alloc.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Constants
+//
+
+// Memory is taken from the system in blocks of this size. Anything bigger
+// than a quarter of a block gets a block of its own.
+static const size_t kBlockSize = 16 * 1024;
+
+// Every allocation is rounded up to a multiple of this.
+#define ARENA_ALIGN (sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double))
+
+
+//
+// Types
+//
+
+struct _arenablock {
+  struct _arenablock* next;
+  size_t size;
+  size_t used;
+};
+typedef struct _arenablock arenablock_t;
+
+
+struct _arena {
+  arenablock_t* blocks; // The first block is the one being allocated from.
+};
+
+
+//
+// Forward declarations
+//
+
+arenablock_t* fetchdeps_arena_new_block(size_t size);
+
+
+//
+// Public functions
+//
+
+arena_t*
+fetchdeps_arena_new()
+{
+  return (arena_t*)fetchdeps_alloc_calloc(ALLOC_ARENA, 1, sizeof(arena_t));
+}
+
+
+void
+fetchdeps_arena_free(arena_t* a)
+{
+  arenablock_t* block;
+  arenablock_t* next;
+
+  assert(a != NULL);
+
+  for (block = a->blocks; block; block = next) {
+    next = block->next;
+    fetchdeps_alloc_free(block);
+  }
+  fetchdeps_alloc_free(a);
+}
+
+
+void*
+fetchdeps_arena_alloc(arena_t* a, size_t size)
+{
+  arenablock_t* block;
+  void* mem;
+
+  assert(a != NULL);
+
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (size == 0)
+    size = ARENA_ALIGN;
+
+  block = a->blocks;
+  if (!block || block->size - block->used < size) {
+    if (size > kBlockSize / 4) {
+      // Big allocations go in a block of their own, behind the current one,
+      // so the space left in the current block isn't wasted.
+      block = fetchdeps_arena_new_block(size);
+      if (!block)
+        return NULL;
+      if (a->blocks) {
+        block->next = a->blocks->next;
+        a->blocks->next = block;
+      }
+      else {
+        a->blocks = block;
+      }
+    }
+    else {
+      block = fetchdeps_arena_new_block(kBlockSize);
+      if (!block)
+        return NULL;
+      block->next = a->blocks;
+      a->blocks = block;
+    }
+  }
+
+  mem = (char*)(block + 1) + block->used;
+  block->used += size;
+  return mem;
+}
+
+
+char*
+fetchdeps_arena_strdup(arena_t* a, const char* str)
+{
+  size_t len;
+  char* copy;
+
+  assert(str != NULL);
+
+  len = strlen(str) + 1;
+  copy = (char*)fetchdeps_arena_alloc(a, len);
+  if (copy)
+    memcpy(copy, str, len);
+  return copy;
+}
+
+
+void
+fetchdeps_arena_usage(arena_t* a, size_t* num_blocks, size_t* bytes)
+{
+  arenablock_t* block;
+
+  assert(a != NULL);
+  assert(num_blocks != NULL);
+  assert(bytes != NULL);
+
+  *num_blocks = 0;
+  *bytes = 0;
+  for (block = a->blocks; block; block = block->next) {
+    ++*num_blocks;
+    *bytes += block->size;
+  }
+}
+
+
+//
+// Private functions
+//
+
+arenablock_t*
+fetchdeps_arena_new_block(size_t size)
+{
+  // The header is three words, so the data which follows it starts aligned.
+  arenablock_t* block = (arenablock_t*)fetchdeps_alloc_calloc(ALLOC_ARENA, 1, sizeof(arenablock_t) + size);
+  if (!block)
+    return NULL;
+  block->size = size;
+  return block;
+}
+
@@ -0,0 +1,42 @@
+#ifndef fetchdeps_arena_h
+#define fetchdeps_arena_h
+
+#include "common.h"
+
+#include <stddef.h>
+
+//
+// Types
+//
+
+// A region of memory which things can be allocated from very cheaply, but
+// which can only be freed all at once. Used for data whose lifetime is tied to
+// some larger object, like the nodes of a parsed deps file.
+struct _arena;
+typedef struct _arena arena_t;
+
+
+//
+// Functions
+//
+
+// Allocate a new, empty arena. It must eventually be freed with
+// fetchdeps_arena_free.
+arena_t* fetchdeps_arena_new();
+
+// Deallocate the arena, including everything that was allocated from it.
+void fetchdeps_arena_free(arena_t* a);
+
+// Allocate 'size' bytes of zeroed memory from the arena, aligned for pointers
+// and doubles. Returns NULL if memory couldn't be allocated.
+void* fetchdeps_arena_alloc(arena_t* a, size_t size);
+
+// Copy a string into the arena. Returns NULL if memory couldn't be allocated.
+char* fetchdeps_arena_strdup(arena_t* a, const char* str);
+
+// Report how many blocks the arena has taken from the system, and how many
+// bytes they hold between them.
+void fetchdeps_arena_usage(arena_t* a, size_t* num_blocks, size_t* bytes);
+
+#endif // fetchdeps_arena_h
+
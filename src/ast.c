@@ -0,0 +1,360 @@
+#include "ast.h"
+
+#include "alloc.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_ast_add_filter(ast_t* ast, filter_t* filter);
+bool_t fetchdeps_ast_intern_block(ast_t* ast, ast_stmt_t* stmt);
+bool_t fetchdeps_ast_intern_cond(ast_t* ast, ast_cond_t* cond);
+bool_t fetchdeps_ast_compile_block(ast_t* ast, ast_stmt_t* stmt);
+bool_t fetchdeps_ast_compile_cond(ast_t* ast, ast_cond_t* cond);
+
+
+//
+// Public functions
+//
+
+ast_t*
+fetchdeps_ast_new()
+{
+  ast_t* ast;
+
+  ast = (ast_t*)fetchdeps_alloc_calloc(ALLOC_AST, 1, sizeof(ast_t));
+  if (!ast)
+    return NULL;
+
+  ast->arena = fetchdeps_arena_new();
+  if (!ast->arena) {
+    fetchdeps_alloc_free(ast);
+    return NULL;
+  }
+
+  ast->strings = fetchdeps_vocab_new();
+  if (!ast->strings) {
+    fetchdeps_arena_free(ast->arena);
+    fetchdeps_alloc_free(ast);
+    return NULL;
+  }
+
+  return ast;
+}
+
+
+void
+fetchdeps_ast_free(ast_t* ast)
+{
+  size_t i;
+
+  assert(ast != NULL);
+
+  for (i = 0; i < ast->num_filters; ++i)
+    fetchdeps_filter_free(ast->filters[i]);
+  if (ast->filters)
+    fetchdeps_alloc_free(ast->filters);
+  fetchdeps_vocab_free(ast->strings);
+  if (ast->vars)
+    fetchdeps_vocab_free(ast->vars);
+  if (ast->values)
+    fetchdeps_vocab_free(ast->values);
+  fetchdeps_arena_free(ast->arena);
+  fetchdeps_alloc_free(ast);
+}
+
+
+char*
+fetchdeps_ast_intern(ast_t* ast, const char* str, size_t len)
+{
+  char* copy;
+  int id;
+
+  assert(ast != NULL);
+  assert(str != NULL);
+
+  id = fetchdeps_vocab_find_n(ast->strings, str, len);
+  if (id >= 0)
+    return fetchdeps_vocab_get(ast->strings, id);
+
+  copy = (char*)fetchdeps_arena_alloc(ast->arena, len + 1);
+  if (!copy)
+    return NULL;
+  memcpy(copy, str, len);
+  if (fetchdeps_vocab_add(ast->strings, copy) < 0)
+    return NULL;
+  return copy;
+}
+
+
+ast_value_t*
+fetchdeps_ast_new_value(ast_t* ast, char* str)
+{
+  ast_value_t* value;
+
+  assert(ast != NULL);
+  assert(str != NULL);
+
+  value = (ast_value_t*)fetchdeps_arena_alloc(ast->arena, sizeof(ast_value_t));
+  if (!value)
+    return NULL;
+  value->str = str;
+  return value;
+}
+
+
+ast_cond_t*
+fetchdeps_ast_new_relation(ast_t* ast, cond_op_t op, char* var, ast_value_t* values)
+{
+  ast_cond_t* cond;
+
+  assert(ast != NULL);
+  assert(op == COND_IN || op == COND_NOT_IN);
+  assert(var != NULL);
+
+  cond = (ast_cond_t*)fetchdeps_arena_alloc(ast->arena, sizeof(ast_cond_t));
+  if (!cond)
+    return NULL;
+  cond->op = op;
+  cond->var = var;
+  cond->values = values;
+  return cond;
+}
+
+
+ast_cond_t*
+fetchdeps_ast_new_binary(ast_t* ast, cond_op_t op, ast_cond_t* lhs, ast_cond_t* rhs)
+{
+  ast_cond_t* cond;
+
+  assert(ast != NULL);
+  assert(op == COND_AND || op == COND_OR);
+  assert(lhs != NULL);
+  assert(rhs != NULL);
+
+  cond = (ast_cond_t*)fetchdeps_arena_alloc(ast->arena, sizeof(ast_cond_t));
+  if (!cond)
+    return NULL;
+  cond->op = op;
+  cond->lhs = lhs;
+  cond->rhs = rhs;
+  return cond;
+}
+
+
+ast_stmt_t*
+fetchdeps_ast_new_conditional(ast_t* ast, ast_cond_t* cond, ast_stmt_t* body)
+{
+  ast_stmt_t* stmt;
+
+  assert(ast != NULL);
+  assert(cond != NULL);
+
+  stmt = (ast_stmt_t*)fetchdeps_arena_alloc(ast->arena, sizeof(ast_stmt_t));
+  if (!stmt)
+    return NULL;
+  stmt->kind = STMT_CONDITIONAL;
+  stmt->cond = cond;
+  stmt->body = body;
+  return stmt;
+}
+
+
+ast_stmt_t*
+fetchdeps_ast_new_include(ast_t* ast, char* path)
+{
+  ast_stmt_t* stmt;
+
+  assert(ast != NULL);
+  assert(path != NULL);
+
+  stmt = (ast_stmt_t*)fetchdeps_arena_alloc(ast->arena, sizeof(ast_stmt_t));
+  if (!stmt)
+    return NULL;
+  stmt->kind = STMT_INCLUDE;
+  stmt->path = path;
+  return stmt;
+}
+
+
+ast_stmt_t*
+fetchdeps_ast_new_url(ast_t* ast, char* url, filter_t* filter)
+{
+  ast_stmt_t* stmt;
+
+  assert(ast != NULL);
+  assert(url != NULL);
+
+  if (filter && !fetchdeps_ast_add_filter(ast, filter))
+    return NULL;
+
+  stmt = (ast_stmt_t*)fetchdeps_arena_alloc(ast->arena, sizeof(ast_stmt_t));
+  if (!stmt)
+    return NULL;
+  stmt->kind = STMT_URL;
+  stmt->url = url;
+  stmt->filter = filter;
+  if (fetchdeps_template_has_vars(url)) {
+    stmt->url_template = fetchdeps_template_compile(ast->arena, url);
+    if (!stmt->url_template)
+      return NULL;
+  }
+  return stmt;
+}
+
+
+bool_t
+fetchdeps_ast_compile(ast_t* ast)
+{
+  assert(ast != NULL);
+
+  if (ast->compiled)
+    return 1;
+
+  ast->vars = fetchdeps_vocab_new();
+  if (!ast->vars)
+    return 0;
+  ast->values = fetchdeps_vocab_new();
+  if (!ast->values)
+    return 0;
+
+  // The size of the bitsets isn't known until every value has been seen, so
+  // this takes two passes.
+  if (!fetchdeps_ast_intern_block(ast, ast->root))
+    return 0;
+  if (!fetchdeps_ast_compile_block(ast, ast->root))
+    return 0;
+
+  ast->compiled = 1;
+  return 1;
+}
+
+
+void
+fetchdeps_ast_append(ast_list_t* block, ast_stmt_t* stmt)
+{
+  assert(block != NULL);
+
+  if (!stmt)
+    return;
+  if (block->tail)
+    block->tail->next = stmt;
+  else
+    block->head = stmt;
+  block->tail = stmt;
+}
+
+
+void
+fetchdeps_ast_append_value(ast_value_list_t* list, ast_value_t* value)
+{
+  assert(list != NULL);
+  assert(value != NULL);
+
+  if (list->tail)
+    list->tail->next = value;
+  else
+    list->head = value;
+  list->tail = value;
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_ast_add_filter(ast_t* ast, filter_t* filter)
+{
+  if (ast->num_filters == ast->filters_capacity) {
+    size_t new_capacity = ast->filters_capacity ? ast->filters_capacity * 2 : 8;
+    filter_t** new_filters = (filter_t**)fetchdeps_alloc_realloc(ALLOC_AST, ast->filters, new_capacity * sizeof(filter_t*));
+    if (!new_filters) {
+      fetchdeps_filter_free(filter);
+      return 0;
+    }
+    ast->filters = new_filters;
+    ast->filters_capacity = new_capacity;
+  }
+
+  ast->filters[ast->num_filters++] = filter;
+  return 1;
+}
+
+
+bool_t
+fetchdeps_ast_intern_block(ast_t* ast, ast_stmt_t* stmt)
+{
+  for (; stmt; stmt = stmt->next) {
+    if (stmt->kind != STMT_CONDITIONAL)
+      continue;
+    if (!fetchdeps_ast_intern_cond(ast, stmt->cond))
+      return 0;
+    if (!fetchdeps_ast_intern_block(ast, stmt->body))
+      return 0;
+  }
+  return 1;
+}
+
+
+bool_t
+fetchdeps_ast_intern_cond(ast_t* ast, ast_cond_t* cond)
+{
+  ast_value_t* v;
+
+  if (cond->op == COND_AND || cond->op == COND_OR)
+    return fetchdeps_ast_intern_cond(ast, cond->lhs) &&
+           fetchdeps_ast_intern_cond(ast, cond->rhs);
+
+  cond->var_id = fetchdeps_vocab_add(ast->vars, cond->var);
+  if (cond->var_id < 0)
+    return 0;
+  for (v = cond->values; v; v = v->next) {
+    if (fetchdeps_vocab_add(ast->values, v->str) < 0)
+      return 0;
+  }
+  return 1;
+}
+
+
+bool_t
+fetchdeps_ast_compile_block(ast_t* ast, ast_stmt_t* stmt)
+{
+  for (; stmt; stmt = stmt->next) {
+    if (stmt->kind != STMT_CONDITIONAL)
+      continue;
+    if (!fetchdeps_ast_compile_cond(ast, stmt->cond))
+      return 0;
+    if (!fetchdeps_ast_compile_block(ast, stmt->body))
+      return 0;
+  }
+  return 1;
+}
+
+
+bool_t
+fetchdeps_ast_compile_cond(ast_t* ast, ast_cond_t* cond)
+{
+  ast_value_t* v;
+  size_t words;
+
+  if (cond->op == COND_AND || cond->op == COND_OR)
+    return fetchdeps_ast_compile_cond(ast, cond->lhs) &&
+           fetchdeps_ast_compile_cond(ast, cond->rhs);
+
+  words = fetchdeps_vocab_words(ast->values);
+  cond->value_bits = (uint64_t*)fetchdeps_arena_alloc(ast->arena, words * sizeof(uint64_t));
+  if (!cond->value_bits)
+    return 0;
+  for (v = cond->values; v; v = v->next) {
+    int id = fetchdeps_vocab_find(ast->values, v->str);
+    cond->value_bits[id / 64] |= (uint64_t)1 << (id % 64);
+  }
+  return 1;
+}
+
@@ -0,0 +1,172 @@
+#ifndef fetchdeps_ast_h
+#define fetchdeps_ast_h
+
+#include "arena.h"
+#include "common.h"
+#include "filter.h"
+#include "template.h"
+#include "vocab.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Types
+//
+
+// One string in a comma separated list of them.
+struct _ast_value {
+  char* str;
+  struct _ast_value* next;
+};
+typedef struct _ast_value ast_value_t;
+
+
+enum _cond_op {
+  COND_IN,        // The variable has any of the values.
+  COND_NOT_IN,    // The variable has none of the values.
+  COND_AND,
+  COND_OR
+};
+typedef enum _cond_op cond_op_t;
+
+
+// A condition. For COND_IN and COND_NOT_IN, 'var' and 'values' are set, along
+// with the location of the variable name so that we can report it if the
+// variable turns out not to exist. For COND_AND and COND_OR, 'lhs' and 'rhs'
+// are set.
+//
+// Once the AST has been compiled, relations also have 'var_id', the variable's
+// id in the AST's vocabulary of variable names, and 'value_bits', a bitset
+// with a bit set for each of the values in the AST's vocabulary of values.
+struct _ast_cond {
+  cond_op_t op;
+  char* var;
+  ast_value_t* values;
+  int line, first_column, last_column;
+  int var_id;
+  uint64_t* value_bits;
+  struct _ast_cond* lhs;
+  struct _ast_cond* rhs;
+};
+typedef struct _ast_cond ast_cond_t;
+
+
+enum _stmt_kind {
+  STMT_URL,
+  STMT_CONDITIONAL,
+  STMT_INCLUDE
+};
+typedef enum _stmt_kind stmt_kind_t;
+
+
+// A statement in a block. For STMT_URL, 'url' is set and 'filter' is either
+// NULL or the options given after the URL. If the URL refers to any variables,
+// 'url_template' is the compiled form of it, and the location of the URL is
+// set for error messages. For STMT_CONDITIONAL, 'body' is the
+// first statement of the block which applies when 'cond' is true. For
+// STMT_INCLUDE, 'path' is the deps file to include, exactly as it was written,
+// along with its location for error messages. 'included' is filled in with the
+// parser for that file once it has been parsed, or left NULL if the file
+// couldn't be found.
+struct _ast_stmt {
+  stmt_kind_t kind;
+  struct _ast_stmt* next; // The next statement in the same block.
+
+  char* url;
+  urltemplate_t* url_template;
+  filter_t* filter;
+
+  ast_cond_t* cond;
+  struct _ast_stmt* body;
+
+  char* path;
+  int line, first_column, last_column;
+  struct _parser* included;
+};
+typedef struct _ast_stmt ast_stmt_t;
+
+
+// A block under construction: the first and last statements in it.
+struct _ast_list {
+  ast_stmt_t* head;
+  ast_stmt_t* tail;
+};
+typedef struct _ast_list ast_list_t;
+
+
+// A list of values under construction: the first and last values in it.
+struct _ast_value_list {
+  ast_value_t* head;
+  ast_value_t* tail;
+};
+typedef struct _ast_value_list ast_value_list_t;
+
+
+// A parsed deps file. All of the nodes and strings are allocated from the
+// arena; the filters and vocabularies are the only things allocated
+// separately.
+struct _ast {
+  arena_t* arena;
+  ast_stmt_t* root;
+
+  vocab_t* strings;  // Every string returned by fetchdeps_ast_intern.
+
+  bool_t compiled;
+  vocab_t* vars;    // Every variable name used in a relation.
+  vocab_t* values;  // Every value used in a relation.
+
+  filter_t** filters;
+  size_t num_filters;
+  size_t filters_capacity;
+};
+typedef struct _ast ast_t;
+
+
+//
+// Functions
+//
+
+// Allocate a new, empty AST. It must eventually be freed with
+// fetchdeps_ast_free.
+ast_t* fetchdeps_ast_new();
+
+// Deallocate the AST, including all of its nodes, strings and filters.
+void fetchdeps_ast_free(ast_t* ast);
+
+// Get a copy of the first 'len' characters of 'str' from the AST's arena.
+// Strings are interned, so however many times the same string is passed in,
+// it's only copied the first time. 'str' needn't be nul terminated. Returns
+// NULL if memory couldn't be allocated.
+char* fetchdeps_ast_intern(ast_t* ast, const char* str, size_t len);
+
+// Functions for building nodes. Strings passed to these must already belong to
+// the AST's arena. They all return NULL if memory couldn't be allocated.
+ast_value_t* fetchdeps_ast_new_value(ast_t* ast, char* str);
+ast_cond_t* fetchdeps_ast_new_relation(ast_t* ast, cond_op_t op, char* var, ast_value_t* values);
+ast_cond_t* fetchdeps_ast_new_binary(ast_t* ast, cond_op_t op, ast_cond_t* lhs, ast_cond_t* rhs);
+ast_stmt_t* fetchdeps_ast_new_conditional(ast_t* ast, ast_cond_t* cond, ast_stmt_t* body);
+ast_stmt_t* fetchdeps_ast_new_include(ast_t* ast, char* path);
+
+// Make a node for a URL statement. The AST takes ownership of the filter, which
+// may be NULL, even if this fails. A URL which refers to variables is compiled
+// into a template here.
+ast_stmt_t* fetchdeps_ast_new_url(ast_t* ast, char* url, filter_t* filter);
+
+// Compile the relations in the AST so that they can be evaluated with bitsets
+// rather than string comparisons. Every variable name and value used in a
+// relation is given an id in the AST's vocabularies, then each relation's list
+// of values is turned into a bitset over the values. Compiling an AST which
+// has already been compiled does nothing. Returns false if memory couldn't be
+// allocated.
+bool_t fetchdeps_ast_compile(ast_t* ast);
+
+// Add a statement to the end of a block. A NULL statement (i.e. a blank line)
+// leaves the block unchanged.
+void fetchdeps_ast_append(ast_list_t* block, ast_stmt_t* stmt);
+
+// Add a value to the end of a list of values.
+void fetchdeps_ast_append_value(ast_value_list_t* list, ast_value_t* value);
+
+#endif // fetchdeps_ast_h
+
@@ -0,0 +1,218 @@
+#include "bufpool.h"
+
+#include "alloc.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+
+//
+// Types
+//
+
+struct _bufpool {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  size_t buffer_size;
+  size_t max_buffers;
+  size_t num_allocated;
+  size_t num_in_use;
+  size_t peak_in_use;
+
+  buffer_t* free_list;
+  buffer_t* queue_head;
+  buffer_t* queue_tail;
+  bool_t closed;
+};
+
+
+//
+// Public functions
+//
+
+bufpool_t*
+fetchdeps_bufpool_new(size_t num_buffers, size_t buffer_size)
+{
+  bufpool_t* pool;
+
+  assert(num_buffers > 0);
+  assert(buffer_size > 0);
+
+  pool = (bufpool_t*)fetchdeps_alloc_calloc(ALLOC_BUFPOOL, 1, sizeof(bufpool_t));
+  if (!pool)
+    return NULL;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pool->buffer_size = buffer_size;
+  pool->max_buffers = num_buffers;
+  return pool;
+}
+
+
+void
+fetchdeps_bufpool_free(bufpool_t* pool)
+{
+  buffer_t* buf;
+  buffer_t* next;
+
+  assert(pool != NULL);
+
+  // Anything still in the queue is freed along with the free list.
+  if (pool->queue_tail) {
+    pool->queue_tail->next = pool->free_list;
+    pool->free_list = pool->queue_head;
+  }
+  for (buf = pool->free_list; buf; buf = next) {
+    next = buf->next;
+    fetchdeps_alloc_free(buf);
+  }
+
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+  fetchdeps_alloc_free(pool);
+}
+
+
+size_t
+fetchdeps_bufpool_buffer_size(bufpool_t* pool)
+{
+  assert(pool != NULL);
+  return pool->buffer_size;
+}
+
+
+size_t
+fetchdeps_bufpool_capacity(bufpool_t* pool)
+{
+  assert(pool != NULL);
+  return pool->max_buffers * pool->buffer_size;
+}
+
+
+size_t
+fetchdeps_bufpool_peak_usage(bufpool_t* pool)
+{
+  size_t peak;
+
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  peak = pool->peak_in_use * pool->buffer_size;
+  pthread_mutex_unlock(&pool->lock);
+  return peak;
+}
+
+
+buffer_t*
+fetchdeps_bufpool_try_acquire(bufpool_t* pool)
+{
+  buffer_t* buf = NULL;
+
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->free_list) {
+    buf = pool->free_list;
+    pool->free_list = buf->next;
+  }
+  else if (pool->num_allocated < pool->max_buffers) {
+    // The header and data share one allocation.
+    buf = (buffer_t*)fetchdeps_alloc_malloc(ALLOC_BUFPOOL, sizeof(buffer_t) + pool->buffer_size);
+    if (buf) {
+      buf->data = (char*)(buf + 1);
+      ++pool->num_allocated;
+    }
+  }
+  if (buf) {
+    buf->len = 0;
+    buf->next = NULL;
+    if (++pool->num_in_use > pool->peak_in_use)
+      pool->peak_in_use = pool->num_in_use;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return buf;
+}
+
+
+void
+fetchdeps_bufpool_release(bufpool_t* pool, buffer_t* buf)
+{
+  assert(pool != NULL);
+  assert(buf != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  buf->next = pool->free_list;
+  pool->free_list = buf;
+  --pool->num_in_use;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+void
+fetchdeps_bufpool_push(bufpool_t* pool, buffer_t* buf)
+{
+  assert(pool != NULL);
+  assert(buf != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  assert(!pool->closed);
+  buf->next = NULL;
+  if (pool->queue_tail)
+    pool->queue_tail->next = buf;
+  else
+    pool->queue_head = buf;
+  pool->queue_tail = buf;
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+buffer_t*
+fetchdeps_bufpool_pop(bufpool_t* pool)
+{
+  buffer_t* buf;
+
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->queue_head && !pool->closed)
+    pthread_cond_wait(&pool->cond, &pool->lock);
+  buf = pool->queue_head;
+  if (buf) {
+    pool->queue_head = buf->next;
+    if (!pool->queue_head)
+      pool->queue_tail = NULL;
+    buf->next = NULL;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return buf;
+}
+
+
+void
+fetchdeps_bufpool_close(bufpool_t* pool)
+{
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->closed = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+void
+fetchdeps_bufpool_reopen(bufpool_t* pool)
+{
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  assert(pool->queue_head == NULL);
+  assert(pool->num_in_use == 0);
+  pool->closed = 0;
+  pthread_mutex_unlock(&pool->lock);
+}
+
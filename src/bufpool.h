@@ -0,0 +1,78 @@
+#ifndef fetchdeps_bufpool_h
+#define fetchdeps_bufpool_h
+
+#include "common.h"
+
+#include <stddef.h>
+
+//
+// Types
+//
+
+// A fixed size block of memory owned by a buffer pool. 'len' is the number of
+// bytes of 'data' which are in use.
+struct _buffer {
+  char* data;
+  size_t len;
+  struct _buffer* next;
+};
+typedef struct _buffer buffer_t;
+
+
+// A fixed number of equally sized buffers shared between a producer and a
+// consumer thread. The producer acquires empty buffers, fills them and pushes
+// them onto a queue; the consumer pops them off the queue in order and
+// releases them when it's done with them. Since there are never more than
+// num_buffers in existence, the memory used stays the same however much data
+// flows through the pool. When no buffer is free the producer has to wait,
+// which is how backpressure gets applied.
+struct _bufpool;
+typedef struct _bufpool bufpool_t;
+
+
+//
+// Functions
+//
+
+// Create a pool of up to 'num_buffers' buffers, each 'buffer_size' bytes
+// long. The buffers themselves are only allocated when they're first needed.
+// The pool must eventually be freed with fetchdeps_bufpool_free.
+bufpool_t* fetchdeps_bufpool_new(size_t num_buffers, size_t buffer_size);
+
+// Deallocate the pool and all of its buffers. No thread may be using it.
+void fetchdeps_bufpool_free(bufpool_t* pool);
+
+// Returns the size of each buffer in the pool.
+size_t fetchdeps_bufpool_buffer_size(bufpool_t* pool);
+
+// Returns the most memory the pool's buffers can ever use.
+size_t fetchdeps_bufpool_capacity(bufpool_t* pool);
+
+// Returns the most memory that has been held in buffers at any one time since
+// the pool was created, whether they were being filled, queued or consumed.
+size_t fetchdeps_bufpool_peak_usage(bufpool_t* pool);
+
+// Get an empty buffer without blocking. Returns NULL if all of the buffers are
+// in use (or a new one couldn't be allocated).
+buffer_t* fetchdeps_bufpool_try_acquire(bufpool_t* pool);
+
+// Returns a buffer to the pool once it's no longer needed.
+void fetchdeps_bufpool_release(bufpool_t* pool, buffer_t* buf);
+
+// Add a filled buffer to the end of the queue for the consumer.
+void fetchdeps_bufpool_push(bufpool_t* pool, buffer_t* buf);
+
+// Take the buffer at the front of the queue, waiting for one to be pushed if
+// necessary. Returns NULL once the queue is empty and the pool has been
+// closed.
+buffer_t* fetchdeps_bufpool_pop(bufpool_t* pool);
+
+// Tell the consumer that nothing more will be pushed.
+void fetchdeps_bufpool_close(bufpool_t* pool);
+
+// Reopen a closed pool so it can be used for another stream. The queue must
+// be empty and all buffers released.
+void fetchdeps_bufpool_reopen(bufpool_t* pool);
+
+#endif // fetchdeps_bufpool_h
+
@@ -0,0 +1,700 @@
+#include "cache.h"
+
+#include "alloc.h"
+#include "hash.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>   // For getpid().
+
+
+//
+// Constants
+//
+
+static const char kCacheMagic[4] = { 'F', 'D', 'C', 'B' };
+
+// Bump this whenever the format below changes.
+static const uint32_t kCacheVersion = 3;
+
+// Stops a corrupt cache file from sending the decoder into deep recursion.
+// Real deps files can't nest anywhere near this deeply.
+static const int kMaxDepth = 1000;
+
+// Bytecode opcodes. A block is a sequence of statements ended by OP_END:
+//
+//   OP_URL <url> <line> <first col> <last col>
+//   OP_URL_FILTERED <url> <line> <first col> <last col> <strip> <count> <include>... <count> <exclude>...
+//   OP_IF <condition> <block>
+//   OP_INCLUDE <path> <line> <first col> <last col>
+//
+// and a condition is one of:
+//
+//   OP_AND <condition> <condition>
+//   OP_OR <condition> <condition>
+//   OP_IN <var> <line> <first col> <last col> <count> <value>...
+//   OP_NOT_IN (as for OP_IN)
+//
+// Opcodes are a single byte. Everything else is a native 32 bit integer;
+// strings are byte offsets into the string table.
+enum _opcode {
+  OP_END,
+  OP_URL,
+  OP_URL_FILTERED,
+  OP_IF,
+  OP_INCLUDE,
+  OP_AND,
+  OP_OR,
+  OP_IN,
+  OP_NOT_IN
+};
+
+
+//
+// Types
+//
+
+// The cache files are only ever read on the machine that wrote them, so the
+// header is written as-is.
+struct _cache_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t pointer_size;  // Catches 32 and 64 bit builds sharing a checkout.
+  uint32_t strings_len;
+  uint32_t code_len;
+  uint32_t reserved;
+  cache_key_t key;
+};
+typedef struct _cache_header cache_header_t;
+
+
+struct _bytebuf {
+  unsigned char* data;
+  size_t len;
+  size_t capacity;
+  bool_t failed;
+};
+typedef struct _bytebuf bytebuf_t;
+
+
+// Collects the strings for the string table, storing each distinct string
+// once. The hash table maps strings to their offsets in 'strings'; slots hold
+// offset + 1, so zero means empty.
+struct _interner {
+  bytebuf_t strings;
+  uint32_t* slots;
+  size_t num_slots;
+  size_t count;
+};
+typedef struct _interner interner_t;
+
+
+struct _encoder {
+  bytebuf_t code;
+  interner_t strings;
+};
+typedef struct _encoder encoder_t;
+
+
+struct _cachedecoder {
+  ast_t* ast;
+  char* strings;
+  uint32_t strings_len;
+  unsigned char* code;
+  size_t code_len;
+  size_t pos;
+};
+typedef struct _cachedecoder cachedecoder_t;
+
+
+//
+// Forward declarations
+//
+
+void fetchdeps_cache_put(bytebuf_t* buf, const void* data, size_t len);
+void fetchdeps_cache_put_u8(bytebuf_t* buf, uint8_t value);
+void fetchdeps_cache_put_u32(bytebuf_t* buf, uint32_t value);
+void fetchdeps_cache_put_str(encoder_t* enc, char* str);
+void fetchdeps_cache_put_values(encoder_t* enc, ast_value_t* values);
+void fetchdeps_cache_put_patterns(encoder_t* enc, char** patterns, size_t count);
+void fetchdeps_cache_encode_block(encoder_t* enc, ast_stmt_t* stmt);
+void fetchdeps_cache_encode_cond(encoder_t* enc, ast_cond_t* cond);
+uint32_t fetchdeps_cache_intern(interner_t* in, char* str);
+
+bool_t fetchdeps_cache_get_u8(cachedecoder_t* dec, uint8_t* value);
+bool_t fetchdeps_cache_get_u32(cachedecoder_t* dec, uint32_t* value);
+bool_t fetchdeps_cache_get_str(cachedecoder_t* dec, char** str);
+bool_t fetchdeps_cache_decode_block(cachedecoder_t* dec, int depth, ast_stmt_t** head);
+bool_t fetchdeps_cache_decode_cond(cachedecoder_t* dec, int depth, ast_cond_t** cond);
+bool_t fetchdeps_cache_decode_filter(cachedecoder_t* dec, filter_t** filter);
+
+
+//
+// Public functions
+//
+
+bool_t
+fetchdeps_cache_key(char* deps_file, const char* data, size_t size, cache_key_t* key)
+{
+  struct stat st;
+
+  assert(deps_file != NULL);
+  assert(data != NULL || size == 0);
+  assert(key != NULL);
+
+  if (stat(deps_file, &st) != 0)
+    return 0;
+
+  memset(key, 0, sizeof(*key));
+  key->size = (uint64_t)size;
+#ifdef __APPLE__
+  key->mtime_sec = st.st_mtimespec.tv_sec;
+  key->mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+  key->mtime_sec = st.st_mtim.tv_sec;
+  key->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+
+  // The hash catches edits which don't change the size and land within the
+  // filesystem's timestamp granularity.
+  key->hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, data, size);
+  return 1;
+}
+
+
+bool_t
+fetchdeps_cache_load(ast_t* ast, char* cache_file, cache_key_t* key)
+{
+  cache_header_t header;
+  cachedecoder_t dec;
+  unsigned char* code = NULL;
+  ast_stmt_t* root = NULL;
+  FILE* f = NULL;
+  int saved_errno = errno;
+
+  assert(ast != NULL);
+  assert(ast->root == NULL);
+  assert(cache_file != NULL);
+  assert(key != NULL);
+
+  memset(&dec, 0, sizeof(dec));
+
+  f = fopen(cache_file, "rb");
+  if (!f)
+    goto failure;
+
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+      header.version != kCacheVersion ||
+      header.pointer_size != sizeof(void*) ||
+      memcmp(&header.key, key, sizeof(*key)) != 0)
+    goto failure;
+
+  // The string table goes into the arena as-is and the AST points into it.
+  dec.ast = ast;
+  dec.strings_len = header.strings_len;
+  if (dec.strings_len > 0) {
+    dec.strings = (char*)fetchdeps_arena_alloc(ast->arena, dec.strings_len);
+    if (!dec.strings || fread(dec.strings, 1, dec.strings_len, f) != dec.strings_len)
+      goto failure;
+    if (dec.strings[dec.strings_len - 1] != '\0')
+      goto failure;
+  }
+
+  code = (unsigned char*)fetchdeps_alloc_malloc(ALLOC_CACHE, header.code_len);
+  if (!code || fread(code, 1, header.code_len, f) != header.code_len)
+    goto failure;
+  dec.code = code;
+  dec.code_len = header.code_len;
+
+  if (!fetchdeps_cache_decode_block(&dec, 0, &root) || dec.pos != dec.code_len)
+    goto failure;
+
+  ast->root = root;
+  fetchdeps_alloc_free(code);
+  fclose(f);
+  errno = saved_errno;
+  return 1;
+
+failure:
+  if (code)
+    fetchdeps_alloc_free(code);
+  if (f)
+    fclose(f);
+  errno = saved_errno;
+  return 0;
+}
+
+
+bool_t
+fetchdeps_cache_save(ast_t* ast, char* cache_file, cache_key_t* key)
+{
+  cache_header_t header;
+  encoder_t enc;
+  char* tmp_file = NULL;
+  FILE* f = NULL;
+  size_t tmp_len;
+  int saved_errno = errno;
+
+  assert(ast != NULL);
+  assert(cache_file != NULL);
+  assert(key != NULL);
+
+  memset(&enc, 0, sizeof(enc));
+  fetchdeps_cache_encode_block(&enc, ast->root);
+  if (enc.code.failed || enc.strings.strings.failed ||
+      enc.code.len > UINT32_MAX || enc.strings.strings.len > UINT32_MAX)
+    goto failure;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.pointer_size = sizeof(void*);
+  header.strings_len = (uint32_t)enc.strings.strings.len;
+  header.code_len = (uint32_t)enc.code.len;
+  header.key = *key;
+
+  // Write to a temporary file, then move it into place. The name includes our
+  // pid in case several processes are updating the cache at once.
+  tmp_len = strlen(cache_file) + 32;
+  tmp_file = (char*)fetchdeps_alloc_malloc(ALLOC_CACHE, tmp_len);
+  if (!tmp_file)
+    goto failure;
+  snprintf(tmp_file, tmp_len, "%s.%ld.tmp", cache_file, (long)getpid());
+
+  f = fopen(tmp_file, "wb");
+  if (!f)
+    goto failure;
+  if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+      fwrite(enc.strings.strings.data, 1, enc.strings.strings.len, f) != enc.strings.strings.len ||
+      fwrite(enc.code.data, 1, enc.code.len, f) != enc.code.len)
+    goto failure;
+  if (fclose(f) != 0) {
+    f = NULL;
+    goto failure;
+  }
+  f = NULL;
+
+  if (rename(tmp_file, cache_file) != 0)
+    goto failure;
+
+  fetchdeps_alloc_free(tmp_file);
+  fetchdeps_alloc_free(enc.code.data);
+  fetchdeps_alloc_free(enc.strings.strings.data);
+  fetchdeps_alloc_free(enc.strings.slots);
+  errno = saved_errno;
+  return 1;
+
+failure:
+  if (f)
+    fclose(f);
+  if (tmp_file) {
+    remove(tmp_file);
+    fetchdeps_alloc_free(tmp_file);
+  }
+  if (enc.code.data)
+    fetchdeps_alloc_free(enc.code.data);
+  if (enc.strings.strings.data)
+    fetchdeps_alloc_free(enc.strings.strings.data);
+  if (enc.strings.slots)
+    fetchdeps_alloc_free(enc.strings.slots);
+  errno = saved_errno;
+  return 0;
+}
+
+
+//
+// Encoding functions
+//
+
+void
+fetchdeps_cache_put(bytebuf_t* buf, const void* data, size_t len)
+{
+  if (buf->failed)
+    return;
+
+  if (buf->len + len > buf->capacity) {
+    size_t new_capacity = buf->capacity ? buf->capacity * 2 : 4096;
+    unsigned char* new_data;
+
+    while (new_capacity < buf->len + len)
+      new_capacity *= 2;
+    new_data = (unsigned char*)fetchdeps_alloc_realloc(ALLOC_CACHE, buf->data, new_capacity);
+    if (!new_data) {
+      buf->failed = 1;
+      return;
+    }
+    buf->data = new_data;
+    buf->capacity = new_capacity;
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+
+void
+fetchdeps_cache_put_u8(bytebuf_t* buf, uint8_t value)
+{
+  fetchdeps_cache_put(buf, &value, sizeof(value));
+}
+
+
+void
+fetchdeps_cache_put_u32(bytebuf_t* buf, uint32_t value)
+{
+  fetchdeps_cache_put(buf, &value, sizeof(value));
+}
+
+
+void
+fetchdeps_cache_put_str(encoder_t* enc, char* str)
+{
+  fetchdeps_cache_put_u32(&enc->code, fetchdeps_cache_intern(&enc->strings, str));
+}
+
+
+void
+fetchdeps_cache_put_values(encoder_t* enc, ast_value_t* values)
+{
+  ast_value_t* v;
+  uint32_t count = 0;
+
+  for (v = values; v; v = v->next)
+    ++count;
+  fetchdeps_cache_put_u32(&enc->code, count);
+  for (v = values; v; v = v->next)
+    fetchdeps_cache_put_str(enc, v->str);
+}
+
+
+void
+fetchdeps_cache_put_patterns(encoder_t* enc, char** patterns, size_t count)
+{
+  size_t i;
+
+  fetchdeps_cache_put_u32(&enc->code, (uint32_t)count);
+  for (i = 0; i < count; ++i)
+    fetchdeps_cache_put_str(enc, patterns[i]);
+}
+
+
+void
+fetchdeps_cache_encode_block(encoder_t* enc, ast_stmt_t* stmt)
+{
+  for (; stmt; stmt = stmt->next) {
+    if (stmt->kind == STMT_CONDITIONAL) {
+      fetchdeps_cache_put_u8(&enc->code, OP_IF);
+      fetchdeps_cache_encode_cond(enc, stmt->cond);
+      fetchdeps_cache_encode_block(enc, stmt->body);
+    }
+    else if (stmt->kind == STMT_INCLUDE) {
+      fetchdeps_cache_put_u8(&enc->code, OP_INCLUDE);
+      fetchdeps_cache_put_str(enc, stmt->path);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->line);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->first_column);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->last_column);
+    }
+    else if (stmt->filter) {
+      filter_t* filter = stmt->filter;
+      fetchdeps_cache_put_u8(&enc->code, OP_URL_FILTERED);
+      fetchdeps_cache_put_str(enc, stmt->url);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->line);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->first_column);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->last_column);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)filter->strip_components);
+      fetchdeps_cache_put_patterns(enc, filter->includes, filter->num_includes);
+      fetchdeps_cache_put_patterns(enc, filter->excludes, filter->num_excludes);
+    }
+    else {
+      fetchdeps_cache_put_u8(&enc->code, OP_URL);
+      fetchdeps_cache_put_str(enc, stmt->url);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->line);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->first_column);
+      fetchdeps_cache_put_u32(&enc->code, (uint32_t)stmt->last_column);
+    }
+  }
+  fetchdeps_cache_put_u8(&enc->code, OP_END);
+}
+
+
+void
+fetchdeps_cache_encode_cond(encoder_t* enc, ast_cond_t* cond)
+{
+  switch (cond->op) {
+  case COND_AND:
+  case COND_OR:
+    fetchdeps_cache_put_u8(&enc->code, cond->op == COND_AND ? OP_AND : OP_OR);
+    fetchdeps_cache_encode_cond(enc, cond->lhs);
+    fetchdeps_cache_encode_cond(enc, cond->rhs);
+    break;
+  default:
+    fetchdeps_cache_put_u8(&enc->code, cond->op == COND_IN ? OP_IN : OP_NOT_IN);
+    fetchdeps_cache_put_str(enc, cond->var);
+    fetchdeps_cache_put_u32(&enc->code, (uint32_t)cond->line);
+    fetchdeps_cache_put_u32(&enc->code, (uint32_t)cond->first_column);
+    fetchdeps_cache_put_u32(&enc->code, (uint32_t)cond->last_column);
+    fetchdeps_cache_put_values(enc, cond->values);
+    break;
+  }
+}
+
+
+uint32_t
+fetchdeps_cache_intern(interner_t* in, char* str)
+{
+  size_t len = strlen(str);
+  uint64_t hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, str, len);
+  size_t mask, i;
+  uint32_t offset;
+
+  // Keep the table at most half full.
+  if ((in->count + 1) * 2 > in->num_slots) {
+    size_t new_num_slots = in->num_slots ? in->num_slots * 2 : 256;
+    uint32_t* new_slots = (uint32_t*)fetchdeps_alloc_calloc(ALLOC_CACHE, new_num_slots, sizeof(uint32_t));
+    size_t j;
+
+    if (!new_slots) {
+      in->strings.failed = 1;
+      return 0;
+    }
+    for (j = 0; j < in->num_slots; ++j) {
+      char* s;
+      uint64_t h;
+
+      if (in->slots[j] == 0)
+        continue;
+      s = (char*)in->strings.data + in->slots[j] - 1;
+      h = fetchdeps_hash_fnv1a(kFnvOffsetBasis, s, strlen(s));
+      for (i = h & (new_num_slots - 1); new_slots[i] != 0; i = (i + 1) & (new_num_slots - 1))
+        ;
+      new_slots[i] = in->slots[j];
+    }
+    fetchdeps_alloc_free(in->slots);
+    in->slots = new_slots;
+    in->num_slots = new_num_slots;
+  }
+
+  mask = in->num_slots - 1;
+  for (i = hash & mask; in->slots[i] != 0; i = (i + 1) & mask) {
+    if (strcmp((char*)in->strings.data + in->slots[i] - 1, str) == 0)
+      return in->slots[i] - 1;
+  }
+
+  offset = (uint32_t)in->strings.len;
+  fetchdeps_cache_put(&in->strings, str, len + 1);
+  if (in->strings.failed)
+    return 0;
+  in->slots[i] = offset + 1;
+  ++in->count;
+  return offset;
+}
+
+
+//
+// Decoding functions
+//
+
+bool_t
+fetchdeps_cache_get_u8(cachedecoder_t* dec, uint8_t* value)
+{
+  if (dec->pos + sizeof(*value) > dec->code_len)
+    return 0;
+  *value = dec->code[dec->pos++];
+  return 1;
+}
+
+
+bool_t
+fetchdeps_cache_get_u32(cachedecoder_t* dec, uint32_t* value)
+{
+  if (dec->pos + sizeof(*value) > dec->code_len)
+    return 0;
+  memcpy(value, dec->code + dec->pos, sizeof(*value));
+  dec->pos += sizeof(*value);
+  return 1;
+}
+
+
+bool_t
+fetchdeps_cache_get_str(cachedecoder_t* dec, char** str)
+{
+  uint32_t offset;
+
+  // The last byte of the table is a nul, so any offset inside it gives a
+  // properly terminated string.
+  if (!fetchdeps_cache_get_u32(dec, &offset) || offset >= dec->strings_len)
+    return 0;
+  *str = dec->strings + offset;
+  return 1;
+}
+
+
+bool_t
+fetchdeps_cache_decode_block(cachedecoder_t* dec, int depth, ast_stmt_t** head)
+{
+  ast_list_t block = { NULL, NULL };
+
+  if (depth > kMaxDepth)
+    return 0;
+
+  for (;;) {
+    ast_stmt_t* stmt = NULL;
+    ast_cond_t* cond;
+    ast_stmt_t* body;
+    filter_t* filter;
+    char* url;
+    uint32_t line = 0, first_column = 0, last_column = 0;
+    uint8_t op;
+
+    if (!fetchdeps_cache_get_u8(dec, &op))
+      return 0;
+
+    switch (op) {
+    case OP_END:
+      *head = block.head;
+      return 1;
+    case OP_URL:
+      if (!fetchdeps_cache_get_str(dec, &url) ||
+          !fetchdeps_cache_get_u32(dec, &line) ||
+          !fetchdeps_cache_get_u32(dec, &first_column) ||
+          !fetchdeps_cache_get_u32(dec, &last_column))
+        return 0;
+      stmt = fetchdeps_ast_new_url(dec->ast, url, NULL);
+      break;
+    case OP_URL_FILTERED:
+      if (!fetchdeps_cache_get_str(dec, &url) ||
+          !fetchdeps_cache_get_u32(dec, &line) ||
+          !fetchdeps_cache_get_u32(dec, &first_column) ||
+          !fetchdeps_cache_get_u32(dec, &last_column) ||
+          !fetchdeps_cache_decode_filter(dec, &filter))
+        return 0;
+      stmt = fetchdeps_ast_new_url(dec->ast, url, filter);
+      break;
+    case OP_IF:
+      if (!fetchdeps_cache_decode_cond(dec, depth + 1, &cond) ||
+          !fetchdeps_cache_decode_block(dec, depth + 1, &body))
+        return 0;
+      stmt = fetchdeps_ast_new_conditional(dec->ast, cond, body);
+      break;
+    case OP_INCLUDE:
+      if (!fetchdeps_cache_get_str(dec, &url) ||
+          !fetchdeps_cache_get_u32(dec, &line) ||
+          !fetchdeps_cache_get_u32(dec, &first_column) ||
+          !fetchdeps_cache_get_u32(dec, &last_column))
+        return 0;
+      stmt = fetchdeps_ast_new_include(dec->ast, url);
+      break;
+    default:
+      return 0;
+    }
+
+    if (!stmt)
+      return 0;
+    // Conditionals have no location of their own; errors in them are
+    // reported against the variable in the condition instead.
+    if (op != OP_IF) {
+      stmt->line = (int)line;
+      stmt->first_column = (int)first_column;
+      stmt->last_column = (int)last_column;
+    }
+    fetchdeps_ast_append(&block, stmt);
+  }
+}
+
+
+bool_t
+fetchdeps_cache_decode_cond(cachedecoder_t* dec, int depth, ast_cond_t** cond)
+{
+  ast_cond_t* lhs;
+  ast_cond_t* rhs;
+  ast_value_list_t values = { NULL, NULL };
+  uint32_t line, first_column, last_column, count, i;
+  char* var;
+  uint8_t op;
+
+  if (depth > kMaxDepth || !fetchdeps_cache_get_u8(dec, &op))
+    return 0;
+
+  switch (op) {
+  case OP_AND:
+  case OP_OR:
+    if (!fetchdeps_cache_decode_cond(dec, depth + 1, &lhs) ||
+        !fetchdeps_cache_decode_cond(dec, depth + 1, &rhs))
+      return 0;
+    *cond = fetchdeps_ast_new_binary(dec->ast, op == OP_AND ? COND_AND : COND_OR, lhs, rhs);
+    return *cond != NULL;
+
+  case OP_IN:
+  case OP_NOT_IN:
+    if (!fetchdeps_cache_get_str(dec, &var) ||
+        !fetchdeps_cache_get_u32(dec, &line) ||
+        !fetchdeps_cache_get_u32(dec, &first_column) ||
+        !fetchdeps_cache_get_u32(dec, &last_column) ||
+        !fetchdeps_cache_get_u32(dec, &count))
+      return 0;
+    for (i = 0; i < count; ++i) {
+      char* str;
+      ast_value_t* value;
+      if (!fetchdeps_cache_get_str(dec, &str))
+        return 0;
+      value = fetchdeps_ast_new_value(dec->ast, str);
+      if (!value)
+        return 0;
+      fetchdeps_ast_append_value(&values, value);
+    }
+    *cond = fetchdeps_ast_new_relation(dec->ast, op == OP_IN ? COND_IN : COND_NOT_IN, var, values.head);
+    if (!*cond)
+      return 0;
+    (*cond)->line = (int)line;
+    (*cond)->first_column = (int)first_column;
+    (*cond)->last_column = (int)last_column;
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+
+bool_t
+fetchdeps_cache_decode_filter(cachedecoder_t* dec, filter_t** filter)
+{
+  uint32_t strip, count, i;
+  filter_t* f;
+  char* pattern;
+
+  if (!fetchdeps_cache_get_u32(dec, &strip))
+    return 0;
+
+  f = fetchdeps_filter_new();
+  if (!f)
+    return 0;
+  f->strip_components = (int)strip;
+
+  if (!fetchdeps_cache_get_u32(dec, &count))
+    goto failure;
+  for (i = 0; i < count; ++i) {
+    if (!fetchdeps_cache_get_str(dec, &pattern) || !fetchdeps_filter_add_include(f, pattern))
+      goto failure;
+  }
+
+  if (!fetchdeps_cache_get_u32(dec, &count))
+    goto failure;
+  for (i = 0; i < count; ++i) {
+    if (!fetchdeps_cache_get_str(dec, &pattern) || !fetchdeps_filter_add_exclude(f, pattern))
+      goto failure;
+  }
+
+  *filter = f;
+  return 1;
+
+failure:
+  fetchdeps_filter_free(f);
+  return 0;
+}
+
@@ -0,0 +1,53 @@
+#ifndef fetchdeps_cache_h
+#define fetchdeps_cache_h
+
+#include "ast.h"
+#include "common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Types
+//
+
+// Identifies one version of a deps file. The cache is only used if all of
+// these match.
+struct _cache_key {
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t hash;      // FNV-1a hash of the file's contents.
+};
+typedef struct _cache_key cache_key_t;
+
+
+//
+// Functions
+//
+
+// Work out the key for 'deps_file', whose contents have already been read
+// into 'data'. The contents are hashed from there rather than read again, so
+// the key always matches what gets parsed. Returns false if the file couldn't
+// be examined.
+bool_t fetchdeps_cache_key(char* deps_file, const char* data, size_t size, cache_key_t* key);
+
+// Load a compiled deps file from 'cache_file' into 'ast', which must be empty.
+// The cache file holds each distinct string once, followed by the statements
+// and conditions encoded as a compact bytecode which is decoded straight back
+// into AST nodes.
+//
+// Returns false if there's no cache file, it was written for a different key,
+// or it's unreadable or corrupt. In that case 'ast' may contain some nodes but
+// its root won't have been set; the caller should throw it away. This never
+// sets an error, since the caller is expected to fall back to parsing.
+bool_t fetchdeps_cache_load(ast_t* ast, char* cache_file, cache_key_t* key);
+
+// Write 'ast' to 'cache_file', tagged with 'key'. The file is replaced
+// atomically, so a concurrent reader will either see the old cache or the new
+// one. Returns false if the file couldn't be written; as with
+// fetchdeps_cache_load, no error is set.
+bool_t fetchdeps_cache_save(ast_t* ast, char* cache_file, cache_key_t* key);
+
+#endif // fetchdeps_cache_h
+
@@ -1,5 +1,6 @@
 #include "cmdline.h"
 
+#include "alloc.h"
 #include "errors.h"
 
 #include <assert.h>
@@ -56,6 +57,15 @@ fetchdeps_cmdline_init(cmdline_t* options, int argc, char** argv)
   options->fname = NULL;
   options->verbose = 0;
   options->no_changes = 0;
+  options->matrix = 0;
+  options->json = 0;
+  options->watch = 0;
+  options->prune = 0;
+  options->alloc_stats = 0;
+  options->trace_file = NULL;
+  options->metrics_file = NULL;
+  options->jobs = 0;
+  options->writer = WRITER_AUTO;
   options->action = ACTION_HELP;
 }
 
@@ -66,7 +76,11 @@ fetchdeps_cmdline_cleanup(cmdline_t* options)
   assert(options != NULL);
 
   if (options->fname)
-    free(options->fname);
+    fetchdeps_alloc_free(options->fname);
+  if (options->trace_file)
+    fetchdeps_alloc_free(options->trace_file);
+  if (options->metrics_file)
+    fetchdeps_alloc_free(options->metrics_file);
 }
 
 
@@ -74,11 +88,20 @@ exittype_t
 fetchdeps_cmdline_parse(cmdline_t* options)
 {
   // Parse the command line.
-  char* short_options = "f:t:vnh";
+  char* short_options = "f:t:j:w:vnmh";
   struct option long_options [] = {
     { "file",       required_argument,  NULL, 'f' },
     { "verbose",    no_argument,        NULL, 'v' },
     { "no-changes", no_argument,        NULL, 'n' },
+    { "jobs",       required_argument,  NULL, 'j' },
+    { "writer",     required_argument,  NULL, 'w' },
+    { "matrix",     no_argument,        NULL, 'm' },
+    { "json",       no_argument,        NULL, 'J' },
+    { "watch",      no_argument,        NULL, 'W' },
+    { "prune",      no_argument,        NULL, 'P' },
+    { "alloc-stats", no_argument,       NULL, 'A' },
+    { "trace",      required_argument,  NULL, 'T' },
+    { "metrics-textfile", required_argument, NULL, 'M' },
     { "help",       no_argument,        NULL, 'h' },
     { NULL,         0,                  NULL, 0 }
   };
@@ -94,7 +117,7 @@ fetchdeps_cmdline_parse(cmdline_t* options)
         exit_type = EXIT_FAIL;
       }
       else {
-        options->fname = strdup(optarg);
+        options->fname = fetchdeps_alloc_strdup(ALLOC_CMDLINE, optarg);
         if (!options->fname)
           exit_type = EXIT_FAIL;
       }
@@ -105,6 +128,49 @@ fetchdeps_cmdline_parse(cmdline_t* options)
     case 'n':
       options->no_changes = 1;
       break;
+    case 'j':
+      options->jobs = atoi(optarg);
+      if (options->jobs < 1) {
+        fetchdeps_errors_set_with_msg(ERR_CMDLINE, "Invalid number of jobs '%s'", optarg);
+        exit_type = EXIT_FAIL;
+      }
+      break;
+    case 'w':
+      options->writer = fetchdeps_writer_lookup_backend(optarg);
+      if (options->writer == WRITER_UNKNOWN) {
+        fetchdeps_errors_set_with_msg(ERR_CMDLINE, "Unknown writer '%s'", optarg);
+        exit_type = EXIT_FAIL;
+      }
+      break;
+    case 'm':
+      options->matrix = 1;
+      break;
+    case 'J':
+      options->json = 1;
+      break;
+    case 'W':
+      options->watch = 1;
+      break;
+    case 'P':
+      options->prune = 1;
+      break;
+    case 'A':
+      options->alloc_stats = 1;
+      break;
+    case 'T':
+      if (options->trace_file)
+        fetchdeps_alloc_free(options->trace_file);
+      options->trace_file = fetchdeps_alloc_strdup(ALLOC_CMDLINE, optarg);
+      if (!options->trace_file)
+        exit_type = EXIT_FAIL;
+      break;
+    case 'M':
+      if (options->metrics_file)
+        fetchdeps_alloc_free(options->metrics_file);
+      options->metrics_file = fetchdeps_alloc_strdup(ALLOC_CMDLINE, optarg);
+      if (!options->metrics_file)
+        exit_type = EXIT_FAIL;
+      break;
     case 'h':
       fetchdeps_cmdline_print_usage(options, stderr);
       exit_type = EXIT_OK;
@@ -134,6 +200,27 @@ fetchdeps_cmdline_parse(cmdline_t* options)
     }
   }
 
+  if (exit_type == NO_EXIT && options->matrix && options->action != ACTION_LIST) {
+    fetchdeps_errors_set_with_msg(ERR_CMDLINE, "--matrix can only be used with list");
+    exit_type = EXIT_FAIL;
+  }
+  if (exit_type == NO_EXIT && options->json && !options->matrix) {
+    fetchdeps_errors_set_with_msg(ERR_CMDLINE, "--json can only be used with --matrix");
+    exit_type = EXIT_FAIL;
+  }
+  if (exit_type == NO_EXIT && options->watch && options->action != ACTION_GET) {
+    fetchdeps_errors_set_with_msg(ERR_CMDLINE, "--watch can only be used with get");
+    exit_type = EXIT_FAIL;
+  }
+  if (exit_type == NO_EXIT && options->watch && options->no_changes) {
+    fetchdeps_errors_set_with_msg(ERR_CMDLINE, "--watch can't be used with --no-changes");
+    exit_type = EXIT_FAIL;
+  }
+  if (exit_type == NO_EXIT && options->prune && !options->watch) {
+    fetchdeps_errors_set_with_msg(ERR_CMDLINE, "--prune can only be used with --watch");
+    exit_type = EXIT_FAIL;
+  }
+
   return exit_type;
 
 failure:
@@ -179,11 +266,48 @@ fetchdeps_cmdline_print_usage(cmdline_t* options, FILE* out)
 "                   search for a file called 'default.deps' in the current\n"
 "                   directory or any of its ancestors and use that if found.\n"
 "\n"
-"  -v, --verbose    Print out all variables before starting to parse.\n"
+"  -v, --verbose    Print out all variables before starting to parse, and\n"
+"                   timing and memory use information for get and install.\n"
 "\n"
 "  -n, --no-changes Don't download anything, or change the disk in any way,\n"
 "                   but show what would have been downloaded.\n"
 "\n"
+"  -j, --jobs       Number of worker threads to use for parallel work such\n"
+"                   as parsing included deps files, uninstall and delete.\n"
+"                   Defaults to the number of CPUs.\n"
+"\n"
+"  -w, --writer     How install writes files: 'uring' batches them through\n"
+"                   io_uring, 'posix' uses plain system calls and 'auto' (the\n"
+"                   default) uses io_uring when the kernel supports it.\n"
+"\n"
+"  -m, --matrix     For list: treat each var=value1,value2,... as a set of\n"
+"                   values, and list the dependencies for every combination\n"
+"                   of them as a table.\n"
+"\n"
+"      --json       With --matrix, print the results as JSON instead.\n"
+"\n"
+"      --watch      For get: keep running, and whenever the deps file or any\n"
+"                   file it includes changes, download just the new URLs.\n"
+"\n"
+"      --prune      With --watch, also delete the downloads for URLs which\n"
+"                   are no longer in the deps file.\n"
+"\n"
+"      --alloc-stats\n"
+"                   When finished, print how many allocations each part of\n"
+"                   the program made and how much memory they used.\n"
+"\n"
+"      --trace FILE Record when each phase of the run (parsing, each\n"
+"                   download and extraction, etc.) starts and finishes on\n"
+"                   each thread, and write it to FILE as a Chrome trace for\n"
+"                   loading into Perfetto or chrome://tracing.\n"
+"\n"
+"      --metrics-textfile PATH\n"
+"                   When finished, write figures about the run (bytes\n"
+"                   downloaded, transfer, parse and install times, etc.) to\n"
+"                   PATH in the OpenMetrics text format, e.g. for\n"
+"                   node-exporter's textfile collector. With --watch it's\n"
+"                   rewritten after each update.\n"
+"\n"
 "  -h, --help       Print this message and exit.\n"
       , options->prog, options->prog);
 }
@@ -2,6 +2,7 @@
 #define fetchdeps_cmdline_h
 
 #include "common.h"
+#include "writer.h"
 
 #include <stdio.h>
 
@@ -42,6 +43,15 @@ struct _cmdline {
   char* fname;
   bool_t verbose;
   bool_t no_changes;
+  bool_t matrix;
+  bool_t json;
+  bool_t watch;
+  bool_t prune;
+  bool_t alloc_stats;
+  char* trace_file;
+  char* metrics_file;
+  int jobs;
+  writer_backend_t writer;
   action_t action;
 };
 
@@ -1,30 +1,41 @@
 /* Parse compound logical expressions. */
 
 %{
+#include "ast.h"
 #include "common.h"
+#include "filter.h"
 #include "parse.h"
 #include "stringset.h"
-#include "varmap.h"
 #include <stdio.h>
+#include <stdlib.h>
 
-int yylex();
-void yyerror(stringset_t* /*ignored*/, const char* s);
-
-extern parser_t* g_ctx;
+filter_t* add_patterns(filter_t* filter, ast_value_t* patterns, bool_t include);
 %}
 
+%code {
+int yylex(YYSTYPE* lvalp, YYLTYPE* llocp, void* scanner);
+void yyerror(YYLTYPE* llocp, void* scanner, parser_t* ctx, const char* msg);
+ast_cond_t* new_relation(parser_t* ctx, cond_op_t op, char* var, ast_value_t* values, YYLTYPE* var_loc);
+ast_stmt_t* new_include(parser_t* ctx, char* path, YYLTYPE* path_loc);
+ast_stmt_t* new_url(parser_t* ctx, char* url, filter_t* filter, YYLTYPE* url_loc);
+}
+
 %union {
-  int bool_val;
+  int int_val;
+  filter_t* filter_val;
   char* str_val;
   char* varname_val;
   char* url_val;
-  stringset_t* strset_val;
-  stringset_t* urlset_val;
+  ast_value_list_t values_val;
+  ast_cond_t* cond_val;
+  ast_stmt_t* stmt_val;
+  ast_list_t list_val;
 }
 
 %token <varname_val> VAR
 %token <str_val> STR
 %token <url_val> URL
+%token <int_val> NUM
 
 %token COMMA
 
@@ -35,114 +46,244 @@ extern parser_t* g_ctx;
 %token EQ
 %token NE
 
+%token INCLUDE
+%token EXCLUDE
+%token STRIP
+
 %token INDENT
 %token DEDENT
 %token COLON
 %token NEWLINE
 
-%type <urlset_val> start
-%type <strset_val> str_value
-%type <strset_val> var_value
-%type <bool_val> relation
-%type <bool_val> condition
-%type <urlset_val> statement
-%type <urlset_val> block;
+%type <values_val> str_value
+%type <varname_val> var_value
+%type <varname_val> any_var
+%type <cond_val> relation
+%type <cond_val> condition
+%type <stmt_val> statement
+%type <list_val> block;
+%type <filter_val> url_options
+
+%destructor { if ($$) fetchdeps_filter_free($$); } <filter_val>
 
+%define api.pure full
 %error-verbose
 %locations
-%parse-param {stringset_t* parse_results} 
+%lex-param {void* scanner}
+%parse-param {void* scanner} {parser_t* ctx}
 
 %%
 
 start:
-  block   { if (!fetchdeps_stringset_add_all(parse_results, $1)) {
-              yyerror(parse_results, "failed to add URLs to result set");
-              YYERROR;
-            }
-            /*fetchdeps_stringset_free($1);*/ }
+  block   { ctx->ast->root = $1.head; }
 ;
 
 
 str_value:
-    STR                   { $$ = fetchdeps_stringset_new_single($1);
-                            if (!$$) {
-                              yyerror(parse_results, "failed to create new string literal");
+    STR                   { ast_value_t* value = $1 ? fetchdeps_ast_new_value(ctx->ast, $1) : NULL;
+                            if (!value) {
+                              yyerror(&@$, scanner, ctx, "failed to create new string literal");
                               YYERROR;
-                            } }
-  | str_value COMMA STR   { $$ = $1;
-                            if (!fetchdeps_stringset_add($$, $3)) {
-                              yyerror(parse_results, "failed to add literal string to string value");
+                            }
+                            $$.head = $$.tail = NULL;
+                            fetchdeps_ast_append_value(&$$, value); }
+  | str_value COMMA STR   { ast_value_t* value = $3 ? fetchdeps_ast_new_value(ctx->ast, $3) : NULL;
+                            if (!value) {
+                              yyerror(&@$, scanner, ctx, "failed to add literal string to string value");
                               YYERROR;
-                            } }
+                            }
+                            $$ = $1;
+                            fetchdeps_ast_append_value(&$$, value); }
   ;
 
 
+/* The words used for URL options can still be variable names in a
+   condition. A condition on a variable called "include" looks just like an
+   include statement until after its values, so it only goes through any_var
+   when an operator follows the name; otherwise relation matches it
+   directly. */
 var_value:
-    VAR     { $$ = fetchdeps_varmap_get(g_ctx->vars, $1);
-              if (!$$) {
-                yyerror(parse_results, "unknown variable\n");
-                YYERROR;
-              } }
+    VAR       { $$ = $1;
+                if (!$$) {
+                  yyerror(&@$, scanner, ctx, "failed to allocate variable name");
+                  YYERROR;
+                } }
+  | EXCLUDE   { $$ = fetchdeps_ast_intern(ctx->ast, "exclude", 7);
+                if (!$$) {
+                  yyerror(&@$, scanner, ctx, "failed to allocate variable name");
+                  YYERROR;
+                } }
+  ;
+
+
+any_var:
+    var_value { $$ = $1; }
+  | INCLUDE   { $$ = fetchdeps_ast_intern(ctx->ast, "include", 7);
+                if (!$$) {
+                  yyerror(&@$, scanner, ctx, "failed to allocate variable name");
+                  YYERROR;
+                } }
   ;
 
 
 relation:
-    var_value str_value       { $$ = fetchdeps_stringset_contains_any($1, $2);
-                                fetchdeps_stringset_free($2); }
-  | var_value NOT str_value   { $$ = !fetchdeps_stringset_contains_any($1, $3);
-                                fetchdeps_stringset_free($3); }
-  | var_value EQ str_value    { $$ = fetchdeps_stringset_contains_any($1, $3);
-                                fetchdeps_stringset_free($3); }
-  | var_value NE str_value    { $$ = !fetchdeps_stringset_contains_any($1, $3);
-                                fetchdeps_stringset_free($3); }
+    var_value str_value       { $$ = new_relation(ctx, COND_IN, $1, $2.head, &@1);
+                                if (!$$) {
+                                  yyerror(&@$, scanner, ctx, "failed to allocate relation");
+                                  YYERROR;
+                                } }
+  | INCLUDE str_value         { char* var = fetchdeps_ast_intern(ctx->ast, "include", 7);
+                                $$ = var ? new_relation(ctx, COND_IN, var, $2.head, &@1) : NULL;
+                                if (!$$) {
+                                  yyerror(&@$, scanner, ctx, "failed to allocate relation");
+                                  YYERROR;
+                                } }
+  | any_var NOT str_value     { $$ = new_relation(ctx, COND_NOT_IN, $1, $3.head, &@1);
+                                if (!$$) {
+                                  yyerror(&@$, scanner, ctx, "failed to allocate relation");
+                                  YYERROR;
+                                } }
+  | any_var EQ str_value      { $$ = new_relation(ctx, COND_IN, $1, $3.head, &@1);
+                                if (!$$) {
+                                  yyerror(&@$, scanner, ctx, "failed to allocate relation");
+                                  YYERROR;
+                                } }
+  | any_var NE str_value      { $$ = new_relation(ctx, COND_NOT_IN, $1, $3.head, &@1);
+                                if (!$$) {
+                                  yyerror(&@$, scanner, ctx, "failed to allocate relation");
+                                  YYERROR;
+                                } }
   ;
 
 
 condition:
     relation                { $$ = $1; }
-  | condition AND relation  { $$ = $1 && $3; }
-  | condition OR relation   { $$ = $1 || $3; }
+  | condition AND relation  { $$ = fetchdeps_ast_new_binary(ctx->ast, COND_AND, $1, $3);
+                              if (!$$) {
+                                yyerror(&@$, scanner, ctx, "failed to allocate condition");
+                                YYERROR;
+                              } }
+  | condition OR relation   { $$ = fetchdeps_ast_new_binary(ctx->ast, COND_OR, $1, $3);
+                              if (!$$) {
+                                yyerror(&@$, scanner, ctx, "failed to allocate condition");
+                                YYERROR;
+                              } }
   ;
 
 
-statement: /* empty */                  { $$ = fetchdeps_stringset_new();
+statement: /* empty */                  { $$ = NULL; }
+  | URL url_options                     { if ($1) {
+                                            $$ = new_url(ctx, $1, $2, &@1);
+                                          }
+                                          else {
+                                            if ($2)
+                                              fetchdeps_filter_free($2);
+                                            $$ = NULL;
+                                          }
                                           if (!$$) {
-                                            yyerror(parse_results, "failed to allocate empty statement");
+                                            yyerror(&@$, scanner, ctx, "failed to allocate URL");
                                             YYERROR;
                                           } }
-  | URL                                 { $$ = fetchdeps_stringset_new_single($1);
+  | condition COLON INDENT block DEDENT { $$ = fetchdeps_ast_new_conditional(ctx->ast, $1, $4.head);
                                           if (!$$) {
-                                            yyerror(parse_results, "failed to allocate URL");
+                                            yyerror(&@$, scanner, ctx, "failed to allocate conditional section");
                                             YYERROR;
                                           } }
-  | condition COLON INDENT block DEDENT { if ($1) {
-                                            $$ = $4;
-                                          }
-                                          else {
-                                            fetchdeps_stringset_free($4);
-                                            $$ = fetchdeps_stringset_new();
+  | INCLUDE STR                         { $$ = $2 ? new_include(ctx, $2, &@2) : NULL;
+                                          if (!$$) {
+                                            yyerror(&@$, scanner, ctx, "failed to allocate include");
+                                            YYERROR;
+                                          } }
+  ;
+
+url_options:
+    /* empty */                           { $$ = NULL; }
+  | url_options INCLUDE str_value         { $$ = add_patterns($1, $3.head, 1);
                                             if (!$$) {
-                                              yyerror(parse_results, "failed to allocate empty statement for ignored conditional block");
+                                              yyerror(&@$, scanner, ctx, "failed to add include patterns");
+                                              YYERROR;
+                                            } }
+  | url_options EXCLUDE str_value         { $$ = add_patterns($1, $3.head, 0);
+                                            if (!$$) {
+                                              yyerror(&@$, scanner, ctx, "failed to add exclude patterns");
+                                              YYERROR;
+                                            } }
+  | url_options STRIP NUM                 { $$ = $1 ? $1 : fetchdeps_filter_new();
+                                            if (!$$) {
+                                              yyerror(&@$, scanner, ctx, "failed to allocate filter");
                                               YYERROR;
                                             }
-                                          } }
+                                            $$->strip_components = $3; }
   ;
 
 block:
-    statement                 { $$ = $1; }
+    statement                 { $$.head = $$.tail = NULL;
+                                fetchdeps_ast_append(&$$, $1); }
   | block NEWLINE statement   { $$ = $1;
-                                if (!fetchdeps_stringset_add_all($$, $3)) {
-                                  yyerror(parse_results, "failed to add URLs from conditional section");
-                                  YYERROR;
-                                }
-                                fetchdeps_stringset_free($3); }
+                                fetchdeps_ast_append(&$$, $3); }
 
 
 %%
 
-void yyerror(stringset_t* ignored, const char* msg)
+filter_t* add_patterns(filter_t* filter, ast_value_t* patterns, bool_t include)
+{
+  ast_value_t* pattern;
+
+  if (!filter)
+    filter = fetchdeps_filter_new();
+  if (!filter)
+    return NULL;
+
+  for (pattern = patterns; pattern; pattern = pattern->next) {
+    bool_t ok = include ? fetchdeps_filter_add_include(filter, pattern->str)
+                        : fetchdeps_filter_add_exclude(filter, pattern->str);
+    if (!ok) {
+      fetchdeps_filter_free(filter);
+      return NULL;
+    }
+  }
+
+  return filter;
+}
+
+
+ast_cond_t* new_relation(parser_t* ctx, cond_op_t op, char* var, ast_value_t* values, YYLTYPE* var_loc)
 {
-  fprintf(stderr, "[line %d, cols %d - %d] %s\n",
-          yylloc.first_line, yylloc.first_column, yylloc.last_column, msg);
+  ast_cond_t* cond = fetchdeps_ast_new_relation(ctx->ast, op, var, values);
+  if (cond) {
+    cond->line = var_loc->first_line;
+    cond->first_column = var_loc->first_column;
+    cond->last_column = var_loc->last_column;
+  }
+  return cond;
 }
 
+
+ast_stmt_t* new_include(parser_t* ctx, char* path, YYLTYPE* path_loc)
+{
+  ast_stmt_t* stmt = fetchdeps_ast_new_include(ctx->ast, path);
+  if (stmt) {
+    stmt->line = path_loc->first_line;
+    stmt->first_column = path_loc->first_column;
+    stmt->last_column = path_loc->last_column;
+  }
+  return stmt;
+}
+
+
+ast_stmt_t* new_url(parser_t* ctx, char* url, filter_t* filter, YYLTYPE* url_loc)
+{
+  ast_stmt_t* stmt = fetchdeps_ast_new_url(ctx->ast, url, filter);
+  if (stmt) {
+    stmt->line = url_loc->first_line;
+    stmt->first_column = url_loc->first_column;
+    stmt->last_column = url_loc->last_column;
+  }
+  return stmt;
+}
+
+
+void yyerror(YYLTYPE* llocp, void* scanner, parser_t* ctx, const char* msg)
+{
+  fetchdeps_parser_report(ctx, llocp->first_line, llocp->first_column, llocp->last_column, msg);
+}
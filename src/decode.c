@@ -0,0 +1,533 @@
+#include "decode.h"
+
+#include "alloc.h"
+#include "errors.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bzlib.h>
+#include <lzma.h>
+#include <zlib.h>
+#include <zstd.h>
+
+
+//
+// Constants
+//
+
+static const size_t kInputBufferSize = 64 * 1024;
+
+// The multi-threaded xz decoder falls back to a single thread rather than
+// use more than this much memory for its buffers.
+static const uint64_t kXzThreadMemLimit = 256 * 1024 * 1024;
+
+
+//
+// Types
+//
+
+struct _decoder {
+  decode_format_t format;
+  FILE* in;
+  int num_threads;
+
+  unsigned char* inbuf;
+  size_t in_pos;    // Offset of the first unconsumed byte in inbuf.
+  size_t in_len;    // Number of valid bytes in inbuf.
+  bool_t in_eof;
+
+  bool_t stream_end;
+  union {
+    z_stream gz;
+    bz_stream bz;
+    ZSTD_DStream* zstd;
+    lzma_stream xz;
+  } stream;
+};
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_decode_fill(decoder_t* dec);
+decode_format_t fetchdeps_decode_sniff(unsigned char* buf, size_t len);
+bool_t fetchdeps_decode_stream_init(decoder_t* dec);
+void fetchdeps_decode_stream_end(decoder_t* dec);
+ssize_t fetchdeps_decode_read_gzip(decoder_t* dec, void* buf, size_t len);
+ssize_t fetchdeps_decode_read_bzip2(decoder_t* dec, void* buf, size_t len);
+ssize_t fetchdeps_decode_read_zstd(decoder_t* dec, void* buf, size_t len);
+ssize_t fetchdeps_decode_read_xz(decoder_t* dec, void* buf, size_t len);
+bool_t fetchdeps_decode_xz_init(decoder_t* dec);
+
+
+//
+// Public functions
+//
+
+decoder_t*
+fetchdeps_decode_new(FILE* in, int num_threads)
+{
+  decoder_t* dec = NULL;
+
+  assert(in != NULL);
+
+  dec = (decoder_t*)fetchdeps_alloc_calloc(ALLOC_DECODE, 1, sizeof(decoder_t));
+  if (!dec)
+    goto failure;
+
+  dec->in = in;
+  dec->num_threads = num_threads > 0 ? num_threads : 1;
+  dec->inbuf = (unsigned char*)fetchdeps_alloc_malloc(ALLOC_DECODE, kInputBufferSize);
+  if (!dec->inbuf)
+    goto failure;
+
+  if (!fetchdeps_decode_fill(dec))
+    goto failure;
+
+  dec->format = fetchdeps_decode_sniff(dec->inbuf, dec->in_len);
+  if (dec->format == DECODE_ZIP) {
+    fetchdeps_errors_set_with_msg(ERR_NOT_IMPL, "Zip archives");
+    goto failure;
+  }
+
+  if (!fetchdeps_decode_stream_init(dec))
+    goto failure;
+
+  return dec;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (dec) {
+    if (dec->inbuf)
+      fetchdeps_alloc_free(dec->inbuf);
+    fetchdeps_alloc_free(dec);
+  }
+  return NULL;
+}
+
+
+void
+fetchdeps_decode_free(decoder_t* dec)
+{
+  assert(dec != NULL);
+
+  fetchdeps_decode_stream_end(dec);
+  fetchdeps_alloc_free(dec->inbuf);
+  fetchdeps_alloc_free(dec);
+}
+
+
+decode_format_t
+fetchdeps_decode_format(decoder_t* dec)
+{
+  assert(dec != NULL);
+  return dec->format;
+}
+
+
+const char*
+fetchdeps_decode_format_name(decode_format_t format)
+{
+  switch (format) {
+  case DECODE_NONE:   return "uncompressed";
+  case DECODE_GZIP:   return "gzip";
+  case DECODE_BZIP2:  return "bzip2";
+  case DECODE_ZSTD:   return "zstd";
+  case DECODE_XZ:     return "xz";
+  case DECODE_ZIP:    return "zip";
+  default:            return "unknown";
+  }
+}
+
+
+const char*
+fetchdeps_decode_format_suffix(decode_format_t format)
+{
+  switch (format) {
+  case DECODE_GZIP:   return ".gz";
+  case DECODE_BZIP2:  return ".bz2";
+  case DECODE_ZSTD:   return ".zst";
+  case DECODE_XZ:     return ".xz";
+  case DECODE_ZIP:    return ".zip";
+  default:            return NULL;
+  }
+}
+
+
+ssize_t
+fetchdeps_decode_read(decoder_t* dec, void* buf, size_t len)
+{
+  assert(dec != NULL);
+  assert(buf != NULL);
+
+  switch (dec->format) {
+  case DECODE_GZIP:
+    return fetchdeps_decode_read_gzip(dec, buf, len);
+  case DECODE_BZIP2:
+    return fetchdeps_decode_read_bzip2(dec, buf, len);
+  case DECODE_ZSTD:
+    return fetchdeps_decode_read_zstd(dec, buf, len);
+  case DECODE_XZ:
+    return fetchdeps_decode_read_xz(dec, buf, len);
+  default:
+    break;
+  }
+
+  // Uncompressed: hand out whatever's buffered, then refill.
+  if (dec->in_pos == dec->in_len) {
+    if (!fetchdeps_decode_fill(dec))
+      return -1;
+    if (dec->in_len == 0)
+      return 0;
+  }
+  if (len > dec->in_len - dec->in_pos)
+    len = dec->in_len - dec->in_pos;
+  memcpy(buf, dec->inbuf + dec->in_pos, len);
+  dec->in_pos += len;
+  return (ssize_t)len;
+}
+
+
+bool_t
+fetchdeps_decode_read_full(decoder_t* dec, void* buf, size_t len)
+{
+  char* p = (char*)buf;
+
+  while (len > 0) {
+    ssize_t n = fetchdeps_decode_read(dec, p, len);
+    if (n <= 0) {
+      if (n == 0)
+        fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Unexpected end of data");
+      return 0;
+    }
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_decode_fill(decoder_t* dec)
+{
+  size_t remaining = dec->in_len - dec->in_pos;
+
+  // Keep any unconsumed bytes at the front of the buffer.
+  if (remaining > 0 && dec->in_pos > 0)
+    memmove(dec->inbuf, dec->inbuf + dec->in_pos, remaining);
+  dec->in_pos = 0;
+  dec->in_len = remaining;
+
+  if (dec->in_eof)
+    return 1;
+
+  dec->in_len += fread(dec->inbuf + remaining, 1, kInputBufferSize - remaining, dec->in);
+  if (ferror(dec->in)) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to read archive");
+    return 0;
+  }
+  if (feof(dec->in))
+    dec->in_eof = 1;
+  return 1;
+}
+
+
+decode_format_t
+fetchdeps_decode_sniff(unsigned char* buf, size_t len)
+{
+  if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b)
+    return DECODE_GZIP;
+  if (len >= 3 && buf[0] == 'B' && buf[1] == 'Z' && buf[2] == 'h')
+    return DECODE_BZIP2;
+  if (len >= 4 && buf[0] == 0x28 && buf[1] == 0xb5 && buf[2] == 0x2f && buf[3] == 0xfd)
+    return DECODE_ZSTD;
+  if (len >= 6 && memcmp(buf, "\xfd" "7zXZ\0", 6) == 0)
+    return DECODE_XZ;
+  if (len >= 4 && buf[0] == 'P' && buf[1] == 'K' && buf[2] == 3 && buf[3] == 4)
+    return DECODE_ZIP;
+  return DECODE_NONE;
+}
+
+
+bool_t
+fetchdeps_decode_stream_init(decoder_t* dec)
+{
+  memset(&dec->stream, 0, sizeof(dec->stream));
+  dec->stream_end = 0;
+
+  switch (dec->format) {
+  case DECODE_GZIP:
+    // 15 bits of window, plus 32 to tell zlib to expect a gzip header.
+    if (inflateInit2(&dec->stream.gz, 15 + 32) != Z_OK) {
+      fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Unable to initialise gzip decoder");
+      return 0;
+    }
+    break;
+  case DECODE_BZIP2:
+    if (BZ2_bzDecompressInit(&dec->stream.bz, 0, 0) != BZ_OK) {
+      fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Unable to initialise bzip2 decoder");
+      return 0;
+    }
+    break;
+  case DECODE_ZSTD:
+    // The zstd frame format has no way to decode in parallel, so this is
+    // always single-threaded. It does handle multiple frames by itself.
+    dec->stream.zstd = ZSTD_createDStream();
+    if (!dec->stream.zstd || ZSTD_isError(ZSTD_initDStream(dec->stream.zstd))) {
+      fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Unable to initialise zstd decoder");
+      return 0;
+    }
+    break;
+  case DECODE_XZ:
+    if (!fetchdeps_decode_xz_init(dec)) {
+      fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Unable to initialise xz decoder");
+      return 0;
+    }
+    break;
+  default:
+    break;
+  }
+  return 1;
+}
+
+
+void
+fetchdeps_decode_stream_end(decoder_t* dec)
+{
+  switch (dec->format) {
+  case DECODE_GZIP:
+    inflateEnd(&dec->stream.gz);
+    break;
+  case DECODE_BZIP2:
+    BZ2_bzDecompressEnd(&dec->stream.bz);
+    break;
+  case DECODE_ZSTD:
+    if (dec->stream.zstd)
+      ZSTD_freeDStream(dec->stream.zstd);
+    break;
+  case DECODE_XZ:
+    lzma_end(&dec->stream.xz);
+    break;
+  default:
+    break;
+  }
+}
+
+
+bool_t
+fetchdeps_decode_xz_init(decoder_t* dec)
+{
+  lzma_stream init = LZMA_STREAM_INIT;
+
+  dec->stream.xz = init;
+
+#if LZMA_VERSION >= 50040000
+  // The threaded decoder splits the work up by block, so it only helps with
+  // files that were compressed in multiple blocks. For anything else it
+  // quietly decodes on a single thread.
+  if (dec->num_threads > 1) {
+    lzma_mt mt;
+
+    memset(&mt, 0, sizeof(mt));
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = (uint32_t)dec->num_threads;
+    mt.memlimit_threading = kXzThreadMemLimit;
+    mt.memlimit_stop = UINT64_MAX;
+    if (lzma_stream_decoder_mt(&dec->stream.xz, &mt) == LZMA_OK)
+      return 1;
+  }
+#endif
+
+  return lzma_stream_decoder(&dec->stream.xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+}
+
+
+ssize_t
+fetchdeps_decode_read_gzip(decoder_t* dec, void* buf, size_t len)
+{
+  z_stream* z = &dec->stream.gz;
+
+  z->next_out = (Bytef*)buf;
+  z->avail_out = (uInt)len;
+
+  while (z->avail_out == len) {
+    int ret;
+
+    if (dec->in_pos == dec->in_len) {
+      if (!fetchdeps_decode_fill(dec))
+        return -1;
+      if (dec->in_len == 0 && dec->stream_end)
+        return 0;
+    }
+
+    // A gzip file can hold several members back to back; start a new one if
+    // there's more input after the end of the last.
+    if (dec->stream_end) {
+      if (inflateReset(z) != Z_OK)
+        goto corrupt;
+      dec->stream_end = 0;
+    }
+
+    z->next_in = dec->inbuf + dec->in_pos;
+    z->avail_in = (uInt)(dec->in_len - dec->in_pos);
+    ret = inflate(z, Z_NO_FLUSH);
+    dec->in_pos = dec->in_len - z->avail_in;
+
+    if (ret == Z_STREAM_END)
+      dec->stream_end = 1;
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+      goto corrupt;
+
+    // The decoder may still have had output pending after the last of the
+    // input, but if it didn't then the data was truncated.
+    if (dec->in_eof && z->avail_in == 0 && z->avail_out == len && !dec->stream_end)
+      goto corrupt;
+  }
+
+  return (ssize_t)(len - z->avail_out);
+
+corrupt:
+  fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Corrupt gzip data");
+  return -1;
+}
+
+
+ssize_t
+fetchdeps_decode_read_bzip2(decoder_t* dec, void* buf, size_t len)
+{
+  bz_stream* bz = &dec->stream.bz;
+
+  bz->next_out = (char*)buf;
+  bz->avail_out = (unsigned int)len;
+
+  while (bz->avail_out == len) {
+    int ret;
+
+    if (dec->in_pos == dec->in_len) {
+      if (!fetchdeps_decode_fill(dec))
+        return -1;
+      if (dec->in_len == 0 && dec->stream_end)
+        return 0;
+    }
+
+    // Parallel compressors like pbzip2 write several streams back to back.
+    if (dec->stream_end) {
+      BZ2_bzDecompressEnd(bz);
+      memset(bz, 0, sizeof(*bz));
+      if (BZ2_bzDecompressInit(bz, 0, 0) != BZ_OK)
+        goto corrupt;
+      bz->next_out = (char*)buf;
+      bz->avail_out = (unsigned int)len;
+      dec->stream_end = 0;
+    }
+
+    bz->next_in = (char*)dec->inbuf + dec->in_pos;
+    bz->avail_in = (unsigned int)(dec->in_len - dec->in_pos);
+    ret = BZ2_bzDecompress(bz);
+    dec->in_pos = dec->in_len - bz->avail_in;
+
+    if (ret == BZ_STREAM_END)
+      dec->stream_end = 1;
+    else if (ret != BZ_OK)
+      goto corrupt;
+
+    if (dec->in_eof && bz->avail_in == 0 && bz->avail_out == len && !dec->stream_end)
+      goto corrupt;
+  }
+
+  return (ssize_t)(len - bz->avail_out);
+
+corrupt:
+  fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Corrupt bzip2 data");
+  return -1;
+}
+
+
+ssize_t
+fetchdeps_decode_read_zstd(decoder_t* dec, void* buf, size_t len)
+{
+  ZSTD_outBuffer out = { buf, len, 0 };
+
+  while (out.pos == 0) {
+    ZSTD_inBuffer in;
+    size_t ret;
+
+    if (dec->in_pos == dec->in_len) {
+      if (!fetchdeps_decode_fill(dec))
+        return -1;
+      if (dec->in_len == 0 && dec->stream_end)
+        return 0;
+    }
+
+    in.src = dec->inbuf;
+    in.size = dec->in_len;
+    in.pos = dec->in_pos;
+    ret = ZSTD_decompressStream(dec->stream.zstd, &out, &in);
+    dec->in_pos = in.pos;
+
+    if (ZSTD_isError(ret))
+      goto corrupt;
+
+    // A return of 0 means a frame has just been completely decoded and
+    // flushed. Any further input is the start of another frame.
+    dec->stream_end = (ret == 0);
+
+    if (dec->in_eof && in.pos == in.size && out.pos == 0 && !dec->stream_end)
+      goto corrupt;
+  }
+
+  return (ssize_t)out.pos;
+
+corrupt:
+  fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Corrupt zstd data");
+  return -1;
+}
+
+
+ssize_t
+fetchdeps_decode_read_xz(decoder_t* dec, void* buf, size_t len)
+{
+  lzma_stream* xz = &dec->stream.xz;
+
+  if (dec->stream_end)
+    return 0;
+
+  xz->next_out = (uint8_t*)buf;
+  xz->avail_out = len;
+
+  while (xz->avail_out == len) {
+    lzma_ret ret;
+
+    if (dec->in_pos == dec->in_len && !dec->in_eof) {
+      if (!fetchdeps_decode_fill(dec))
+        return -1;
+    }
+
+    // With LZMA_CONCATENATED the decoder can't tell the last stream is
+    // finished until we tell it there's no more input.
+    xz->next_in = dec->inbuf + dec->in_pos;
+    xz->avail_in = dec->in_len - dec->in_pos;
+    ret = lzma_code(xz, dec->in_eof ? LZMA_FINISH : LZMA_RUN);
+    dec->in_pos = dec->in_len - xz->avail_in;
+
+    if (ret == LZMA_STREAM_END) {
+      dec->stream_end = 1;
+      break;
+    }
+    if (ret != LZMA_OK)
+      goto corrupt;
+  }
+
+  return (ssize_t)(len - xz->avail_out);
+
+corrupt:
+  fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Corrupt xz data");
+  return -1;
+}
@@ -0,0 +1,72 @@
+#ifndef fetchdeps_decode_h
+#define fetchdeps_decode_h
+
+#include "common.h"
+
+#include <stdio.h>
+#include <sys/types.h> // For ssize_t.
+
+//
+// Types
+//
+
+enum _decode_format {
+  DECODE_NONE,    // Not compressed; the data is passed through unchanged.
+  DECODE_GZIP,
+  DECODE_BZIP2,
+  DECODE_ZSTD,
+  DECODE_XZ,
+  DECODE_ZIP      // Recognised, but can't be decoded as a stream.
+};
+typedef enum _decode_format decode_format_t;
+
+
+struct _decoder;
+typedef struct _decoder decoder_t;
+
+
+//
+// Functions
+//
+
+// Create a decoder which decompresses the contents of the file 'in'. The
+// compression format is identified from the magic bytes at the start of the
+// file, not from its name. Anything which isn't recognised is treated as
+// uncompressed. The decoder doesn't take ownership of the file.
+//
+// 'num_threads' is the most threads the decoder may use. Only xz files can
+// currently be decoded in parallel, and only when they were compressed in
+// multiple blocks (e.g. with 'xz -T0'); everything else is decoded on the
+// calling thread.
+//
+// Returns NULL if memory couldn't be allocated, the file couldn't be read, or
+// the format is one we can recognise but not decode (i.e. zip). Otherwise the
+// decoder must eventually be freed with fetchdeps_decode_free.
+decoder_t* fetchdeps_decode_new(FILE* in, int num_threads);
+
+// Deallocate a decoder.
+void fetchdeps_decode_free(decoder_t* dec);
+
+// Returns the compression format the decoder detected.
+decode_format_t fetchdeps_decode_format(decoder_t* dec);
+
+// Returns a short human readable name for a compression format.
+const char* fetchdeps_decode_format_name(decode_format_t format);
+
+// Returns the usual filename suffix for a compression format, including the
+// leading '.', or NULL if it doesn't have one.
+const char* fetchdeps_decode_format_suffix(decode_format_t format);
+
+// Read up to 'len' bytes of decompressed data into 'buf'. Returns the number
+// of bytes read, which may be less than len even when we're not at the end of
+// the data; 0 at the end of the data; or -1 if the input is corrupt or
+// couldn't be read.
+ssize_t fetchdeps_decode_read(decoder_t* dec, void* buf, size_t len);
+
+// Read exactly 'len' bytes into 'buf', calling fetchdeps_decode_read as many
+// times as necessary. Returns false if there was an error or the data ended
+// before 'len' bytes were read.
+bool_t fetchdeps_decode_read_full(decoder_t* dec, void* buf, size_t len);
+
+#endif // fetchdeps_decode_h
+
@@ -1,22 +1,91 @@
 #include "download.h"
 
+#include "alloc.h"
+#include "bufpool.h"
+#include "errors.h"
+#include "metrics.h"
+#include "trace.h"
+
 #include <assert.h>
+#include <errno.h>
 #include <libgen.h> // For basename()
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <curl/curl.h>
 
 
+//
+// Constants
+//
+
+// Downloads are passed from curl to the thread which writes them to disk
+// through this many buffers of this size, so no download ever holds more than
+// 4 MB in memory. Each buffer must be at least CURL_MAX_WRITE_SIZE, the most
+// curl ever passes to the write callback at once.
+static const size_t kPoolBuffers = 16;
+static const size_t kPoolBufferSize = 256 * 1024;
+
+// How long to wait for socket activity before checking for free buffers
+// anyway. The writer thread wakes us up sooner whenever it frees one.
+static const int kPollTimeoutMS = 1000;
+
+
+//
+// Types
+//
+
+// The state for a single transfer. The write callback fills buffers from the
+// pool and queues them; the writer thread drains the queue to the local file.
+// When the pool runs dry the callback pauses the transfer, and the main loop
+// unpauses it after the writer has freed up a buffer.
+struct _transfer {
+  CURL* curl;
+  CURLM* multi;
+  bufpool_t* pool;
+  buffer_t* current;    // Partially filled buffer, not yet queued.
+  bool_t paused;
+  uint64_t bytes;
+
+  FILE* out;
+  int write_error;      // Set by the writer thread: the errno of a failed write.
+};
+typedef struct _transfer transfer_t;
+
+
+// A transfer plus the queue of URLs waiting for it. The download thread takes
+// URLs from the front of the queue, and everything from 'lock' down is shared
+// with it.
+struct _downloader {
+  transfer_t t;
+  char* to_dir;
+  pthread_t thread;
+  size_t num_files;
+  size_t num_failed;
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  char** urls;
+  size_t num_urls;
+  size_t urls_capacity;
+  size_t next;      // Index of the next URL to download.
+  bool_t closed;    // Set when no more URLs will be added.
+};
+
+
 //
 // Forward declarations
 //
 
 size_t fetchdeps_download_writefunc(void* buffer, size_t size, size_t nmemb, void* userdata);
+void* fetchdeps_download_writer_main(void* arg);
+void* fetchdeps_download_main(void* arg);
+void fetchdeps_download_free(downloader_t* d);
+bool_t fetchdeps_download_check(downloader_t* d);
 
-bool_t fetchdeps_download_fetch_one(CURL* curl, char* url, char* to_dir);
-
-char* fetchdeps_download_get_local_filename(char* url, char* to_dir);
+bool_t fetchdeps_download_fetch_one(transfer_t* t, char* url, char* to_dir);
+bool_t fetchdeps_download_perform(transfer_t* t, char* url);
 
 
 //
@@ -24,50 +93,173 @@ char* fetchdeps_download_get_local_filename(char* url, char* to_dir);
 //
 
 bool_t
-fetchdeps_download_fetch_all(stringset_t* urls, char* to_dir)
+fetchdeps_download_fetch_all(stringset_t* urls, char* to_dir, download_stats_t* stats)
 {
-  CURL* curl = NULL;
-  stringiter_t* url_iter = NULL;
+  downloader_t* d;
+  stringiter_t* url_iter;
   char* url;
+  bool_t queued = 1;
 
   assert(urls);
   assert(to_dir);
 
+  d = fetchdeps_download_start(to_dir);
+  if (!d)
+    return 0;
+
+  url_iter = fetchdeps_stringiter_new(urls);
+  if (!url_iter) {
+    fetchdeps_download_cancel(d);
+    return 0;
+  }
+
+  for (url = fetchdeps_stringiter_next(url_iter); url && queued; url = fetchdeps_stringiter_next(url_iter))
+    queued = fetchdeps_download_add(d, url);
+  fetchdeps_stringiter_free(url_iter);
+
+  return fetchdeps_download_finish(d, stats) && queued;
+}
+
+
+downloader_t*
+fetchdeps_download_start(char* to_dir)
+{
+  downloader_t* d;
+  transfer_t* t;
+
+  assert(to_dir);
+
   // TODO: Check that the to_dir exists and is writable.
 
-  curl = curl_easy_init();
-  if (!curl)
+  d = (downloader_t*)fetchdeps_alloc_calloc(ALLOC_DOWNLOAD, 1, sizeof(downloader_t));
+  if (!d)
+    return NULL;
+  t = &d->t;
+
+  d->to_dir = fetchdeps_alloc_strdup(ALLOC_DOWNLOAD, to_dir);
+  if (!d->to_dir)
     goto failure;
 
-  url_iter = fetchdeps_stringiter_new(urls);
-  if (!url_iter)
+  t->curl = curl_easy_init();
+  if (!t->curl)
+    goto failure;
+  t->multi = curl_multi_init();
+  if (!t->multi)
+    goto failure;
+  t->pool = fetchdeps_bufpool_new(kPoolBuffers, kPoolBufferSize);
+  if (!t->pool)
     goto failure;
 
   // Set up common curl options.
-  if (curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fetchdeps_download_writefunc) != CURLE_OK)
+  if (curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, fetchdeps_download_writefunc) != CURLE_OK)
     goto failure;
-  if (curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0) != CURLE_OK)
+  if (curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, t) != CURLE_OK)
+    goto failure;
+  if (curl_easy_setopt(t->curl, CURLOPT_NOPROGRESS, 0L) != CURLE_OK)
     goto failure;
 
-  // Loop over the URLs, downloading each in turn.
-  url = fetchdeps_stringiter_next(url_iter);
-  while (url) {
-    if (!fetchdeps_download_fetch_one(curl, url, to_dir))
-      goto failure;
-    url = fetchdeps_stringiter_next(url_iter);
+  if (pthread_mutex_init(&d->lock, NULL) != 0)
+    goto failure;
+  if (pthread_cond_init(&d->changed, NULL) != 0) {
+    pthread_mutex_destroy(&d->lock);
+    goto failure;
+  }
+  if (pthread_create(&d->thread, NULL, fetchdeps_download_main, d) != 0) {
+    pthread_cond_destroy(&d->changed);
+    pthread_mutex_destroy(&d->lock);
+    goto failure;
   }
 
-  fetchdeps_stringiter_free(url_iter);
-  curl_easy_cleanup(curl);
-
-  return 1;
+  return d;
 
 failure:
-  if (url_iter)
-    fetchdeps_stringiter_free(url_iter);
-  if (curl)
-    curl_easy_cleanup(curl);
-  return 0;
+  fetchdeps_download_free(d);
+  return NULL;
+}
+
+
+bool_t
+fetchdeps_download_add(downloader_t* d, char* url)
+{
+  char* copy;
+  bool_t ok = 0;
+
+  assert(d != NULL);
+  assert(url != NULL);
+
+  copy = fetchdeps_alloc_strdup(ALLOC_DOWNLOAD, url);
+  if (!copy)
+    return 0;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->num_urls == d->urls_capacity) {
+    size_t new_capacity = d->urls_capacity ? d->urls_capacity * 2 : 32;
+    char** new_urls = (char**)fetchdeps_alloc_realloc(ALLOC_DOWNLOAD, d->urls, new_capacity * sizeof(char*));
+    if (!new_urls)
+      goto done;
+    d->urls = new_urls;
+    d->urls_capacity = new_capacity;
+  }
+  d->urls[d->num_urls++] = copy;
+  copy = NULL;
+  pthread_cond_signal(&d->changed);
+  ok = 1;
+
+done:
+  pthread_mutex_unlock(&d->lock);
+  if (copy)
+    fetchdeps_alloc_free(copy);
+  return ok;
+}
+
+
+bool_t
+fetchdeps_download_finish(downloader_t* d, download_stats_t* stats)
+{
+  bool_t ok;
+
+  assert(d != NULL);
+
+  pthread_mutex_lock(&d->lock);
+  d->closed = 1;
+  pthread_cond_signal(&d->changed);
+  pthread_mutex_unlock(&d->lock);
+  pthread_join(d->thread, NULL);
+
+  ok = fetchdeps_download_check(d);
+  if (stats) {
+    stats->num_files = d->num_files;
+    stats->bytes = d->t.bytes;
+    stats->peak_buffer_usage = fetchdeps_bufpool_peak_usage(d->t.pool);
+    stats->buffer_capacity = fetchdeps_bufpool_capacity(d->t.pool);
+  }
+
+  pthread_cond_destroy(&d->changed);
+  pthread_mutex_destroy(&d->lock);
+  fetchdeps_download_free(d);
+  return ok;
+}
+
+
+bool_t
+fetchdeps_download_cancel(downloader_t* d)
+{
+  bool_t ok;
+
+  assert(d != NULL);
+
+  pthread_mutex_lock(&d->lock);
+  d->closed = 1;
+  d->next = d->num_urls;
+  pthread_cond_signal(&d->changed);
+  pthread_mutex_unlock(&d->lock);
+  pthread_join(d->thread, NULL);
+
+  ok = fetchdeps_download_check(d);
+  pthread_cond_destroy(&d->changed);
+  pthread_mutex_destroy(&d->lock);
+  fetchdeps_download_free(d);
+  return ok;
 }
 
 
@@ -78,47 +270,275 @@ failure:
 size_t
 fetchdeps_download_writefunc(void *buffer, size_t size, size_t nmemb, void *userp)
 {
-  FILE* f = (FILE*)userp;
-  assert(f != NULL);
-  return fwrite(buffer, size, nmemb, f);
+  transfer_t* t = (transfer_t*)userp;
+  size_t buffer_size, len, remaining;
+  char* src = (char*)buffer;
+
+  assert(t != NULL);
+
+  if (__atomic_load_n(&t->write_error, __ATOMIC_ACQUIRE) != 0)
+    return 0; // Makes curl fail the transfer.
+
+  buffer_size = fetchdeps_bufpool_buffer_size(t->pool);
+  len = size * nmemb;
+
+  // If we pause, curl will pass all of this data to us again when we're
+  // unpaused, so we have to make sure there's room for it before copying any.
+  if (!t->current || t->current->len + len > buffer_size) {
+    buffer_t* next = fetchdeps_bufpool_try_acquire(t->pool);
+    if (!next) {
+      t->paused = 1;
+      return CURL_WRITEFUNC_PAUSE;
+    }
+    if (t->current)
+      fetchdeps_bufpool_push(t->pool, t->current);
+    t->current = next;
+  }
+
+  remaining = len;
+  while (remaining > 0) {
+    size_t chunk = buffer_size - t->current->len;
+    if (chunk > remaining)
+      chunk = remaining;
+    memcpy(t->current->data + t->current->len, src, chunk);
+    t->current->len += chunk;
+    src += chunk;
+    remaining -= chunk;
+
+    // Only reachable if curl hands us more than a whole buffer at once.
+    if (remaining > 0) {
+      buffer_t* next = fetchdeps_bufpool_try_acquire(t->pool);
+      if (!next)
+        return 0;
+      fetchdeps_bufpool_push(t->pool, t->current);
+      t->current = next;
+    }
+  }
+
+  t->bytes += len;
+  return len;
+}
+
+
+void*
+fetchdeps_download_writer_main(void* arg)
+{
+  transfer_t* t = (transfer_t*)arg;
+  buffer_t* buf;
+
+  while ((buf = fetchdeps_bufpool_pop(t->pool)) != NULL) {
+    // After a failure, keep draining the queue so the transfer can't stall.
+    if (__atomic_load_n(&t->write_error, __ATOMIC_ACQUIRE) == 0 &&
+        fwrite(buf->data, 1, buf->len, t->out) != buf->len)
+      __atomic_store_n(&t->write_error, errno ? errno : EIO, __ATOMIC_RELEASE);
+    fetchdeps_bufpool_release(t->pool, buf);
+    curl_multi_wakeup(t->multi);
+  }
+  return NULL;
+}
+
+
+void*
+fetchdeps_download_main(void* arg)
+{
+  downloader_t* d = (downloader_t*)arg;
+  char* url;
+
+  fetchdeps_trace_name_thread("download");
+  for (;;) {
+    pthread_mutex_lock(&d->lock);
+    while (d->next == d->num_urls && !d->closed)
+      pthread_cond_wait(&d->changed, &d->lock);
+    if (d->next == d->num_urls) {
+      pthread_mutex_unlock(&d->lock);
+      break;
+    }
+    url = d->urls[d->next++];
+    pthread_mutex_unlock(&d->lock);
+
+    // A failed download doesn't stop the rest: its error goes into the
+    // report, so that every URL which failed gets mentioned.
+    if (fetchdeps_download_fetch_one(&d->t, url, d->to_dir)) {
+      ++d->num_files;
+    }
+    else {
+      fetchdeps_errors_report();
+      ++d->num_failed;
+    }
+  }
+  return NULL;
+}
+
+
+void
+fetchdeps_download_free(downloader_t* d)
+{
+  size_t i;
+
+  if (!d)
+    return;
+
+  for (i = 0; i < d->num_urls; ++i)
+    fetchdeps_alloc_free(d->urls[i]);
+  if (d->urls)
+    fetchdeps_alloc_free(d->urls);
+  if (d->t.pool)
+    fetchdeps_bufpool_free(d->t.pool);
+  if (d->t.multi)
+    curl_multi_cleanup(d->t.multi);
+  if (d->t.curl)
+    curl_easy_cleanup(d->t.curl);
+  if (d->to_dir)
+    fetchdeps_alloc_free(d->to_dir);
+  fetchdeps_alloc_free(d);
+}
+
+
+// Once the download thread has finished, set the calling thread's error if
+// any of the downloads failed. The details are already in the report.
+bool_t
+fetchdeps_download_check(downloader_t* d)
+{
+  if (d->num_failed == 0)
+    return 1;
+  fetchdeps_errors_set_with_msg(ERR_DOWNLOAD, "%lu of %lu downloads failed",
+                                (unsigned long)d->num_failed,
+                                (unsigned long)(d->num_files + d->num_failed));
+  return 0;
 }
 
 
 bool_t
-fetchdeps_download_fetch_one(CURL* curl, char* url, char* to_dir)
+fetchdeps_download_fetch_one(transfer_t* t, char* url, char* to_dir)
 {
   char* local_filename = NULL;
-  FILE* local_file = NULL;
+  pthread_t writer;
+  bool_t writer_started = 0;
+  bool_t ok;
+  uint64_t start = fetchdeps_trace_now();
+  uint64_t start_bytes = t->bytes;
+
+  fetchdeps_trace_begin("download", url);
 
   // Figure out what to save the file as locally.
   local_filename = fetchdeps_download_get_local_filename(url, to_dir);
   if (!local_filename)
     goto failure;
 
-  local_file = fopen(local_filename, "wb");
-  if (!local_file)
+  t->out = fopen(local_filename, "wb");
+  if (!t->out) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to create %s", local_filename);
     goto failure;
+  }
+  t->write_error = 0;
+  t->paused = 0;
+
+  fetchdeps_bufpool_reopen(t->pool);
+  if (pthread_create(&writer, NULL, fetchdeps_download_writer_main, t) != 0)
+    goto failure;
+  writer_started = 1;
+
+  ok = fetchdeps_download_perform(t, url);
 
-  curl_easy_setopt(curl, CURLOPT_URL, url);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, local_file);
+  // Hand over whatever's left and wait for it all to reach the disk.
+  if (t->current) {
+    if (ok)
+      fetchdeps_bufpool_push(t->pool, t->current);
+    else
+      fetchdeps_bufpool_release(t->pool, t->current);
+    t->current = NULL;
+  }
+  fetchdeps_bufpool_close(t->pool);
+  pthread_join(writer, NULL);
+  writer_started = 0;
 
-  if (curl_easy_perform(curl) != CURLE_OK)
+  if (t->write_error != 0) {
+    errno = t->write_error;
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to write %s", local_filename);
+    goto failure;
+  }
+  if (!ok)
     goto failure;
 
-  fclose(local_file);
-  free(local_filename);
+  if (fclose(t->out) != 0) {
+    t->out = NULL;
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to write %s", local_filename);
+    goto failure;
+  }
+  t->out = NULL;
+  fetchdeps_alloc_free(local_filename);
 
+  fetchdeps_metrics_count(COUNTER_DOWNLOADS, 1);
+  fetchdeps_metrics_count(COUNTER_DOWNLOAD_BYTES, t->bytes - start_bytes);
+  fetchdeps_metrics_observe(HISTOGRAM_TRANSFER, start);
+  fetchdeps_trace_end();
   return 1;
 
 failure:
-  if (local_file)
-    fclose(local_file);
+  if (writer_started) {
+    fetchdeps_bufpool_close(t->pool);
+    pthread_join(writer, NULL);
+  }
+  if (t->out) {
+    fclose(t->out);
+    t->out = NULL;
+  }
   if (local_filename)
-    free(local_filename);
+    fetchdeps_alloc_free(local_filename);
+  fetchdeps_metrics_count(COUNTER_DOWNLOAD_FAILURES, 1);
+  fetchdeps_metrics_count(COUNTER_DOWNLOAD_BYTES, t->bytes - start_bytes);
+  fetchdeps_trace_end();
   return 0;
 }
 
 
+bool_t
+fetchdeps_download_perform(transfer_t* t, char* url)
+{
+  CURLcode result = CURLE_OK;
+  CURLMsg* msg;
+  int running = 1;
+  int remaining;
+
+  curl_easy_setopt(t->curl, CURLOPT_URL, url);
+  if (curl_multi_add_handle(t->multi, t->curl) != CURLM_OK) {
+    fetchdeps_errors_set_with_msg(ERR_DOWNLOAD, "Unable to start downloading %s", url);
+    return 0;
+  }
+
+  while (running) {
+    if (curl_multi_perform(t->multi, &running) != CURLM_OK) {
+      result = CURLE_FAILED_INIT;
+      break;
+    }
+
+    // Try again if we paused, now that the writer may have freed a buffer. If
+    // it hasn't, the write callback will just pause again.
+    if (t->paused) {
+      t->paused = 0;
+      curl_easy_pause(t->curl, CURLPAUSE_CONT);
+    }
+
+    if (running && curl_multi_poll(t->multi, NULL, 0, kPollTimeoutMS, NULL) != CURLM_OK) {
+      result = CURLE_FAILED_INIT;
+      break;
+    }
+  }
+
+  while ((msg = curl_multi_info_read(t->multi, &remaining)) != NULL) {
+    if (msg->msg == CURLMSG_DONE && msg->easy_handle == t->curl)
+      result = msg->data.result;
+  }
+  curl_multi_remove_handle(t->multi, t->curl);
+
+  if (result != CURLE_OK) {
+    fetchdeps_errors_set_with_msg(ERR_DOWNLOAD, "Unable to download %s (%s)", url, curl_easy_strerror(result));
+    return 0;
+  }
+  return 1;
+}
+
+
 char*
 fetchdeps_download_get_local_filename(char* url, char* to_dir)
 {
@@ -127,31 +547,32 @@ fetchdeps_download_get_local_filename(char* url, char* to_dir)
   char* local_path = NULL;
   int local_path_len;
 
-  url_copy = strdup(url);
+  url_copy = fetchdeps_alloc_strdup(ALLOC_DOWNLOAD, url);
   if (!url_copy)
     goto failure;
 
   filename = basename(url_copy);
   if (!filename)
     goto failure;
-  free(url_copy);
-  url_copy = NULL;
 
   local_path_len = strlen(to_dir) + strlen(filename) + 2;
-  local_path = malloc(local_path_len * sizeof(char));
+  local_path = fetchdeps_alloc_malloc(ALLOC_DOWNLOAD, local_path_len * sizeof(char));
   if (!local_path)
     goto failure;
 
   if (snprintf(local_path, local_path_len, "%s/%s", to_dir, filename) != local_path_len - 1)
     goto failure;
 
+  // The filename points into url_copy, so we can only free it now.
+  fetchdeps_alloc_free(url_copy);
+
   return local_path;
 
 failure:
   if (url_copy)
-    free(url_copy);
+    fetchdeps_alloc_free(url_copy);
   if (local_path)
-    free(local_path);
+    fetchdeps_alloc_free(local_path);
   return NULL;
 }
 
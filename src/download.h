@@ -3,18 +3,77 @@
 
 #include "stringset.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Types
+//
+
+// Figures gathered while downloading, for reporting at the end of a run.
+struct _download_stats {
+  size_t num_files;
+  uint64_t bytes;
+  size_t peak_buffer_usage; // Most memory held in transfer buffers at once.
+  size_t buffer_capacity;   // The limit on the above.
+};
+typedef struct _download_stats download_stats_t;
+
+
+// Downloads URLs on a background thread as they're handed to it, so that the
+// caller can carry on working out which URLs it needs at the same time.
+struct _downloader;
+typedef struct _downloader downloader_t;
+
+
 //
 // Public functions
 //
 
 // Download the contents of a set of URLs. If any of the downloads fails for
-// any reason, the return value will be false; otherwise it will be true.
+// any reason, the return value will be false; otherwise it will be true. A
+// failed download doesn't stop the others: each failure is added to the error
+// report (see fetchdeps_errors_report), so all of them can be printed.
 //
 // The to_dir parameter is the path to a directory where all the downloaded
 // files will be stored. If the directory doesn't exist, or doesn't have both
 // read and write permission for the current user, the function will return
 // false without trying to download anything.
-bool_t fetchdeps_download_fetch_all(stringset_t* urls, char* to_dir);
+//
+// Each download is streamed to disk through a small fixed pool of buffers by a
+// separate thread. If the disk falls behind the network, the transfer is
+// paused until a buffer frees up, so memory use doesn't grow with the size of
+// the download.
+//
+// If 'stats' is not NULL it is filled in with figures about the downloads.
+bool_t fetchdeps_download_fetch_all(stringset_t* urls, char* to_dir, download_stats_t* stats);
+
+// Start a downloader which saves files into to_dir, as for
+// fetchdeps_download_fetch_all. Returns NULL if it couldn't be started. It
+// must eventually be stopped with fetchdeps_download_finish or
+// fetchdeps_download_cancel.
+downloader_t* fetchdeps_download_start(char* to_dir);
+
+// Queue a URL to be downloaded after the ones already queued. The downloader
+// takes its own copy of the URL. Returns false if memory couldn't be
+// allocated.
+bool_t fetchdeps_download_add(downloader_t* d, char* url);
+
+// Wait for all of the queued URLs to be downloaded, then free the downloader.
+// The return value and 'stats' are as for fetchdeps_download_fetch_all.
+bool_t fetchdeps_download_finish(downloader_t* d, download_stats_t* stats);
+
+// Stop as soon as the current download is done, dropping any queued URLs,
+// then free the downloader. Used when the caller hits an error of its own.
+// Returns false, with the error set, if one of the downloads had failed; that
+// replaces any error the caller had set.
+bool_t fetchdeps_download_cancel(downloader_t* d);
+
+// Returns the path that the contents of 'url' are saved to inside to_dir.
+// This is to_dir plus the last component of the URL. The caller must free
+// the returned string with fetchdeps_alloc_free. The return value is NULL if memory couldn't be
+// allocated.
+char* fetchdeps_download_get_local_filename(char* url, char* to_dir);
 
 #endif // fetchdeps_download_h
 
@@ -1,5 +1,9 @@
 #include "environ.h"
 
+#include "errors.h"
+#include "strpool.h"
+#include "trace.h"
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,14 +11,6 @@
 #include <sys/utsname.h> // for uname()
 
 
-//
-// Global variables
-//
-
-// Provided by the C library, each entry is a string of the form NAME=VALUE.
-extern char** environ;
-
-
 //
 // Forward declarations
 //
@@ -72,26 +68,23 @@ fetchdeps_environ_parse_vars(varmap_t* vm, char** var_strings)
   assert(vm != NULL);
 
   for (i = 0; var_strings[i] != NULL; ++i) {
-    bool_t ok;
     char* var = NULL;
     char* value = NULL;
 
-    var = strdup(var_strings[i]);
-    if (!var)
-      goto failure;
-
-    value = var;
+    // The name goes straight into the string pool, so there's no need to
+    // copy the string just to terminate it.
+    value = var_strings[i];
     while (*value && *value != '=')
       ++value;
 
-    if (*value == '=') {
-      *value = '\0';
+    var = fetchdeps_strpool_intern(var_strings[i], value - var_strings[i], NULL);
+    if (!var)
+      goto failure;
+
+    if (*value == '=')
       ++value;
-    }
 
-    ok = fetchdeps_varmap_set_single(vm, var, value);
-    free(var);
-    if (!ok)
+    if (!fetchdeps_varmap_set_single(vm, var, value))
       goto failure;
   }
 
@@ -105,7 +98,16 @@ failure:
 bool_t
 fetchdeps_environ_get_vars(varmap_t* vm)
 {
-  return fetchdeps_environ_parse_vars(vm, environ);
+  bool_t ok;
+
+  assert(vm != NULL);
+
+  fetchdeps_trace_begin("import environment", NULL);
+  ok = fetchdeps_varmap_use_environ(vm);
+  if (!ok)
+    fetchdeps_errors_trap_system_error();
+  fetchdeps_trace_end();
+  return ok;
 }
 
 
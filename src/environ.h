@@ -33,16 +33,15 @@ bool_t fetchdeps_environ_default_vars(varmap_t* vm);
 // may have already been added to the map.
 bool_t fetchdeps_environ_parse_vars(varmap_t* vm, char** var_strings);
 
-// Fill the varmap with a mapping for each environment variable. The varmap
-// must not be null. The return value will be true if all environment variables
-// were added to the map; it will be false if anything went wrong, such as an
-// out of memory error while allocating space for the new entries.
+// Make each environment variable available through the varmap. The varmap
+// must not be null. The variables are read lazily, the first time each one is
+// looked up (see fetchdeps_varmap_use_environ), apart from the ones already in
+// the map. Returns false, with the error set, if there wasn't enough memory to
+// replace those.
 //
 // If the varmap contains any variables with the same name as an environment
-// variable, the existing value will be overwritten by this function.
-//
-// Note that this function is not atomic. If it returns false, some variables
-// may have already been added to the map.
+// variable, the environment variable's value takes precedence. Variables set
+// in the varmap after this call take precedence over the environment.
 bool_t fetchdeps_environ_get_vars(varmap_t* vm);
 
 #endif // fetchdeps_environ_h
@@ -1,6 +1,9 @@
 #include "errors.h"
 
+#include "alloc.h"
+
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,17 +30,47 @@ static const char* ERRORS[] = {
   "use -h or --help to see usage information",
   "no deps file specified and couldn't find default.deps",
   "directory doesn't exist or isn't writable",
-  "not implemented yet - sorry!"
+  "not implemented yet - sorry!",
+  "archive is corrupt or in an unsupported format",
+  "download failed"
+};
+
+// Errors reported after this many are counted but not kept.
+static const size_t kMaxReportedErrors = 100;
+
+
+//
+// Types
+//
+
+struct _errorinfo {
+  error_t err;
+  int sys_errno;    // For ERR_SYSTEM, the errno when the error was set.
+  char msg[MAX_ERRMSG_LENGTH];
 };
+typedef struct _errorinfo errorinfo_t;
 
 
 //
+// Forward declarations
+//
+
+void fetchdeps_errors_print_one(FILE* out, errorinfo_t* info);
+
+
 //
 // Global variables
 //
 
-error_t fetchdeps_error = ERR_NONE;
-char fetchdeps_errmsg[MAX_ERRMSG_LENGTH];
+// The calling thread's error.
+static __thread errorinfo_t tError;
+
+// The errors moved here by fetchdeps_errors_report. Only failures touch this,
+// so the lock is never on a hot path.
+static pthread_mutex_t gReportLock = PTHREAD_MUTEX_INITIALIZER;
+static errorinfo_t* gReport = NULL;
+static size_t gNumReported = 0;
+static size_t gNumDropped = 0;
 
 
 //
@@ -47,8 +80,9 @@ char fetchdeps_errmsg[MAX_ERRMSG_LENGTH];
 void
 fetchdeps_errors_set(error_t err)
 {
-  fetchdeps_error = err;
-  memset(fetchdeps_errmsg, 0, sizeof(fetchdeps_errmsg));
+  tError.err = err;
+  tError.sys_errno = errno;
+  tError.msg[0] = '\0';
 }
 
 
@@ -59,10 +93,11 @@ fetchdeps_errors_set_with_msg(error_t err, char* format, ...)
 
   assert(format != NULL);
 
-  fetchdeps_error = err;
+  tError.err = err;
+  tError.sys_errno = errno;
 
   va_start(args, format);
-  vsnprintf(fetchdeps_errmsg, MAX_ERRMSG_LENGTH, format, args);
+  vsnprintf(tError.msg, MAX_ERRMSG_LENGTH, format, args);
   va_end(args);
 }
 
@@ -70,9 +105,10 @@ fetchdeps_errors_set_with_msg(error_t err, char* format, ...)
 void
 fetchdeps_errors_trap_system_error()
 {
-  if (fetchdeps_error == ERR_NONE && errno != 0) {
-    fetchdeps_error = ERR_SYSTEM;
-    memset(fetchdeps_errmsg, 0, sizeof(fetchdeps_errmsg));
+  if (tError.err == ERR_NONE && errno != 0) {
+    tError.err = ERR_SYSTEM;
+    tError.sys_errno = errno;
+    tError.msg[0] = '\0';
   }
 }
 
@@ -80,36 +116,79 @@ fetchdeps_errors_trap_system_error()
 void
 fetchdeps_errors_clear()
 {
-  fetchdeps_error = ERR_NONE;
-  memset(fetchdeps_errmsg, 0, sizeof(fetchdeps_errmsg));
+  tError.err = ERR_NONE;
+  tError.msg[0] = '\0';
+
+  pthread_mutex_lock(&gReportLock);
+  if (gReport)
+    fetchdeps_alloc_free(gReport);
+  gReport = NULL;
+  gNumReported = 0;
+  gNumDropped = 0;
+  pthread_mutex_unlock(&gReportLock);
 }
 
 
 error_t
 fetchdeps_errors_get()
 {
-  return fetchdeps_error;
+  return tError.err;
 }
 
 
 char*
 fetchdeps_errors_get_msg()
 {
-  return fetchdeps_errmsg;
+  return tError.msg;
+}
+
+
+void
+fetchdeps_errors_report()
+{
+  if (tError.err == ERR_NONE)
+    return;
+
+  pthread_mutex_lock(&gReportLock);
+  if (!gReport)
+    gReport = (errorinfo_t*)fetchdeps_alloc_malloc(ALLOC_ERRORS, kMaxReportedErrors * sizeof(errorinfo_t));
+  if (gReport && gNumReported < kMaxReportedErrors)
+    gReport[gNumReported++] = tError;
+  else
+    ++gNumDropped;
+  pthread_mutex_unlock(&gReportLock);
+
+  tError.err = ERR_NONE;
+  tError.msg[0] = '\0';
 }
 
 
 void
 fetchdeps_errors_print(FILE* out)
+{
+  size_t i;
+
+  pthread_mutex_lock(&gReportLock);
+  for (i = 0; i < gNumReported; ++i)
+    fetchdeps_errors_print_one(out, &gReport[i]);
+  if (gNumDropped > 0)
+    fprintf(out, "...and %lu more errors\n", (unsigned long)gNumDropped);
+  pthread_mutex_unlock(&gReportLock);
+
+  fetchdeps_errors_print_one(out, &tError);
+}
+
+
+void
+fetchdeps_errors_print_one(FILE* out, errorinfo_t* info)
 {
   // Don't print anything when there's no error.
-  if (fetchdeps_error == ERR_NONE)
+  if (info->err == ERR_NONE)
     return;
 
-  char* prefix = (fetchdeps_errmsg[0] != '\0') ? fetchdeps_errmsg : "Error";
-  if (fetchdeps_error == ERR_SYSTEM)
-    fprintf(out, "%s: %s\n", prefix, strerror(errno));
+  char* prefix = (info->msg[0] != '\0') ? info->msg : "Error";
+  if (info->err == ERR_SYSTEM)
+    fprintf(out, "%s: %s\n", prefix, strerror(info->sys_errno));
   else
-    fprintf(out, "%s: %s\n", prefix, ERRORS[fetchdeps_error]);
+    fprintf(out, "%s: %s\n", prefix, ERRORS[info->err]);
 }
-
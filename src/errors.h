@@ -14,7 +14,9 @@ enum _error {
   ERR_CMDLINE,    // An unknown option on the command line.
   ERR_NO_DEPS,    // No deps file specified and couldn't find default deps file.
   ERR_NO_DIR,     // No working directory could be found.
-  ERR_NOT_IMPL    // Functionality which isn't implemented yet.
+  ERR_NOT_IMPL,   // Functionality which isn't implemented yet.
+  ERR_ARCHIVE,    // A downloaded archive is corrupt or in an unsupported format.
+  ERR_DOWNLOAD    // A URL couldn't be downloaded.
 };
 typedef enum _error error_t;
 
@@ -23,13 +25,33 @@ typedef enum _error error_t;
 // Functions
 //
 
+// Each thread has an error of its own, so threads working in parallel can
+// fail independently without getting in each other's way. Setting an error
+// doesn't take any locks. An ERR_SYSTEM error keeps the value errno had when
+// it was set, so later system calls can't change what gets printed.
+//
+// A worker thread's error disappears with the thread, so when a worker fails
+// it should call fetchdeps_errors_report to add its error to the report for
+// the whole run. The report is printed by fetchdeps_errors_print.
+
 void fetchdeps_errors_set(error_t err);
 void fetchdeps_errors_set_with_msg(error_t err, char* format, ...);
 void fetchdeps_errors_trap_system_error();
+
+// Clear the calling thread's error, and the report.
 void fetchdeps_errors_clear();
 
+// The calling thread's error.
 error_t fetchdeps_errors_get();
 char* fetchdeps_errors_get_msg();
+
+// Move the calling thread's error into the report, then clear it. Does
+// nothing if the thread doesn't have an error. Only the first hundred errors
+// are kept; the rest are just counted.
+void fetchdeps_errors_report();
+
+// Print every error in the report, in the order they were reported, followed
+// by the calling thread's error if it has one.
 void fetchdeps_errors_print(FILE* out);
 
 
@@ -0,0 +1,799 @@
+#include "extract.h"
+
+#include "alloc.h"
+#include "decode.h"
+#include "errors.h"
+#include "filesys.h"
+#include "metrics.h"
+#include "stringset.h"
+#include "trace.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+//
+// Constants
+//
+
+#define TAR_BLOCK_SIZE 512
+
+static const size_t kDataBufferSize = 64 * 1024;
+
+// Offsets and sizes of the tar header fields we use.
+#define TAR_NAME      0
+#define TAR_NAME_LEN  100
+#define TAR_MODE      100
+#define TAR_SIZE      124
+#define TAR_MTIME     136
+#define TAR_CHKSUM    148
+#define TAR_TYPE      156
+#define TAR_LINK      157
+#define TAR_LINK_LEN  100
+#define TAR_MAGIC     257
+#define TAR_PREFIX    345
+#define TAR_PREFIX_LEN 155
+
+
+//
+// Types
+//
+
+struct _extractor {
+  decoder_t* dec;
+  filter_t* filter;
+  writer_t* w;
+  FILE* manifest;
+
+  char* buf;
+  char* last_parent;  // The last directory we made sure exists.
+  size_t num_files;   // Files and links written so far.
+  stringset_t* links; // Symbolic links created from this archive.
+
+  // Overrides for the next entry, from GNU long name or pax headers.
+  char* next_name;
+  char* next_link;
+  long long next_size;
+};
+typedef struct _extractor extractor_t;
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_extract_tar(extractor_t* ex, unsigned char* first_block);
+bool_t fetchdeps_extract_single(extractor_t* ex, char* path, char* name,
+                                unsigned char* first_block, size_t first_len);
+
+bool_t fetchdeps_extract_entry(extractor_t* ex, unsigned char* header);
+bool_t fetchdeps_extract_regular(extractor_t* ex, char* path, unsigned int mode,
+                                 time_t mtime, long long size);
+bool_t fetchdeps_extract_directory(extractor_t* ex, char* path, unsigned int mode);
+bool_t fetchdeps_extract_parents(extractor_t* ex, char* path);
+bool_t fetchdeps_extract_skip(extractor_t* ex, long long size);
+long long fetchdeps_extract_padded(long long size);
+char* fetchdeps_extract_read_string(extractor_t* ex, long long size);
+bool_t fetchdeps_extract_pax(extractor_t* ex, long long size);
+void fetchdeps_extract_record(extractor_t* ex, char* path, bool_t is_dir);
+
+bool_t fetchdeps_extract_is_tar_header(unsigned char* block);
+bool_t fetchdeps_extract_is_zero_block(unsigned char* block);
+long long fetchdeps_extract_number(unsigned char* field, size_t len);
+char* fetchdeps_extract_clean_path(char* path);
+bool_t fetchdeps_extract_check_symlink(extractor_t* ex, char* path, char* target);
+char* fetchdeps_extract_field(unsigned char* field, size_t len);
+
+
+//
+// Public functions
+//
+
+bool_t
+fetchdeps_extract_file(char* path, char* name, filter_t* filter,
+                       writer_t* w, FILE* manifest, int num_threads)
+{
+  extractor_t ex;
+  FILE* f = NULL;
+  unsigned char first_block[TAR_BLOCK_SIZE];
+  size_t first_len = 0;
+  bool_t ok;
+  uint64_t start = fetchdeps_trace_now();
+
+  assert(path != NULL);
+  assert(name != NULL);
+  assert(w != NULL);
+
+  fetchdeps_trace_begin("extract", path);
+
+  memset(&ex, 0, sizeof(ex));
+  ex.filter = filter;
+  ex.w = w;
+  ex.manifest = manifest;
+  ex.next_size = -1;
+
+  f = fopen(path, "rb");
+  if (!f) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to open %s", path);
+    goto failure;
+  }
+
+  ex.dec = fetchdeps_decode_new(f, num_threads);
+  if (!ex.dec)
+    goto failure;
+
+  ex.buf = (char*)fetchdeps_alloc_malloc(ALLOC_EXTRACT, kDataBufferSize);
+  if (!ex.buf)
+    goto failure;
+
+  ex.links = fetchdeps_stringset_new();
+  if (!ex.links)
+    goto failure;
+
+  // Read the first block, which tells us whether this is a tar file. Small
+  // plain files may not even fill it.
+  while (first_len < TAR_BLOCK_SIZE) {
+    ssize_t n = fetchdeps_decode_read(ex.dec, first_block + first_len, TAR_BLOCK_SIZE - first_len);
+    if (n < 0)
+      goto failure;
+    if (n == 0)
+      break;
+    first_len += n;
+  }
+
+  if (first_len == TAR_BLOCK_SIZE && fetchdeps_extract_is_tar_header(first_block))
+    ok = fetchdeps_extract_tar(&ex, first_block);
+  else
+    ok = fetchdeps_extract_single(&ex, path, name, first_block, first_len);
+  if (!ok)
+    goto failure;
+
+  fetchdeps_decode_free(ex.dec);
+  fclose(f);
+  fetchdeps_alloc_free(ex.buf);
+  fetchdeps_stringset_free(ex.links);
+  if (ex.last_parent)
+    fetchdeps_alloc_free(ex.last_parent);
+
+  fetchdeps_metrics_count(COUNTER_EXTRACTIONS, 1);
+  fetchdeps_metrics_count(COUNTER_EXTRACTED_FILES, ex.num_files);
+  fetchdeps_metrics_observe(HISTOGRAM_EXTRACT, start);
+  fetchdeps_trace_end();
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (ex.dec)
+    fetchdeps_decode_free(ex.dec);
+  if (f)
+    fclose(f);
+  if (ex.buf)
+    fetchdeps_alloc_free(ex.buf);
+  if (ex.links)
+    fetchdeps_stringset_free(ex.links);
+  if (ex.last_parent)
+    fetchdeps_alloc_free(ex.last_parent);
+  if (ex.next_name)
+    fetchdeps_alloc_free(ex.next_name);
+  if (ex.next_link)
+    fetchdeps_alloc_free(ex.next_link);
+  fetchdeps_metrics_count(COUNTER_EXTRACTED_FILES, ex.num_files);
+  fetchdeps_trace_end();
+  return 0;
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_extract_tar(extractor_t* ex, unsigned char* first_block)
+{
+  unsigned char header[TAR_BLOCK_SIZE];
+
+  memcpy(header, first_block, TAR_BLOCK_SIZE);
+  for (;;) {
+    // The archive ends with two zero blocks, but there's no need to read the
+    // second one.
+    if (fetchdeps_extract_is_zero_block(header))
+      return 1;
+
+    if (!fetchdeps_extract_is_tar_header(header)) {
+      fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Bad tar header");
+      return 0;
+    }
+
+    if (!fetchdeps_extract_entry(ex, header))
+      return 0;
+
+    if (!fetchdeps_decode_read_full(ex->dec, header, TAR_BLOCK_SIZE))
+      return 0;
+  }
+}
+
+
+bool_t
+fetchdeps_extract_single(extractor_t* ex, char* path, char* name,
+                         unsigned char* first_block, size_t first_len)
+{
+  char* local_name = NULL;
+  struct stat buf;
+  time_t mtime = 0;
+  const char* suffix;
+  size_t name_len;
+  ssize_t n = 0;
+  bool_t in_file = 0;
+
+  local_name = fetchdeps_alloc_strdup(ALLOC_EXTRACT, name);
+  if (!local_name)
+    goto failure;
+
+  // Drop the compression suffix, so that foo.txt.gz is installed as foo.txt.
+  suffix = fetchdeps_decode_format_suffix(fetchdeps_decode_format(ex->dec));
+  name_len = strlen(local_name);
+  if (suffix) {
+    size_t suffix_len = strlen(suffix);
+    if (name_len > suffix_len && strcmp(local_name + name_len - suffix_len, suffix) == 0)
+      local_name[name_len - suffix_len] = '\0';
+  }
+
+  if (stat(path, &buf) == 0)
+    mtime = buf.st_mtime;
+
+  // We don't know the decompressed size, so claim the maximum. That stops the
+  // writer from trying to batch it.
+  if (!fetchdeps_writer_begin_file(ex->w, local_name, 0644, mtime, (size_t)-1))
+    goto failure;
+  in_file = 1;
+  if (!fetchdeps_writer_append(ex->w, first_block, first_len))
+    goto failure;
+  while ((n = fetchdeps_decode_read(ex->dec, ex->buf, kDataBufferSize)) > 0) {
+    if (!fetchdeps_writer_append(ex->w, ex->buf, n))
+      goto failure;
+  }
+  if (n < 0)
+    goto failure;
+  in_file = 0;
+  if (!fetchdeps_writer_end_file(ex->w))
+    goto failure;
+
+  fetchdeps_extract_record(ex, local_name, 0);
+  fetchdeps_alloc_free(local_name);
+  return 1;
+
+failure:
+  if (in_file)
+    fetchdeps_writer_abort_file(ex->w);
+  if (local_name)
+    fetchdeps_alloc_free(local_name);
+  return 0;
+}
+
+
+bool_t
+fetchdeps_extract_entry(extractor_t* ex, unsigned char* header)
+{
+  char* raw_path = NULL;
+  char* raw_link = NULL;
+  char* path;
+  char type = (char)header[TAR_TYPE];
+  unsigned int mode = (unsigned int)fetchdeps_extract_number(header + TAR_MODE, 8);
+  time_t mtime = (time_t)fetchdeps_extract_number(header + TAR_MTIME, 12);
+  long long size = fetchdeps_extract_number(header + TAR_SIZE, 12);
+  bool_t ok = 1;
+
+  if (size < 0) {
+    fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Bad size in tar header");
+    return 0;
+  }
+
+  // Headers which describe the next entry rather than being one themselves.
+  switch (type) {
+  case 'L':
+    if (ex->next_name)
+      fetchdeps_alloc_free(ex->next_name);
+    ex->next_name = fetchdeps_extract_read_string(ex, size);
+    return ex->next_name != NULL;
+  case 'K':
+    if (ex->next_link)
+      fetchdeps_alloc_free(ex->next_link);
+    ex->next_link = fetchdeps_extract_read_string(ex, size);
+    return ex->next_link != NULL;
+  case 'x':
+    return fetchdeps_extract_pax(ex, size);
+  case 'g':
+    return fetchdeps_extract_skip(ex, fetchdeps_extract_padded(size));
+  default:
+    break;
+  }
+
+  // Work out the full name of the entry.
+  if (ex->next_name) {
+    raw_path = ex->next_name;
+    ex->next_name = NULL;
+  }
+  else {
+    char* name = fetchdeps_extract_field(header + TAR_NAME, TAR_NAME_LEN);
+    char* prefix = NULL;
+
+    if (!name)
+      return 0;
+    // Only POSIX ustar headers have a prefix field; old GNU headers keep
+    // other things there.
+    if (memcmp(header + TAR_MAGIC, "ustar\0", 6) == 0 && header[TAR_PREFIX] != '\0') {
+      prefix = fetchdeps_extract_field(header + TAR_PREFIX, TAR_PREFIX_LEN);
+      if (!prefix) {
+        fetchdeps_alloc_free(name);
+        return 0;
+      }
+      raw_path = (char*)fetchdeps_alloc_malloc(ALLOC_EXTRACT, strlen(prefix) + strlen(name) + 2);
+      if (raw_path)
+        sprintf(raw_path, "%s/%s", prefix, name);
+      fetchdeps_alloc_free(prefix);
+      fetchdeps_alloc_free(name);
+    }
+    else {
+      raw_path = name;
+    }
+    if (!raw_path)
+      return 0;
+  }
+
+  if (ex->next_link) {
+    raw_link = ex->next_link;
+    ex->next_link = NULL;
+  }
+  else if (type == '1' || type == '2') {
+    raw_link = fetchdeps_extract_field(header + TAR_LINK, TAR_LINK_LEN);
+    if (!raw_link)
+      goto failure;
+  }
+
+  if (ex->next_size >= 0) {
+    size = ex->next_size;
+    ex->next_size = -1;
+  }
+
+  path = fetchdeps_extract_clean_path(raw_path);
+  if (!fetchdeps_filesys_is_safe_path(path)) {
+    fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Unsafe path '%s' in archive", raw_path);
+    goto failure;
+  }
+
+  // Entries like "./" name the root itself, which already exists. Applying
+  // the filter here means anything it rejects is skipped over in the stream
+  // without ever being written.
+  if (*path != '\0')
+    path = fetchdeps_filter_apply(ex->filter, path);
+  if (!path || *path == '\0') {
+    ok = fetchdeps_extract_skip(ex, fetchdeps_extract_padded(size));
+  }
+  else {
+    switch (type) {
+    case '0':
+    case '\0':
+    case '7':
+      ok = fetchdeps_extract_parents(ex, path) &&
+           fetchdeps_extract_regular(ex, path, mode, mtime, size);
+      break;
+    case '5':
+      ok = fetchdeps_extract_parents(ex, path) &&
+           fetchdeps_extract_directory(ex, path, mode) &&
+           fetchdeps_extract_skip(ex, fetchdeps_extract_padded(size));
+      break;
+    case '2':
+      // The writer won't follow a link itself, but whatever uses the files
+      // afterwards will.
+      if (!fetchdeps_extract_check_symlink(ex, path, raw_link))
+        goto failure;
+      ok = fetchdeps_extract_parents(ex, path) &&
+           fetchdeps_writer_make_symlink(ex->w, path, raw_link) &&
+           fetchdeps_extract_skip(ex, fetchdeps_extract_padded(size));
+      if (ok)
+        fetchdeps_extract_record(ex, path, 0);
+      break;
+    case '1':
+      {
+        char* target = fetchdeps_extract_clean_path(raw_link);
+        if (!fetchdeps_filesys_is_safe_path(target)) {
+          fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Unsafe link target '%s' in archive", raw_link);
+          goto failure;
+        }
+        // If the target was filtered out, there's nothing to link to.
+        target = fetchdeps_filter_apply(ex->filter, target);
+        if (!target) {
+          ok = fetchdeps_extract_skip(ex, fetchdeps_extract_padded(size));
+          break;
+        }
+        ok = fetchdeps_extract_parents(ex, path) &&
+             fetchdeps_writer_make_hardlink(ex->w, path, target) &&
+             fetchdeps_extract_skip(ex, fetchdeps_extract_padded(size));
+        if (ok)
+          fetchdeps_extract_record(ex, path, 0);
+      }
+      break;
+    default:
+      // Devices, fifos and anything else we don't know about are skipped.
+      ok = fetchdeps_extract_skip(ex, fetchdeps_extract_padded(size));
+      break;
+    }
+  }
+
+  fetchdeps_alloc_free(raw_path);
+  if (raw_link)
+    fetchdeps_alloc_free(raw_link);
+  return ok;
+
+failure:
+  fetchdeps_alloc_free(raw_path);
+  if (raw_link)
+    fetchdeps_alloc_free(raw_link);
+  return 0;
+}
+
+
+bool_t
+fetchdeps_extract_regular(extractor_t* ex, char* path, unsigned int mode,
+                          time_t mtime, long long size)
+{
+  long long remaining = size;
+
+  if (!fetchdeps_writer_begin_file(ex->w, path, mode, mtime, (size_t)size))
+    return 0;
+
+  while (remaining > 0) {
+    size_t chunk = (remaining < (long long)kDataBufferSize) ? (size_t)remaining : kDataBufferSize;
+    if (!fetchdeps_decode_read_full(ex->dec, ex->buf, chunk) ||
+        !fetchdeps_writer_append(ex->w, ex->buf, chunk)) {
+      fetchdeps_writer_abort_file(ex->w);
+      return 0;
+    }
+    remaining -= chunk;
+  }
+
+  if (!fetchdeps_writer_end_file(ex->w))
+    return 0;
+
+  fetchdeps_extract_record(ex, path, 0);
+
+  // Skip the padding at the end of the last block.
+  return fetchdeps_extract_skip(ex, fetchdeps_extract_padded(size) - size);
+}
+
+
+bool_t
+fetchdeps_extract_directory(extractor_t* ex, char* path, unsigned int mode)
+{
+  bool_t created;
+
+  // Make sure we can always get back into directories we create.
+  if (!fetchdeps_writer_make_dir(ex->w, path, (mode & 07777) | 0700, &created))
+    return 0;
+  if (created)
+    fetchdeps_extract_record(ex, path, 1);
+  return 1;
+}
+
+
+bool_t
+fetchdeps_extract_parents(extractor_t* ex, char* path)
+{
+  char* slash = strrchr(path, '/');
+  char* p;
+  size_t len;
+
+  if (!slash)
+    return 1;
+
+  // Archive entries are usually grouped by directory, so most of the time the
+  // parent is the same as last time.
+  len = slash - path;
+  if (ex->last_parent && strlen(ex->last_parent) == len &&
+      strncmp(ex->last_parent, path, len) == 0)
+    return 1;
+
+  for (p = strchr(path, '/'); p; p = strchr(p + 1, '/')) {
+    bool_t ok;
+    *p = '\0';
+    ok = fetchdeps_extract_directory(ex, path, 0755);
+    *p = '/';
+    if (!ok)
+      return 0;
+  }
+
+  if (ex->last_parent)
+    fetchdeps_alloc_free(ex->last_parent);
+  ex->last_parent = fetchdeps_alloc_strndup(ALLOC_EXTRACT, path, len);
+  return 1;
+}
+
+
+bool_t
+fetchdeps_extract_skip(extractor_t* ex, long long size)
+{
+  while (size > 0) {
+    size_t chunk = (size < (long long)kDataBufferSize) ? (size_t)size : kDataBufferSize;
+    if (!fetchdeps_decode_read_full(ex->dec, ex->buf, chunk))
+      return 0;
+    size -= chunk;
+  }
+  return 1;
+}
+
+
+long long
+fetchdeps_extract_padded(long long size)
+{
+  // Entry data is always padded out to a whole number of blocks.
+  return (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+}
+
+
+char*
+fetchdeps_extract_read_string(extractor_t* ex, long long size)
+{
+  long long padded = fetchdeps_extract_padded(size);
+  char* str;
+
+  // Names and pax headers are short; anything enormous is corrupt.
+  if (size > 1024 * 1024) {
+    fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Oversized tar extended header");
+    return NULL;
+  }
+
+  str = (char*)fetchdeps_alloc_malloc(ALLOC_EXTRACT, padded + 1);
+  if (!str)
+    return NULL;
+  if (!fetchdeps_decode_read_full(ex->dec, str, padded)) {
+    fetchdeps_alloc_free(str);
+    return NULL;
+  }
+  str[size] = '\0';
+  return str;
+}
+
+
+bool_t
+fetchdeps_extract_pax(extractor_t* ex, long long size)
+{
+  char* data;
+  char* p;
+  char* end;
+
+  data = fetchdeps_extract_read_string(ex, size);
+  if (!data)
+    return 0;
+
+  // Each record is "<length> <key>=<value>\n", where the length includes
+  // the whole record.
+  p = data;
+  end = data + size;
+  while (p < end) {
+    char* record = p;
+    char* key;
+    char* value;
+    long len = strtol(p, &key, 10);
+
+    if (len <= 0 || record + len > end || *key != ' ')
+      break;
+    ++key;
+    value = strchr(key, '=');
+    if (!value || value >= record + len)
+      break;
+    *value++ = '\0';
+    record[len - 1] = '\0';
+
+    if (strcmp(key, "path") == 0) {
+      if (ex->next_name)
+        fetchdeps_alloc_free(ex->next_name);
+      ex->next_name = fetchdeps_alloc_strdup(ALLOC_EXTRACT, value);
+    }
+    else if (strcmp(key, "linkpath") == 0) {
+      if (ex->next_link)
+        fetchdeps_alloc_free(ex->next_link);
+      ex->next_link = fetchdeps_alloc_strdup(ALLOC_EXTRACT, value);
+    }
+    else if (strcmp(key, "size") == 0) {
+      ex->next_size = strtoll(value, NULL, 10);
+    }
+
+    p = record + len;
+  }
+
+  fetchdeps_alloc_free(data);
+  return 1;
+}
+
+
+void
+fetchdeps_extract_record(extractor_t* ex, char* path, bool_t is_dir)
+{
+  if (!is_dir)
+    ++ex->num_files;
+  if (ex->manifest)
+    fprintf(ex->manifest, is_dir ? "%s/\n" : "%s\n", path);
+}
+
+
+bool_t
+fetchdeps_extract_is_tar_header(unsigned char* block)
+{
+  unsigned long sum = 0;
+  long long expected;
+  int i;
+
+  // The checksum is calculated with the checksum field itself treated as
+  // spaces.
+  for (i = 0; i < TAR_BLOCK_SIZE; ++i)
+    sum += (i >= TAR_CHKSUM && i < TAR_CHKSUM + 8) ? ' ' : block[i];
+
+  expected = fetchdeps_extract_number(block + TAR_CHKSUM, 8);
+  return expected >= 0 && (unsigned long)expected == sum;
+}
+
+
+bool_t
+fetchdeps_extract_is_zero_block(unsigned char* block)
+{
+  int i;
+
+  for (i = 0; i < TAR_BLOCK_SIZE; ++i) {
+    if (block[i] != 0)
+      return 0;
+  }
+  return 1;
+}
+
+
+long long
+fetchdeps_extract_number(unsigned char* field, size_t len)
+{
+  long long result = 0;
+  size_t i = 0;
+
+  // GNU tar stores numbers too big for the octal field in base 256, flagged
+  // by the top bit of the first byte.
+  if (field[0] & 0x80) {
+    result = field[0] & 0x3f;
+    for (i = 1; i < len; ++i)
+      result = (result << 8) | field[i];
+    return (field[0] & 0x40) ? -1 : result;
+  }
+
+  while (i < len && (field[i] == ' ' || field[i] == '\0'))
+    ++i;
+  if (i == len)
+    return 0;
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i)
+    result = (result << 3) | (field[i] - '0');
+  return result;
+}
+
+
+char*
+fetchdeps_extract_clean_path(char* path)
+{
+  size_t len;
+
+  // Strip any leading "./" components and trailing slashes.
+  while (path[0] == '.' && path[1] == '/') {
+    path += 2;
+    while (*path == '/')
+      ++path;
+  }
+  if (strcmp(path, ".") == 0)
+    path += 1;
+
+  len = strlen(path);
+  while (len > 0 && path[len - 1] == '/')
+    path[--len] = '\0';
+
+  return path;
+}
+
+
+// A symbolic link is safe if its target, taken relative to the directory the
+// link is in, stays inside the root. Going through an earlier link from this
+// archive lands somewhere that was checked when that link was made, but a ".."
+// after that is relative to wherever it went, which the text of the target
+// can't tell us; those are rejected rather than followed. Safe links are
+// remembered for checking later ones. Returns false, with the error set, if
+// the link is unsafe or memory runs out.
+bool_t
+fetchdeps_extract_check_symlink(extractor_t* ex, char* path, char* target)
+{
+  char* parts[2];
+  char* resolved;
+  char* name = NULL;
+  size_t len = 0;
+  bool_t through_link = 0;
+  int i;
+
+  if (*target == '/')
+    goto unsafe;
+
+  // The path the walk has reached, relative to the root and with any "." and
+  // empty components left out, so that it can be compared with other links.
+  resolved = (char*)fetchdeps_alloc_malloc(ALLOC_EXTRACT, strlen(path) + strlen(target) + 2);
+  if (!resolved)
+    return 0;
+  resolved[0] = '\0';
+
+  // Walk down to the directory the link is in, then follow the target from
+  // there.
+  parts[0] = path;
+  parts[1] = target;
+  for (i = 0; i < 2; ++i) {
+    char* p = parts[i];
+
+    while (*p) {
+      size_t comp_len = strcspn(p, "/");
+      char* next = p + comp_len;
+
+      while (*next == '/')
+        ++next;
+      if (i == 0 && *next == '\0') {
+        name = p;
+        break;
+      }
+
+      if (comp_len == 2 && p[0] == '.' && p[1] == '.') {
+        if (through_link || len == 0) {
+          fetchdeps_alloc_free(resolved);
+          goto unsafe;
+        }
+        while (len > 0 && resolved[len - 1] != '/')
+          --len;
+        if (len > 0)
+          --len;
+        resolved[len] = '\0';
+      }
+      else if (comp_len > 0 && !(comp_len == 1 && p[0] == '.')) {
+        if (len > 0)
+          resolved[len++] = '/';
+        memcpy(resolved + len, p, comp_len);
+        len += comp_len;
+        resolved[len] = '\0';
+        if (fetchdeps_stringset_contains(ex->links, resolved))
+          through_link = 1;
+      }
+      p = next;
+    }
+
+    // Remember where the link itself lives before following its target.
+    if (i == 0 && name) {
+      char* dir_end = resolved + len;
+      size_t name_len = strcspn(name, "/");
+      bool_t added;
+
+      if (len > 0)
+        *dir_end++ = '/';
+      memcpy(dir_end, name, name_len);
+      dir_end[name_len] = '\0';
+      added = fetchdeps_stringset_add(ex->links, resolved);
+      resolved[len] = '\0';
+      if (!added) {
+        fetchdeps_alloc_free(resolved);
+        return 0;
+      }
+    }
+  }
+
+  fetchdeps_alloc_free(resolved);
+  return 1;
+
+unsafe:
+  fetchdeps_errors_set_with_msg(ERR_ARCHIVE, "Unsafe link target '%s' in archive", target);
+  return 0;
+}
+
+
+char*
+fetchdeps_extract_field(unsigned char* field, size_t len)
+{
+  // Fields fill their whole width with no terminator when they're full.
+  return fetchdeps_alloc_strndup(ALLOC_EXTRACT, (char*)field, strnlen((char*)field, len));
+}
@@ -0,0 +1,40 @@
+#ifndef fetchdeps_extract_h
+#define fetchdeps_extract_h
+
+#include "common.h"
+#include "filter.h"
+#include "writer.h"
+
+#include <stdio.h>
+
+//
+// Functions
+//
+
+// Install the downloaded file at 'path' using the writer. The file is
+// decompressed according to its magic bytes (see fetchdeps_decode_new). If
+// the result is a tar archive, its contents are extracted; otherwise the
+// decompressed data is written as a single file called 'name', minus any
+// compression suffix.
+//
+// Archive entries with absolute paths or ".." components are rejected. Any
+// parent directories missing from the archive are created.
+//
+// If 'filter' is not NULL, each archive entry is passed through
+// fetchdeps_filter_apply as it's read: entries it rejects are skipped without
+// being written, and the rest are written straight to their remapped paths.
+// The filter doesn't apply to downloads which aren't archives.
+//
+// If 'manifest' is not NULL, a line is written to it for every file and
+// directory the extraction creates, in the format described for
+// fetchdeps_filesys_manifest_file.
+//
+// 'num_threads' is passed on to fetchdeps_decode_new.
+//
+// Returns true on success. On failure, some of the archive may already have
+// been extracted.
+bool_t fetchdeps_extract_file(char* path, char* name, filter_t* filter,
+                              writer_t* w, FILE* manifest, int num_threads);
+
+#endif // fetchdeps_extract_h
+
@@ -1,14 +1,17 @@
 #include "filesys.h"
 
+#include "alloc.h"
 #include "common.h"
 #include "errors.h"
 
 #include <assert.h>
 #include <dirent.h> // For opendir() and closedir().
+#include <errno.h>
+#include <fcntl.h>  // For open().
 #include <libgen.h> // For the dirname() function. TODO: check if this is the right include for Mac as well.
 #include <limits.h> // For PATH_MAX
 #include <stdio.h>  // For snprintf(), fopen(), etc.
-#include <stdlib.h> // For realpath(), malloc(), etc.
+#include <stdlib.h> // For realpath(), etc.
 #include <string.h> // For strcmp().
 #include <sys/stat.h> // for mkdir()
 #include <unistd.h> // for getcwd().
@@ -18,10 +21,14 @@
 // Constants
 //
 
+static const char* CACHE_FILE = "parsed.cache";
 static const char* DEFAULT_DEPSFILE = "default.deps";
 static const char* DEPS_DIR = ".deps";
 static const char* DOWNLOADS_DIR = "downloads";
 static const char* DOWNLOADS_LIST = "urls.txt";
+static const char* INSTALL_DIR = "Thirdparty";
+static const char* MANIFEST_FILE = "installed.txt";
+static const int MAX_WORKERS = 16;
 static const char* ROOT_PATH = "/";
 
 
@@ -36,9 +43,15 @@ bool_t fetchdeps_filesys_depsfile_exists(const char* dirpath);
 
 // Combine a directory path with a filename to make a new path string. The
 // result will be a null-terminated string, or NULL if the function failed. It's
-// up to the caller to free() the returned string.
+// up to the caller to fetchdeps_alloc_free() the returned string.
 char* fetchdeps_filesys_make_filepath(const char* dirpath, const char* filename);
 
+// Return the path to a file or directory called 'name' inside the directory
+// 'subdir', which is itself in the same directory as the deps file. If subdir
+// is NULL, the result is 'name' in the same directory as the deps file. The
+// caller must fetchdeps_alloc_free() the returned string.
+char* fetchdeps_filesys_project_path(char* deps_file, const char* subdir, const char* name);
+
 
 //
 // Public functions
@@ -78,8 +91,8 @@ fetchdeps_filesys_init(char* deps_file)
     goto failure;
 
   free(file_path);
-  free(dir_path);
-  free(download_path);
+  fetchdeps_alloc_free(dir_path);
+  fetchdeps_alloc_free(download_path);
 
   return 1;
 
@@ -88,9 +101,9 @@ failure:
   if (file_path)
     free(file_path);
   if (dir_path)
-    free(dir_path);
+    fetchdeps_alloc_free(dir_path);
   if (download_path)
-    free(download_path);
+    fetchdeps_alloc_free(download_path);
   return 0;
 }
 
@@ -137,7 +150,7 @@ fetchdeps_filesys_default_deps_file()
 failure:
   fetchdeps_errors_trap_system_error();
   if (result)
-    free(result);
+    fetchdeps_alloc_free(result);
   // Note: we don't free dirpath because dirname docs say not to.
   return NULL;
 }
@@ -168,7 +181,7 @@ fetchdeps_filesys_download_dir(char* deps_file)
     goto failure;
 
   free(file_path);
-  free(dir_path);
+  fetchdeps_alloc_free(dir_path);
 
   return download_path;
 
@@ -177,9 +190,9 @@ failure:
   if (file_path)
     free(file_path);
   if (dir_path)
-    free(dir_path);
+    fetchdeps_alloc_free(dir_path);
   if (download_path)
-    free(download_path);
+    fetchdeps_alloc_free(download_path);
   return NULL;
 }
 
@@ -197,6 +210,146 @@ fetchdeps_filesys_make_directory(char* path)
 }
 
 
+char*
+fetchdeps_filesys_install_dir(char* deps_file)
+{
+  return fetchdeps_filesys_project_path(deps_file, NULL, INSTALL_DIR);
+}
+
+
+char*
+fetchdeps_filesys_manifest_file(char* deps_file)
+{
+  return fetchdeps_filesys_project_path(deps_file, DEPS_DIR, MANIFEST_FILE);
+}
+
+
+char*
+fetchdeps_filesys_cache_file(char* deps_file)
+{
+  return fetchdeps_filesys_project_path(deps_file, DEPS_DIR, CACHE_FILE);
+}
+
+
+bool_t
+fetchdeps_filesys_is_file(char* path)
+{
+  struct stat buf;
+
+  assert(path != NULL);
+
+  if (stat(path, &buf) != 0)
+    return 0;
+  return S_ISREG(buf.st_mode);
+}
+
+
+bool_t
+fetchdeps_filesys_is_safe_path(char* path)
+{
+  char* p = path;
+
+  assert(path != NULL);
+
+  if (*path == '/')
+    return 0;
+
+  while (*p) {
+    if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+      return 0;
+    p = strchr(p, '/');
+    if (!p)
+      break;
+    ++p;
+  }
+  return 1;
+}
+
+
+char*
+fetchdeps_filesys_read_file(char* path, size_t padding, size_t* size)
+{
+  struct stat st;
+  char* data = NULL;
+  size_t capacity, len = 0;
+  int fd;
+  int saved_errno;
+
+  assert(path != NULL);
+  assert(padding > 0);
+  assert(size != NULL);
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0)
+    goto failure;
+
+  // Regular files are usually read in one go. Anything else, like a pipe,
+  // has no useful size, so we start small and keep going until the end.
+  capacity = (S_ISREG(st.st_mode) ? (size_t)st.st_size : 0) + padding + 1;
+  if (capacity < 4096)
+    capacity = 4096;
+  data = (char*)fetchdeps_alloc_malloc(ALLOC_FILESYS, capacity);
+  if (!data)
+    goto failure;
+
+  for (;;) {
+    ssize_t n;
+
+    // Always keep room for the padding after whatever has been read.
+    if (len + padding == capacity) {
+      size_t new_capacity = capacity * 2;
+      char* new_data = (char*)fetchdeps_alloc_realloc(ALLOC_FILESYS, data, new_capacity);
+      if (!new_data)
+        goto failure;
+      data = new_data;
+      capacity = new_capacity;
+    }
+
+    n = read(fd, data + len, capacity - len - padding);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      goto failure;
+    }
+    if (n == 0)
+      break;
+    len += (size_t)n;
+  }
+
+  memset(data + len, 0, padding);
+  close(fd);
+  *size = len;
+  return data;
+
+failure:
+  saved_errno = errno;
+  if (data)
+    fetchdeps_alloc_free(data);
+  close(fd);
+  errno = saved_errno;
+  return NULL;
+}
+
+
+int
+fetchdeps_filesys_num_workers(int jobs)
+{
+  long cpus;
+
+  if (jobs > 0)
+    return jobs;
+
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1)
+    return 1;
+  if (cpus > MAX_WORKERS)
+    return MAX_WORKERS;
+  return (int)cpus;
+}
+
+
 //
 // Private functions
 //
@@ -229,7 +382,7 @@ fetchdeps_filesys_make_filepath(const char* dirpath, const char* filename)
   assert(filename != NULL);
 
   filepath_len = strlen(dirpath) + strlen(filename) + 2;
-  filepath = malloc(filepath_len * sizeof(char));
+  filepath = fetchdeps_alloc_malloc(ALLOC_FILESYS, filepath_len * sizeof(char));
   if (!filepath)
     goto failure;
 
@@ -241,7 +394,54 @@ fetchdeps_filesys_make_filepath(const char* dirpath, const char* filename)
 failure:
   fetchdeps_errors_trap_system_error();
   if (filepath)
-    free(filepath);
+    fetchdeps_alloc_free(filepath);
   return NULL;
 }
 
+
+
+char*
+fetchdeps_filesys_project_path(char* deps_file, const char* subdir, const char* name)
+{
+  char* file_path = NULL;
+  char* parent_path = NULL;
+  char* dir_path = NULL;
+  char* result = NULL;
+
+  assert(deps_file != NULL);
+  assert(name != NULL);
+
+  file_path = realpath(deps_file, NULL);
+  if (!file_path)
+    goto failure;
+
+  parent_path = dirname(file_path);
+  if (!parent_path)
+    goto failure;
+
+  if (subdir) {
+    dir_path = fetchdeps_filesys_make_filepath(parent_path, subdir);
+    if (!dir_path)
+      goto failure;
+    result = fetchdeps_filesys_make_filepath(dir_path, name);
+  }
+  else {
+    result = fetchdeps_filesys_make_filepath(parent_path, name);
+  }
+  if (!result)
+    goto failure;
+
+  free(file_path);
+  if (dir_path)
+    fetchdeps_alloc_free(dir_path);
+
+  return result;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (file_path)
+    free(file_path);
+  if (dir_path)
+    fetchdeps_alloc_free(dir_path);
+  return NULL;
+}
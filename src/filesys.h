@@ -3,6 +3,8 @@
 
 #include "common.h"
 
+#include <stddef.h>
+
 //
 // Functions
 //
@@ -30,7 +32,8 @@ bool_t fetchdeps_filesys_is_directory(char* path);
 // hierarchy, starting from the current directory. The default file name is
 // "default.deps". If we find a readable file with that name in our search, we
 // return the full (canonical) path as a null-terminated string. This string
-// will have been allocated using malloc & the caller must free it themselves.
+// will have been allocated using fetchdeps_alloc_malloc & the caller must free
+// it themselves with fetchdeps_alloc_free.
 // If the file was not found, the return value is NULL.
 char* fetchdeps_filesys_default_deps_file();
 
@@ -66,5 +69,52 @@ char* fetchdeps_filesys_download_dir(char* deps_file);
 // further.
 bool_t fetchdeps_filesys_make_directory(char* path);
 
+// Returns the directory that dependencies get installed into. This is a
+// directory called "Thirdparty" in the same directory as the deps_file. As with
+// fetchdeps_filesys_download_dir, the directory doesn't have to exist yet. The
+// return value is NULL if the deps_file doesn't exist or some other error
+// occurred; otherwise it must be freed by the caller with
+// fetchdeps_alloc_free.
+char* fetchdeps_filesys_install_dir(char* deps_file);
+
+// Returns the path to the install manifest: a file inside the ".deps"
+// directory which lists every file and directory created by 'deps install',
+// one per line, relative to the install directory. Directory names end with a
+// '/'. The file doesn't have to exist. The return value is NULL if the
+// deps_file doesn't exist or some other error occurred; otherwise it must be
+// freed by the caller with fetchdeps_alloc_free.
+char* fetchdeps_filesys_manifest_file(char* deps_file);
+
+// Returns the path to the compiled deps cache: a file inside the ".deps"
+// directory holding the parsed form of the deps file, so that it doesn't have
+// to be parsed again while it's unchanged. The file doesn't have to exist. The
+// return value is NULL if the deps_file doesn't exist or some other error
+// occurred; otherwise it must be freed by the caller with
+// fetchdeps_alloc_free.
+char* fetchdeps_filesys_cache_file(char* deps_file);
+
+// Check whether the given path names an existing regular file. Returns false
+// if it doesn't exist, isn't a regular file, or can't be checked for any other
+// reason.
+bool_t fetchdeps_filesys_is_file(char* path);
+
+// Check whether a path is safe to use relative to some root directory: it
+// mustn't be absolute and mustn't contain any ".." components, so that it
+// can't refer to anything outside the root. Returns true if the path is safe.
+bool_t fetchdeps_filesys_is_safe_path(char* path);
+
+// Read the whole of a file into memory, followed by 'padding' zero bytes,
+// which must be at least one. Works on anything which can be read, including
+// pipes, and the copy isn't affected by later changes to the file. On success
+// the number of bytes read is stored in 'size'. Returns NULL if the file
+// couldn't be opened or read; otherwise the buffer must be released with
+// fetchdeps_alloc_free.
+char* fetchdeps_filesys_read_file(char* path, size_t padding, size_t* size);
+
+// Returns the number of worker threads to use for parallel filesystem work.
+// If jobs is greater than zero it's returned as-is; otherwise we use the
+// number of online CPUs, clamped to a sensible range.
+int fetchdeps_filesys_num_workers(int jobs);
+
 #endif // fetchdeps_filesys_h
 
@@ -0,0 +1,136 @@
+// FNM_LEADING_DIR is a GNU extension (BSD and OS X have it too).
+#define _GNU_SOURCE
+
+#include "filter.h"
+
+#include "alloc.h"
+
+#include <assert.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_filter_add_pattern(char*** patterns, size_t* count, char* pattern);
+bool_t fetchdeps_filter_matches_any(char** patterns, size_t count, char* path);
+
+
+//
+// Public functions
+//
+
+filter_t*
+fetchdeps_filter_new()
+{
+  return (filter_t*)fetchdeps_alloc_calloc(ALLOC_FILTER, 1, sizeof(filter_t));
+}
+
+
+void
+fetchdeps_filter_free(filter_t* f)
+{
+  size_t i;
+
+  assert(f != NULL);
+
+  for (i = 0; i < f->num_includes; ++i)
+    fetchdeps_alloc_free(f->includes[i]);
+  for (i = 0; i < f->num_excludes; ++i)
+    fetchdeps_alloc_free(f->excludes[i]);
+  if (f->includes)
+    fetchdeps_alloc_free(f->includes);
+  if (f->excludes)
+    fetchdeps_alloc_free(f->excludes);
+  fetchdeps_alloc_free(f);
+}
+
+
+bool_t
+fetchdeps_filter_add_include(filter_t* f, char* pattern)
+{
+  assert(f != NULL);
+  return fetchdeps_filter_add_pattern(&f->includes, &f->num_includes, pattern);
+}
+
+
+bool_t
+fetchdeps_filter_add_exclude(filter_t* f, char* pattern)
+{
+  assert(f != NULL);
+  return fetchdeps_filter_add_pattern(&f->excludes, &f->num_excludes, pattern);
+}
+
+
+char*
+fetchdeps_filter_apply(filter_t* f, char* path)
+{
+  int i;
+
+  assert(path != NULL);
+
+  if (!f)
+    return path;
+
+  for (i = 0; i < f->strip_components; ++i) {
+    path = strchr(path, '/');
+    if (!path)
+      return NULL;
+    while (*path == '/')
+      ++path;
+  }
+  if (*path == '\0')
+    return NULL;
+
+  if (f->num_includes > 0 && !fetchdeps_filter_matches_any(f->includes, f->num_includes, path))
+    return NULL;
+  if (fetchdeps_filter_matches_any(f->excludes, f->num_excludes, path))
+    return NULL;
+
+  return path;
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_filter_add_pattern(char*** patterns, size_t* count, char* pattern)
+{
+  char** new_patterns;
+  char* copy;
+
+  assert(pattern != NULL);
+
+  copy = fetchdeps_alloc_strdup(ALLOC_FILTER, pattern);
+  if (!copy)
+    return 0;
+
+  new_patterns = (char**)fetchdeps_alloc_realloc(ALLOC_FILTER, *patterns, (*count + 1) * sizeof(char*));
+  if (!new_patterns) {
+    fetchdeps_alloc_free(copy);
+    return 0;
+  }
+
+  new_patterns[*count] = copy;
+  *patterns = new_patterns;
+  ++*count;
+  return 1;
+}
+
+
+bool_t
+fetchdeps_filter_matches_any(char** patterns, size_t count, char* path)
+{
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    if (fnmatch(patterns[i], path, FNM_LEADING_DIR) == 0)
+      return 1;
+  }
+  return 0;
+}
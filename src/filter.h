@@ -0,0 +1,55 @@
+#ifndef fetchdeps_filter_h
+#define fetchdeps_filter_h
+
+#include "common.h"
+
+#include <stddef.h>
+
+//
+// Types
+//
+
+// Controls which entries of an archive get installed, and where. These come
+// from the include, exclude and strip-components options after a URL in the
+// deps file.
+struct _filter {
+  char** includes;
+  size_t num_includes;
+  char** excludes;
+  size_t num_excludes;
+  int strip_components;
+};
+typedef struct _filter filter_t;
+
+
+//
+// Functions
+//
+
+// Allocate a new filter which lets everything through unchanged. It must
+// eventually be freed with fetchdeps_filter_free.
+filter_t* fetchdeps_filter_new();
+
+// Deallocate a filter, including all of its patterns.
+void fetchdeps_filter_free(filter_t* f);
+
+// Add a glob pattern to the include or exclude list. The filter takes its own
+// copy of the pattern. Returns false if memory couldn't be allocated.
+bool_t fetchdeps_filter_add_include(filter_t* f, char* pattern);
+bool_t fetchdeps_filter_add_exclude(filter_t* f, char* pattern);
+
+// Apply the filter to a path from an archive. The first strip_components
+// components are removed, then the remainder is matched against the patterns:
+// it must match at least one include pattern (if there are any) and none of
+// the exclude patterns. A pattern matches if it matches the whole path or any
+// leading directory of it, and '*' matches across slashes, so "include" and
+// "include/*" both select everything under include/.
+//
+// Returns a pointer into 'path' for the remapped name if the entry should be
+// installed, or NULL if it should be skipped. Paths with no more than
+// strip_components components are always skipped. A NULL filter lets every
+// path through unchanged.
+char* fetchdeps_filter_apply(filter_t* f, char* path);
+
+#endif // fetchdeps_filter_h
+
@@ -0,0 +1,27 @@
+#include "hash.h"
+
+
+//
+// Constants
+//
+
+static const uint64_t kFnvPrime = 1099511628211ULL;
+
+
+//
+// Public functions
+//
+
+uint64_t
+fetchdeps_hash_fnv1a(uint64_t seed, const void* data, size_t len)
+{
+  const unsigned char* p = (const unsigned char*)data;
+  uint64_t hash = seed;
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    hash ^= p[i];
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
@@ -0,0 +1,27 @@
+#ifndef fetchdeps_hash_h
+#define fetchdeps_hash_h
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Constants
+//
+
+// The starting value for a new FNV-1a hash.
+#define kFnvOffsetBasis 14695981039346656037ULL
+
+
+//
+// Functions
+//
+
+// Add 'len' bytes of 'data' to an FNV-1a hash. Pass kFnvOffsetBasis as the
+// seed to hash a single piece of data, or the result of a previous call to
+// carry on hashing from where it left off, so that data arriving in chunks
+// hashes the same as it would all at once.
+uint64_t fetchdeps_hash_fnv1a(uint64_t seed, const void* data, size_t len);
+
+#endif // fetchdeps_hash_h
@@ -1,17 +1,43 @@
+#include "alloc.h"
 #include "cmdline.h"
 #include "common.h"
 #include "download.h"
 #include "environ.h"
 #include "errors.h"
+#include "extract.h"
 #include "filesys.h"
+#include "matrix.h"
+#include "metrics.h"
 #include "parse.h"
+#include "remove.h"
 #include "stringset.h"
+#include "strpool.h"
+#include "trace.h"
+#include "watch.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <getopt.h>
+#include <libgen.h> // For basename()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>   // For clock_gettime()
+#include <unistd.h> // For unlink()
+
+
+//
+// Types
+//
+
+// Where fetch_urls sends each URL. When watching the deps file, 'previous'
+// holds the URLs from the last time it was evaluated, which are already
+// downloaded; otherwise it's NULL.
+struct _fetchstate {
+  downloader_t* downloader;
+  stringset_t* previous;
+};
+typedef struct _fetchstate fetchstate_t;
 
 
 //
@@ -96,6 +122,215 @@ failure:
 }
 
 
+// Show how much the string pool saved: every lookup which found a string
+// already there would otherwise have been a separate allocation.
+void
+print_strpool_stats()
+{
+  strpool_stats_t stats;
+
+  fetchdeps_strpool_get_stats(&stats);
+  fprintf(stderr, "Interned %lu strings for %lu lookups in %lu allocations (%lu KB)\n",
+          (unsigned long)stats.strings,
+          (unsigned long)stats.lookups,
+          (unsigned long)stats.blocks,
+          (unsigned long)(stats.bytes / 1024));
+}
+
+
+// Point the parser at the compiled cache in the .deps directory and tell it
+// how many threads it can use for included files. With -n, the cache can be
+// read but isn't updated.
+bool_t
+configure_parser(parser_t* ctx, cmdline_t* options)
+{
+  char* cache_file;
+  bool_t ok;
+
+  fetchdeps_parser_set_workers(ctx, fetchdeps_filesys_num_workers(options->jobs));
+
+  // A deps file read from a pipe is different every time, and has no project
+  // directory to keep a cache in anyway.
+  if (!fetchdeps_filesys_is_file(options->fname))
+    return 1;
+
+  cache_file = fetchdeps_filesys_cache_file(options->fname);
+  if (!cache_file)
+    return 0;
+  ok = fetchdeps_parser_set_cache(ctx, cache_file, !options->no_changes);
+  fetchdeps_alloc_free(cache_file);
+  return ok;
+}
+
+
+// Passes each URL to the downloader as soon as evaluation finds it.
+bool_t
+queue_download(void* arg, char* url)
+{
+  fetchstate_t* state = (fetchstate_t*)arg;
+
+  if (state->previous && fetchdeps_stringset_contains(state->previous, url))
+    return 1;
+  return fetchdeps_download_add(state->downloader, url);
+}
+
+
+// Parse the deps file and download its URLs, apart from any which are in
+// 'previous' (which may be NULL). The downloads start while the rest of the
+// file is still being evaluated, rather than once it's finished.
+bool_t
+fetch_urls(parser_t* ctx, stringset_t* urls, stringset_t* previous, char* to_dir, download_stats_t* stats)
+{
+  fetchstate_t state;
+
+  if (!fetchdeps_parser_build(ctx))
+    return 0;
+
+  state.downloader = fetchdeps_download_start(to_dir);
+  if (!state.downloader)
+    return 0;
+  state.previous = previous;
+
+  if (!fetchdeps_parser_eval_each(ctx, urls, queue_download, &state)) {
+    // Downloads which failed before we stopped are in the error report
+    // already, so the evaluation's error is the one to keep.
+    fetchdeps_download_cancel(state.downloader);
+    if (fetchdeps_errors_get() == ERR_NONE)
+      fetchdeps_errors_set(ERR_PARSE);
+    return 0;
+  }
+  return fetchdeps_download_finish(state.downloader, stats);
+}
+
+
+// Delete the downloads for URLs which were in 'previous' but aren't in 'urls'.
+bool_t
+prune_downloads(stringset_t* previous, stringset_t* urls, char* to_dir, bool_t verbose)
+{
+  stringiter_t* url_iter;
+  char* url;
+  char* local_filename;
+
+  url_iter = fetchdeps_stringiter_new(previous);
+  if (!url_iter)
+    return 0;
+
+  for (url = fetchdeps_stringiter_next(url_iter); url; url = fetchdeps_stringiter_next(url_iter)) {
+    if (fetchdeps_stringset_contains(urls, url))
+      continue;
+
+    local_filename = fetchdeps_download_get_local_filename(url, to_dir);
+    if (!local_filename)
+      goto failure;
+    if (unlink(local_filename) != 0 && errno != ENOENT) {
+      fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to delete %s", local_filename);
+      fetchdeps_alloc_free(local_filename);
+      goto failure;
+    }
+    if (verbose)
+      fprintf(stderr, "Removed %s\n", local_filename);
+    fetchdeps_alloc_free(local_filename);
+  }
+
+  fetchdeps_stringiter_free(url_iter);
+  return 1;
+
+failure:
+  fetchdeps_stringiter_free(url_iter);
+  return 0;
+}
+
+
+// Keep running get each time the deps file, or any file it includes, changes.
+// Only the URLs which are new since the last successful run are downloaded,
+// and with --prune the downloads for URLs which have gone are deleted.
+// Problems with the deps file or the downloads are reported, but we carry on
+// watching so they can be fixed. This only returns if watching fails.
+bool_t
+watch_urls(cmdline_t* options, char* to_dir)
+{
+  watcher_t* w;
+  parser_t* ctx = NULL;
+  stringset_t* urls = NULL;
+  stringset_t* previous = NULL;
+  download_stats_t stats;
+  size_t i;
+  bool_t ok;
+
+  w = fetchdeps_watch_new();
+  if (!w)
+    return 0;
+
+  for (;;) {
+    urls = fetchdeps_stringset_new();
+    if (!urls)
+      goto failure;
+
+    ctx = fetchdeps_parser_new(options->fname);
+    ok = ctx &&
+         fetchdeps_environ_init_all_vars(ctx->vars, options->argv) &&
+         configure_parser(ctx, options) &&
+         fetch_urls(ctx, urls, previous, to_dir, &stats) &&
+         (!options->prune || !previous || prune_downloads(previous, urls, to_dir, options->verbose));
+    if (ok) {
+      if (options->verbose)
+        fprintf(stderr, "Downloaded %lu new files (%llu bytes)\n",
+                (unsigned long)stats.num_files, (unsigned long long)stats.bytes);
+      if (previous)
+        fetchdeps_stringset_free(previous);
+      previous = urls;
+      urls = NULL;
+    }
+    else {
+      fetchdeps_errors_trap_system_error();
+      fetchdeps_errors_print(stderr);
+      fetchdeps_errors_clear();
+    }
+
+    // Includes may have been added or removed, so watch whichever files make
+    // up the deps file now.
+    fetchdeps_watch_clear(w);
+    if (!fetchdeps_watch_add_file(w, options->fname))
+      goto failure;
+    for (i = 0; ctx && i < ctx->num_includes; ++i) {
+      if (!fetchdeps_watch_add_file(w, ctx->includes[i]->fname))
+        goto failure;
+    }
+
+    if (ctx) {
+      fetchdeps_parser_free(ctx);
+      ctx = NULL;
+    }
+    if (urls) {
+      fetchdeps_stringset_free(urls);
+      urls = NULL;
+    }
+
+    // Keep the figures current for whatever's scraping them.
+    if (options->metrics_file && !fetchdeps_metrics_write(options->metrics_file)) {
+      fetchdeps_errors_print(stderr);
+      fetchdeps_errors_clear();
+    }
+
+    if (options->verbose)
+      fprintf(stderr, "Watching %s for changes\n", options->fname);
+    if (!fetchdeps_watch_wait(w))
+      goto failure;
+  }
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (ctx)
+    fetchdeps_parser_free(ctx);
+  if (urls)
+    fetchdeps_stringset_free(urls);
+  if (previous)
+    fetchdeps_stringset_free(previous);
+  fetchdeps_watch_free(w);
+  return 0;
+}
+
+
 bool_t
 help_action(cmdline_t* options)
 {
@@ -137,14 +372,14 @@ init_action(cmdline_t* options)
       goto failure;
   }
 
-  free(to_dir);
+  fetchdeps_alloc_free(to_dir);
 
   return 1;
 
 failure:
   fetchdeps_errors_trap_system_error();
   if (to_dir)
-    free(to_dir);
+    fetchdeps_alloc_free(to_dir);
   return 0;
 }
 
@@ -155,9 +390,13 @@ get_action(cmdline_t* options)
   char* to_dir = NULL;
   parser_t* ctx = NULL;
   stringset_t* urls = NULL;
+  download_stats_t stats;
+  struct timespec start, end;
 
   assert(options != NULL);
 
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
   // Locate the downloads directory.
   to_dir = fetchdeps_filesys_download_dir(options->fname);
   if (!to_dir)
@@ -169,29 +408,46 @@ get_action(cmdline_t* options)
     goto failure;
   }
 
+  if (options->watch) {
+    if (!watch_urls(options, to_dir))
+      goto failure;
+    fetchdeps_alloc_free(to_dir);
+    return 1;
+  }
+
   // Set up for parsing.
   ctx = fetchdeps_parser_new(options->fname);
   if (!ctx)
     goto failure;
   if (!fetchdeps_environ_init_all_vars(ctx->vars, options->argv))
     goto failure;
+  if (!configure_parser(ctx, options))
+    goto failure;
   urls = fetchdeps_stringset_new();
   if (!urls)
     goto failure;
 
   // Parse away!
-  if (!fetchdeps_parser_parse(ctx, urls))
-    goto failure;
-
-  // Finished parsing, let's do something with the urls.
-  if (options->no_changes)
+  if (options->no_changes) {
+    if (!fetchdeps_parser_parse(ctx, urls))
+      goto failure;
     print_urls(urls);
-  else if (!fetchdeps_download_fetch_all(urls, to_dir))
+  }
+  else if (!fetch_urls(ctx, urls, NULL, to_dir, &stats))
     goto failure;
+  else if (options->verbose) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "Downloaded %lu files (%llu bytes) in %.3f s, peak buffer usage %lu of %lu KB\n",
+            (unsigned long)stats.num_files,
+            (unsigned long long)stats.bytes,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+            (unsigned long)(stats.peak_buffer_usage / 1024),
+            (unsigned long)(stats.buffer_capacity / 1024));
+  }
 
   // Cleanup
   if (to_dir)
-    free(to_dir);
+    fetchdeps_alloc_free(to_dir);
   fetchdeps_parser_free(ctx);
   fetchdeps_stringset_free(urls);
 
@@ -200,7 +456,7 @@ get_action(cmdline_t* options)
 failure:
   fetchdeps_errors_trap_system_error();
   if (to_dir)
-    free(to_dir);
+    fetchdeps_alloc_free(to_dir);
   if (ctx)
     fetchdeps_parser_free(ctx);
   if (urls)
@@ -209,6 +465,63 @@ failure:
 }
 
 
+bool_t
+matrix_list_action(cmdline_t* options)
+{
+  parser_t* ctx = NULL;
+  matrix_t* m = NULL;
+  int i;
+
+  assert(options != NULL);
+
+  // The variables on the command line are the ones to vary; everything else
+  // comes from the defaults and the environment as usual.
+  ctx = fetchdeps_parser_new(options->fname);
+  if (!ctx)
+    goto failure;
+  if (!fetchdeps_environ_default_vars(ctx->vars))
+    goto failure;
+  if (!fetchdeps_environ_get_vars(ctx->vars))
+    goto failure;
+  if (!configure_parser(ctx, options))
+    goto failure;
+
+  m = fetchdeps_matrix_new(ctx->vars);
+  if (!m)
+    goto failure;
+  for (i = 1; i < options->argc; ++i) {
+    if (!fetchdeps_matrix_add_var(m, options->argv[i]))
+      goto failure;
+  }
+
+  // Parse once, then evaluate for all of the combinations together.
+  if (!fetchdeps_parser_build(ctx))
+    goto failure;
+  if (!fetchdeps_matrix_eval(m, ctx)) {
+    if (fetchdeps_errors_get() == ERR_NONE)
+      fetchdeps_errors_set(ERR_PARSE);
+    goto failure;
+  }
+
+  if (options->json)
+    fetchdeps_matrix_print_json(m, stdout);
+  else
+    fetchdeps_matrix_print_table(m, stdout);
+
+  fetchdeps_matrix_free(m);
+  fetchdeps_parser_free(ctx);
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (m)
+    fetchdeps_matrix_free(m);
+  if (ctx)
+    fetchdeps_parser_free(ctx);
+  return 0;
+}
+
+
 bool_t
 list_action(cmdline_t* options)
 {
@@ -217,12 +530,17 @@ list_action(cmdline_t* options)
 
   assert(options != NULL);
 
+  if (options->matrix)
+    return matrix_list_action(options);
+
   // Set up for parsing.
   ctx = fetchdeps_parser_new(options->fname);
   if (!ctx)
     goto failure;
   if (!fetchdeps_environ_init_all_vars(ctx->vars, options->argv))
     goto failure;
+  if (!configure_parser(ctx, options))
+    goto failure;
   urls = fetchdeps_stringset_new();
   if (!urls)
     goto failure;
@@ -253,7 +571,150 @@ failure:
 bool_t
 install_action(cmdline_t* options)
 {
-  fetchdeps_errors_set_with_msg(ERR_NOT_IMPL, "'install' action");
+  char* from_dir = NULL;
+  char* install_dir = NULL;
+  char* manifest_path = NULL;
+  parser_t* ctx = NULL;
+  stringset_t* urls = NULL;
+  stringiter_t* url_iter = NULL;
+  char* local_filename = NULL;
+  FILE* manifest = NULL;
+  writer_t* w = NULL;
+  struct timespec start, end;
+  char* url;
+
+  assert(options != NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Locate the downloads directory.
+  from_dir = fetchdeps_filesys_download_dir(options->fname);
+  if (!from_dir)
+    goto failure;
+  if (!fetchdeps_filesys_is_directory(from_dir)) {
+    fetchdeps_errors_set_with_msg(ERR_NO_DIR, "Bad download directory (you may need to run 'deps init')");
+    goto failure;
+  }
+
+  install_dir = fetchdeps_filesys_install_dir(options->fname);
+  if (!install_dir)
+    goto failure;
+  manifest_path = fetchdeps_filesys_manifest_file(options->fname);
+  if (!manifest_path)
+    goto failure;
+
+  // Set up for parsing.
+  ctx = fetchdeps_parser_new(options->fname);
+  if (!ctx)
+    goto failure;
+  if (!fetchdeps_environ_init_all_vars(ctx->vars, options->argv))
+    goto failure;
+  if (!configure_parser(ctx, options))
+    goto failure;
+  urls = fetchdeps_stringset_new();
+  if (!urls)
+    goto failure;
+
+  // Parse away!
+  if (!fetchdeps_parser_parse(ctx, urls))
+    goto failure;
+
+  if (!options->no_changes) {
+    if (!fetchdeps_filesys_is_directory(install_dir) &&
+        !fetchdeps_filesys_make_directory(install_dir))
+      goto failure;
+
+    manifest = fopen(manifest_path, "a");
+    if (!manifest) {
+      fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to open install manifest %s", manifest_path);
+      goto failure;
+    }
+
+    w = fetchdeps_writer_new(install_dir, options->writer);
+    if (!w)
+      goto failure;
+  }
+
+  // Install each of the downloaded files.
+  url_iter = fetchdeps_stringiter_new(urls);
+  if (!url_iter)
+    goto failure;
+  url = fetchdeps_stringiter_next(url_iter);
+  while (url) {
+    local_filename = fetchdeps_download_get_local_filename(url, from_dir);
+    if (!local_filename)
+      goto failure;
+
+    if (!fetchdeps_filesys_is_file(local_filename)) {
+      errno = ENOENT;
+      fetchdeps_errors_set_with_msg(ERR_SYSTEM, "%s hasn't been downloaded (you may need to run 'deps get')", url);
+      goto failure;
+    }
+
+    if (options->no_changes)
+      printf("Would install %s into %s\n", local_filename, install_dir);
+    else if (!fetchdeps_extract_file(local_filename, basename(local_filename),
+                                     fetchdeps_parser_get_filter(ctx, url), w, manifest,
+                                     fetchdeps_filesys_num_workers(options->jobs)))
+      goto failure;
+
+    fetchdeps_alloc_free(local_filename);
+    local_filename = NULL;
+    url = fetchdeps_stringiter_next(url_iter);
+  }
+
+  // Cleanup
+  if (w) {
+    size_t file_count = fetchdeps_writer_file_count(w);
+    writer_backend_t backend = fetchdeps_writer_backend(w);
+    bool_t ok = fetchdeps_writer_free(w);
+
+    w = NULL;
+    if (!ok)
+      goto failure;
+
+    if (options->verbose) {
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      fprintf(stderr, "Installed %lu files in %.3f s using the %s writer\n",
+              (unsigned long)file_count,
+              (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+              fetchdeps_writer_backend_name(backend));
+    }
+  }
+  if (manifest && fclose(manifest) != 0) {
+    manifest = NULL;
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to write install manifest %s", manifest_path);
+    goto failure;
+  }
+  fetchdeps_stringiter_free(url_iter);
+  fetchdeps_parser_free(ctx);
+  fetchdeps_stringset_free(urls);
+  fetchdeps_alloc_free(from_dir);
+  fetchdeps_alloc_free(install_dir);
+  fetchdeps_alloc_free(manifest_path);
+
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (local_filename)
+    fetchdeps_alloc_free(local_filename);
+  if (w)
+    fetchdeps_writer_free(w);
+  if (manifest)
+    fclose(manifest);
+  if (url_iter)
+    fetchdeps_stringiter_free(url_iter);
+  if (ctx)
+    fetchdeps_parser_free(ctx);
+  if (urls)
+    fetchdeps_stringset_free(urls);
+  if (from_dir)
+    fetchdeps_alloc_free(from_dir);
+  if (install_dir)
+    fetchdeps_alloc_free(install_dir);
+  if (manifest_path)
+    fetchdeps_alloc_free(manifest_path);
   return 0;
 }
 
@@ -261,7 +722,47 @@ install_action(cmdline_t* options)
 bool_t
 uninstall_action(cmdline_t* options)
 {
-  fetchdeps_errors_set_with_msg(ERR_NOT_IMPL, "'uninstall' action");
+  char* install_dir = NULL;
+  char* manifest = NULL;
+  int num_workers;
+
+  assert(options != NULL);
+
+  install_dir = fetchdeps_filesys_install_dir(options->fname);
+  if (!install_dir)
+    goto failure;
+  manifest = fetchdeps_filesys_manifest_file(options->fname);
+  if (!manifest)
+    goto failure;
+
+  num_workers = fetchdeps_filesys_num_workers(options->jobs);
+
+  // If we have a record of what was installed, remove exactly that; otherwise
+  // clear out the whole install directory.
+  if (fetchdeps_filesys_is_file(manifest)) {
+    if (options->no_changes)
+      printf("Would remove files listed in %s from %s\n", manifest, install_dir);
+    else if (!fetchdeps_remove_manifest(install_dir, manifest, num_workers))
+      goto failure;
+  }
+  else {
+    if (options->no_changes)
+      printf("Would remove everything in %s\n", install_dir);
+    else if (!fetchdeps_remove_tree_contents(install_dir, num_workers))
+      goto failure;
+  }
+
+  fetchdeps_alloc_free(install_dir);
+  fetchdeps_alloc_free(manifest);
+
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (install_dir)
+    fetchdeps_alloc_free(install_dir);
+  if (manifest)
+    fetchdeps_alloc_free(manifest);
   return 0;
 }
 
@@ -269,7 +770,32 @@ uninstall_action(cmdline_t* options)
 bool_t
 delete_action(cmdline_t* options)
 {
-  fetchdeps_errors_set_with_msg(ERR_NOT_IMPL, "'delete' action");
+  char* download_dir = NULL;
+
+  assert(options != NULL);
+
+  download_dir = fetchdeps_filesys_download_dir(options->fname);
+  if (!download_dir)
+    goto failure;
+
+  if (!fetchdeps_filesys_is_directory(download_dir)) {
+    fetchdeps_errors_set_with_msg(ERR_NO_DIR, "Bad download directory (you may need to run 'deps init')");
+    goto failure;
+  }
+
+  if (options->no_changes)
+    printf("Would remove everything in %s\n", download_dir);
+  else if (!fetchdeps_remove_tree_contents(download_dir, fetchdeps_filesys_num_workers(options->jobs)))
+    goto failure;
+
+  fetchdeps_alloc_free(download_dir);
+
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (download_dir)
+    fetchdeps_alloc_free(download_dir);
   return 0;
 }
 
@@ -308,8 +834,12 @@ main(int argc, char** argv)
   exittype_t exit_type;
   parser_t* ctx = NULL;
   bool_t success = 0;
+  bool_t metrics_pending = 0;
+  uint64_t start;
 
-  // Parse the command line.
+  // Parse the command line. We don't know whether to trace until afterwards,
+  // so it's timed regardless and recorded once tracing is on.
+  start = fetchdeps_trace_now();
   fetchdeps_cmdline_init(&options, argc, argv);
   exit_type = fetchdeps_cmdline_parse(&options);
   if (exit_type == EXIT_FAIL)
@@ -319,9 +849,28 @@ main(int argc, char** argv)
     exit(0);
   }
 
+  // Allocations from here on are counted, so the figures cover everything the
+  // action does.
+  if (options.alloc_stats)
+    fetchdeps_alloc_enable_stats();
+
+  if (options.trace_file) {
+    if (!fetchdeps_trace_open(options.trace_file))
+      goto failure;
+    fetchdeps_trace_name_thread("main");
+    fetchdeps_trace_complete("command line", NULL, start);
+  }
+  if (options.metrics_file) {
+    fetchdeps_metrics_enable();
+    metrics_pending = 1;
+  }
+
   // If no fname was given try to find the default deps file.
-  if (!options.fname)
+  if (!options.fname) {
+    fetchdeps_trace_begin("find deps file", NULL);
     options.fname = fetchdeps_filesys_default_deps_file();
+    fetchdeps_trace_end();
+  }
   if (!options.fname) {
     fetchdeps_errors_set(ERR_NO_DEPS);
     goto failure;
@@ -360,15 +909,40 @@ main(int argc, char** argv)
   if (!success)
     goto failure;
 
+  if (options.verbose)
+    print_strpool_stats();
+
+  // All the other threads have finished by now.
+  if (!fetchdeps_trace_close())
+    goto failure;
+  if (metrics_pending) {
+    metrics_pending = 0;
+    if (!fetchdeps_metrics_write(options.metrics_file))
+      goto failure;
+  }
+
   // Clean up.
   fetchdeps_cmdline_cleanup(&options);
+  fetchdeps_strpool_free();
+  if (options.alloc_stats)
+    fetchdeps_alloc_print_stats(stderr);
   
   return 0;
 
 failure:
   fetchdeps_errors_print(stderr);
+  fetchdeps_errors_clear();
+  if (!fetchdeps_trace_close())
+    fetchdeps_errors_print(stderr);
+  // A failed run's figures are worth having too.
+  if (metrics_pending && !fetchdeps_metrics_write(options.metrics_file))
+    fetchdeps_errors_print(stderr);
+  fetchdeps_errors_clear();
   fetchdeps_cmdline_cleanup(&options);
+  fetchdeps_strpool_free();
   if (ctx)
     fetchdeps_parser_free(ctx);
+  if (options.alloc_stats)
+    fetchdeps_alloc_print_stats(stderr);
   return 1;
 }
@@ -0,0 +1,855 @@
+#include "matrix.h"
+
+#include "alloc.h"
+#include "arena.h"
+#include "errors.h"
+#include "hash.h"
+#include "stringset.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Constants
+//
+
+// More combinations than this are almost certainly a typo, and the table
+// would be unreadable anyway.
+static const size_t kMaxCombinations = 4096;
+
+static const size_t kMinTableSlots = 64;
+
+static const size_t kNoEntry = (size_t)-1;
+
+
+//
+// Types
+//
+
+// A variable with more than one value. Its values cycle every 'stride'
+// combinations, so that the first variable changes the slowest. 'sets' holds
+// each value as a set of its own, for expanding URL templates; they're only
+// made when a template needs them.
+struct _matrixvar {
+  char* name;
+  char** values;
+  size_t num_values;
+  size_t stride;
+  stringset_t** sets;
+};
+typedef struct _matrixvar matrixvar_t;
+
+
+// A URL or a condition, with the combinations it applies to.
+struct _matrixentry {
+  const char* key;
+  size_t key_len;
+  uint64_t hash;
+  uint64_t* mask;
+};
+typedef struct _matrixentry matrixentry_t;
+
+
+// Entries in the order they were added, plus an open addressing index into
+// them. Each slot holds an entry's index plus one, or zero if it's empty.
+struct _matrixtable {
+  matrixentry_t* entries;
+  size_t num_entries;
+  size_t entries_capacity;
+
+  size_t* slots;
+  size_t num_slots;
+};
+typedef struct _matrixtable matrixtable_t;
+
+
+// Where the expansions of a URL template go: either every combination in
+// 'mask', if the template doesn't use any of the matrix's variables, or just
+// 'combo'.
+struct _matrixexpansion {
+  matrix_t* m;
+  parser_t* file;
+  ast_stmt_t* stmt;
+  uint64_t* mask;
+  size_t combo;
+};
+typedef struct _matrixexpansion matrixexpansion_t;
+
+
+struct _matrix {
+  varmap_t* vars;
+  arena_t* arena;   // Holds the variables, masks and condition keys.
+
+  matrixvar_t* axes;
+  size_t num_axes;
+  size_t axes_capacity;
+
+  size_t num_combos;
+  size_t num_words; // Length of each mask in 64 bit words.
+  uint64_t* all;    // Mask with a bit set for every combination.
+
+  matrixtable_t urls;
+  matrixtable_t conds;  // Keyed on the structure of the condition.
+
+  char* scratch;    // For building condition keys.
+  size_t scratch_capacity;
+
+  char* expand_buf; // Reused for every URL template expansion.
+  size_t expand_capacity;
+};
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_matrix_eval_file(matrix_t* m, parser_t* file, uint64_t* mask);
+bool_t fetchdeps_matrix_eval_block(matrix_t* m, parser_t* file, ast_stmt_t* stmt, uint64_t* mask);
+bool_t fetchdeps_matrix_eval_url(matrix_t* m, parser_t* file, ast_stmt_t* stmt, uint64_t* mask);
+bool_t fetchdeps_matrix_eval_template(matrix_t* m, parser_t* file, ast_stmt_t* stmt, uint64_t* mask);
+stringset_t* fetchdeps_matrix_lookup_var(void* arg, const char* name);
+bool_t fetchdeps_matrix_emit_url(void* arg, char* url, size_t len);
+size_t fetchdeps_matrix_eval_cond(matrix_t* m, parser_t* file, ast_cond_t* cond);
+size_t fetchdeps_matrix_eval_relation(matrix_t* m, parser_t* file, ast_cond_t* cond);
+size_t fetchdeps_matrix_eval_binary(matrix_t* m, parser_t* file, ast_cond_t* cond);
+bool_t fetchdeps_matrix_relation_holds(ast_cond_t* cond, int value_id);
+matrixvar_t* fetchdeps_matrix_find_var(matrix_t* m, char* name);
+bool_t fetchdeps_matrix_append_key(matrix_t* m, size_t* len, const void* data, size_t data_len);
+
+size_t fetchdeps_matrix_lookup(matrix_t* m, matrixtable_t* t, const char* key, size_t key_len, bool_t* added);
+bool_t fetchdeps_matrix_grow_slots(matrixtable_t* t);
+void fetchdeps_matrix_free_table(matrixtable_t* t);
+
+bool_t fetchdeps_matrix_is_empty(matrix_t* m, uint64_t* mask);
+bool_t fetchdeps_matrix_is_set(uint64_t* mask, size_t combo);
+void fetchdeps_matrix_set(uint64_t* mask, size_t combo);
+char* fetchdeps_matrix_value(matrixvar_t* var, size_t combo);
+void fetchdeps_matrix_print_json_string(FILE* out, const char* str);
+
+
+//
+// Public functions
+//
+
+matrix_t*
+fetchdeps_matrix_new(varmap_t* vars)
+{
+  matrix_t* m;
+
+  assert(vars != NULL);
+
+  m = (matrix_t*)fetchdeps_alloc_calloc(ALLOC_MATRIX, 1, sizeof(matrix_t));
+  if (!m)
+    return NULL;
+
+  m->arena = fetchdeps_arena_new();
+  if (!m->arena) {
+    fetchdeps_alloc_free(m);
+    return NULL;
+  }
+
+  m->vars = vars;
+  m->num_combos = 1;
+  return m;
+}
+
+
+void
+fetchdeps_matrix_free(matrix_t* m)
+{
+  size_t i, v;
+
+  assert(m != NULL);
+
+  fetchdeps_matrix_free_table(&m->urls);
+  fetchdeps_matrix_free_table(&m->conds);
+  for (i = 0; i < m->num_axes; ++i) {
+    for (v = 0; m->axes[i].sets && v < m->axes[i].num_values; ++v) {
+      if (m->axes[i].sets[v])
+        fetchdeps_stringset_free(m->axes[i].sets[v]);
+    }
+  }
+  if (m->axes)
+    fetchdeps_alloc_free(m->axes);
+  if (m->expand_buf)
+    fetchdeps_alloc_free(m->expand_buf);
+  if (m->scratch)
+    fetchdeps_alloc_free(m->scratch);
+  fetchdeps_arena_free(m->arena);
+  fetchdeps_alloc_free(m);
+}
+
+
+bool_t
+fetchdeps_matrix_add_var(matrix_t* m, char* spec)
+{
+  matrixvar_t* var;
+  char* eq;
+  char* start;
+  char* end;
+  size_t i;
+
+  assert(m != NULL);
+  assert(spec != NULL);
+
+  eq = strchr(spec, '=');
+  if (!eq || eq == spec) {
+    fetchdeps_errors_set_with_msg(ERR_CMDLINE, "Expected name=value1,value2,... but got '%s'", spec);
+    return 0;
+  }
+
+  if (m->num_axes == m->axes_capacity) {
+    size_t new_capacity = m->axes_capacity ? m->axes_capacity * 2 : 4;
+    matrixvar_t* new_axes = (matrixvar_t*)fetchdeps_alloc_realloc(ALLOC_MATRIX, m->axes, new_capacity * sizeof(matrixvar_t));
+    if (!new_axes)
+      goto failure;
+    m->axes = new_axes;
+    m->axes_capacity = new_capacity;
+  }
+
+  var = &m->axes[m->num_axes];
+  memset(var, 0, sizeof(matrixvar_t));
+
+  var->name = (char*)fetchdeps_arena_alloc(m->arena, eq - spec + 1);
+  if (!var->name)
+    goto failure;
+  memcpy(var->name, spec, eq - spec);
+  if (fetchdeps_matrix_find_var(m, var->name)) {
+    fetchdeps_errors_set_with_msg(ERR_CMDLINE, "Variable '%s' given more than once", var->name);
+    return 0;
+  }
+
+  var->num_values = 1;
+  for (end = eq + 1; *end; ++end) {
+    if (*end == ',')
+      ++var->num_values;
+  }
+  if (m->num_combos * var->num_values > kMaxCombinations) {
+    fetchdeps_errors_set_with_msg(ERR_CMDLINE, "Too many combinations (the limit is %lu)", (unsigned long)kMaxCombinations);
+    return 0;
+  }
+
+  var->values = (char**)fetchdeps_arena_alloc(m->arena, var->num_values * sizeof(char*));
+  if (!var->values)
+    goto failure;
+
+  start = eq + 1;
+  for (i = 0; i < var->num_values; ++i) {
+    for (end = start; *end && *end != ','; ++end)
+      ;
+    if (end == start) {
+      fetchdeps_errors_set_with_msg(ERR_CMDLINE, "Empty value for variable '%s'", var->name);
+      return 0;
+    }
+    var->values[i] = (char*)fetchdeps_arena_alloc(m->arena, end - start + 1);
+    if (!var->values[i])
+      goto failure;
+    memcpy(var->values[i], start, end - start);
+    start = end + 1;
+  }
+
+  m->num_combos *= var->num_values;
+  ++m->num_axes;
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  return 0;
+}
+
+
+bool_t
+fetchdeps_matrix_eval(matrix_t* m, parser_t* ctx)
+{
+  size_t stride;
+  size_t i;
+
+  assert(m != NULL);
+  assert(ctx != NULL);
+
+  stride = m->num_combos;
+  for (i = 0; i < m->num_axes; ++i) {
+    stride /= m->axes[i].num_values;
+    m->axes[i].stride = stride;
+  }
+
+  m->num_words = (m->num_combos + 63) / 64;
+  m->all = (uint64_t*)fetchdeps_arena_alloc(m->arena, m->num_words * sizeof(uint64_t));
+  if (!m->all)
+    return 0;
+  for (i = 0; i < m->num_combos; ++i)
+    fetchdeps_matrix_set(m->all, i);
+
+  return fetchdeps_matrix_eval_file(m, ctx, m->all);
+}
+
+
+void
+fetchdeps_matrix_print_table(matrix_t* m, FILE* out)
+{
+  size_t width;
+  size_t c, i;
+
+  assert(m != NULL);
+  assert(out != NULL);
+
+  width = 1;
+  for (c = m->num_combos; c >= 10; c /= 10)
+    ++width;
+
+  for (c = 0; c < m->num_combos; ++c) {
+    fprintf(out, "%*lu:", (int)width, (unsigned long)(c + 1));
+    for (i = 0; i < m->num_axes; ++i)
+      fprintf(out, " %s=%s", m->axes[i].name, fetchdeps_matrix_value(&m->axes[i], c));
+    fprintf(out, "\n");
+  }
+  fprintf(out, "\n");
+
+  for (c = 0; c < m->num_combos; ++c)
+    fprintf(out, "%*lu ", (int)width, (unsigned long)(c + 1));
+  fprintf(out, "\n");
+
+  for (i = 0; i < m->urls.num_entries; ++i) {
+    matrixentry_t* url = &m->urls.entries[i];
+    for (c = 0; c < m->num_combos; ++c)
+      fprintf(out, "%*s ", (int)width, fetchdeps_matrix_is_set(url->mask, c) ? "x" : "-");
+    fprintf(out, " %s\n", url->key);
+  }
+}
+
+
+void
+fetchdeps_matrix_print_json(matrix_t* m, FILE* out)
+{
+  size_t c, i;
+  bool_t first;
+
+  assert(m != NULL);
+  assert(out != NULL);
+
+  fprintf(out, "[");
+  for (c = 0; c < m->num_combos; ++c) {
+    fprintf(out, "%s\n  {\n    \"vars\": {", c ? "," : "");
+    for (i = 0; i < m->num_axes; ++i) {
+      fprintf(out, "%s", i ? ", " : "");
+      fetchdeps_matrix_print_json_string(out, m->axes[i].name);
+      fprintf(out, ": ");
+      fetchdeps_matrix_print_json_string(out, fetchdeps_matrix_value(&m->axes[i], c));
+    }
+    fprintf(out, "},\n    \"urls\": [");
+
+    first = 1;
+    for (i = 0; i < m->urls.num_entries; ++i) {
+      matrixentry_t* url = &m->urls.entries[i];
+      if (!fetchdeps_matrix_is_set(url->mask, c))
+        continue;
+      fprintf(out, "%s\n      ", first ? "" : ",");
+      fetchdeps_matrix_print_json_string(out, url->key);
+      first = 0;
+    }
+    fprintf(out, "%s]\n  }", first ? "" : "\n    ");
+  }
+  fprintf(out, "\n]\n");
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_matrix_eval_file(matrix_t* m, parser_t* file, uint64_t* mask)
+{
+  bool_t ok;
+
+  if (!fetchdeps_ast_compile(file->ast))
+    return 0;
+
+  file->evaluating = 1;
+  ok = fetchdeps_matrix_eval_block(m, file, file->ast->root, mask);
+  file->evaluating = 0;
+  return ok;
+}
+
+
+bool_t
+fetchdeps_matrix_eval_block(matrix_t* m, parser_t* file, ast_stmt_t* stmt, uint64_t* mask)
+{
+  size_t i, w;
+
+  for (; stmt; stmt = stmt->next) {
+    if (stmt->kind == STMT_URL) {
+      if (!fetchdeps_matrix_eval_url(m, file, stmt, mask))
+        return 0;
+    }
+    else if (stmt->kind == STMT_INCLUDE) {
+      if (!fetchdeps_parser_check_include(file, stmt) ||
+          !fetchdeps_matrix_eval_file(m, stmt->included, mask))
+        return 0;
+    }
+    else {
+      uint64_t* cond_mask;
+      uint64_t* body_mask;
+
+      i = fetchdeps_matrix_eval_cond(m, file, stmt->cond);
+      if (i == kNoEntry)
+        return 0;
+      cond_mask = m->conds.entries[i].mask;
+
+      body_mask = (uint64_t*)fetchdeps_arena_alloc(m->arena, m->num_words * sizeof(uint64_t));
+      if (!body_mask)
+        return 0;
+      for (w = 0; w < m->num_words; ++w)
+        body_mask[w] = mask[w] & cond_mask[w];
+
+      if (!fetchdeps_matrix_is_empty(m, body_mask) &&
+          !fetchdeps_matrix_eval_block(m, file, stmt->body, body_mask))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+bool_t
+fetchdeps_matrix_eval_url(matrix_t* m, parser_t* file, ast_stmt_t* stmt, uint64_t* mask)
+{
+  uint64_t* url_mask;
+  size_t i, w;
+  bool_t added;
+
+  if (stmt->url_template)
+    return fetchdeps_matrix_eval_template(m, file, stmt, mask);
+
+  i = fetchdeps_matrix_lookup(m, &m->urls, stmt->url, strlen(stmt->url), &added);
+  if (i == kNoEntry)
+    return 0;
+  url_mask = m->urls.entries[i].mask;
+  for (w = 0; w < m->num_words; ++w)
+    url_mask[w] |= mask[w];
+  return 1;
+}
+
+
+bool_t
+fetchdeps_matrix_eval_template(matrix_t* m, parser_t* file, ast_stmt_t* stmt, uint64_t* mask)
+{
+  urltemplate_t* t = stmt->url_template;
+  matrixexpansion_t exp;
+  size_t i;
+
+  exp.m = m;
+  exp.file = file;
+  exp.stmt = stmt;
+  exp.mask = mask;
+  exp.combo = 0;
+
+  // A template which only uses ordinary variables expands the same way for
+  // every combination, so it only needs doing once.
+  for (i = 0; i < t->num_segments && exp.mask; ++i) {
+    if (t->segments[i].is_var && fetchdeps_matrix_find_var(m, (char*)t->segments[i].text))
+      exp.mask = NULL;
+  }
+  if (exp.mask) {
+    return fetchdeps_template_expand(t, fetchdeps_matrix_lookup_var, &exp,
+                                     fetchdeps_matrix_emit_url, &exp,
+                                     &m->expand_buf, &m->expand_capacity);
+  }
+
+  for (exp.combo = 0; exp.combo < m->num_combos; ++exp.combo) {
+    if (fetchdeps_matrix_is_set(mask, exp.combo) &&
+        !fetchdeps_template_expand(t, fetchdeps_matrix_lookup_var, &exp,
+                                   fetchdeps_matrix_emit_url, &exp,
+                                   &m->expand_buf, &m->expand_capacity))
+      return 0;
+  }
+  return 1;
+}
+
+
+stringset_t*
+fetchdeps_matrix_lookup_var(void* arg, const char* name)
+{
+  matrixexpansion_t* exp = (matrixexpansion_t*)arg;
+  matrix_t* m = exp->m;
+  matrixvar_t* var;
+  stringset_t* value;
+  size_t v;
+
+  var = fetchdeps_matrix_find_var(m, (char*)name);
+  if (!var) {
+    value = fetchdeps_varmap_get(m->vars, (char*)name);
+    if (!value)
+      fetchdeps_parser_report(exp->file, exp->stmt->line, exp->stmt->first_column, exp->stmt->last_column, "unknown variable in URL");
+    return value;
+  }
+
+  // Running out of memory here mustn't look like an unknown variable, so the
+  // error is set before handing back NULL.
+  if (!var->sets) {
+    var->sets = (stringset_t**)fetchdeps_arena_alloc(m->arena, var->num_values * sizeof(stringset_t*));
+    if (!var->sets) {
+      fetchdeps_errors_trap_system_error();
+      return NULL;
+    }
+  }
+  v = (exp->combo / var->stride) % var->num_values;
+  if (!var->sets[v]) {
+    var->sets[v] = fetchdeps_stringset_new_single(var->values[v]);
+    if (!var->sets[v])
+      fetchdeps_errors_trap_system_error();
+  }
+  return var->sets[v];
+}
+
+
+bool_t
+fetchdeps_matrix_emit_url(void* arg, char* url, size_t len)
+{
+  matrixexpansion_t* exp = (matrixexpansion_t*)arg;
+  matrix_t* m = exp->m;
+  matrixentry_t* entry;
+  size_t i, w;
+  bool_t added;
+
+  i = fetchdeps_matrix_lookup(m, &m->urls, url, len, &added);
+  if (i == kNoEntry)
+    return 0;
+
+  // The expansion is about to be overwritten, so the entry needs its own copy.
+  entry = &m->urls.entries[i];
+  if (added) {
+    entry->key = fetchdeps_arena_strdup(m->arena, url);
+    if (!entry->key)
+      return 0;
+  }
+
+  if (!exp->mask) {
+    fetchdeps_matrix_set(entry->mask, exp->combo);
+    return 1;
+  }
+  for (w = 0; w < m->num_words; ++w)
+    entry->mask[w] |= exp->mask[w];
+  return 1;
+}
+
+
+size_t
+fetchdeps_matrix_eval_cond(matrix_t* m, parser_t* file, ast_cond_t* cond)
+{
+  if (cond->op == COND_AND || cond->op == COND_OR)
+    return fetchdeps_matrix_eval_binary(m, file, cond);
+  else
+    return fetchdeps_matrix_eval_relation(m, file, cond);
+}
+
+
+size_t
+fetchdeps_matrix_eval_relation(matrix_t* m, parser_t* file, ast_cond_t* cond)
+{
+  matrixvar_t* var;
+  stringset_t* value = NULL;
+  ast_value_t* v;
+  matrixentry_t* entry;
+  char op;
+  size_t len = 0;
+  size_t i, c;
+  bool_t added;
+
+  var = fetchdeps_matrix_find_var(m, cond->var);
+  if (!var) {
+    value = fetchdeps_varmap_get(m->vars, cond->var);
+    if (!value) {
+      fetchdeps_parser_report(file, cond->line, cond->first_column, cond->last_column, "unknown variable");
+      return kNoEntry;
+    }
+  }
+
+  // The key is the operator, the variable name and the values, each with its
+  // terminating nul, so identical relations anywhere in any of the files share
+  // one entry.
+  op = (cond->op == COND_IN) ? 'I' : 'N';
+  if (!fetchdeps_matrix_append_key(m, &len, &op, 1) ||
+      !fetchdeps_matrix_append_key(m, &len, cond->var, strlen(cond->var) + 1))
+    return kNoEntry;
+  for (v = cond->values; v; v = v->next) {
+    if (!fetchdeps_matrix_append_key(m, &len, v->str, strlen(v->str) + 1))
+      return kNoEntry;
+  }
+
+  i = fetchdeps_matrix_lookup(m, &m->conds, m->scratch, len, &added);
+  if (i == kNoEntry || !added)
+    return i;
+
+  entry = &m->conds.entries[i];
+  entry->key = (char*)fetchdeps_arena_alloc(m->arena, len);
+  if (!entry->key)
+    return kNoEntry;
+  memcpy((char*)entry->key, m->scratch, len);
+
+  if (var) {
+    // Each of the variable's values only needs looking up once.
+    bool_t* holds = (bool_t*)fetchdeps_arena_alloc(m->arena, var->num_values * sizeof(bool_t));
+    if (!holds)
+      return kNoEntry;
+    for (c = 0; c < var->num_values; ++c)
+      holds[c] = fetchdeps_matrix_relation_holds(cond, fetchdeps_vocab_find(file->ast->values, var->values[c]));
+    for (c = 0; c < m->num_combos; ++c) {
+      if (holds[(c / var->stride) % var->num_values])
+        fetchdeps_matrix_set(entry->mask, c);
+    }
+  }
+  else {
+    size_t words = fetchdeps_vocab_words(file->ast->values);
+    uint64_t* bits;
+    bool_t found = 0;
+
+    bits = (uint64_t*)fetchdeps_arena_alloc(m->arena, words * sizeof(uint64_t));
+    if (!bits || !fetchdeps_vocab_set_bits(file->ast->values, value, bits))
+      return kNoEntry;
+    for (c = 0; c < words && !found; ++c)
+      found = (bits[c] & cond->value_bits[c]) != 0;
+    if (found == (cond->op == COND_IN))
+      memcpy(entry->mask, m->all, m->num_words * sizeof(uint64_t));
+  }
+  return i;
+}
+
+
+size_t
+fetchdeps_matrix_eval_binary(matrix_t* m, parser_t* file, ast_cond_t* cond)
+{
+  uint64_t* lhs_mask;
+  uint64_t* rhs_mask;
+  matrixentry_t* entry;
+  char op;
+  size_t lhs, rhs, i, w;
+  size_t len = 0;
+  bool_t added;
+
+  lhs = fetchdeps_matrix_eval_cond(m, file, cond->lhs);
+  if (lhs == kNoEntry)
+    return kNoEntry;
+
+  // Short circuit, as fetchdeps_parser_eval_cond does: the right hand side is
+  // only looked at if it matters for at least one combination.
+  lhs_mask = m->conds.entries[lhs].mask;
+  if (cond->op == COND_AND && fetchdeps_matrix_is_empty(m, lhs_mask))
+    return lhs;
+  if (cond->op == COND_OR && memcmp(lhs_mask, m->all, m->num_words * sizeof(uint64_t)) == 0)
+    return lhs;
+
+  rhs = fetchdeps_matrix_eval_cond(m, file, cond->rhs);
+  if (rhs == kNoEntry)
+    return kNoEntry;
+
+  // Both sides already have entries, so their indexes identify them.
+  op = (cond->op == COND_AND) ? 'A' : 'O';
+  if (!fetchdeps_matrix_append_key(m, &len, &op, 1) ||
+      !fetchdeps_matrix_append_key(m, &len, &lhs, sizeof(lhs)) ||
+      !fetchdeps_matrix_append_key(m, &len, &rhs, sizeof(rhs)))
+    return kNoEntry;
+
+  i = fetchdeps_matrix_lookup(m, &m->conds, m->scratch, len, &added);
+  if (i == kNoEntry || !added)
+    return i;
+
+  entry = &m->conds.entries[i];
+  entry->key = (char*)fetchdeps_arena_alloc(m->arena, len);
+  if (!entry->key)
+    return kNoEntry;
+  memcpy((char*)entry->key, m->scratch, len);
+
+  lhs_mask = m->conds.entries[lhs].mask;
+  rhs_mask = m->conds.entries[rhs].mask;
+  for (w = 0; w < m->num_words; ++w) {
+    if (cond->op == COND_AND)
+      entry->mask[w] = lhs_mask[w] & rhs_mask[w];
+    else
+      entry->mask[w] = lhs_mask[w] | rhs_mask[w];
+  }
+  return i;
+}
+
+
+bool_t
+fetchdeps_matrix_relation_holds(ast_cond_t* cond, int value_id)
+{
+  bool_t found;
+
+  // A value that isn't in the vocabulary doesn't appear in any relation.
+  found = value_id >= 0 && ((cond->value_bits[value_id / 64] >> (value_id % 64)) & 1);
+  return found == (cond->op == COND_IN);
+}
+
+
+matrixvar_t*
+fetchdeps_matrix_find_var(matrix_t* m, char* name)
+{
+  size_t i;
+
+  for (i = 0; i < m->num_axes; ++i) {
+    if (strcmp(m->axes[i].name, name) == 0)
+      return &m->axes[i];
+  }
+  return NULL;
+}
+
+
+bool_t
+fetchdeps_matrix_append_key(matrix_t* m, size_t* len, const void* data, size_t data_len)
+{
+  if (*len + data_len > m->scratch_capacity) {
+    size_t new_capacity = m->scratch_capacity ? m->scratch_capacity : 256;
+    char* new_scratch;
+    while (new_capacity < *len + data_len)
+      new_capacity *= 2;
+    new_scratch = (char*)fetchdeps_alloc_realloc(ALLOC_MATRIX, m->scratch, new_capacity);
+    if (!new_scratch)
+      return 0;
+    m->scratch = new_scratch;
+    m->scratch_capacity = new_capacity;
+  }
+
+  memcpy(m->scratch + *len, data, data_len);
+  *len += data_len;
+  return 1;
+}
+
+
+size_t
+fetchdeps_matrix_lookup(matrix_t* m, matrixtable_t* t, const char* key, size_t key_len, bool_t* added)
+{
+  matrixentry_t* entry;
+  uint64_t hash;
+  size_t slot;
+
+  *added = 0;
+  hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, key, key_len);
+
+  if (t->num_slots) {
+    for (slot = hash & (t->num_slots - 1); t->slots[slot]; slot = (slot + 1) & (t->num_slots - 1)) {
+      entry = &t->entries[t->slots[slot] - 1];
+      if (entry->hash == hash && entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0)
+        return t->slots[slot] - 1;
+    }
+  }
+
+  // Not there, so add it. Keep the index no more than half full.
+  if (t->num_entries == t->entries_capacity) {
+    size_t new_capacity = t->entries_capacity ? t->entries_capacity * 2 : 32;
+    matrixentry_t* new_entries = (matrixentry_t*)fetchdeps_alloc_realloc(ALLOC_MATRIX, t->entries, new_capacity * sizeof(matrixentry_t));
+    if (!new_entries)
+      return kNoEntry;
+    t->entries = new_entries;
+    t->entries_capacity = new_capacity;
+  }
+  if ((t->num_entries + 1) * 2 > t->num_slots && !fetchdeps_matrix_grow_slots(t))
+    return kNoEntry;
+
+  entry = &t->entries[t->num_entries];
+  entry->key = key;
+  entry->key_len = key_len;
+  entry->hash = hash;
+  entry->mask = (uint64_t*)fetchdeps_arena_alloc(m->arena, m->num_words * sizeof(uint64_t));
+  if (!entry->mask)
+    return kNoEntry;
+
+  for (slot = hash & (t->num_slots - 1); t->slots[slot]; slot = (slot + 1) & (t->num_slots - 1))
+    ;
+  t->slots[slot] = ++t->num_entries;
+  *added = 1;
+  return t->num_entries - 1;
+}
+
+
+bool_t
+fetchdeps_matrix_grow_slots(matrixtable_t* t)
+{
+  size_t new_num_slots = t->num_slots ? t->num_slots * 2 : kMinTableSlots;
+  size_t* new_slots;
+  size_t i, slot;
+
+  new_slots = (size_t*)fetchdeps_alloc_calloc(ALLOC_MATRIX, new_num_slots, sizeof(size_t));
+  if (!new_slots)
+    return 0;
+
+  for (i = 0; i < t->num_entries; ++i) {
+    for (slot = t->entries[i].hash & (new_num_slots - 1); new_slots[slot]; slot = (slot + 1) & (new_num_slots - 1))
+      ;
+    new_slots[slot] = i + 1;
+  }
+
+  if (t->slots)
+    fetchdeps_alloc_free(t->slots);
+  t->slots = new_slots;
+  t->num_slots = new_num_slots;
+  return 1;
+}
+
+
+void
+fetchdeps_matrix_free_table(matrixtable_t* t)
+{
+  if (t->entries)
+    fetchdeps_alloc_free(t->entries);
+  if (t->slots)
+    fetchdeps_alloc_free(t->slots);
+}
+
+
+
+bool_t
+fetchdeps_matrix_is_empty(matrix_t* m, uint64_t* mask)
+{
+  size_t w;
+
+  for (w = 0; w < m->num_words; ++w) {
+    if (mask[w])
+      return 0;
+  }
+  return 1;
+}
+
+
+bool_t
+fetchdeps_matrix_is_set(uint64_t* mask, size_t combo)
+{
+  return (mask[combo / 64] >> (combo % 64)) & 1;
+}
+
+
+void
+fetchdeps_matrix_set(uint64_t* mask, size_t combo)
+{
+  mask[combo / 64] |= (uint64_t)1 << (combo % 64);
+}
+
+
+char*
+fetchdeps_matrix_value(matrixvar_t* var, size_t combo)
+{
+  return var->values[(combo / var->stride) % var->num_values];
+}
+
+
+void
+fetchdeps_matrix_print_json_string(FILE* out, const char* str)
+{
+  const unsigned char* ch;
+
+  fputc('"', out);
+  for (ch = (const unsigned char*)str; *ch; ++ch) {
+    if (*ch == '"' || *ch == '\\')
+      fprintf(out, "\\%c", *ch);
+    else if (*ch < 0x20)
+      fprintf(out, "\\u%04x", *ch);
+    else
+      fputc(*ch, out);
+  }
+  fputc('"', out);
+}
+
@@ -0,0 +1,59 @@
+#ifndef fetchdeps_matrix_h
+#define fetchdeps_matrix_h
+
+#include "ast.h"
+#include "common.h"
+#include "parse.h"
+#include "varmap.h"
+
+#include <stdio.h>
+
+//
+// Types
+//
+
+// The URLs a deps file gives for every combination of values of some
+// variables, e.g. every os with every bits. The file is evaluated once for all
+// of the combinations together: each condition is worked out for all of them
+// at once as a bitmask with one bit per combination, and conditions which
+// appear more than once in the file are only worked out the first time.
+// Sections are skipped as soon as no combination reaches them.
+struct _matrix;
+typedef struct _matrix matrix_t;
+
+
+//
+// Functions
+//
+
+// Create an empty matrix. Variables which aren't given any values with
+// fetchdeps_matrix_add_var are looked up in 'vars', which must outlive the
+// matrix. Returns NULL if memory couldn't be allocated. The matrix must
+// eventually be freed with fetchdeps_matrix_free.
+matrix_t* fetchdeps_matrix_new(varmap_t* vars);
+
+// Deallocate the matrix.
+void fetchdeps_matrix_free(matrix_t* m);
+
+// Add a variable to the matrix from a command line argument of the form
+// "name=value1,value2,...". Returns false, with the error set, if the
+// argument isn't in that form, names a variable which has already been added,
+// or would make too many combinations.
+bool_t fetchdeps_matrix_add_var(matrix_t* m, char* spec);
+
+// Evaluate the file built by fetchdeps_parser_build, and the files it
+// includes, for every combination. As with fetchdeps_parser_eval, only the
+// sections reached by at least one combination are looked at. Returns false
+// if a condition refers to a variable which doesn't exist, files include each
+// other in a cycle, or memory couldn't be allocated.
+bool_t fetchdeps_matrix_eval(matrix_t* m, parser_t* ctx);
+
+// Print the results of fetchdeps_matrix_eval. The table has a numbered column
+// for each combination and a row for each URL, in the order they first appear
+// in the deps file. The JSON has an object for each combination, holding its
+// variables and its list of URLs.
+void fetchdeps_matrix_print_table(matrix_t* m, FILE* out);
+void fetchdeps_matrix_print_json(matrix_t* m, FILE* out);
+
+#endif // fetchdeps_matrix_h
+
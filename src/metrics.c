@@ -0,0 +1,240 @@
+#include "metrics.h"
+
+#include "alloc.h"
+#include "errors.h"
+#include "trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+
+//
+// Constants
+//
+
+static const struct {
+  const char* name;
+  const char* help;
+} kCounters[] = {
+  { "fetchdeps_downloads",          "Downloads which completed." },
+  { "fetchdeps_download_failures",  "Downloads which failed." },
+  { "fetchdeps_download_bytes",     "Bytes downloaded." },
+  { "fetchdeps_parse_cache_hits",   "Deps files loaded from the compiled cache." },
+  { "fetchdeps_parse_cache_misses", "Deps files which had to be parsed." },
+  { "fetchdeps_extractions",        "Downloaded files installed." },
+  { "fetchdeps_extracted_files",    "Files written while installing." },
+};
+
+static const struct {
+  const char* name;
+  const char* help;
+} kHistograms[] = {
+  { "fetchdeps_transfer_duration_seconds", "How long each download took." },
+  { "fetchdeps_extract_duration_seconds",  "How long each downloaded file took to install." },
+  { "fetchdeps_parse_duration_seconds",    "How long each deps file took to parse, includes and all." },
+};
+
+// The upper bounds of the histogram buckets, in microseconds. There's an
+// extra bucket on the end for anything longer.
+static const uint64_t kBuckets[] = {
+  1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+  1000000, 2500000, 5000000, 10000000, 30000000, 60000000, 300000000
+};
+#define kNumBuckets (sizeof(kBuckets) / sizeof(kBuckets[0]))
+
+
+//
+// Types
+//
+
+// The buckets aren't cumulative here; they're added up when written out.
+struct _histodata {
+  uint64_t buckets[kNumBuckets + 1];
+  uint64_t count;
+  uint64_t sum;   // In microseconds.
+};
+typedef struct _histodata histodata_t;
+
+
+//
+// Forward declarations
+//
+
+void fetchdeps_metrics_write_all(FILE* out);
+void fetchdeps_metrics_write_seconds(FILE* out, uint64_t micros);
+
+
+//
+// Global variables
+//
+
+// Set before any other threads start.
+static bool_t gMetricsEnabled = 0;
+
+static uint64_t gCounters[kNumCounters];
+static histodata_t gHistograms[kNumHistograms];
+
+
+//
+// Public functions
+//
+
+void
+fetchdeps_metrics_enable()
+{
+  gMetricsEnabled = 1;
+}
+
+
+void
+fetchdeps_metrics_count(counter_t counter, uint64_t n)
+{
+  assert(counter < kNumCounters);
+
+  if (!gMetricsEnabled)
+    return;
+  __atomic_add_fetch(&gCounters[counter], n, __ATOMIC_RELAXED);
+}
+
+
+void
+fetchdeps_metrics_observe(histogram_t histogram, uint64_t start)
+{
+  histodata_t* h;
+  uint64_t now, elapsed;
+  size_t i;
+
+  assert(histogram < kNumHistograms);
+
+  if (!gMetricsEnabled)
+    return;
+
+  now = fetchdeps_trace_now();
+  elapsed = now > start ? now - start : 0;
+  for (i = 0; i < kNumBuckets && elapsed > kBuckets[i]; ++i)
+    ;
+
+  h = &gHistograms[histogram];
+  __atomic_add_fetch(&h->buckets[i], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->sum, elapsed, __ATOMIC_RELAXED);
+}
+
+
+bool_t
+fetchdeps_metrics_write(const char* fname)
+{
+  char* tmp_fname = NULL;
+  size_t len;
+  FILE* out = NULL;
+
+  assert(fname != NULL);
+
+  len = strlen(fname) + 5;
+  tmp_fname = (char*)fetchdeps_alloc_malloc(ALLOC_METRICS, len);
+  if (!tmp_fname)
+    goto failure;
+  snprintf(tmp_fname, len, "%s.tmp", fname);
+
+  out = fopen(tmp_fname, "w");
+  if (!out) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to create metrics file %s", tmp_fname);
+    goto failure;
+  }
+
+  fetchdeps_metrics_write_all(out);
+
+  if (ferror(out)) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to write metrics file %s", tmp_fname);
+    goto failure;
+  }
+  if (fclose(out) != 0) {
+    out = NULL;
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to write metrics file %s", tmp_fname);
+    goto failure;
+  }
+  out = NULL;
+
+  if (rename(tmp_fname, fname) != 0) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to rename %s to %s", tmp_fname, fname);
+    goto failure;
+  }
+
+  fetchdeps_alloc_free(tmp_fname);
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (out) {
+    fclose(out);
+    remove(tmp_fname);
+  }
+  if (tmp_fname)
+    fetchdeps_alloc_free(tmp_fname);
+  return 0;
+}
+
+
+//
+// Private functions
+//
+
+void
+fetchdeps_metrics_write_all(FILE* out)
+{
+  histodata_t h;
+  uint64_t total;
+  size_t i, j;
+
+  for (i = 0; i < kNumCounters; ++i) {
+    fprintf(out, "# TYPE %s counter\n", kCounters[i].name);
+    fprintf(out, "# HELP %s %s\n", kCounters[i].name, kCounters[i].help);
+    fprintf(out, "%s_total %llu\n", kCounters[i].name,
+            (unsigned long long)__atomic_load_n(&gCounters[i], __ATOMIC_RELAXED));
+  }
+
+  for (i = 0; i < kNumHistograms; ++i) {
+    // Take a copy first, so the buckets at least add up to the count even if
+    // other threads are still adding to them.
+    for (j = 0; j <= kNumBuckets; ++j)
+      h.buckets[j] = __atomic_load_n(&gHistograms[i].buckets[j], __ATOMIC_RELAXED);
+    h.sum = __atomic_load_n(&gHistograms[i].sum, __ATOMIC_RELAXED);
+
+    fprintf(out, "# TYPE %s histogram\n", kHistograms[i].name);
+    fprintf(out, "# UNIT %s seconds\n", kHistograms[i].name);
+    fprintf(out, "# HELP %s %s\n", kHistograms[i].name, kHistograms[i].help);
+    total = 0;
+    for (j = 0; j < kNumBuckets; ++j) {
+      total += h.buckets[j];
+      fprintf(out, "%s_bucket{le=\"", kHistograms[i].name);
+      fetchdeps_metrics_write_seconds(out, kBuckets[j]);
+      fprintf(out, "\"} %llu\n", (unsigned long long)total);
+    }
+    total += h.buckets[kNumBuckets];
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", kHistograms[i].name, (unsigned long long)total);
+    fprintf(out, "%s_sum ", kHistograms[i].name);
+    fetchdeps_metrics_write_seconds(out, h.sum);
+    fprintf(out, "\n%s_count %llu\n", kHistograms[i].name, (unsigned long long)total);
+  }
+
+  fprintf(out, "# EOF\n");
+}
+
+
+// Write a number of microseconds as seconds, without any trailing zeros.
+void
+fetchdeps_metrics_write_seconds(FILE* out, uint64_t micros)
+{
+  char frac[8];
+  size_t len;
+
+  fprintf(out, "%llu", (unsigned long long)(micros / 1000000));
+  snprintf(frac, sizeof(frac), "%06llu", (unsigned long long)(micros % 1000000));
+  len = 6;
+  while (len > 0 && frac[len - 1] == '0')
+    --len;
+  frac[len] = '\0';
+  fprintf(out, ".%s", len > 0 ? frac : "0");
+}
+
@@ -0,0 +1,63 @@
+#ifndef fetchdeps_metrics_h
+#define fetchdeps_metrics_h
+
+#include "common.h"
+
+#include <stdint.h>
+
+//
+// Types
+//
+
+// Running totals. Keep kCounters in metrics.c in step.
+enum _counter {
+  COUNTER_DOWNLOADS,          // Transfers which completed.
+  COUNTER_DOWNLOAD_FAILURES,  // Transfers which didn't.
+  COUNTER_DOWNLOAD_BYTES,
+  COUNTER_CACHE_HITS,         // Deps files loaded from the compiled cache...
+  COUNTER_CACHE_MISSES,       // ...and ones which had to be parsed.
+  COUNTER_EXTRACTIONS,
+  COUNTER_EXTRACTED_FILES,
+  kNumCounters
+};
+typedef enum _counter counter_t;
+
+
+// Durations, in seconds, counted into buckets. Keep kHistograms in metrics.c
+// in step.
+enum _histogram {
+  HISTOGRAM_TRANSFER,         // Each download.
+  HISTOGRAM_EXTRACT,          // Each downloaded file installed.
+  HISTOGRAM_PARSE,            // Each parse of a deps file and its includes.
+  kNumHistograms
+};
+typedef enum _histogram histogram_t;
+
+
+//
+// Functions
+//
+
+// Metrics are figures about the run which are written out in the OpenMetrics
+// text format, for a scraper such as node-exporter's textfile collector to
+// pick up. Until fetchdeps_metrics_enable is called nothing is recorded, and
+// the functions below return straight away. They're safe to call from any
+// thread.
+
+// Start recording metrics.
+void fetchdeps_metrics_enable();
+
+// Add 'n' to a counter.
+void fetchdeps_metrics_count(counter_t counter, uint64_t n);
+
+// Add the time since 'start', from fetchdeps_trace_now, to a histogram.
+void fetchdeps_metrics_observe(histogram_t histogram, uint64_t start);
+
+// Write everything recorded so far to 'fname'. The file is written under a
+// temporary name and then renamed, so a scraper never sees half of it. Can be
+// called more than once; the counts carry on from where they were. Returns
+// false, with the error set, if the file couldn't be written.
+bool_t fetchdeps_metrics_write(const char* fname);
+
+#endif // fetchdeps_metrics_h
+
@@ -1,10 +1,18 @@
 #include "parse.h"
 
+#include "alloc.h"
 #include "errors.h"
+#include "filesys.h"
+#include "metrics.h"
 #include "stringset.h"
+#include "trace.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <libgen.h>   // For dirname().
+#include <limits.h>   // For PATH_MAX.
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,53 +27,839 @@
 #endif
 
 
+//
+// Types
+//
+
+// The included files waiting to be parsed by fetchdeps_parser_build_worker.
+struct _buildqueue {
+  pthread_mutex_t lock;
+  parser_t** files;
+  size_t next;
+  size_t end;
+  size_t num_failed;
+};
+typedef struct _buildqueue buildqueue_t;
+
+
+// Where the expansions of a URL template go.
+struct _expansion {
+  parser_t* ctx;
+  parser_t* file;
+  ast_stmt_t* stmt;
+  stringset_t* results;
+};
+typedef struct _expansion expansion_t;
+
+
+//
+// Forward declarations
+//
+
+parser_t* fetchdeps_parser_new_file(char* fname);
+bool_t fetchdeps_parser_build_all(parser_t* ctx);
+bool_t fetchdeps_parser_build_one(parser_t* file);
+bool_t fetchdeps_parser_resolve_includes(parser_t* ctx, parser_t* file, ast_stmt_t* stmt);
+bool_t fetchdeps_parser_find_include(parser_t* ctx, parser_t* file, ast_stmt_t* stmt);
+bool_t fetchdeps_parser_include_path(parser_t* file, ast_stmt_t* stmt, char* path);
+bool_t fetchdeps_parser_build_includes(parser_t* ctx, size_t start, size_t end);
+bool_t fetchdeps_parser_build_included(parser_t* file);
+void* fetchdeps_parser_build_worker(void* arg);
+bool_t fetchdeps_parser_reset_bits(parser_t* file);
+bool_t fetchdeps_parser_eval_file(parser_t* ctx, parser_t* file, stringset_t* results);
+bool_t fetchdeps_parser_eval_block(parser_t* ctx, parser_t* file, ast_stmt_t* stmt, stringset_t* results);
+bool_t fetchdeps_parser_eval_url(parser_t* ctx, parser_t* file, ast_stmt_t* stmt, stringset_t* results);
+bool_t fetchdeps_parser_add_url(parser_t* ctx, stringset_t* results, char* url);
+stringset_t* fetchdeps_parser_lookup_var(void* arg, const char* name);
+bool_t fetchdeps_parser_emit_url(void* arg, char* url, size_t len);
+int fetchdeps_parser_eval_cond(parser_t* ctx, parser_t* file, ast_cond_t* cond);
+uint64_t* fetchdeps_parser_var_bits(parser_t* ctx, parser_t* file, ast_cond_t* cond);
+bool_t fetchdeps_parser_add_filter(parser_t* ctx, char* url, filter_t* filter);
+
+
 //
 // Public functions
 //
 
 parser_t*
 fetchdeps_parser_new(char* fname)
+{
+  parser_t* ctx;
+
+  ctx = fetchdeps_parser_new_file(fname);
+  if (!ctx)
+    return NULL;
+
+  ctx->vars = fetchdeps_varmap_new();
+  if (!ctx->vars) {
+    fetchdeps_errors_trap_system_error();
+    fetchdeps_parser_free(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+
+void 
+fetchdeps_parser_free(parser_t* ctx)
+{
+  size_t i;
+
+  if (ctx->data)
+    fetchdeps_alloc_free(ctx->data);
+  if (ctx->vars)
+    fetchdeps_varmap_free(ctx->vars);
+  if (ctx->ast)
+    fetchdeps_ast_free(ctx->ast);
+  if (ctx->fname)
+    fetchdeps_alloc_free(ctx->fname);
+  if (ctx->real_path)
+    free(ctx->real_path);
+  if (ctx->cache_file)
+    fetchdeps_alloc_free(ctx->cache_file);
+  if (ctx->filters)
+    fetchdeps_alloc_free(ctx->filters);
+  if (ctx->var_bits)
+    fetchdeps_alloc_free(ctx->var_bits);
+  if (ctx->var_found)
+    fetchdeps_alloc_free(ctx->var_found);
+  for (i = 0; i < ctx->num_includes; ++i)
+    fetchdeps_parser_free(ctx->includes[i]);
+  if (ctx->includes)
+    fetchdeps_alloc_free(ctx->includes);
+  if (ctx->expand_buf)
+    fetchdeps_alloc_free(ctx->expand_buf);
+  if (ctx->held_reports)
+    fetchdeps_alloc_free(ctx->held_reports);
+  fetchdeps_alloc_free(ctx);
+}
+
+
+bool_t
+fetchdeps_parser_parse(parser_t* ctx, stringset_t* results)
+{
+  assert(ctx != NULL);
+  assert(results != NULL);
+
+  if (!fetchdeps_parser_build(ctx))
+    return 0;
+  if (!fetchdeps_parser_eval(ctx, results)) {
+    // Problems in the file are only reported, but anything else has already
+    // set the error.
+    if (fetchdeps_errors_get() == ERR_NONE)
+      fetchdeps_errors_set(ERR_PARSE);
+    return 0;
+  }
+  return 1;
+}
+
+
+bool_t
+fetchdeps_parser_build(parser_t* ctx)
+{
+  bool_t ok;
+  uint64_t start = fetchdeps_trace_now();
+
+  assert(ctx != NULL);
+
+  fetchdeps_trace_begin("parse", ctx->fname);
+  ok = fetchdeps_parser_build_all(ctx);
+  if (ok)
+    fetchdeps_metrics_observe(HISTOGRAM_PARSE, start);
+  fetchdeps_trace_end();
+  return ok;
+}
+
+
+void
+fetchdeps_parser_set_workers(parser_t* ctx, int num_workers)
+{
+  assert(ctx != NULL);
+  assert(num_workers > 0);
+
+  ctx->num_workers = num_workers;
+}
+
+
+bool_t
+fetchdeps_parser_set_cache(parser_t* ctx, char* cache_file, bool_t writable)
+{
+  char* copy;
+
+  assert(ctx != NULL);
+  assert(cache_file != NULL);
+
+  copy = fetchdeps_alloc_strdup(ALLOC_PARSE, cache_file);
+  if (!copy)
+    return 0;
+  if (ctx->cache_file)
+    fetchdeps_alloc_free(ctx->cache_file);
+  ctx->cache_file = copy;
+  ctx->cache_writable = writable;
+  return 1;
+}
+
+
+filter_t*
+fetchdeps_parser_get_filter(parser_t* ctx, char* url)
+{
+  size_t i;
+
+  assert(ctx != NULL);
+  assert(url != NULL);
+
+  for (i = ctx->num_filters; i > 0; --i) {
+    urlfilter_t* entry = &ctx->filters[i - 1];
+    if (strcmp(entry->url, url) == 0)
+      return entry->filter;
+  }
+  return NULL;
+}
+
+
+bool_t
+fetchdeps_parser_load_cache(parser_t* ctx, cache_key_t* key)
+{
+  ast_t* fresh;
+
+  assert(ctx != NULL);
+  assert(key != NULL);
+
+  if (!ctx->cache_file)
+    return 0;
+  if (fetchdeps_cache_load(ctx->ast, ctx->cache_file, key)) {
+    fetchdeps_metrics_count(COUNTER_CACHE_HITS, 1);
+    return 1;
+  }
+  fetchdeps_metrics_count(COUNTER_CACHE_MISSES, 1);
+
+  // A failed load may have left some nodes behind, so start again.
+  fresh = fetchdeps_ast_new();
+  if (!fresh)
+    return 0;
+  fetchdeps_ast_free(ctx->ast);
+  ctx->ast = fresh;
+  return 0;
+}
+
+
+void
+fetchdeps_parser_save_cache(parser_t* ctx, cache_key_t* key)
+{
+  assert(ctx != NULL);
+  assert(key != NULL);
+
+  if (ctx->cache_file && ctx->cache_writable)
+    fetchdeps_cache_save(ctx->ast, ctx->cache_file, key);
+}
+
+
+void
+fetchdeps_parser_report(parser_t* ctx, int line, int first_column, int last_column, const char* msg)
+{
+  assert(ctx != NULL);
+  assert(msg != NULL);
+
+  if (ctx->hold_reports) {
+    const char* format = "%s: [line %d, cols %d - %d] %s\n";
+    int len = snprintf(NULL, 0, format, ctx->fname, line, first_column, last_column, msg);
+    char* held;
+
+    // If there's no memory for the message, it's lost; the file still counts
+    // as having failed.
+    if (len < 0)
+      return;
+    held = (char*)fetchdeps_alloc_realloc(ALLOC_PARSE, ctx->held_reports, ctx->held_len + len + 1);
+    if (!held)
+      return;
+    snprintf(held + ctx->held_len, len + 1, format, ctx->fname, line, first_column, last_column, msg);
+    ctx->held_reports = held;
+    ctx->held_len += len;
+    return;
+  }
+
+  if (ctx->top)
+    fprintf(stderr, "%s: ", ctx->fname);
+  fprintf(stderr, "[line %d, cols %d - %d] %s\n", line, first_column, last_column, msg);
+}
+
+
+bool_t
+fetchdeps_parser_check_include(parser_t* file, ast_stmt_t* stmt)
+{
+  char path[PATH_MAX + 1];
+  char* real_path;
+  parser_t* inc = stmt->included;
+
+  assert(file != NULL);
+  assert(stmt != NULL);
+
+  if (inc && !inc->failed) {
+    // A file which is already being evaluated further up the stack would
+    // include itself again, forever.
+    if (inc->evaluating) {
+      fetchdeps_parser_report(file, stmt->line, stmt->first_column, stmt->last_column, "include cycle");
+      return 0;
+    }
+    return 1;
+  }
+
+  if (inc) {
+    if (inc->held_reports)
+      fputs(inc->held_reports, stderr);
+    return 0;
+  }
+
+  if (!fetchdeps_parser_include_path(file, stmt, path)) {
+    fetchdeps_parser_report(file, stmt->line, stmt->first_column, stmt->last_column, "included file path is too long");
+    fetchdeps_errors_set(ERR_PARSE);
+    return 0;
+  }
+
+  // Look again, so that the error says why the file couldn't be opened.
+  real_path = realpath(path, NULL);
+  if (real_path) {
+    free(real_path);
+    errno = ENOENT;
+  }
+  fetchdeps_parser_report(file, stmt->line, stmt->first_column, stmt->last_column, "unable to open included file");
+  fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to open deps file %s", path);
+  return 0;
+}
+
+
+bool_t
+fetchdeps_parser_eval(parser_t* ctx, stringset_t* results)
+{
+  size_t i;
+  bool_t ok;
+
+  assert(ctx != NULL);
+  assert(results != NULL);
+
+  fetchdeps_trace_begin("evaluate", NULL);
+  ok = fetchdeps_parser_reset_bits(ctx);
+  for (i = 0; ok && i < ctx->num_includes; ++i) {
+    if (!ctx->includes[i]->failed)
+      ok = fetchdeps_parser_reset_bits(ctx->includes[i]);
+  }
+  if (ok)
+    ok = fetchdeps_parser_eval_file(ctx, ctx, results);
+  fetchdeps_trace_end();
+  return ok;
+}
+
+
+bool_t
+fetchdeps_parser_eval_each(parser_t* ctx, stringset_t* results, parser_url_fn fn, void* arg)
+{
+  bool_t ok;
+
+  assert(ctx != NULL);
+  assert(results != NULL);
+  assert(fn != NULL);
+
+  ctx->url_fn = fn;
+  ctx->url_arg = arg;
+  ok = fetchdeps_parser_eval(ctx, results);
+  ctx->url_fn = NULL;
+  ctx->url_arg = NULL;
+  return ok;
+}
+
+
+//
+// Private functions
+//
+
+// Everything fetchdeps_parser_new does apart from creating the varmap, which
+// included files don't need.
+parser_t*
+fetchdeps_parser_new_file(char* fname)
 {
   parser_t* ctx = NULL;
 
-  ctx = (parser_t*)calloc(1, sizeof(parser_t));
+  ctx = (parser_t*)fetchdeps_alloc_calloc(ALLOC_PARSE, 1, sizeof(parser_t));
   if (!ctx)
     goto failure;
 
-  ctx->vars = fetchdeps_varmap_new();
-  if (!ctx->vars)
+  ctx->ast = fetchdeps_ast_new();
+  if (!ctx->ast)
+    goto failure;
+
+  ctx->fname = fetchdeps_alloc_strdup(ALLOC_PARSE, fname);
+  if (!ctx->fname)
     goto failure;
 
-  ctx->f = fopen(fname, "r");
-  if (!ctx->f) {
+  ctx->data = fetchdeps_filesys_read_file(fname, kParserPadding, &ctx->size);
+  if (!ctx->data) {
     fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to open deps file %s", fname);
     goto failure;
   }
 
+  // Something like /dev/stdin has no canonical path, but nothing else can
+  // be the same file as it either. Either way the string comes from the C
+  // library.
+  ctx->real_path = realpath(fname, NULL);
+  if (!ctx->real_path)
+    ctx->real_path = strdup(fname);
+  if (!ctx->real_path)
+    goto failure;
+  ctx->num_workers = fetchdeps_filesys_num_workers(0);
+
   ctx->indent_level = 0;
+  ctx->column = 1;
 
   return ctx;
 
 failure:
   fetchdeps_errors_trap_system_error();
   if (ctx) {
-    if (ctx->f)
-      fclose(ctx->f);
-    if (ctx->vars)
-      fetchdeps_varmap_free(ctx->vars);
-    free(ctx);
+    if (ctx->data)
+      fetchdeps_alloc_free(ctx->data);
+    if (ctx->ast)
+      fetchdeps_ast_free(ctx->ast);
+    if (ctx->fname)
+      fetchdeps_alloc_free(ctx->fname);
+    if (ctx->real_path)
+      free(ctx->real_path);
+    fetchdeps_alloc_free(ctx);
   }
   return NULL;
 }
 
 
-void 
-fetchdeps_parser_free(parser_t* ctx)
+bool_t
+fetchdeps_parser_build_all(parser_t* ctx)
 {
-  if (ctx->f)
-    fclose(ctx->f);
-  if (ctx->vars)
-    fetchdeps_varmap_free(ctx->vars);
-  free(ctx);
+  size_t start, end, i;
+
+  if (!fetchdeps_parser_build_one(ctx))
+    return 0;
+  if (!fetchdeps_parser_resolve_includes(ctx, ctx, ctx->ast->root))
+    return 0;
+
+  // Parse the included files a generation at a time: first everything the
+  // top level file includes, all in parallel, then everything those files
+  // include, and so on. Files which have already been seen aren't parsed
+  // again, which also stops include cycles from going round forever.
+  for (start = 0; start < ctx->num_includes; start = end) {
+    end = ctx->num_includes;
+    if (!fetchdeps_parser_build_includes(ctx, start, end))
+      return 0;
+    for (i = start; i < end; ++i) {
+      parser_t* file = ctx->includes[i];
+      file->hold_reports = 0;
+      if (!file->failed && !fetchdeps_parser_resolve_includes(ctx, file, file->ast->root))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+// Parse a single file, as its own phase in the trace.
+bool_t
+fetchdeps_parser_build_one(parser_t* file)
+{
+  bool_t ok;
+
+  fetchdeps_trace_begin("parse file", file->fname);
+  ok = fetchdeps_parser_build_file(file);
+  fetchdeps_trace_end();
+  return ok;
+}
+
+
+bool_t
+fetchdeps_parser_resolve_includes(parser_t* ctx, parser_t* file, ast_stmt_t* stmt)
+{
+  for (; stmt; stmt = stmt->next) {
+    if (stmt->kind == STMT_CONDITIONAL) {
+      if (!fetchdeps_parser_resolve_includes(ctx, file, stmt->body))
+        return 0;
+    }
+    else if (stmt->kind == STMT_INCLUDE) {
+      if (!fetchdeps_parser_find_include(ctx, file, stmt))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+// Point an include statement at the parser for the file it names, creating
+// the parser if the file hasn't been seen before. A file which can't be found
+// is left for fetchdeps_parser_check_include to report, in case nothing needs
+// it. Returns false if something else went wrong.
+bool_t
+fetchdeps_parser_find_include(parser_t* ctx, parser_t* file, ast_stmt_t* stmt)
+{
+  char path[PATH_MAX + 1];
+  char* real_path;
+  parser_t* inc;
+  size_t i;
+
+  stmt->included = NULL;
+  if (!fetchdeps_parser_include_path(file, stmt, path))
+    return 1;
+  real_path = realpath(path, NULL);
+  if (!real_path)
+    return 1;
+
+  inc = NULL;
+  if (strcmp(real_path, ctx->real_path) == 0)
+    inc = ctx;
+  for (i = 0; i < ctx->num_includes && !inc; ++i) {
+    if (strcmp(real_path, ctx->includes[i]->real_path) == 0)
+      inc = ctx->includes[i];
+  }
+  free(real_path);
+  if (inc) {
+    stmt->included = inc;
+    return 1;
+  }
+
+  if (ctx->num_includes == ctx->includes_capacity) {
+    size_t new_capacity = ctx->includes_capacity ? ctx->includes_capacity * 2 : 8;
+    parser_t** new_includes = (parser_t**)fetchdeps_alloc_realloc(ALLOC_PARSE, ctx->includes, new_capacity * sizeof(parser_t*));
+    if (!new_includes)
+      return 0;
+    ctx->includes = new_includes;
+    ctx->includes_capacity = new_capacity;
+  }
+
+  // Included files share the top level parser's variables.
+  inc = fetchdeps_parser_new_file(path);
+  if (!inc)
+    return 0;
+  inc->top = ctx;
+  inc->hold_reports = 1;
+  ctx->includes[ctx->num_includes++] = inc;
+  stmt->included = inc;
+  return 1;
+}
+
+
+// Work out the path of the file named by an include statement. Relative paths
+// are relative to the file doing the including. Returns false if the result
+// is too long.
+bool_t
+fetchdeps_parser_include_path(parser_t* file, ast_stmt_t* stmt, char* path)
+{
+  char dir[PATH_MAX + 1];
+
+  if (stmt->path[0] == '/')
+    return snprintf(path, PATH_MAX + 1, "%s", stmt->path) < PATH_MAX + 1;
+  return snprintf(dir, sizeof(dir), "%s", file->fname) < (int)sizeof(dir) &&
+         snprintf(path, PATH_MAX + 1, "%s/%s", dirname(dir), stmt->path) < PATH_MAX + 1;
+}
+
+
+bool_t
+fetchdeps_parser_build_includes(parser_t* ctx, size_t start, size_t end)
+{
+  buildqueue_t queue;
+  pthread_t* threads;
+  size_t num_threads, started, i;
+
+  queue.files = ctx->includes;
+  queue.next = start;
+  queue.end = end;
+  queue.num_failed = 0;
+
+  num_threads = end - start;
+  if (num_threads > (size_t)ctx->num_workers)
+    num_threads = (size_t)ctx->num_workers;
+
+  // Don't bother with threads if there's only one file.
+  if (num_threads < 2) {
+    for (i = start; i < end; ++i) {
+      if (!fetchdeps_parser_build_included(ctx->includes[i]))
+        return 0;
+    }
+    return 1;
+  }
+
+  threads = (pthread_t*)fetchdeps_alloc_calloc(ALLOC_PARSE, num_threads, sizeof(pthread_t));
+  if (!threads)
+    return 0;
+
+  pthread_mutex_init(&queue.lock, NULL);
+  started = 0;
+  for (i = 0; i < num_threads; ++i) {
+    if (pthread_create(&threads[i], NULL, fetchdeps_parser_build_worker, &queue) != 0)
+      break;
+    ++started;
+  }
+
+  // If no threads could be started at all, do the work on this one instead.
+  if (started == 0)
+    fetchdeps_parser_build_worker(&queue);
+
+  for (i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&queue.lock);
+  fetchdeps_alloc_free(threads);
+
+  // The workers' own errors are in the report.
+  if (queue.num_failed > 0) {
+    fetchdeps_errors_set_with_msg(ERR_PARSE, "%lu of %lu included files couldn't be parsed",
+                                  (unsigned long)queue.num_failed, (unsigned long)(end - start));
+    return 0;
+  }
+  return 1;
+}
+
+
+void*
+fetchdeps_parser_build_worker(void* arg)
+{
+  buildqueue_t* queue = (buildqueue_t*)arg;
+  parser_t* file;
+
+  fetchdeps_trace_name_thread("parse worker");
+  for (;;) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->next == queue->end) {
+      pthread_mutex_unlock(&queue->lock);
+      return NULL;
+    }
+    file = queue->files[queue->next++];
+    pthread_mutex_unlock(&queue->lock);
+
+    // Carry on with the other files after a failure, so that every file
+    // with a problem gets reported.
+    if (!fetchdeps_parser_build_included(file)) {
+      fetchdeps_errors_report();
+      pthread_mutex_lock(&queue->lock);
+      ++queue->num_failed;
+      pthread_mutex_unlock(&queue->lock);
+    }
+  }
+}
+
+
+// Parse an included file. One with errors in it is only a problem if it's
+// evaluated, so that's recorded in the parser rather than returned; the
+// return value is false if anything else went wrong.
+bool_t
+fetchdeps_parser_build_included(parser_t* file)
+{
+  if (fetchdeps_parser_build_one(file))
+    return 1;
+  if (fetchdeps_errors_get() != ERR_PARSE)
+    return 0;
+  fetchdeps_errors_clear();
+  file->failed = 1;
+  return 1;
+}
+
+
+bool_t
+fetchdeps_parser_reset_bits(parser_t* file)
+{
+  size_t num_vars, words;
+
+  if (!fetchdeps_ast_compile(file->ast))
+    return 0;
+
+  num_vars = fetchdeps_vocab_size(file->ast->vars);
+  words = fetchdeps_vocab_words(file->ast->values);
+  if (file->var_bits)
+    fetchdeps_alloc_free(file->var_bits);
+  if (file->var_found)
+    fetchdeps_alloc_free(file->var_found);
+  file->var_bits = (uint64_t*)fetchdeps_alloc_calloc(ALLOC_PARSE, num_vars * words + 1, sizeof(uint64_t));
+  file->var_found = (bool_t*)fetchdeps_alloc_calloc(ALLOC_PARSE, num_vars + 1, sizeof(bool_t));
+  return file->var_bits && file->var_found;
+}
+
+
+bool_t
+fetchdeps_parser_eval_file(parser_t* ctx, parser_t* file, stringset_t* results)
+{
+  bool_t ok;
+
+  file->evaluating = 1;
+  ok = fetchdeps_parser_eval_block(ctx, file, file->ast->root, results);
+  file->evaluating = 0;
+  return ok;
+}
+
+
+bool_t
+fetchdeps_parser_eval_block(parser_t* ctx, parser_t* file, ast_stmt_t* stmt, stringset_t* results)
+{
+  for (; stmt; stmt = stmt->next) {
+    if (stmt->kind == STMT_URL) {
+      if (!fetchdeps_parser_eval_url(ctx, file, stmt, results))
+        return 0;
+    }
+    else if (stmt->kind == STMT_INCLUDE) {
+      if (!fetchdeps_parser_check_include(file, stmt) ||
+          !fetchdeps_parser_eval_file(ctx, stmt->included, results))
+        return 0;
+    }
+    else {
+      int matched = fetchdeps_parser_eval_cond(ctx, file, stmt->cond);
+      if (matched < 0)
+        return 0;
+      if (matched && !fetchdeps_parser_eval_block(ctx, file, stmt->body, results))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+bool_t
+fetchdeps_parser_eval_url(parser_t* ctx, parser_t* file, ast_stmt_t* stmt, stringset_t* results)
+{
+  expansion_t exp;
+
+  if (!stmt->url_template) {
+    if (!fetchdeps_parser_add_url(ctx, results, stmt->url))
+      return 0;
+    if (stmt->filter && !fetchdeps_parser_add_filter(ctx, stmt->url, stmt->filter))
+      return 0;
+    return 1;
+  }
+
+  exp.ctx = ctx;
+  exp.file = file;
+  exp.stmt = stmt;
+  exp.results = results;
+  return fetchdeps_template_expand(stmt->url_template,
+                                   fetchdeps_parser_lookup_var, &exp,
+                                   fetchdeps_parser_emit_url, &exp,
+                                   &ctx->expand_buf, &ctx->expand_capacity);
+}
+
+
+bool_t
+fetchdeps_parser_add_url(parser_t* ctx, stringset_t* results, char* url)
+{
+  if (!ctx->url_fn)
+    return fetchdeps_stringset_add(results, url);
+
+  // Only the first time a URL turns up is news to the caller.
+  if (fetchdeps_stringset_contains(results, url))
+    return 1;
+  return fetchdeps_stringset_add(results, url) && ctx->url_fn(ctx->url_arg, url);
+}
+
+
+stringset_t*
+fetchdeps_parser_lookup_var(void* arg, const char* name)
+{
+  expansion_t* exp = (expansion_t*)arg;
+  stringset_t* value;
+
+  value = fetchdeps_varmap_get(exp->ctx->vars, (char*)name);
+  if (!value) {
+    fetchdeps_parser_report(exp->file, exp->stmt->line, exp->stmt->first_column, exp->stmt->last_column, "unknown variable in URL");
+    return NULL;
+  }
+  return value;
+}
+
+
+bool_t
+fetchdeps_parser_emit_url(void* arg, char* url, size_t len)
+{
+  expansion_t* exp = (expansion_t*)arg;
+  char* copy;
+
+  if (!exp->stmt->filter)
+    return fetchdeps_parser_add_url(exp->ctx, exp->results, url);
+
+  // The filter is looked up by URL after evaluation has finished, so it needs
+  // a copy which lasts as long as the file does.
+  copy = fetchdeps_ast_intern(exp->file->ast, url, len);
+  if (!copy)
+    return 0;
+  return fetchdeps_parser_add_url(exp->ctx, exp->results, copy) &&
+         fetchdeps_parser_add_filter(exp->ctx, copy, exp->stmt->filter);
+}
+
+
+int
+fetchdeps_parser_eval_cond(parser_t* ctx, parser_t* file, ast_cond_t* cond)
+{
+  uint64_t* bits;
+  size_t words, w;
+  int lhs;
+
+  switch (cond->op) {
+  case COND_AND:
+  case COND_OR:
+    lhs = fetchdeps_parser_eval_cond(ctx, file, cond->lhs);
+    if (lhs < 0)
+      return -1;
+    // Short circuit: the right hand side is only looked at if it matters.
+    if (lhs == (cond->op == COND_OR))
+      return lhs;
+    return fetchdeps_parser_eval_cond(ctx, file, cond->rhs);
+
+  default:
+    // The variable matches if any of its values are in the list, i.e. if
+    // the two bitsets have any bits in common.
+    bits = fetchdeps_parser_var_bits(ctx, file, cond);
+    if (!bits)
+      return -1;
+    words = fetchdeps_vocab_words(file->ast->values);
+    for (w = 0; w < words; ++w) {
+      if (bits[w] & cond->value_bits[w])
+        return cond->op == COND_IN;
+    }
+    return cond->op == COND_NOT_IN;
+  }
+}
+
+
+// Variables come from the top level parser, but each file has its own
+// vocabulary so the bitsets are kept per file.
+uint64_t*
+fetchdeps_parser_var_bits(parser_t* ctx, parser_t* file, ast_cond_t* cond)
+{
+  size_t words = fetchdeps_vocab_words(file->ast->values);
+  uint64_t* bits = file->var_bits + cond->var_id * words;
+  stringset_t* value;
+
+  if (file->var_found[cond->var_id])
+    return bits;
+
+  value = fetchdeps_varmap_get(ctx->vars, cond->var);
+  if (!value) {
+    fetchdeps_parser_report(file, cond->line, cond->first_column, cond->last_column, "unknown variable");
+    return NULL;
+  }
+  if (!fetchdeps_vocab_set_bits(file->ast->values, value, bits))
+    return NULL;
+
+  file->var_found[cond->var_id] = 1;
+  return bits;
+}
+
+
+bool_t
+fetchdeps_parser_add_filter(parser_t* ctx, char* url, filter_t* filter)
+{
+  urlfilter_t* entry;
+
+  if (ctx->num_filters == ctx->filters_capacity) {
+    size_t new_capacity = ctx->filters_capacity ? ctx->filters_capacity * 2 : 8;
+    urlfilter_t* new_filters = (urlfilter_t*)fetchdeps_alloc_realloc(ALLOC_PARSE, ctx->filters, new_capacity * sizeof(urlfilter_t));
+    if (!new_filters)
+      return 0;
+    ctx->filters = new_filters;
+    ctx->filters_capacity = new_capacity;
+  }
+
+  entry = &ctx->filters[ctx->num_filters++];
+  entry->url = url;
+  entry->filter = filter;
+  return 1;
 }
 
@@ -1,23 +1,96 @@
 #ifndef fetchdeps_parse_h
 #define fetchdeps_parse_h
 
+#include "ast.h"
+#include "cache.h"
 #include "common.h"
+#include "filter.h"
 #include "stringset.h"
 #include "varmap.h"
 
+#include <stdint.h>
 #include <stdio.h>
 
 
+//
+// Constants
+//
+
+// The number of zero bytes after the end of the file's contents. The scanner
+// needs two, so that it can scan the buffer in place.
+#define kParserPadding 2
+
+
 //
 // Types
 //
 
+// The filter options given after a URL which was part of the results. Both
+// pointers belong to the parser's AST.
+struct _urlfilter {
+  char* url;
+  filter_t* filter;
+};
+typedef struct _urlfilter urlfilter_t;
+
+
+// Called by fetchdeps_parser_eval_each with each URL as soon as evaluation
+// reaches it. The URL is only valid until the function returns. Return false
+// to stop the evaluation.
+typedef bool_t (*parser_url_fn)(void* arg, char* url);
+
+
+// Everything the scanner and parser need to keep track of, apart from the
+// scanner's own buffers. There are no globals involved in parsing, so separate
+// parser_t objects can be used on separate threads at the same time.
 struct _parser {
   int indent_level; // Index of the current indent level in the indents array.
   int indents[100]; // Ought to be enough for anybody...
+  int column;       // Column of the next character the scanner will read.
+
+  varmap_t* vars;   // Only the top level parser has one; included files use it.
+  char* fname;
+  char* real_path;  // The canonical form of fname, for spotting repeats.
+  char* data;       // The file's contents, read into memory...
+  size_t size;      // ...and their length, not counting the padding.
+  ast_t* ast;       // The file's contents, as built by the generated parser.
+
+  char* cache_file; // NULL if the compiled cache isn't being used.
+  bool_t cache_writable;
+
+  urlfilter_t* filters;
+  size_t num_filters;
+  size_t filters_capacity;
+
+  // The values of the variables used in the file, as bitsets over the AST's
+  // vocabulary of values. Each is filled in when the variable is first needed.
+  uint64_t* var_bits;
+  bool_t* var_found;
+
+  // The deps files pulled in by include statements, directly or indirectly.
+  // Only the top level parser has these, and each file appears once however
+  // many times it's included. Their parsers point back to the top level one.
+  struct _parser* top;
+  struct _parser** includes;
+  size_t num_includes;
+  size_t includes_capacity;
+  int num_workers;    // Threads to use for parsing the included files.
+  bool_t evaluating;  // Set while the file is being evaluated.
+
+  // Included files are parsed before anything knows whether they'll be used,
+  // so a problem with one is held back until evaluation reaches it. While
+  // 'hold_reports' is set, messages are collected in 'held_reports' rather
+  // than printed. 'failed' is set if the file couldn't be parsed.
+  bool_t hold_reports;
+  char* held_reports;
+  size_t held_len;
+  bool_t failed;
 
-  varmap_t* vars;
-  FILE* f;
+  char* expand_buf;   // Reused for every URL template expansion.
+  size_t expand_capacity;
+
+  parser_url_fn url_fn; // Set while fetchdeps_parser_eval_each is running.
+  void* url_arg;
 };
 typedef struct _parser parser_t;
 
@@ -31,22 +104,95 @@ typedef struct _parser parser_t;
 // return value will be NULL. Otherwise it's a pointer to an initialised
 // parser_t object, which must eventually be freed with fetchdeps_parser_free.
 //
-// It is safe to create multiple parsers, but only one of them may be parsing at
-// a time as the flex- and bison-generated code uses some global variables to
-// keep track of the parsing state.
+// It is safe to create multiple parsers and to run them concurrently, as long
+// as each parser is only used by one thread at a time.
 parser_t* fetchdeps_parser_new(char* fname);
 
 // Free an existing parser. As well as deallocating the memory (including the
-// memory for the varmap), this also closes the input file.
+// memory for the varmap), this also frees the input file's contents.
 void fetchdeps_parser_free(parser_t* ctx);
 
-// Parse the input file. This parses the entire file, evaluating any conditions
-// in the file and fills in the results parameter. The return value is true if
-// parsing was successful. If parsing failed for any reason - a syntax error,
-// reference to a non-existent variable, failed memory allocation, etc. - then
-// the return value will be false and nothing will be added to results.
+// Parse the input file. This parses the entire file into an AST, along with
+// any files it includes, then evaluates the conditions in it and fills in the
+// results parameter. Each URL appears in the results once, however many of
+// the files list it. Sections whose conditions are false are skipped without
+// being looked at, so a reference to a non-existent variable inside one isn't
+// an error. The return value is true if parsing was successful. If parsing
+// failed for any reason - a syntax error, reference to a non-existent
+// variable, failed memory allocation, etc. - then the return value will be
+// false and results may contain some of the URLs.
 bool_t fetchdeps_parser_parse(parser_t* ctx, stringset_t* results);
 
+// Parse the input file into the parser's AST without evaluating it. This is
+// the first half of fetchdeps_parser_parse, for callers which want to evaluate
+// the AST some other way. Included files are parsed too, in parallel, and the
+// include statements are pointed at their parsers. Returns false, with the
+// error set, if parsing any of the files failed. An included file which is
+// missing or has errors in it doesn't count until it's evaluated; see
+// fetchdeps_parser_check_include.
+bool_t fetchdeps_parser_build(parser_t* ctx);
+
+// Set the number of threads used to parse included files. The default is one
+// per CPU.
+void fetchdeps_parser_set_workers(parser_t* ctx, int num_workers);
+
+// Use a compiled cache for the deps file (see fetchdeps_cache_load). If the
+// cache is up to date, fetchdeps_parser_parse loads the file from it instead
+// of parsing; otherwise it parses as normal and, if 'writable' is true, saves
+// the result to the cache for next time. Problems with the cache are never
+// reported: it's simply ignored. Returns false if memory couldn't be
+// allocated.
+bool_t fetchdeps_parser_set_cache(parser_t* ctx, char* cache_file, bool_t writable);
+
+// Evaluate the file built by fetchdeps_parser_build as fetchdeps_parser_eval
+// does, but also call 'fn' with each URL the first time it's added to
+// 'results', straight away rather than once the whole file has been
+// evaluated. The caller can start work on the URLs, such as downloading them,
+// while the rest of the file is still being evaluated. Returns false if
+// evaluation failed or 'fn' returned false; the URLs already passed to 'fn'
+// stay in 'results'.
+bool_t fetchdeps_parser_eval_each(parser_t* ctx, stringset_t* results, parser_url_fn fn, void* arg);
+
+// Get the filter for a URL in the results of fetchdeps_parser_parse. The
+// return value is NULL if the URL had no filter options. If the same URL
+// appears more than once with options, the last one that was evaluated wins.
+// The filter belongs to the parser and is freed along with it.
+filter_t* fetchdeps_parser_get_filter(parser_t* ctx, char* url);
+
+
+//
+// Functions used by the generated parser
+//
+
+// Parse just this parser's file into its AST, without looking at any files it
+// includes. Returns false, with the error set, if parsing failed.
+bool_t fetchdeps_parser_build_file(parser_t* ctx);
+
+// Print an error message about part of the file to stderr. Messages about
+// included files are prefixed with the file name.
+void fetchdeps_parser_report(parser_t* ctx, int line, int first_column, int last_column, const char* msg);
+
+// Check that the file named by an include statement can be evaluated. A file
+// which was missing or couldn't be parsed only becomes an error here, when
+// evaluation reaches it, and so does an include cycle. Returns false after
+// reporting the problem.
+bool_t fetchdeps_parser_check_include(parser_t* file, ast_stmt_t* stmt);
+
+// Fill in the AST from the compiled cache, if there is one and it matches
+// 'key'. Returns false if the file needs to be parsed, in which case the AST
+// is left empty.
+bool_t fetchdeps_parser_load_cache(parser_t* ctx, cache_key_t* key);
+
+// Save the AST built by the generated parser to the compiled cache, if that's
+// allowed.
+void fetchdeps_parser_save_cache(parser_t* ctx, cache_key_t* key);
+
+// Evaluate the AST built by the generated parser, adding the URLs from every
+// section whose conditions are true to 'results' in the order they appear.
+// Returns false if a condition refers to a variable which doesn't exist, or if
+// memory couldn't be allocated.
+bool_t fetchdeps_parser_eval(parser_t* ctx, stringset_t* results);
+
 
 #endif // fetchdeps_parse_h
 
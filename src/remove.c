@@ -0,0 +1,653 @@
+#include "remove.h"
+
+#include "alloc.h"
+#include "errors.h"
+#include "filesys.h"
+
+#include <assert.h>
+#include <dirent.h>   // For fdopendir(), readdir(), etc.
+#include <errno.h>
+#include <fcntl.h>    // For openat() and the O_* flags.
+#include <pthread.h>
+#include <stdio.h>    // For getline().
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h> // For fstatat().
+#include <unistd.h>   // For unlinkat() and close().
+
+
+//
+// Constants
+//
+
+// Roughly how many manifest files each worker removes before going back to
+// the shared queue for more.
+static const size_t kBatchSize = 64;
+
+
+//
+// Types
+//
+
+// A directory which is being emptied. Every node keeps its directory open
+// until all of its subdirectories have been removed, so that they can be
+// unlinked relative to it. The pending count is one for the node's own scan,
+// plus one for each subdirectory which hasn't been removed yet; whoever takes
+// it to zero removes the directory and then does the same for its parent.
+struct _rmnode {
+  struct _rmnode* parent;
+  struct _rmnode* next; // Link in the work stack.
+  char* name;           // Name relative to the parent directory.
+  DIR* dir;
+  int pending;
+};
+typedef struct _rmnode rmnode_t;
+
+
+struct _rmtree {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  rmnode_t* stack;      // Directories waiting to be scanned.
+  bool_t done;
+
+  int error;            // The errno of the first failure, or zero.
+  char* error_path;
+};
+typedef struct _rmtree rmtree_t;
+
+
+// A single line from the manifest, split into the directory part (NULL for
+// entries at the top level) and the name within that directory.
+struct _rmentry {
+  char* line;
+  char* dir;
+  char* name;
+};
+typedef struct _rmentry rmentry_t;
+
+
+struct _rmbatch {
+  rmentry_t* entries;
+  size_t count;
+};
+typedef struct _rmbatch rmbatch_t;
+
+
+struct _rmlist {
+  int root_fd;
+  rmbatch_t* batches;
+  size_t num_batches;
+  size_t next_batch;    // Updated atomically by the workers.
+
+  pthread_mutex_t lock;
+  int error;
+  char* error_path;
+};
+typedef struct _rmlist rmlist_t;
+
+
+//
+// Forward declarations
+//
+
+void* fetchdeps_remove_tree_worker(void* arg);
+void fetchdeps_remove_scan(rmtree_t* tree, rmnode_t* node);
+void fetchdeps_remove_finish(rmtree_t* tree, rmnode_t* node);
+void fetchdeps_remove_push(rmtree_t* tree, rmnode_t* node);
+void fetchdeps_remove_tree_error(rmtree_t* tree, char* name);
+
+void* fetchdeps_remove_list_worker(void* arg);
+void fetchdeps_remove_list_error(rmlist_t* list, char* name);
+bool_t fetchdeps_remove_same_dir(rmentry_t* a, rmentry_t* b);
+int fetchdeps_remove_compare_entries(const void* a, const void* b);
+int fetchdeps_remove_compare_depth(const void* a, const void* b);
+
+bool_t fetchdeps_remove_run_workers(void* (*worker)(void*), void* arg, int num_workers);
+
+
+//
+// Public functions
+//
+
+bool_t
+fetchdeps_remove_tree_contents(char* path, int num_workers)
+{
+  rmtree_t tree;
+  rmnode_t* root = NULL;
+  bool_t ok;
+
+  assert(path != NULL);
+  assert(num_workers > 0);
+
+  root = (rmnode_t*)fetchdeps_alloc_calloc(ALLOC_REMOVE, 1, sizeof(rmnode_t));
+  if (!root)
+    goto failure;
+
+  root->dir = opendir(path);
+  if (!root->dir) {
+    fetchdeps_alloc_free(root);
+    if (errno == ENOENT)
+      return 1;
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to open %s", path);
+    return 0;
+  }
+  root->pending = 1;
+
+  memset(&tree, 0, sizeof(tree));
+  pthread_mutex_init(&tree.lock, NULL);
+  pthread_cond_init(&tree.cond, NULL);
+
+  // The root has already been opened, so scan it here. Its subdirectories go
+  // on to the stack for the workers.
+  fetchdeps_remove_scan(&tree, root);
+
+  ok = fetchdeps_remove_run_workers(fetchdeps_remove_tree_worker, &tree, num_workers);
+
+  pthread_cond_destroy(&tree.cond);
+  pthread_mutex_destroy(&tree.lock);
+
+  if (!ok)
+    goto failure;
+
+  if (tree.error) {
+    errno = tree.error;
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to remove %s/%s", path,
+        tree.error_path ? tree.error_path : "...");
+    if (tree.error_path)
+      fetchdeps_alloc_free(tree.error_path);
+    return 0;
+  }
+
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  return 0;
+}
+
+
+bool_t
+fetchdeps_remove_manifest(char* root, char* manifest, int num_workers)
+{
+  FILE* f = NULL;
+  char* line = NULL;
+  size_t line_cap = 0;
+  ssize_t line_len;
+  rmentry_t* files = NULL;
+  size_t num_files = 0;
+  size_t files_cap = 0;
+  char** dirs = NULL;
+  size_t num_dirs = 0;
+  size_t dirs_cap = 0;
+  rmlist_t list;
+  size_t i, start;
+
+  assert(root != NULL);
+  assert(manifest != NULL);
+  assert(num_workers > 0);
+
+  memset(&list, 0, sizeof(list));
+  list.root_fd = -1;
+
+  f = fopen(manifest, "r");
+  if (!f) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to open install manifest %s", manifest);
+    goto failure;
+  }
+
+  // Read the manifest, separating out the files from the directories.
+  while ((line_len = getline(&line, &line_cap, f)) != -1) {
+    bool_t is_dir;
+
+    while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r'))
+      line[--line_len] = '\0';
+    if (line_len == 0)
+      continue;
+
+    is_dir = (line[line_len - 1] == '/');
+    if (is_dir)
+      line[--line_len] = '\0';
+
+    if (!fetchdeps_filesys_is_safe_path(line)) {
+      fetchdeps_errors_set_with_msg(ERR_PARSE, "Bad path '%s' in install manifest %s", line, manifest);
+      goto failure;
+    }
+
+    if (is_dir) {
+      if (num_dirs == dirs_cap) {
+        size_t new_cap = dirs_cap ? dirs_cap * 2 : 64;
+        char** new_dirs = (char**)fetchdeps_alloc_realloc(ALLOC_REMOVE, dirs, new_cap * sizeof(char*));
+        if (!new_dirs)
+          goto failure;
+        dirs = new_dirs;
+        dirs_cap = new_cap;
+      }
+      dirs[num_dirs] = fetchdeps_alloc_strndup(ALLOC_REMOVE, line, line_len);
+      if (!dirs[num_dirs])
+        goto failure;
+      ++num_dirs;
+    }
+    else {
+      rmentry_t* entry;
+      char* slash;
+
+      if (num_files == files_cap) {
+        size_t new_cap = files_cap ? files_cap * 2 : 256;
+        rmentry_t* new_files = (rmentry_t*)fetchdeps_alloc_realloc(ALLOC_REMOVE, files, new_cap * sizeof(rmentry_t));
+        if (!new_files)
+          goto failure;
+        files = new_files;
+        files_cap = new_cap;
+      }
+
+      entry = &files[num_files];
+      entry->line = fetchdeps_alloc_strndup(ALLOC_REMOVE, line, line_len);
+      if (!entry->line)
+        goto failure;
+      ++num_files;
+      slash = strrchr(entry->line, '/');
+      if (slash) {
+        *slash = '\0';
+        entry->dir = entry->line;
+        entry->name = slash + 1;
+      }
+      else {
+        entry->dir = NULL;
+        entry->name = entry->line;
+      }
+    }
+  }
+  // The line buffer comes from getline, so it goes back to the C library.
+  free(line);
+  line = NULL;
+  fclose(f);
+  f = NULL;
+
+  list.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (list.root_fd == -1) {
+    if (errno != ENOENT) {
+      fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to open %s", root);
+      goto failure;
+    }
+    // Nothing was left to uninstall, but we still want to get rid of the
+    // manifest below.
+    errno = 0;
+  }
+  else {
+    // Sort the files so that everything in the same directory is adjacent,
+    // then cut the list into batches at directory boundaries.
+    qsort(files, num_files, sizeof(rmentry_t), fetchdeps_remove_compare_entries);
+
+    list.batches = (rmbatch_t*)fetchdeps_alloc_calloc(ALLOC_REMOVE, num_files / kBatchSize + 1, sizeof(rmbatch_t));
+    if (!list.batches)
+      goto failure;
+
+    start = 0;
+    for (i = 1; i <= num_files; ++i) {
+      if (i == num_files ||
+          (i - start >= kBatchSize && !fetchdeps_remove_same_dir(&files[i - 1], &files[i]))) {
+        list.batches[list.num_batches].entries = files + start;
+        list.batches[list.num_batches].count = i - start;
+        ++list.num_batches;
+        start = i;
+      }
+    }
+
+    pthread_mutex_init(&list.lock, NULL);
+    if (!fetchdeps_remove_run_workers(fetchdeps_remove_list_worker, &list, num_workers)) {
+      pthread_mutex_destroy(&list.lock);
+      goto failure;
+    }
+
+    // Remove the directories, deepest first. Anything that wasn't installed
+    // by us keeps its directory alive. Errors go through the list's lock, so
+    // it has to last until this is done.
+    if (num_dirs > 0)
+      qsort(dirs, num_dirs, sizeof(char*), fetchdeps_remove_compare_depth);
+    for (i = 0; i < num_dirs; ++i) {
+      if (unlinkat(list.root_fd, dirs[i], AT_REMOVEDIR) != 0 &&
+          errno != ENOENT && errno != ENOTEMPTY && errno != EEXIST)
+        fetchdeps_remove_list_error(&list, dirs[i]);
+    }
+    pthread_mutex_destroy(&list.lock);
+
+    close(list.root_fd);
+    list.root_fd = -1;
+  }
+
+  if (list.error) {
+    errno = list.error;
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to remove %s/%s", root, list.error_path);
+    goto failure;
+  }
+
+  if (unlink(manifest) != 0) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to remove install manifest %s", manifest);
+    goto failure;
+  }
+
+  for (i = 0; i < num_files; ++i)
+    fetchdeps_alloc_free(files[i].line);
+  fetchdeps_alloc_free(files);
+  for (i = 0; i < num_dirs; ++i)
+    fetchdeps_alloc_free(dirs[i]);
+  fetchdeps_alloc_free(dirs);
+  fetchdeps_alloc_free(list.batches);
+
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (f)
+    fclose(f);
+  if (line)
+    free(line);
+  if (files) {
+    for (i = 0; i < num_files; ++i)
+      fetchdeps_alloc_free(files[i].line);
+    fetchdeps_alloc_free(files);
+  }
+  if (dirs) {
+    for (i = 0; i < num_dirs; ++i)
+      fetchdeps_alloc_free(dirs[i]);
+    fetchdeps_alloc_free(dirs);
+  }
+  if (list.batches)
+    fetchdeps_alloc_free(list.batches);
+  if (list.error_path)
+    fetchdeps_alloc_free(list.error_path);
+  if (list.root_fd != -1)
+    close(list.root_fd);
+  return 0;
+}
+
+
+//
+// Tree removal functions
+//
+
+void*
+fetchdeps_remove_tree_worker(void* arg)
+{
+  rmtree_t* tree = (rmtree_t*)arg;
+  rmnode_t* node;
+
+  for (;;) {
+    pthread_mutex_lock(&tree->lock);
+    while (!tree->stack && !tree->done)
+      pthread_cond_wait(&tree->cond, &tree->lock);
+    if (!tree->stack) {
+      pthread_mutex_unlock(&tree->lock);
+      break;
+    }
+    node = tree->stack;
+    tree->stack = node->next;
+    pthread_mutex_unlock(&tree->lock);
+
+    node->dir = NULL;
+    {
+      int fd = openat(dirfd(node->parent->dir), node->name,
+                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (fd != -1) {
+        node->dir = fdopendir(fd);
+        if (!node->dir)
+          close(fd);
+      }
+    }
+
+    if (node->dir)
+      fetchdeps_remove_scan(tree, node);
+    else {
+      fetchdeps_remove_tree_error(tree, node->name);
+      fetchdeps_remove_finish(tree, node);
+    }
+  }
+
+  return NULL;
+}
+
+
+void
+fetchdeps_remove_scan(rmtree_t* tree, rmnode_t* node)
+{
+  struct dirent* ent;
+  int fd = dirfd(node->dir);
+
+  while ((ent = readdir(node->dir)) != NULL) {
+    bool_t is_dir;
+
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+      continue;
+
+    if (ent->d_type == DT_UNKNOWN) {
+      struct stat buf;
+      if (fstatat(fd, ent->d_name, &buf, AT_SYMLINK_NOFOLLOW) != 0) {
+        fetchdeps_remove_tree_error(tree, ent->d_name);
+        continue;
+      }
+      is_dir = S_ISDIR(buf.st_mode);
+    }
+    else {
+      is_dir = (ent->d_type == DT_DIR);
+    }
+
+    if (is_dir) {
+      rmnode_t* child = (rmnode_t*)fetchdeps_alloc_calloc(ALLOC_REMOVE, 1, sizeof(rmnode_t));
+      if (child)
+        child->name = fetchdeps_alloc_strdup(ALLOC_REMOVE, ent->d_name);
+      if (!child || !child->name) {
+        if (child)
+          fetchdeps_alloc_free(child);
+        fetchdeps_remove_tree_error(tree, ent->d_name);
+        continue;
+      }
+      child->parent = node;
+      child->pending = 1;
+      __atomic_add_fetch(&node->pending, 1, __ATOMIC_ACQ_REL);
+      fetchdeps_remove_push(tree, child);
+    }
+    else if (unlinkat(fd, ent->d_name, 0) != 0 && errno != ENOENT) {
+      fetchdeps_remove_tree_error(tree, ent->d_name);
+    }
+  }
+
+  fetchdeps_remove_finish(tree, node);
+}
+
+
+void
+fetchdeps_remove_finish(rmtree_t* tree, rmnode_t* node)
+{
+  while (node && __atomic_sub_fetch(&node->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+    rmnode_t* parent = node->parent;
+
+    if (node->dir)
+      closedir(node->dir);
+
+    if (parent) {
+      if (unlinkat(dirfd(parent->dir), node->name, AT_REMOVEDIR) != 0 && errno != ENOENT)
+        fetchdeps_remove_tree_error(tree, node->name);
+      fetchdeps_alloc_free(node->name);
+    }
+    else {
+      pthread_mutex_lock(&tree->lock);
+      tree->done = 1;
+      pthread_cond_broadcast(&tree->cond);
+      pthread_mutex_unlock(&tree->lock);
+    }
+
+    fetchdeps_alloc_free(node);
+    node = parent;
+  }
+}
+
+
+void
+fetchdeps_remove_push(rmtree_t* tree, rmnode_t* node)
+{
+  // The stack is LIFO so that each worker tends to go deep before it goes
+  // wide, which keeps the number of open directories down.
+  pthread_mutex_lock(&tree->lock);
+  node->next = tree->stack;
+  tree->stack = node;
+  pthread_cond_signal(&tree->cond);
+  pthread_mutex_unlock(&tree->lock);
+}
+
+
+void
+fetchdeps_remove_tree_error(rmtree_t* tree, char* name)
+{
+  int err = errno;
+
+  pthread_mutex_lock(&tree->lock);
+  if (!tree->error) {
+    tree->error = err ? err : EIO;
+    tree->error_path = fetchdeps_alloc_strdup(ALLOC_REMOVE, name);
+  }
+  pthread_mutex_unlock(&tree->lock);
+}
+
+
+//
+// Manifest removal functions
+//
+
+void*
+fetchdeps_remove_list_worker(void* arg)
+{
+  rmlist_t* list = (rmlist_t*)arg;
+  size_t b, i;
+
+  while ((b = __atomic_fetch_add(&list->next_batch, 1, __ATOMIC_RELAXED)) < list->num_batches) {
+    rmbatch_t* batch = &list->batches[b];
+    char* current_dir = NULL;
+    int dir_fd = -1;
+
+    for (i = 0; i < batch->count; ++i) {
+      rmentry_t* entry = &batch->entries[i];
+
+      // Entries are sorted by directory, so we only need to open a new one
+      // when it changes.
+      if (i == 0 || !fetchdeps_remove_same_dir(entry - 1, entry)) {
+        if (dir_fd != -1 && dir_fd != list->root_fd)
+          close(dir_fd);
+        current_dir = entry->dir;
+        if (current_dir) {
+          dir_fd = openat(list->root_fd, current_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+          if (dir_fd == -1 && errno != ENOENT)
+            fetchdeps_remove_list_error(list, current_dir);
+        }
+        else {
+          dir_fd = list->root_fd;
+        }
+      }
+
+      // If the directory is already gone, so are its files.
+      if (dir_fd == -1)
+        continue;
+
+      if (unlinkat(dir_fd, entry->name, 0) != 0 && errno != ENOENT)
+        fetchdeps_remove_list_error(list, entry->name);
+    }
+
+    if (dir_fd != -1 && dir_fd != list->root_fd)
+      close(dir_fd);
+  }
+
+  return NULL;
+}
+
+
+void
+fetchdeps_remove_list_error(rmlist_t* list, char* name)
+{
+  int err = errno;
+
+  pthread_mutex_lock(&list->lock);
+  if (!list->error) {
+    list->error = err ? err : EIO;
+    list->error_path = fetchdeps_alloc_strdup(ALLOC_REMOVE, name);
+  }
+  pthread_mutex_unlock(&list->lock);
+}
+
+
+bool_t
+fetchdeps_remove_same_dir(rmentry_t* a, rmentry_t* b)
+{
+  if (!a->dir || !b->dir)
+    return a->dir == b->dir;
+  return strcmp(a->dir, b->dir) == 0;
+}
+
+
+int
+fetchdeps_remove_compare_entries(const void* a, const void* b)
+{
+  const rmentry_t* ea = (const rmentry_t*)a;
+  const rmentry_t* eb = (const rmentry_t*)b;
+
+  // Top level entries (with no directory) sort first.
+  if (ea->dir != eb->dir) {
+    int cmp;
+    if (!ea->dir)
+      return -1;
+    if (!eb->dir)
+      return 1;
+    cmp = strcmp(ea->dir, eb->dir);
+    if (cmp != 0)
+      return cmp;
+  }
+  return strcmp(ea->name, eb->name);
+}
+
+
+int
+fetchdeps_remove_compare_depth(const void* a, const void* b)
+{
+  const char* pa = *(const char**)a;
+  const char* pb = *(const char**)b;
+  int depth_a = 0, depth_b = 0;
+
+  for (; *pa; ++pa)
+    depth_a += (*pa == '/');
+  for (; *pb; ++pb)
+    depth_b += (*pb == '/');
+
+  // Deepest first.
+  return depth_b - depth_a;
+}
+
+
+//
+// Common functions
+//
+
+bool_t
+fetchdeps_remove_run_workers(void* (*worker)(void*), void* arg, int num_workers)
+{
+  pthread_t* threads = NULL;
+  int started = 0;
+  int i;
+
+  threads = (pthread_t*)fetchdeps_alloc_calloc(ALLOC_REMOVE, num_workers, sizeof(pthread_t));
+  if (!threads)
+    return 0;
+
+  for (i = 0; i < num_workers; ++i) {
+    if (pthread_create(&threads[i], NULL, worker, arg) != 0)
+      break;
+    ++started;
+  }
+
+  // If no threads could be started at all, do the work on this one instead.
+  if (started == 0)
+    worker(arg);
+
+  for (i = 0; i < started; ++i)
+    pthread_join(threads[i], NULL);
+
+  fetchdeps_alloc_free(threads);
+  return 1;
+}
@@ -0,0 +1,35 @@
+#ifndef fetchdeps_remove_h
+#define fetchdeps_remove_h
+
+#include "common.h"
+
+//
+// Functions
+//
+
+// Delete everything inside the directory at 'path', but not the directory
+// itself. The tree is walked in parallel by up to num_workers threads, each
+// taking whole subdirectories from a shared work queue. All deletions are done
+// with unlinkat() relative to an open descriptor for the containing directory,
+// so no path is ever resolved more than once. Symlinks are deleted, never
+// followed.
+//
+// Returns true if the directory is empty on completion, or didn't exist to
+// begin with. Returns false if anything couldn't be deleted, in which case
+// some of the tree may already have been removed.
+bool_t fetchdeps_remove_tree_contents(char* path, int num_workers);
+
+// Delete exactly the files and directories listed in an install manifest (see
+// fetchdeps_filesys_manifest_file), then the manifest itself. Paths in the
+// manifest are relative to 'root'. Files are grouped by their parent directory
+// and the groups are split into batches for num_workers threads, so each
+// directory is opened once and its files are removed with unlinkat().
+// Directories are removed afterwards, deepest first; any directory which still
+// contains something that wasn't in the manifest is left in place.
+//
+// Files which are already missing aren't treated as an error. Returns true if
+// everything listed was removed, false otherwise.
+bool_t fetchdeps_remove_manifest(char* root, char* manifest, int num_workers);
+
+#endif // fetchdeps_remove_h
+
@@ -1,6 +1,11 @@
 #include "stringset.h"
 
+#include "alloc.h"
+#include "hash.h"
+#include "strpool.h"
+
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,20 +14,46 @@
 // Constants
 //
 
-static const size_t INITIAL_CAPACITY = 2;
+// Sets with up to this many strings keep them inside the stringset_t itself.
+#define INLINE_CAPACITY 8
+
+// The heap arrays start at this size when a set outgrows the inline ones.
+static const size_t INITIAL_CAPACITY = INLINE_CAPACITY * 2;
 
 
 //
 // Types
 //
 
-// Note: the first element in a stringset is a sentinel with a NULL str.
-// The list is circular, so iteration ends when we find ourselves back at the
-// sentinel. The sentinel is the only element allowed to have a NULL str.
+// The strings are kept in a dense array in the order they were added, which
+// is what iteration walks. Each string's hash is stored alongside it so that
+// copying strings between sets never rehashes them.
+//
+// Most sets hold a handful of strings, so small sets use the inline arrays
+// and need no allocations beyond the stringset_t. Instead of a hash index,
+// 'order' lists their strings sorted by hash, and then by address to break
+// ties, which lets two small sets be intersected with a single merge.
+//
+// Once a set outgrows the inline arrays, 'strings' and 'hashes' move to the
+// heap and an open addressing index is built over them. Each slot holds an
+// index into 'strings' plus one, or zero if it's empty. There are always
+// twice as many slots as 'capacity', so the index is never more than half
+// full. 'slots' is NULL while the set is small.
+//
+// The strings themselves belong to the string pool, so any two strings in
+// sets are equal exactly when they're the same pointer.
 struct _stringset {
   char** strings;
+  uint64_t* hashes;
   size_t size;
   size_t capacity;
+
+  size_t* slots;
+  size_t num_slots;
+
+  char* inline_strings[INLINE_CAPACITY];
+  uint64_t inline_hashes[INLINE_CAPACITY];
+  unsigned char order[INLINE_CAPACITY];
 };
 
 
@@ -32,6 +63,21 @@ struct _stringiter {
 };
 
 
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_stringset_add_interned(stringset_t* ss, char* str, uint64_t hash);
+bool_t fetchdeps_stringset_add_inline(stringset_t* ss, char* str, uint64_t hash);
+bool_t fetchdeps_stringset_contains_interned(stringset_t* ss, char* str, uint64_t hash);
+bool_t fetchdeps_stringset_merge_any(stringset_t* a, stringset_t* b);
+int fetchdeps_stringset_compare(uint64_t hash_a, char* str_a, uint64_t hash_b, char* str_b);
+size_t fetchdeps_stringset_find_slot(stringset_t* ss, char* str, uint64_t hash);
+size_t fetchdeps_stringset_find_interned(stringset_t* ss, char* str, uint64_t hash);
+bool_t fetchdeps_stringset_spill(stringset_t* ss);
+bool_t fetchdeps_stringset_grow(stringset_t* ss);
+
+
 //
 // stringset functions
 //
@@ -39,26 +85,19 @@ struct _stringiter {
 stringset_t*
 fetchdeps_stringset_new()
 {
-  stringset_t* ss = (stringset_t*)malloc(sizeof(stringset_t));
+  stringset_t* ss = (stringset_t*)fetchdeps_alloc_malloc(ALLOC_STRINGSET, sizeof(stringset_t));
   if (!ss)
-    goto failure;
-
-  ss->strings = (char**)calloc(INITIAL_CAPACITY, sizeof(char*));
-  if (!ss->strings)
-    goto failure;
+    return NULL;
 
+  // The inline arrays are only read up to 'size', so they needn't be zeroed.
+  ss->strings = ss->inline_strings;
+  ss->hashes = ss->inline_hashes;
   ss->size = 0;
-  ss->capacity = INITIAL_CAPACITY;
+  ss->capacity = INLINE_CAPACITY;
+  ss->slots = NULL;
+  ss->num_slots = 0;
 
   return ss;
-
-failure:
-  if (ss) {
-    if (ss->strings)
-      free(ss->strings);
-    free(ss);
-  }
-  return NULL;
 }
 
 
@@ -88,54 +127,33 @@ failure:
 void
 fetchdeps_stringset_free(stringset_t* ss)
 {
-  size_t i;
-
   assert(ss != NULL);
   assert(ss->strings != NULL);
   assert(ss->size <= ss->capacity);
 
-  for (i = 0; i < ss->size; ++i)
-    free(ss->strings[i]);
-  free(ss->strings);
-  free(ss);
+  if (ss->slots) {
+    fetchdeps_alloc_free(ss->strings);
+    fetchdeps_alloc_free(ss->hashes);
+    fetchdeps_alloc_free(ss->slots);
+  }
+  fetchdeps_alloc_free(ss);
 }
 
 bool_t
 fetchdeps_stringset_add(stringset_t* ss, char* str)
 {
-  size_t i;
+  uint64_t hash;
+  char* interned;
 
   assert(ss != NULL);
   assert(ss->strings != NULL);
   assert(ss->size <= ss->capacity);
   assert(str != NULL);
 
-  for (i = 0; i < ss->size; ++i) {
-    if (strcmp(ss->strings[i], str) == 0)
-      return 1;
-  }
-
-  // If we got here, we're adding a new string.
-  if (ss->size == ss->capacity) {
-    size_t new_capacity = ss->capacity * 2;
-
-    char** new_strings = (char**)realloc(ss->strings, new_capacity * sizeof(char*));
-    if (!new_strings)
-      goto failure;
-    ss->strings = new_strings;
-    ss->capacity = new_capacity;
-    memset(ss->strings + ss->size, 0, ss->capacity - ss->size);
-  }
-
-  ss->strings[ss->size] = strdup(str);
-  if (!ss->strings[ss->size])
-    goto failure;
-  ++ss->size;
-
-  return 1;
-
-failure:
-  return 0;
+  interned = fetchdeps_strpool_intern(str, strlen(str), &hash);
+  if (!interned)
+    return 0;
+  return fetchdeps_stringset_add_interned(ss, interned, hash);
 }
 
 
@@ -152,7 +170,7 @@ fetchdeps_stringset_add_all(stringset_t* dst, stringset_t* src)
   assert(src->size <= src->capacity);
 
   for (i = 0; i < src->size; ++i) {
-    if (!fetchdeps_stringset_add(dst, src->strings[i]))
+    if (!fetchdeps_stringset_add_interned(dst, src->strings[i], src->hashes[i]))
       goto failure;
   }
 
@@ -166,6 +184,7 @@ failure:
 bool_t
 fetchdeps_stringset_contains(stringset_t* ss, char* str)
 {
+  uint64_t hash;
   size_t i;
 
   assert(ss != NULL);
@@ -173,18 +192,41 @@ fetchdeps_stringset_contains(stringset_t* ss, char* str)
   assert(ss->size <= ss->capacity);
   assert(str != NULL);
 
+  hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, str, strlen(str));
+  if (ss->slots)
+    return ss->slots[fetchdeps_stringset_find_slot(ss, str, hash)] != 0;
+
   for (i = 0; i < ss->size; ++i) {
-    if (strcmp(ss->strings[i], str) == 0)
+    if (ss->hashes[i] == hash && strcmp(ss->strings[i], str) == 0)
       return 1;
   }
   return 0;
 }
 
 
+size_t
+fetchdeps_stringset_size(stringset_t* ss)
+{
+  assert(ss != NULL);
+  return ss->size;
+}
+
+
+char*
+fetchdeps_stringset_get(stringset_t* ss, size_t index)
+{
+  assert(ss != NULL);
+  assert(index < ss->size);
+  return ss->strings[index];
+}
+
+
 bool_t
 fetchdeps_stringset_contains_any(stringset_t* haystack,
                                  stringset_t* needles)
 {
+  stringset_t* probe;
+  stringset_t* table;
   size_t i;
 
   assert(haystack != NULL);
@@ -192,10 +234,23 @@ fetchdeps_stringset_contains_any(stringset_t* haystack,
   assert(haystack->size <= haystack->capacity);
   assert(needles != NULL);
   assert(needles->strings != NULL);
-  assert(needles->size <= haystack->capacity);
+  assert(needles->size <= needles->capacity);
+
+  if (!haystack->slots && !needles->slots)
+    return fetchdeps_stringset_merge_any(haystack, needles);
 
-  for (i = 0; i < needles->size; ++i) {
-    if (fetchdeps_stringset_contains(haystack, needles->strings[i]))
+  // The intersection is the same either way round, so look up the strings of
+  // the smaller set in the larger one, which is sure to have an index.
+  if (needles->size <= haystack->size) {
+    probe = needles;
+    table = haystack;
+  }
+  else {
+    probe = haystack;
+    table = needles;
+  }
+  for (i = 0; i < probe->size; ++i) {
+    if (fetchdeps_stringset_contains_interned(table, probe->strings[i], probe->hashes[i]))
       return 1;
   }
   return 0;
@@ -215,7 +270,7 @@ fetchdeps_stringiter_new(stringset_t* ss)
   assert(ss->strings != NULL);
   assert(ss->size <= ss->capacity);
 
-  iter = (stringiter_t*)malloc(sizeof(stringiter_t));
+  iter = (stringiter_t*)fetchdeps_alloc_malloc(ALLOC_STRINGSET, sizeof(stringiter_t));
   if (!iter)
     return NULL;
 
@@ -231,7 +286,7 @@ fetchdeps_stringiter_free(stringiter_t* iter)
 {
   assert(iter != NULL);
 
-  free(iter);
+  fetchdeps_alloc_free(iter);
 }
 
 
@@ -252,3 +307,234 @@ fetchdeps_stringiter_next(stringiter_t* iter)
   return result;
 }
 
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_stringset_add_interned(stringset_t* ss, char* str, uint64_t hash)
+{
+  size_t slot;
+
+  if (!ss->slots) {
+    if (ss->size < INLINE_CAPACITY ||
+        fetchdeps_stringset_contains_interned(ss, str, hash))
+      return fetchdeps_stringset_add_inline(ss, str, hash);
+    if (!fetchdeps_stringset_spill(ss))
+      return 0;
+  }
+
+  slot = fetchdeps_stringset_find_interned(ss, str, hash);
+  if (ss->slots[slot])
+    return 1;
+
+  // If we got here, we're adding a new string.
+  if (ss->size == ss->capacity) {
+    if (!fetchdeps_stringset_grow(ss))
+      return 0;
+    slot = fetchdeps_stringset_find_interned(ss, str, hash);
+  }
+
+  ss->strings[ss->size] = str;
+  ss->hashes[ss->size] = hash;
+  ss->slots[slot] = ++ss->size;
+  return 1;
+}
+
+
+// Adds a string to a small set, keeping 'order' sorted. The set must either
+// have room for the string or contain it already.
+bool_t
+fetchdeps_stringset_add_inline(stringset_t* ss, char* str, uint64_t hash)
+{
+  size_t pos, i;
+
+  for (pos = 0; pos < ss->size; ++pos) {
+    int cmp = fetchdeps_stringset_compare(ss->hashes[ss->order[pos]], ss->strings[ss->order[pos]], hash, str);
+    if (cmp == 0)
+      return 1;
+    if (cmp > 0)
+      break;
+  }
+
+  assert(ss->size < INLINE_CAPACITY);
+  for (i = ss->size; i > pos; --i)
+    ss->order[i] = ss->order[i - 1];
+  ss->order[pos] = (unsigned char)ss->size;
+
+  ss->strings[ss->size] = str;
+  ss->hashes[ss->size] = hash;
+  ++ss->size;
+  return 1;
+}
+
+
+// Checks for a string from the string pool in either kind of set.
+bool_t
+fetchdeps_stringset_contains_interned(stringset_t* ss, char* str, uint64_t hash)
+{
+  size_t i;
+
+  if (ss->slots)
+    return ss->slots[fetchdeps_stringset_find_interned(ss, str, hash)] != 0;
+
+  for (i = 0; i < ss->size; ++i) {
+    if (ss->strings[i] == str)
+      return 1;
+  }
+  return 0;
+}
+
+
+// Intersection test for two small sets: walk both in sorted order, stepping
+// whichever is behind, until the same string turns up in both or one of them
+// runs out.
+bool_t
+fetchdeps_stringset_merge_any(stringset_t* a, stringset_t* b)
+{
+  size_t i = 0, j = 0;
+
+  while (i < a->size && j < b->size) {
+    size_t ai = a->order[i];
+    size_t bj = b->order[j];
+    int cmp = fetchdeps_stringset_compare(a->hashes[ai], a->strings[ai], b->hashes[bj], b->strings[bj]);
+    if (cmp == 0)
+      return 1;
+    if (cmp < 0)
+      ++i;
+    else
+      ++j;
+  }
+  return 0;
+}
+
+
+// The sort order for small sets. Strings from the pool are equal exactly
+// when their addresses are, so the address serves as the tie breaker for
+// equal hashes.
+int
+fetchdeps_stringset_compare(uint64_t hash_a, char* str_a, uint64_t hash_b, char* str_b)
+{
+  if (hash_a != hash_b)
+    return hash_a < hash_b ? -1 : 1;
+  if (str_a != str_b)
+    return (uintptr_t)str_a < (uintptr_t)str_b ? -1 : 1;
+  return 0;
+}
+
+
+// Returns the slot holding 'str' if it's in the set, or else the empty slot
+// where it would go.
+size_t
+fetchdeps_stringset_find_slot(stringset_t* ss, char* str, uint64_t hash)
+{
+  size_t mask = ss->num_slots - 1;
+  size_t slot;
+
+  for (slot = hash & mask; ss->slots[slot]; slot = (slot + 1) & mask) {
+    size_t i = ss->slots[slot] - 1;
+    if (ss->hashes[i] == hash && strcmp(ss->strings[i], str) == 0)
+      break;
+  }
+  return slot;
+}
+
+
+// As fetchdeps_stringset_find_slot, for a string from the string pool, which
+// can be compared by pointer.
+size_t
+fetchdeps_stringset_find_interned(stringset_t* ss, char* str, uint64_t hash)
+{
+  size_t mask = ss->num_slots - 1;
+  size_t slot;
+
+  for (slot = hash & mask; ss->slots[slot]; slot = (slot + 1) & mask) {
+    if (ss->strings[ss->slots[slot] - 1] == str)
+      break;
+  }
+  return slot;
+}
+
+
+// Moves a full small set's strings to the heap and builds the hash index
+// over them.
+bool_t
+fetchdeps_stringset_spill(stringset_t* ss)
+{
+  char** new_strings = NULL;
+  uint64_t* new_hashes = NULL;
+  size_t* new_slots = NULL;
+  size_t num_slots = INITIAL_CAPACITY * 2;
+  size_t i, slot;
+
+  new_strings = (char**)fetchdeps_alloc_malloc(ALLOC_STRINGSET, INITIAL_CAPACITY * sizeof(char*));
+  if (!new_strings)
+    goto failure;
+  new_hashes = (uint64_t*)fetchdeps_alloc_malloc(ALLOC_STRINGSET, INITIAL_CAPACITY * sizeof(uint64_t));
+  if (!new_hashes)
+    goto failure;
+  new_slots = (size_t*)fetchdeps_alloc_calloc(ALLOC_STRINGSET, num_slots, sizeof(size_t));
+  if (!new_slots)
+    goto failure;
+
+  memcpy(new_strings, ss->strings, ss->size * sizeof(char*));
+  memcpy(new_hashes, ss->hashes, ss->size * sizeof(uint64_t));
+  for (i = 0; i < ss->size; ++i) {
+    for (slot = new_hashes[i] & (num_slots - 1); new_slots[slot]; slot = (slot + 1) & (num_slots - 1))
+      ;
+    new_slots[slot] = i + 1;
+  }
+
+  ss->strings = new_strings;
+  ss->hashes = new_hashes;
+  ss->capacity = INITIAL_CAPACITY;
+  ss->slots = new_slots;
+  ss->num_slots = num_slots;
+  return 1;
+
+failure:
+  if (new_strings)
+    fetchdeps_alloc_free(new_strings);
+  if (new_hashes)
+    fetchdeps_alloc_free(new_hashes);
+  return 0;
+}
+
+
+bool_t
+fetchdeps_stringset_grow(stringset_t* ss)
+{
+  size_t new_capacity = ss->capacity * 2;
+  size_t new_num_slots = new_capacity * 2;
+  char** new_strings;
+  uint64_t* new_hashes;
+  size_t* new_slots;
+  size_t i, slot;
+
+  new_strings = (char**)fetchdeps_alloc_realloc(ALLOC_STRINGSET, ss->strings, new_capacity * sizeof(char*));
+  if (!new_strings)
+    return 0;
+  ss->strings = new_strings;
+
+  new_hashes = (uint64_t*)fetchdeps_alloc_realloc(ALLOC_STRINGSET, ss->hashes, new_capacity * sizeof(uint64_t));
+  if (!new_hashes)
+    return 0;
+  ss->hashes = new_hashes;
+
+  new_slots = (size_t*)fetchdeps_alloc_calloc(ALLOC_STRINGSET, new_num_slots, sizeof(size_t));
+  if (!new_slots)
+    return 0;
+
+  for (i = 0; i < ss->size; ++i) {
+    for (slot = ss->hashes[i] & (new_num_slots - 1); new_slots[slot]; slot = (slot + 1) & (new_num_slots - 1))
+      ;
+    new_slots[slot] = i + 1;
+  }
+
+  fetchdeps_alloc_free(ss->slots);
+  ss->slots = new_slots;
+  ss->num_slots = new_num_slots;
+  ss->capacity = new_capacity;
+  return 1;
+}
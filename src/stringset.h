@@ -3,6 +3,8 @@
 
 #include "common.h"
 
+#include <stddef.h>
+
 
 //
 // Types
@@ -23,18 +25,18 @@ typedef struct _stringiter stringiter_t;
 // fetchdeps_stringset_free.
 stringset_t* fetchdeps_stringset_new();
 
-// Allocate a new stringset populated with a single string. The set will take
-// its own copy of the string. The set must eventually be freed via
-// fetchdeps_stringset_free, which will also free up the copy of the string.
+// Allocate a new stringset populated with a single string. The set will use
+// the string pool's copy of the string (see strpool.h). The set must
+// eventually be freed via fetchdeps_stringset_free.
 stringset_t* fetchdeps_stringset_new_single(char* str);
 
-// Deallocate a string set. This frees the memory for the stringset and for all
-// of the strings contained in it.
+// Deallocate a string set. The strings it contained belong to the string pool,
+// so they stay valid afterwards.
 void fetchdeps_stringset_free(stringset_t* ss);
 
 // Add a string to the stringset. If the string already exists in the set,
-// nothing will change. If it's a new value, the set will store a copy of the
-// string.
+// nothing will change. If it's a new value, the set will store the string
+// pool's copy of it, so the caller keeps ownership of 'str'.
 //
 // The function returns true if, on completion, the set contains the string;
 // it doesn't matter whether the string was there already or it was added by
@@ -44,9 +46,9 @@ bool_t fetchdeps_stringset_add(stringset_t* ss, char* str);
 
 // Add all strings from the src stringset to the dst stringset. This has the
 // semantics of a set union operation and is equivalent to calling
-// fetchdeps_stringset_add once for every string in the src stringset. After
-// this call the dst stringset will have copied any new strings from the src.
-// The src is not altered in any way.
+// fetchdeps_stringset_add once for every string in the src stringset, except
+// that the strings are already in the string pool so they're shared rather
+// than looked up again. The src is not altered in any way.
 //
 // The function returns true if the dst stringset contains all of the strings
 // in src on completion. It doesn't matter whether these were added by this
@@ -62,6 +64,14 @@ bool_t fetchdeps_stringset_add_all(stringset_t* dst, stringset_t* src);
 // was found, false if it isn't. Both parameters must be non-NULL.
 bool_t fetchdeps_stringset_contains(stringset_t* ss, char* str);
 
+// Returns the number of strings in the set.
+size_t fetchdeps_stringset_size(stringset_t* ss);
+
+// Returns the string at 'index' in the set, counting from zero in the order
+// the strings were added. 'index' must be less than the size of the set. As
+// with iteration, the string still belongs to the set.
+char* fetchdeps_stringset_get(stringset_t* ss, size_t index);
+
 // Check whether any of the strings in the 'needles' set are also in the
 // 'haystack' set. This is checking whether the intersection of the two sets is
 // non-empty & the return value indicates this. Both sets must be non-NULL.
@@ -86,8 +96,8 @@ void fetchdeps_stringiter_free(stringiter_t* iter);
 //
 // Note that the pointers returned by iteration are pointers to the strings
 // held by the set; we don't copy them before returning them. As such, you
-// shouldn't try to free them yourself; nor should you store them beyond
-// the duration of the iteration.
+// shouldn't try to free or modify them yourself. They belong to the string
+// pool, so they stay valid until fetchdeps_strpool_free is called.
 char* fetchdeps_stringiter_next(stringiter_t* iter);
 
 #endif // fetchdeps_stringset_h
@@ -0,0 +1,176 @@
+#include "strpool.h"
+
+#include "alloc.h"
+#include "arena.h"
+#include "hash.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Constants
+//
+
+static const size_t kMinSlots = 1024;
+
+
+//
+// Types
+//
+
+// A string in the pool, with its hash so the table can grow without rehashing.
+struct _poolslot {
+  char* str;
+  uint64_t hash;
+};
+typedef struct _poolslot poolslot_t;
+
+
+// An open addressing hash table over the strings, which are allocated from
+// 'arena'. A slot with a NULL 'str' is empty. The table is never more than
+// half full.
+struct _strpool {
+  pthread_mutex_t lock;
+  arena_t* arena;
+  poolslot_t* slots;
+  size_t num_slots;
+  size_t size;
+  size_t lookups;
+};
+typedef struct _strpool strpool_t;
+
+
+//
+// Global variables
+//
+
+static strpool_t gPool = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0, 0 };
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_strpool_grow(strpool_t* pool);
+
+
+//
+// Public functions
+//
+
+char*
+fetchdeps_strpool_intern(const char* str, size_t len, uint64_t* hash)
+{
+  strpool_t* pool = &gPool;
+  uint64_t h;
+  size_t slot;
+  char* result = NULL;
+
+  h = fetchdeps_hash_fnv1a(kFnvOffsetBasis, str, len);
+  if (hash)
+    *hash = h;
+
+  pthread_mutex_lock(&pool->lock);
+  ++pool->lookups;
+
+  if (!pool->arena) {
+    pool->arena = fetchdeps_arena_new();
+    if (!pool->arena)
+      goto done;
+  }
+  if ((pool->size + 1) * 2 > pool->num_slots && !fetchdeps_strpool_grow(pool))
+    goto done;
+
+  for (slot = h & (pool->num_slots - 1); pool->slots[slot].str; slot = (slot + 1) & (pool->num_slots - 1)) {
+    poolslot_t* entry = &pool->slots[slot];
+    if (entry->hash == h && strncmp(entry->str, str, len) == 0 && entry->str[len] == '\0') {
+      result = entry->str;
+      goto done;
+    }
+  }
+
+  // The arena hands out zeroed memory, so the copy is already terminated.
+  result = (char*)fetchdeps_arena_alloc(pool->arena, len + 1);
+  if (!result)
+    goto done;
+  memcpy(result, str, len);
+  pool->slots[slot].str = result;
+  pool->slots[slot].hash = h;
+  ++pool->size;
+
+done:
+  pthread_mutex_unlock(&pool->lock);
+  return result;
+}
+
+
+void
+fetchdeps_strpool_get_stats(strpool_stats_t* stats)
+{
+  strpool_t* pool = &gPool;
+
+  memset(stats, 0, sizeof(*stats));
+
+  pthread_mutex_lock(&pool->lock);
+  stats->lookups = pool->lookups;
+  stats->strings = pool->size;
+  if (pool->arena)
+    fetchdeps_arena_usage(pool->arena, &stats->blocks, &stats->bytes);
+  if (pool->slots) {
+    stats->bytes += pool->num_slots * sizeof(poolslot_t);
+    ++stats->blocks;
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+void
+fetchdeps_strpool_free()
+{
+  strpool_t* pool = &gPool;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->arena)
+    fetchdeps_arena_free(pool->arena);
+  if (pool->slots)
+    fetchdeps_alloc_free(pool->slots);
+  pool->arena = NULL;
+  pool->slots = NULL;
+  pool->num_slots = 0;
+  pool->size = 0;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_strpool_grow(strpool_t* pool)
+{
+  size_t new_num_slots = pool->num_slots ? pool->num_slots * 2 : kMinSlots;
+  poolslot_t* new_slots;
+  size_t i, slot;
+
+  new_slots = (poolslot_t*)fetchdeps_alloc_calloc(ALLOC_STRPOOL, new_num_slots, sizeof(poolslot_t));
+  if (!new_slots)
+    return 0;
+
+  for (i = 0; i < pool->num_slots; ++i) {
+    if (!pool->slots[i].str)
+      continue;
+    for (slot = pool->slots[i].hash & (new_num_slots - 1); new_slots[slot].str; slot = (slot + 1) & (new_num_slots - 1))
+      ;
+    new_slots[slot] = pool->slots[i];
+  }
+
+  if (pool->slots)
+    fetchdeps_alloc_free(pool->slots);
+  pool->slots = new_slots;
+  pool->num_slots = new_num_slots;
+  return 1;
+}
+
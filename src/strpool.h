@@ -0,0 +1,48 @@
+#ifndef fetchdeps_strpool_h
+#define fetchdeps_strpool_h
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Types
+//
+
+// Figures about the string pool, for measuring how much interning saves.
+struct _strpool_stats {
+  size_t lookups;       // Calls to fetchdeps_strpool_intern.
+  size_t strings;       // Distinct strings stored; the rest were repeats.
+  size_t bytes;         // Memory taken from the system for the strings...
+  size_t blocks;        // ...and the number of allocations that took.
+};
+typedef struct _strpool_stats strpool_stats_t;
+
+
+//
+// Functions
+//
+
+// The string pool holds a single copy of each distinct string used by
+// stringsets and varmaps for the whole run. Interning the same string twice
+// gives the same pointer, so two interned strings are equal exactly when
+// their pointers are. The strings are allocated from an arena, so they're
+// never freed individually; they all go at once in fetchdeps_strpool_free.
+// The pool is safe to use from several threads at once.
+
+// Returns the canonical copy of the first 'len' characters of 'str', which
+// needn't be nul terminated, adding it to the pool if it isn't there yet. If
+// 'hash' isn't NULL, it's set to the string's hash. Returns NULL if memory
+// couldn't be allocated. The returned string must not be modified.
+char* fetchdeps_strpool_intern(const char* str, size_t len, uint64_t* hash);
+
+// Fill in 'stats' with figures about the pool so far.
+void fetchdeps_strpool_get_stats(strpool_stats_t* stats);
+
+// Free every string in the pool. Nothing which might still refer to one of
+// them may be used afterwards, so this is for the very end of the run.
+void fetchdeps_strpool_free();
+
+#endif // fetchdeps_strpool_h
+
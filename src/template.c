@@ -0,0 +1,266 @@
+#include "template.h"
+
+#include "alloc.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Constants
+//
+
+// URLs rarely refer to more than a handful of variables, so their values are
+// held on the stack up to this many.
+#define kMaxStackVars 8
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_template_expand_from(urltemplate_t* t, stringset_t** values,
+                                      char** chosen, size_t seg, size_t var, size_t len,
+                                      template_emit_fn emit, void* emit_arg,
+                                      char* buf);
+const char* fetchdeps_template_next_var(const char* str, const char** name_end);
+
+
+//
+// Public functions
+//
+
+urltemplate_t*
+fetchdeps_template_compile(arena_t* arena, const char* url)
+{
+  urltemplate_t* t;
+  template_segment_t* seg;
+  template_segment_t* prev;
+  const char* pos;
+  const char* var;
+  const char* name_end;
+  size_t num_segments = 0;
+
+  assert(arena != NULL);
+  assert(url != NULL);
+
+  // Count the segments first, so they can be allocated in one go. Each
+  // variable can bring a literal segment before it, plus one at the very end.
+  for (pos = url; (var = fetchdeps_template_next_var(pos, &name_end)) != NULL; pos = name_end + 1)
+    num_segments += (var > pos) ? 2 : 1;
+  if (num_segments == 0)
+    return NULL;
+  if (*pos)
+    ++num_segments;
+
+  t = (urltemplate_t*)fetchdeps_arena_alloc(arena, sizeof(urltemplate_t));
+  if (!t)
+    return NULL;
+  t->segments = (template_segment_t*)fetchdeps_arena_alloc(arena, num_segments * sizeof(template_segment_t));
+  if (!t->segments)
+    return NULL;
+
+  seg = t->segments;
+  for (pos = url; (var = fetchdeps_template_next_var(pos, &name_end)) != NULL; pos = name_end + 1) {
+    if (var > pos) {
+      seg->text = pos;
+      seg->len = var - pos;
+      t->literal_len += seg->len;
+      ++seg;
+    }
+
+    // The name starts after the "$(" and ends before the ")".
+    seg->len = name_end - (var + 2);
+    seg->text = (char*)fetchdeps_arena_alloc(arena, seg->len + 1);
+    if (!seg->text)
+      return NULL;
+    memcpy((char*)seg->text, var + 2, seg->len);
+    seg->is_var = 1;
+
+    // Repeats of a name share its first occurrence's number, so they can be
+    // given the same value.
+    seg->var = t->num_vars;
+    for (prev = t->segments; prev < seg; ++prev) {
+      if (prev->is_var && strcmp(prev->text, seg->text) == 0) {
+        seg->var = prev->var;
+        break;
+      }
+    }
+    if (seg->var == t->num_vars)
+      ++t->num_vars;
+    ++seg;
+  }
+  if (*pos) {
+    seg->text = pos;
+    seg->len = strlen(pos);
+    t->literal_len += seg->len;
+    ++seg;
+  }
+
+  t->num_segments = seg - t->segments;
+  return t;
+}
+
+
+bool_t
+fetchdeps_template_has_vars(const char* url)
+{
+  const char* name_end;
+
+  assert(url != NULL);
+  return fetchdeps_template_next_var(url, &name_end) != NULL;
+}
+
+
+bool_t
+fetchdeps_template_expand(urltemplate_t* t,
+                          template_lookup_fn lookup, void* lookup_arg,
+                          template_emit_fn emit, void* emit_arg,
+                          char** buf, size_t* capacity)
+{
+  stringset_t* stack_values[kMaxStackVars];
+  char* stack_chosen[kMaxStackVars];
+  stringset_t** values = stack_values;
+  char** chosen = stack_chosen;
+  size_t needed;
+  size_t i, v, n;
+  bool_t ok = 0;
+
+  assert(t != NULL);
+  assert(lookup != NULL);
+  assert(emit != NULL);
+  assert(buf != NULL);
+  assert(capacity != NULL);
+
+  if (t->num_vars > kMaxStackVars) {
+    values = (stringset_t**)fetchdeps_alloc_malloc(ALLOC_TEMPLATE, t->num_vars * sizeof(stringset_t*));
+    chosen = (char**)fetchdeps_alloc_malloc(ALLOC_TEMPLATE, t->num_vars * sizeof(char*));
+    if (!values || !chosen)
+      goto done;
+  }
+
+  // Look every variable up once, and size the buffer for the longest value of
+  // each use so nothing needs checking while the expansions are written.
+  needed = t->literal_len + 1;
+  for (i = 0, v = 0; i < t->num_segments; ++i) {
+    template_segment_t* seg = &t->segments[i];
+    size_t longest = 0;
+
+    if (!seg->is_var)
+      continue;
+
+    // Names are numbered in order of first use, so a new one is always next.
+    if (seg->var == v) {
+      values[v] = lookup(lookup_arg, seg->text);
+      if (!values[v])
+        goto done;
+      ++v;
+    }
+
+    n = fetchdeps_stringset_size(values[seg->var]);
+    if (n == 0) {
+      ok = 1;
+      goto done;
+    }
+    while (n-- > 0) {
+      size_t len = strlen(fetchdeps_stringset_get(values[seg->var], n));
+      if (len > longest)
+        longest = len;
+    }
+    needed += longest;
+  }
+
+  if (needed > *capacity) {
+    size_t new_capacity = *capacity ? *capacity : 256;
+    char* new_buf;
+    while (new_capacity < needed)
+      new_capacity *= 2;
+    new_buf = (char*)fetchdeps_alloc_realloc(ALLOC_TEMPLATE, *buf, new_capacity);
+    if (!new_buf)
+      goto done;
+    *buf = new_buf;
+    *capacity = new_capacity;
+  }
+
+  ok = fetchdeps_template_expand_from(t, values, chosen, 0, 0, 0, emit, emit_arg, *buf);
+
+done:
+  if (values && values != stack_values)
+    fetchdeps_alloc_free(values);
+  if (chosen && chosen != stack_chosen)
+    fetchdeps_alloc_free(chosen);
+  return ok;
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_template_expand_from(urltemplate_t* t, stringset_t** values,
+                               char** chosen, size_t seg, size_t var, size_t len,
+                               template_emit_fn emit, void* emit_arg,
+                               char* buf)
+{
+  size_t i, n;
+
+  // Literal segments are copied straight in, and so is any variable which
+  // already has a value from earlier in the URL; there's nothing to choose.
+  // 'var' is the number of names which have been given values so far, and
+  // names are numbered in order of first use.
+  for (; seg < t->num_segments; ++seg) {
+    template_segment_t* s = &t->segments[seg];
+
+    if (s->is_var && s->var == var)
+      break;
+    if (s->is_var) {
+      size_t value_len = strlen(chosen[s->var]);
+      memcpy(buf + len, chosen[s->var], value_len);
+      len += value_len;
+    }
+    else {
+      memcpy(buf + len, s->text, s->len);
+      len += s->len;
+    }
+  }
+
+  if (seg == t->num_segments) {
+    buf[len] = '\0';
+    return emit(emit_arg, buf, len);
+  }
+
+  n = fetchdeps_stringset_size(values[var]);
+  for (i = 0; i < n; ++i) {
+    char* value = fetchdeps_stringset_get(values[var], i);
+    size_t value_len = strlen(value);
+
+    chosen[var] = value;
+    memcpy(buf + len, value, value_len);
+    if (!fetchdeps_template_expand_from(t, values, chosen, seg + 1, var + 1, len + value_len, emit, emit_arg, buf))
+      return 0;
+  }
+  return 1;
+}
+
+
+// Find the next "$(name)" in 'str', returning a pointer to the '$' and setting
+// 'name_end' to the closing ')'. Returns NULL if there aren't any more.
+const char*
+fetchdeps_template_next_var(const char* str, const char** name_end)
+{
+  const char* end;
+
+  for (str = strstr(str, "$("); str; str = strstr(str + 1, "$(")) {
+    end = strchr(str + 2, ')');
+    if (!end)
+      return NULL;
+    if (end > str + 2) {
+      *name_end = end;
+      return str;
+    }
+  }
+  return NULL;
+}
+
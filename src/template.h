@@ -0,0 +1,80 @@
+#ifndef fetchdeps_template_h
+#define fetchdeps_template_h
+
+#include "arena.h"
+#include "common.h"
+#include "stringset.h"
+
+#include <stddef.h>
+
+//
+// Types
+//
+
+// One piece of a URL template: either literal text, or the name of a variable
+// whose value gets substituted in. Literal text points into the URL the
+// template was compiled from, so it isn't nul terminated; variable names are.
+struct _template_segment {
+  const char* text;
+  size_t len;
+  bool_t is_var;
+  size_t var;   // For variables, which of the template's distinct names it is.
+};
+typedef struct _template_segment template_segment_t;
+
+
+// A URL containing $(varname) references, split into segments once so that
+// it can be expanded many times without looking at the URL text again.
+struct _urltemplate {
+  template_segment_t* segments;
+  size_t num_segments;
+  size_t num_vars;      // Distinct variable names, in order of first use.
+  size_t literal_len;   // Total length of the literal segments.
+};
+typedef struct _urltemplate urltemplate_t;
+
+
+// Returns the values of the variable called 'name', or NULL if there's no such
+// variable or memory couldn't be allocated. The lookup function is expected to
+// report the problem itself.
+typedef stringset_t* (*template_lookup_fn)(void* arg, const char* name);
+
+// Receives one expansion of a template. 'url' is only valid until the
+// function returns. Returns false to stop the expansion.
+typedef bool_t (*template_emit_fn)(void* arg, char* url, size_t len);
+
+
+//
+// Functions
+//
+
+// Split 'url' into segments, allocating the template from 'arena'. The URL
+// must outlive the template. Returns NULL if the URL doesn't contain any
+// variable references, or if memory couldn't be allocated; use
+// fetchdeps_template_has_vars to tell the two apart.
+urltemplate_t* fetchdeps_template_compile(arena_t* arena, const char* url);
+
+// Returns true if 'url' contains at least one $(varname) reference.
+bool_t fetchdeps_template_has_vars(const char* url);
+
+// Expand the template once for every combination of its variables' values,
+// calling 'emit' with each result. A variable used more than once gets the
+// same value everywhere in any one expansion. The first variable in the URL
+// changes the slowest. A variable with no values produces no expansions at
+// all.
+//
+// '*buf' is a buffer of '*capacity' bytes, which may be NULL and zero, and
+// which is grown to fit the longest possible expansion before anything is
+// written. Passing the same buffer to every call means expanding a template
+// normally doesn't allocate at all. The caller frees the buffer with
+// fetchdeps_alloc_free.
+//
+// Returns false if a variable doesn't exist, 'emit' returned false, or memory
+// couldn't be allocated.
+bool_t fetchdeps_template_expand(urltemplate_t* t,
+                                 template_lookup_fn lookup, void* lookup_arg,
+                                 template_emit_fn emit, void* emit_arg,
+                                 char** buf, size_t* capacity);
+
+#endif // fetchdeps_template_h
+
@@ -0,0 +1,356 @@
+#include "trace.h"
+
+#include "alloc.h"
+#include "errors.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>   // For clock_gettime()
+#include <unistd.h> // For getpid()
+
+
+//
+// Constants
+//
+
+// How many events each thread has room for to start with. It doubles from
+// there as needed.
+static const size_t kInitialEvents = 256;
+
+
+//
+// Types
+//
+
+// A single event. 'phase' is the Chrome trace-event phase: 'B' for begin, 'E'
+// for end, or 'X' for a complete event with a duration.
+struct _traceevent {
+  const char* name;
+  char* detail;
+  uint64_t time;
+  uint64_t duration;
+  char phase;
+};
+typedef struct _traceevent traceevent_t;
+
+
+// The events recorded by one thread. Only that thread touches its events
+// until the trace is closed, so recording doesn't need a lock. If memory runs
+// out the thread stops recording, rather than leave its begins and ends
+// mismatched.
+struct _tracethread {
+  struct _tracethread* next;
+  unsigned long tid;
+  const char* name;
+  traceevent_t* events;
+  size_t num_events;
+  size_t capacity;
+  bool_t failed;
+};
+typedef struct _tracethread tracethread_t;
+
+
+//
+// Forward declarations
+//
+
+tracethread_t* fetchdeps_trace_thread();
+void fetchdeps_trace_add(char phase, const char* name, const char* detail,
+                         uint64_t time, uint64_t duration);
+void fetchdeps_trace_write_thread(FILE* out, tracethread_t* t, bool_t* first);
+void fetchdeps_trace_write_string(FILE* out, const char* str);
+void fetchdeps_trace_free_threads();
+
+
+//
+// Global variables
+//
+
+// Set once, before any other threads start, and cleared once they've all
+// finished, so the unlocked reads of it are safe.
+static bool_t gTracing = 0;
+static FILE* gTraceFile = NULL;
+static char* gTraceFname = NULL;
+
+// Every thread which has recorded anything. Only adding to the list needs the
+// lock.
+static pthread_mutex_t gThreadsLock = PTHREAD_MUTEX_INITIALIZER;
+static tracethread_t* gThreads = NULL;
+static unsigned long gNextTid = 1;
+
+static __thread tracethread_t* tThread = NULL;
+
+
+//
+// Public functions
+//
+
+bool_t
+fetchdeps_trace_open(const char* fname)
+{
+  assert(fname != NULL);
+  assert(!gTracing);
+
+  gTraceFname = fetchdeps_alloc_strdup(ALLOC_TRACE, fname);
+  if (!gTraceFname) {
+    fetchdeps_errors_trap_system_error();
+    return 0;
+  }
+
+  gTraceFile = fopen(fname, "w");
+  if (!gTraceFile) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to create trace file %s", fname);
+    fetchdeps_alloc_free(gTraceFname);
+    gTraceFname = NULL;
+    return 0;
+  }
+
+  gTracing = 1;
+  return 1;
+}
+
+
+bool_t
+fetchdeps_trace_close()
+{
+  tracethread_t* t;
+  bool_t first = 1;
+  bool_t ok;
+
+  if (!gTracing)
+    return 1;
+  gTracing = 0;
+
+  // The threads are listed newest first, but each track's sort index puts
+  // them back in the order they started, with the main thread at the top.
+  fprintf(gTraceFile, "{\"traceEvents\":[");
+  for (t = gThreads; t; t = t->next)
+    fetchdeps_trace_write_thread(gTraceFile, t, &first);
+  fprintf(gTraceFile, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+  ok = !ferror(gTraceFile);
+  if (fclose(gTraceFile) != 0)
+    ok = 0;
+  if (!ok)
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to write trace file %s", gTraceFname);
+
+  gTraceFile = NULL;
+  fetchdeps_alloc_free(gTraceFname);
+  gTraceFname = NULL;
+  fetchdeps_trace_free_threads();
+  return ok;
+}
+
+
+bool_t
+fetchdeps_trace_enabled()
+{
+  return gTracing;
+}
+
+
+uint64_t
+fetchdeps_trace_now()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+void
+fetchdeps_trace_name_thread(const char* name)
+{
+  tracethread_t* t;
+
+  assert(name != NULL);
+
+  if (!gTracing)
+    return;
+  t = fetchdeps_trace_thread();
+  if (t && !t->name)
+    t->name = name;
+}
+
+
+void
+fetchdeps_trace_begin(const char* name, const char* detail)
+{
+  assert(name != NULL);
+
+  if (!gTracing)
+    return;
+  fetchdeps_trace_add('B', name, detail, fetchdeps_trace_now(), 0);
+}
+
+
+void
+fetchdeps_trace_end()
+{
+  if (!gTracing)
+    return;
+  fetchdeps_trace_add('E', NULL, NULL, fetchdeps_trace_now(), 0);
+}
+
+
+void
+fetchdeps_trace_complete(const char* name, const char* detail, uint64_t start)
+{
+  uint64_t now;
+
+  assert(name != NULL);
+
+  if (!gTracing)
+    return;
+  now = fetchdeps_trace_now();
+  fetchdeps_trace_add('X', name, detail, start, now > start ? now - start : 0);
+}
+
+
+//
+// Private functions
+//
+
+// Returns the calling thread's events, setting them up if this is the first
+// time it's recorded anything. Returns NULL if memory couldn't be allocated.
+tracethread_t*
+fetchdeps_trace_thread()
+{
+  tracethread_t* t = tThread;
+
+  if (t)
+    return t;
+
+  t = (tracethread_t*)fetchdeps_alloc_calloc(ALLOC_TRACE, 1, sizeof(tracethread_t));
+  if (!t)
+    return NULL;
+
+  pthread_mutex_lock(&gThreadsLock);
+  t->tid = gNextTid++;
+  t->next = gThreads;
+  gThreads = t;
+  pthread_mutex_unlock(&gThreadsLock);
+
+  tThread = t;
+  return t;
+}
+
+
+void
+fetchdeps_trace_add(char phase, const char* name, const char* detail,
+                    uint64_t time, uint64_t duration)
+{
+  tracethread_t* t;
+  traceevent_t* event;
+
+  t = fetchdeps_trace_thread();
+  if (!t || t->failed)
+    return;
+
+  if (t->num_events == t->capacity) {
+    size_t new_capacity = t->capacity ? t->capacity * 2 : kInitialEvents;
+    traceevent_t* new_events = (traceevent_t*)fetchdeps_alloc_realloc(ALLOC_TRACE, t->events, new_capacity * sizeof(traceevent_t));
+    if (!new_events) {
+      t->failed = 1;
+      return;
+    }
+    t->events = new_events;
+    t->capacity = new_capacity;
+  }
+
+  event = &t->events[t->num_events];
+  event->detail = NULL;
+  if (detail) {
+    event->detail = fetchdeps_alloc_strdup(ALLOC_TRACE, detail);
+    if (!event->detail) {
+      t->failed = 1;
+      return;
+    }
+  }
+  event->name = name;
+  event->time = time;
+  event->duration = duration;
+  event->phase = phase;
+  ++t->num_events;
+}
+
+
+void
+fetchdeps_trace_write_thread(FILE* out, tracethread_t* t, bool_t* first)
+{
+  unsigned long pid = (unsigned long)getpid();
+  char default_name[32];
+  size_t i;
+
+  if (!t->name)
+    snprintf(default_name, sizeof(default_name), "thread %lu", t->tid);
+  fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":",
+          *first ? "" : ",", pid, t->tid);
+  fetchdeps_trace_write_string(out, t->name ? t->name : default_name);
+  fprintf(out, "}}");
+  fprintf(out, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"sort_index\":%lu}}",
+          pid, t->tid, t->tid);
+  *first = 0;
+
+  for (i = 0; i < t->num_events; ++i) {
+    traceevent_t* event = &t->events[i];
+
+    fprintf(out, ",\n{\"ph\":\"%c\",\"pid\":%lu,\"tid\":%lu,\"ts\":%llu",
+            event->phase, pid, t->tid, (unsigned long long)event->time);
+    if (event->phase == 'X')
+      fprintf(out, ",\"dur\":%llu", (unsigned long long)event->duration);
+    if (event->name) {
+      fprintf(out, ",\"name\":");
+      fetchdeps_trace_write_string(out, event->name);
+    }
+    if (event->detail) {
+      fprintf(out, ",\"args\":{\"detail\":");
+      fetchdeps_trace_write_string(out, event->detail);
+      fputc('}', out);
+    }
+    fputc('}', out);
+  }
+}
+
+
+void
+fetchdeps_trace_write_string(FILE* out, const char* str)
+{
+  const unsigned char* ch;
+
+  fputc('"', out);
+  for (ch = (const unsigned char*)str; *ch; ++ch) {
+    if (*ch == '"' || *ch == '\\')
+      fprintf(out, "\\%c", *ch);
+    else if (*ch < 0x20)
+      fprintf(out, "\\u%04x", *ch);
+    else
+      fputc(*ch, out);
+  }
+  fputc('"', out);
+}
+
+
+void
+fetchdeps_trace_free_threads()
+{
+  tracethread_t* t;
+  size_t i;
+
+  while (gThreads) {
+    t = gThreads;
+    gThreads = t->next;
+    for (i = 0; i < t->num_events; ++i) {
+      if (t->events[i].detail)
+        fetchdeps_alloc_free(t->events[i].detail);
+    }
+    if (t->events)
+      fetchdeps_alloc_free(t->events);
+    fetchdeps_alloc_free(t);
+  }
+  tThread = NULL;
+}
+
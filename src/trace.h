@@ -0,0 +1,55 @@
+#ifndef fetchdeps_trace_h
+#define fetchdeps_trace_h
+
+#include "common.h"
+
+#include <stdint.h>
+
+//
+// Functions
+//
+
+// Tracing records when each phase of a run begins and ends, on each thread,
+// and writes them out at the end as a Chrome trace-event JSON file which can
+// be loaded into Perfetto or chrome://tracing. Every thread which records
+// anything gets a track of its own.
+//
+// Until fetchdeps_trace_open is called, all of the other functions return
+// straight away without doing anything, so they can be left in hot paths.
+//
+// Event names must be string literals, or at least last until the trace is
+// closed. The 'detail' strings are copied and may be NULL.
+
+// Start recording events, to be written to 'fname' by fetchdeps_trace_close.
+// The file is created straight away, so a bad path is reported now rather
+// than at the end. Returns false, with the error set, if it couldn't be.
+// Tracing can only be turned on once per run.
+bool_t fetchdeps_trace_open(const char* fname);
+
+// Write out everything recorded and stop tracing. No other thread may be
+// recording events at the time. Returns false, with the error set, if the
+// file couldn't be written. Does nothing if tracing isn't on.
+bool_t fetchdeps_trace_close();
+
+// Returns true if fetchdeps_trace_open has been called.
+bool_t fetchdeps_trace_enabled();
+
+// The current time, in the units used for the trace: microseconds since some
+// arbitrary point. Can be called whether or not tracing is on.
+uint64_t fetchdeps_trace_now();
+
+// Give the calling thread's track a name, unless it already has one. Threads
+// which aren't given one are called "thread N".
+void fetchdeps_trace_name_thread(const char* name);
+
+// Begin and end a phase on the calling thread. Phases on the same thread must
+// nest: each end matches the most recent begin which hasn't been ended.
+void fetchdeps_trace_begin(const char* name, const char* detail);
+void fetchdeps_trace_end();
+
+// Record a phase which ran from 'start' (from fetchdeps_trace_now) until now.
+// For phases which had to start before tracing could be turned on.
+void fetchdeps_trace_complete(const char* name, const char* detail, uint64_t start);
+
+#endif // fetchdeps_trace_h
+
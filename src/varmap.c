@@ -1,6 +1,11 @@
 #include "varmap.h"
 
+#include "alloc.h"
+#include "hash.h"
+#include "strpool.h"
+
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -8,18 +13,41 @@
 // Constants
 //
 
-static const size_t kInitialCapacity = 10;
+static const size_t kInitialCapacity = 16;
+
+
+//
+// Global variables
+//
+
+// Provided by the C library, each entry is a string of the form NAME=VALUE.
+extern char** environ;
 
 
 //
 // Types
 //
 
+// The entries are kept in dense arrays in the order they were added, which is
+// what iteration walks, plus an open addressing index into them laid out the
+// same way as the one in stringset.c: each slot holds an index plus one, or
+// zero if it's empty, and there are twice as many slots as 'capacity'.
+//
+// A NULL value records that an environment variable was looked up and isn't
+// set, so that we don't ask for it again. As far as the public functions are
+// concerned, those entries don't exist.
 struct _varmap {
   char** keys;
+  uint64_t* hashes;
   stringset_t** values;
   size_t size;
   size_t capacity;
+
+  size_t* slots;
+  size_t num_slots;
+
+  bool_t use_environ;       // Look up missing keys with getenv.
+  bool_t imported_environ;  // All of the environment is in the map already.
 };
 
 
@@ -29,6 +57,18 @@ struct _variter {
 };
 
 
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_varmap_find(varmap_t* vm, char* key, uint64_t hash, size_t* index);
+bool_t fetchdeps_varmap_insert(varmap_t* vm, char* key, size_t len, uint64_t hash, stringset_t* value);
+stringset_t* fetchdeps_varmap_lookup(varmap_t* vm, char* key);
+bool_t fetchdeps_varmap_import_environ(varmap_t* vm);
+size_t fetchdeps_varmap_find_slot(varmap_t* vm, char* key, uint64_t hash);
+bool_t fetchdeps_varmap_grow(varmap_t* vm);
+
+
 //
 // varmap_t functions
 //
@@ -36,38 +76,38 @@ struct _variter {
 varmap_t*
 fetchdeps_varmap_new()
 {
-  varmap_t* vm = (varmap_t*)malloc(sizeof(varmap_t));
+  varmap_t* vm = (varmap_t*)fetchdeps_alloc_calloc(ALLOC_VARMAP, 1, sizeof(varmap_t));
   if (!vm)
     return NULL;
 
-  vm->keys = NULL;
-  vm->values = NULL;
-  vm->size = 0;
-  vm->capacity = kInitialCapacity;
-
-  size_t keyBytes = sizeof(char*) * kInitialCapacity;
-  size_t valueBytes = sizeof(stringset_t*) * kInitialCapacity;
-
-  vm->keys = (char**)malloc(keyBytes);
+  vm->keys = (char**)fetchdeps_alloc_calloc(ALLOC_VARMAP, kInitialCapacity, sizeof(char*));
   if (!vm->keys)
     goto failure;
-
-  vm->values = (stringset_t**)malloc(valueBytes);
+  vm->hashes = (uint64_t*)fetchdeps_alloc_calloc(ALLOC_VARMAP, kInitialCapacity, sizeof(uint64_t));
+  if (!vm->hashes)
+    goto failure;
+  vm->values = (stringset_t**)fetchdeps_alloc_calloc(ALLOC_VARMAP, kInitialCapacity, sizeof(stringset_t*));
   if (!vm->values)
     goto failure;
+  vm->slots = (size_t*)fetchdeps_alloc_calloc(ALLOC_VARMAP, kInitialCapacity * 2, sizeof(size_t));
+  if (!vm->slots)
+    goto failure;
 
-  memset(vm->keys, 0, keyBytes);
-  memset(vm->values, 0, valueBytes);
+  vm->size = 0;
+  vm->capacity = kInitialCapacity;
+  vm->num_slots = kInitialCapacity * 2;
 
   return vm;
 
 failure:
   if (vm) {
     if (vm->keys)
-      free(vm->keys);
+      fetchdeps_alloc_free(vm->keys);
+    if (vm->hashes)
+      fetchdeps_alloc_free(vm->hashes);
     if (vm->values)
-      free(vm->values);
-    free(vm);
+      fetchdeps_alloc_free(vm->values);
+    fetchdeps_alloc_free(vm);
   }
   return NULL;
 }
@@ -80,71 +120,48 @@ fetchdeps_varmap_free(varmap_t* vm)
 
   assert(vm != NULL);
   assert(vm->size <= vm->capacity);
-  assert(vm->capacity > 0);
   assert(vm->keys != NULL);
   assert(vm->values != NULL);
 
   for (i = 0; i < vm->size; ++i) {
-    free(vm->keys[i]);
-    fetchdeps_stringset_free(vm->values[i]);
+    if (vm->values[i])
+      fetchdeps_stringset_free(vm->values[i]);
   }
-  if (vm->keys)
-    free(vm->keys);
-  if (vm->values)
-    free(vm->values);
+  fetchdeps_alloc_free(vm->keys);
+  fetchdeps_alloc_free(vm->hashes);
+  fetchdeps_alloc_free(vm->values);
+  fetchdeps_alloc_free(vm->slots);
 
-  free(vm);
+  fetchdeps_alloc_free(vm);
 }
 
 
 bool_t
 fetchdeps_varmap_set(varmap_t* vm, char* key, stringset_t* value)
 {
+  size_t len;
+  uint64_t hash;
   size_t i;
 
   assert(vm != NULL);
   assert(vm->size <= vm->capacity);
-  assert(vm->capacity > 0);
   assert(vm->keys != NULL);
   assert(vm->values != NULL);
   assert(key != NULL);
   assert(value != NULL);
 
-  // See if we're replacing an existing value.
-  for (i = 0; i < vm->size; ++i) {
-    if (strcmp(vm->keys[i], key) == 0) {
-      if (vm->values[i])
-        fetchdeps_stringset_free(vm->values[i]);
-      vm->values[i] = value;
-      return 1;
-    }
-  }
-
-  // If we get here, it's a new key. Make sure we've got room for it.
-  if (vm->size == vm->capacity) {
-    size_t new_capacity = vm->capacity * 2;
-    
-    char** new_keys = realloc(vm->keys, new_capacity * sizeof(char*));
-    if (!new_keys)
-      return 0;
-    vm->keys = new_keys;
+  len = strlen(key);
+  hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, key, len);
 
-    stringset_t** new_values = realloc(vm->values, new_capacity * sizeof(stringset_t*));
-    if (!new_values)
-      return 0;
-    vm->values = new_values;
-
-    vm->capacity = new_capacity;
+  // See if we're replacing an existing value.
+  if (fetchdeps_varmap_find(vm, key, hash, &i)) {
+    if (vm->values[i])
+      fetchdeps_stringset_free(vm->values[i]);
+    vm->values[i] = value;
+    return 1;
   }
 
-  // Add the new key.
-  vm->keys[vm->size] = strdup(key);
-  if (!vm->keys[vm->size])
-    return 0;
-  vm->values[vm->size] = value;
-  ++vm->size;
-
-  return 1;
+  return fetchdeps_varmap_insert(vm, key, len, hash, value);
 }
 
 
@@ -154,10 +171,6 @@ fetchdeps_varmap_set_single(varmap_t* vm, char* key, char* value)
   stringset_t* ss;
 
   assert(vm != NULL);
-  assert(vm->size <= vm->capacity);
-  assert(vm->capacity > 0);
-  assert(vm->keys != NULL);
-  assert(vm->values != NULL);
   assert(key != NULL);
   assert(value != NULL);
 
@@ -165,78 +178,84 @@ fetchdeps_varmap_set_single(varmap_t* vm, char* key, char* value)
   if (!ss)
     return 0;
 
-  return fetchdeps_varmap_set(vm, key, ss);
+  if (!fetchdeps_varmap_set(vm, key, ss)) {
+    fetchdeps_stringset_free(ss);
+    return 0;
+  }
+  return 1;
 }
 
 
-stringset_t*
-fetchdeps_varmap_get(varmap_t* vm, char* key)
+bool_t
+fetchdeps_varmap_use_environ(varmap_t* vm)
 {
   size_t i;
 
+  assert(vm != NULL);
+
+  // The environment overrides anything which is in the map already, so this
+  // behaves as though every environment variable had been set right now.
+  for (i = 0; i < vm->size; ++i) {
+    char* value = getenv(vm->keys[i]);
+    stringset_t* ss;
+
+    if (!value)
+      continue;
+    ss = fetchdeps_stringset_new_single(value);
+    if (!ss)
+      return 0;
+    if (vm->values[i])
+      fetchdeps_stringset_free(vm->values[i]);
+    vm->values[i] = ss;
+  }
+
+  vm->use_environ = 1;
+  return 1;
+}
+
+
+stringset_t*
+fetchdeps_varmap_get(varmap_t* vm, char* key)
+{
   assert(vm != NULL);
   assert(vm->size <= vm->capacity);
-  assert(vm->capacity > 0);
   assert(vm->keys != NULL);
   assert(vm->values != NULL);
   assert(key != NULL);
 
-  // See if we're replacing an existing value.
-  for (i = 0; i < vm->size; ++i) {
-    if (strcmp(vm->keys[i], key) == 0)
-      return vm->values[i];
-  }
-
-  return NULL;
+  return fetchdeps_varmap_lookup(vm, key);
 }
 
 
 bool_t
 fetchdeps_varmap_contains(varmap_t* vm, char* key)
 {
-  size_t i;
-
   assert(vm != NULL);
   assert(vm->size <= vm->capacity);
-  assert(vm->capacity > 0);
   assert(vm->keys != NULL);
   assert(vm->values != NULL);
   assert(key != NULL);
 
-  // See if we're replacing an existing value.
-  for (i = 0; i < vm->size; ++i) {
-    if (strcmp(vm->keys[i], key) == 0)
-      return 1;
-  }
-
-  return 0;
+  return fetchdeps_varmap_lookup(vm, key) != NULL;
 }
 
 
 bool_t
 fetchdeps_varmap_add_value(varmap_t* vm, char* key, char* value)
 {
-  size_t i;
   stringset_t* ss;
 
   assert(vm != NULL);
   assert(vm->size <= vm->capacity);
-  assert(vm->capacity > 0);
   assert(vm->keys != NULL);
   assert(vm->values != NULL);
   assert(key != NULL);
 
   // Find the variable we'll be adding to.
-  for (i = 0; i < vm->size; ++i) {
-    if (strcmp(vm->keys[i], key) == 0)
-      break;
-  }
-  if (i == vm->size)
+  ss = fetchdeps_varmap_lookup(vm, key);
+  if (!ss)
     return 0;
 
-  ss = vm->values[i];
-  assert(ss != NULL);
-
   return fetchdeps_stringset_add(ss, value);
 }
 
@@ -252,11 +271,17 @@ fetchdeps_variter_new(varmap_t* vm)
 
   assert(vm != NULL);
   assert(vm->size <= vm->capacity);
-  assert(vm->capacity > 0);
   assert(vm->keys != NULL);
   assert(vm->values != NULL);
 
-  iter = (variter_t*)malloc(sizeof(variter_t));
+  // Iteration has to show every variable, so this is the one place where we
+  // need the whole environment.
+  if (vm->use_environ && !vm->imported_environ) {
+    if (!fetchdeps_varmap_import_environ(vm))
+      return NULL;
+  }
+
+  iter = (variter_t*)fetchdeps_alloc_malloc(ALLOC_VARMAP, sizeof(variter_t));
   if (!iter)
     return NULL;
 
@@ -272,7 +297,7 @@ fetchdeps_variter_free(variter_t* iter)
 {
   assert(iter != NULL);
 
-  free(iter);
+  fetchdeps_alloc_free(iter);
 }
 
 
@@ -280,17 +305,203 @@ varentry_t
 fetchdeps_variter_next(variter_t* iter)
 {
   varentry_t result = { NULL, 0 };
+  varmap_t* vm;
 
   assert(iter != NULL);
   assert(iter->vm != NULL);
 
-  if (iter->index >= iter->vm->size)
+  vm = iter->vm;
+  while (iter->index < vm->size && !vm->values[iter->index])
+    ++iter->index;
+  if (iter->index >= vm->size)
     return result;
 
-  result.name = iter->vm->keys[iter->index];
-  result.value = iter->vm->values[iter->index];
+  result.name = vm->keys[iter->index];
+  result.value = vm->values[iter->index];
   ++iter->index;
 
   return result;
 }
 
+
+//
+// Private functions
+//
+
+// Sets 'index' to the position of 'key' in the entry arrays and returns true
+// if it's in the map, including as an unset environment variable.
+bool_t
+fetchdeps_varmap_find(varmap_t* vm, char* key, uint64_t hash, size_t* index)
+{
+  size_t slot = fetchdeps_varmap_find_slot(vm, key, hash);
+
+  if (!vm->slots[slot])
+    return 0;
+  *index = vm->slots[slot] - 1;
+  return 1;
+}
+
+
+// Adds a new entry, which must not be in the map already. 'value' may be NULL
+// to record an unset environment variable. Only the first 'len' characters of
+// 'key' are used.
+bool_t
+fetchdeps_varmap_insert(varmap_t* vm, char* key, size_t len, uint64_t hash, stringset_t* value)
+{
+  char* interned;
+  size_t slot;
+
+  if (vm->size == vm->capacity && !fetchdeps_varmap_grow(vm))
+    return 0;
+
+  interned = fetchdeps_strpool_intern(key, len, NULL);
+  if (!interned)
+    return 0;
+
+  slot = fetchdeps_varmap_find_slot(vm, interned, hash);
+  assert(vm->slots[slot] == 0);
+
+  vm->keys[vm->size] = interned;
+  vm->hashes[vm->size] = hash;
+  vm->values[vm->size] = value;
+  vm->slots[slot] = ++vm->size;
+  return 1;
+}
+
+
+// Finds the value for a key, importing it from the environment the first time
+// it's asked for if that's enabled. Returns NULL if there's no such variable.
+stringset_t*
+fetchdeps_varmap_lookup(varmap_t* vm, char* key)
+{
+  size_t len = strlen(key);
+  uint64_t hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, key, len);
+  stringset_t* ss = NULL;
+  char* value;
+  size_t i;
+
+  if (fetchdeps_varmap_find(vm, key, hash, &i))
+    return vm->values[i];
+  if (!vm->use_environ || vm->imported_environ)
+    return NULL;
+
+  // Remember the answer even when the variable isn't set, so that a deps file
+  // testing the same unset variable over and over only asks once.
+  value = getenv(key);
+  if (value) {
+    ss = fetchdeps_stringset_new_single(value);
+    if (!ss)
+      return NULL;
+  }
+  if (!fetchdeps_varmap_insert(vm, key, len, hash, ss)) {
+    if (ss)
+      fetchdeps_stringset_free(ss);
+    return NULL;
+  }
+  return ss;
+}
+
+
+// Adds every environment variable which isn't in the map yet. Anything which
+// is there already either came from the environment or was set afterwards
+// and overrides it, so existing entries are left alone.
+bool_t
+fetchdeps_varmap_import_environ(varmap_t* vm)
+{
+  char** var;
+
+  for (var = environ; *var; ++var) {
+    char* value = *var;
+    char* name;
+    stringset_t* ss;
+    uint64_t hash;
+    size_t len;
+    size_t i;
+
+    while (*value && *value != '=')
+      ++value;
+    len = value - *var;
+    if (*value == '=')
+      ++value;
+
+    // The name isn't terminated in place, so use the pool's copy.
+    name = fetchdeps_strpool_intern(*var, len, NULL);
+    if (!name)
+      return 0;
+    hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, name, len);
+    if (fetchdeps_varmap_find(vm, name, hash, &i))
+      continue;
+
+    ss = fetchdeps_stringset_new_single(value);
+    if (!ss)
+      return 0;
+    if (!fetchdeps_varmap_insert(vm, name, len, hash, ss)) {
+      fetchdeps_stringset_free(ss);
+      return 0;
+    }
+  }
+
+  vm->imported_environ = 1;
+  return 1;
+}
+
+
+// Returns the slot holding 'key' if it's in the map, or else the empty slot
+// where it would go.
+size_t
+fetchdeps_varmap_find_slot(varmap_t* vm, char* key, uint64_t hash)
+{
+  size_t mask = vm->num_slots - 1;
+  size_t slot;
+
+  for (slot = hash & mask; vm->slots[slot]; slot = (slot + 1) & mask) {
+    size_t i = vm->slots[slot] - 1;
+    if (vm->keys[i] == key || (vm->hashes[i] == hash && strcmp(vm->keys[i], key) == 0))
+      break;
+  }
+  return slot;
+}
+
+
+bool_t
+fetchdeps_varmap_grow(varmap_t* vm)
+{
+  size_t new_capacity = vm->capacity * 2;
+  size_t new_num_slots = new_capacity * 2;
+  char** new_keys;
+  uint64_t* new_hashes;
+  stringset_t** new_values;
+  size_t* new_slots;
+  size_t i, slot;
+
+  new_keys = (char**)fetchdeps_alloc_realloc(ALLOC_VARMAP, vm->keys, new_capacity * sizeof(char*));
+  if (!new_keys)
+    return 0;
+  vm->keys = new_keys;
+
+  new_hashes = (uint64_t*)fetchdeps_alloc_realloc(ALLOC_VARMAP, vm->hashes, new_capacity * sizeof(uint64_t));
+  if (!new_hashes)
+    return 0;
+  vm->hashes = new_hashes;
+
+  new_values = (stringset_t**)fetchdeps_alloc_realloc(ALLOC_VARMAP, vm->values, new_capacity * sizeof(stringset_t*));
+  if (!new_values)
+    return 0;
+  vm->values = new_values;
+
+  new_slots = (size_t*)fetchdeps_alloc_calloc(ALLOC_VARMAP, new_num_slots, sizeof(size_t));
+  if (!new_slots)
+    return 0;
+
+  for (i = 0; i < vm->size; ++i) {
+    for (slot = vm->hashes[i] & (new_num_slots - 1); new_slots[slot]; slot = (slot + 1) & (new_num_slots - 1))
+      ;
+    new_slots[slot] = i + 1;
+  }
+
+  fetchdeps_alloc_free(vm->slots);
+  vm->slots = new_slots;
+  vm->num_slots = new_num_slots;
+  vm->capacity = new_capacity;
+  return 1;
+}
@@ -29,17 +29,18 @@ typedef struct _varentry varentry_t;
 // fetchdeps_varmap_free.
 varmap_t* fetchdeps_varmap_new();
 
-// Deallocate a varmap. This frees all memory for the varmap, including all keys
-// and values.
+// Deallocate a varmap. This frees all memory for the varmap, including all of
+// the values. The keys belong to the string pool.
 void fetchdeps_varmap_free(varmap_t* vm);
 
 // Set the value associated with a key in the varmap. If the key already exists
 // in the map, the existing value is replaced. If the key isn't already in the
 // varmap a new entry is added.
 //
-// Note that the varmap will make a copy of the key, but will take ownership of
-// the value without copying it. Once you've set a stringset as the value for a
-// key, you should be sure not to free it yourself. You should also avoid
+// Note that the varmap will use the string pool's copy of the key (see
+// strpool.h), but will take ownership of the value without copying it. Once
+// you've set a stringset as the value for a key, you should be sure not to
+// free it yourself. You should also avoid
 // holding on to any pointers to the stringset beyond this point, as they will
 // become invalid when the varmap is freed or the value gets replaced.
 //
@@ -54,9 +55,21 @@ bool_t fetchdeps_varmap_set(varmap_t* vm, char* key, stringset_t* value);
 // fetchdeps_varmap_set.
 bool_t fetchdeps_varmap_set_single(varmap_t* vm, char* key, char* value);
 
+// Make the process environment visible through the varmap. Rather than copying
+// every environment variable up front, each one is read with getenv the first
+// time it's looked up. The result is the same as if the whole environment had
+// been copied in at the time of this call: environment variables replace any
+// entries already in the map, and anything set afterwards replaces them.
+//
+// Entries already in the map are replaced straight away, which needs memory.
+// Returns false if that couldn't be allocated, in which case some of them may
+// have been replaced and the environment won't be used for the others.
+bool_t fetchdeps_varmap_use_environ(varmap_t* vm);
+
 // Get the value for a key in the varmap. The return value is NULL if there's no
 // such key in the varmap; otherwise it's a pointer to the stringset associated
-// with the key.
+// with the key. This may add an entry for an environment variable, so it isn't
+// safe to call while iterating over the varmap.
 //
 // Note that all pointers returned by this point to the stringsets held by the
 // varmap; we don't copy them before returning them. As such, you shouldn't try
@@ -87,8 +100,10 @@ bool_t fetchdeps_varmap_add_value(varmap_t* vm, char* key, char* value);
 //
 
 // Create a new iterator for the provided varmap. Changes to the varmap during
-// iteration will invalidate the iterator. The iterator must be freed eventually
-// using fetchdeps_variter_free().
+// iteration will invalidate the iterator. If the varmap is using the
+// environment, any environment variables which haven't been looked up yet are
+// copied in first, so that iteration covers all of them. The iterator must be
+// freed eventually using fetchdeps_variter_free().
 variter_t* fetchdeps_variter_new(varmap_t* vm);
 
 // Free an iterator which was created by fetchdeps_variter_new().
@@ -0,0 +1,213 @@
+#include "vocab.h"
+
+#include "alloc.h"
+#include "hash.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Types
+//
+
+// The strings in id order, plus an open addressing index into them. Each slot
+// holds an id plus one, or zero if it's empty. The index is never more than
+// half full.
+struct _vocab {
+  char** strings;
+  uint64_t* hashes;
+  size_t size;
+  size_t capacity;
+
+  int* slots;
+  size_t num_slots;
+};
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_vocab_grow(vocab_t* v);
+
+
+//
+// Public functions
+//
+
+vocab_t*
+fetchdeps_vocab_new()
+{
+  return (vocab_t*)fetchdeps_alloc_calloc(ALLOC_VOCAB, 1, sizeof(vocab_t));
+}
+
+
+void
+fetchdeps_vocab_free(vocab_t* v)
+{
+  assert(v != NULL);
+
+  if (v->strings)
+    fetchdeps_alloc_free(v->strings);
+  if (v->hashes)
+    fetchdeps_alloc_free(v->hashes);
+  if (v->slots)
+    fetchdeps_alloc_free(v->slots);
+  fetchdeps_alloc_free(v);
+}
+
+
+int
+fetchdeps_vocab_add(vocab_t* v, char* str)
+{
+  uint64_t hash;
+  size_t slot;
+  int id;
+
+  assert(v != NULL);
+  assert(str != NULL);
+
+  id = fetchdeps_vocab_find(v, str);
+  if (id >= 0)
+    return id;
+
+  if ((v->size + 1) * 2 > v->num_slots && !fetchdeps_vocab_grow(v))
+    return -1;
+
+  hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, str, strlen(str));
+  id = (int)v->size++;
+  v->strings[id] = str;
+  v->hashes[id] = hash;
+
+  for (slot = hash & (v->num_slots - 1); v->slots[slot]; slot = (slot + 1) & (v->num_slots - 1))
+    ;
+  v->slots[slot] = id + 1;
+  return id;
+}
+
+
+int
+fetchdeps_vocab_find(vocab_t* v, char* str)
+{
+  assert(str != NULL);
+  return fetchdeps_vocab_find_n(v, str, strlen(str));
+}
+
+
+int
+fetchdeps_vocab_find_n(vocab_t* v, const char* str, size_t len)
+{
+  uint64_t hash;
+  size_t slot;
+
+  assert(v != NULL);
+  assert(str != NULL);
+
+  if (v->size == 0)
+    return -1;
+
+  hash = fetchdeps_hash_fnv1a(kFnvOffsetBasis, str, len);
+  for (slot = hash & (v->num_slots - 1); v->slots[slot]; slot = (slot + 1) & (v->num_slots - 1)) {
+    int id = v->slots[slot] - 1;
+    if (v->hashes[id] == hash && strncmp(v->strings[id], str, len) == 0 && v->strings[id][len] == '\0')
+      return id;
+  }
+  return -1;
+}
+
+
+char*
+fetchdeps_vocab_get(vocab_t* v, int id)
+{
+  assert(v != NULL);
+  assert(id >= 0 && (size_t)id < v->size);
+
+  return v->strings[id];
+}
+
+
+size_t
+fetchdeps_vocab_size(vocab_t* v)
+{
+  assert(v != NULL);
+  return v->size;
+}
+
+
+size_t
+fetchdeps_vocab_words(vocab_t* v)
+{
+  assert(v != NULL);
+  return v->size ? (v->size + 63) / 64 : 1;
+}
+
+
+bool_t
+fetchdeps_vocab_set_bits(vocab_t* v, stringset_t* strings, uint64_t* bits)
+{
+  stringiter_t* iter;
+  char* str;
+
+  assert(v != NULL);
+  assert(strings != NULL);
+  assert(bits != NULL);
+
+  iter = fetchdeps_stringiter_new(strings);
+  if (!iter)
+    return 0;
+
+  for (str = fetchdeps_stringiter_next(iter); str; str = fetchdeps_stringiter_next(iter)) {
+    int id = fetchdeps_vocab_find(v, str);
+    if (id >= 0)
+      bits[id / 64] |= (uint64_t)1 << (id % 64);
+  }
+
+  fetchdeps_stringiter_free(iter);
+  return 1;
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_vocab_grow(vocab_t* v)
+{
+  size_t new_capacity = v->capacity ? v->capacity * 2 : 32;
+  size_t new_num_slots = new_capacity * 2;
+  char** new_strings;
+  uint64_t* new_hashes;
+  int* new_slots;
+  size_t i, slot;
+
+  new_strings = (char**)fetchdeps_alloc_realloc(ALLOC_VOCAB, v->strings, new_capacity * sizeof(char*));
+  if (!new_strings)
+    return 0;
+  v->strings = new_strings;
+
+  new_hashes = (uint64_t*)fetchdeps_alloc_realloc(ALLOC_VOCAB, v->hashes, new_capacity * sizeof(uint64_t));
+  if (!new_hashes)
+    return 0;
+  v->hashes = new_hashes;
+
+  new_slots = (int*)fetchdeps_alloc_calloc(ALLOC_VOCAB, new_num_slots, sizeof(int));
+  if (!new_slots)
+    return 0;
+
+  for (i = 0; i < v->size; ++i) {
+    for (slot = v->hashes[i] & (new_num_slots - 1); new_slots[slot]; slot = (slot + 1) & (new_num_slots - 1))
+      ;
+    new_slots[slot] = (int)i + 1;
+  }
+
+  if (v->slots)
+    fetchdeps_alloc_free(v->slots);
+  v->slots = new_slots;
+  v->num_slots = new_num_slots;
+  v->capacity = new_capacity;
+  return 1;
+}
+
@@ -0,0 +1,61 @@
+#ifndef fetchdeps_vocab_h
+#define fetchdeps_vocab_h
+
+#include "common.h"
+#include "stringset.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Types
+//
+
+// A set of distinct strings, each with a small integer id. Ids are handed out
+// in order starting from zero, so a set of strings from the vocabulary can be
+// stored as a bitset with one bit per id, and two such sets can be intersected
+// a machine word at a time. The vocabulary doesn't copy the strings, so they
+// must outlive it.
+struct _vocab;
+typedef struct _vocab vocab_t;
+
+
+//
+// Functions
+//
+
+// Allocate a new, empty vocabulary. It must eventually be freed with
+// fetchdeps_vocab_free.
+vocab_t* fetchdeps_vocab_new();
+
+// Deallocate the vocabulary. The strings in it aren't freed.
+void fetchdeps_vocab_free(vocab_t* v);
+
+// Add a string to the vocabulary if it isn't already there and return its id.
+// Returns -1 if memory couldn't be allocated.
+int fetchdeps_vocab_add(vocab_t* v, char* str);
+
+// Returns the id of a string, or -1 if it isn't in the vocabulary.
+int fetchdeps_vocab_find(vocab_t* v, char* str);
+
+// As fetchdeps_vocab_find, but for the first 'len' characters of 'str', which
+// needn't be nul terminated.
+int fetchdeps_vocab_find_n(vocab_t* v, const char* str, size_t len);
+
+// Returns the string with the given id.
+char* fetchdeps_vocab_get(vocab_t* v, int id);
+
+// Returns the number of strings in the vocabulary.
+size_t fetchdeps_vocab_size(vocab_t* v);
+
+// Returns the number of 64 bit words in a bitset over the vocabulary. This is
+// never zero, so a bitset can always be allocated.
+size_t fetchdeps_vocab_words(vocab_t* v);
+
+// Set the bit for each string in 'strings' which is in the vocabulary. Strings
+// which aren't in it are ignored, since nothing can match them. 'bits' must
+// already be zeroed. Returns false if memory couldn't be allocated.
+bool_t fetchdeps_vocab_set_bits(vocab_t* v, stringset_t* strings, uint64_t* bits);
+
+#endif // fetchdeps_vocab_h
+
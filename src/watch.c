@@ -0,0 +1,289 @@
+#include "watch.h"
+
+#include "alloc.h"
+#include "errors.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <libgen.h>   // For dirname() and basename().
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+
+
+//
+// Constants
+//
+
+// The events which mean a file in a watched directory may have changed.
+static const uint32_t kWatchEvents =
+    IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+// How long things must be quiet after a change before we report it.
+static const int kSettleMS = 200;
+
+
+//
+// Types
+//
+
+// A watched file: the watch descriptor for its directory, plus its name within
+// that directory. Watching the same directory twice gives the same watch
+// descriptor, so files in the same directory share one.
+struct _watchfile {
+  int wd;
+  char* name;
+};
+typedef struct _watchfile watchfile_t;
+
+
+// Clearing the files doesn't remove their directories' watches straight away:
+// they're kept in 'stale' until the next wait, and only the ones which no new
+// file needs are removed then. A directory which stays watched throughout
+// doesn't miss any changes made while the new set of files is worked out.
+struct _watcher {
+  int fd;
+  watchfile_t* files;
+  size_t num_files;
+  size_t files_capacity;
+
+  int* stale;
+  size_t num_stale;
+  size_t stale_capacity;
+};
+
+
+//
+// Forward declarations
+//
+
+int fetchdeps_watch_read_events(watcher_t* w);
+void fetchdeps_watch_remove_stale(watcher_t* w);
+
+
+//
+// Public functions
+//
+
+watcher_t*
+fetchdeps_watch_new()
+{
+  watcher_t* w;
+
+  w = (watcher_t*)fetchdeps_alloc_calloc(ALLOC_WATCH, 1, sizeof(watcher_t));
+  if (!w)
+    return NULL;
+
+  w->fd = inotify_init1(IN_CLOEXEC);
+  if (w->fd < 0) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to watch for changes");
+    fetchdeps_alloc_free(w);
+    return NULL;
+  }
+  return w;
+}
+
+
+void
+fetchdeps_watch_free(watcher_t* w)
+{
+  assert(w != NULL);
+
+  fetchdeps_watch_clear(w);
+  if (w->files)
+    fetchdeps_alloc_free(w->files);
+  if (w->stale)
+    fetchdeps_alloc_free(w->stale);
+  close(w->fd);
+  fetchdeps_alloc_free(w);
+}
+
+
+bool_t
+fetchdeps_watch_add_file(watcher_t* w, char* path)
+{
+  char* dir_copy = NULL;
+  char* name_copy = NULL;
+  watchfile_t* file;
+  int wd;
+
+  assert(w != NULL);
+  assert(path != NULL);
+
+  // dirname and basename may modify their arguments.
+  dir_copy = fetchdeps_alloc_strdup(ALLOC_WATCH, path);
+  name_copy = fetchdeps_alloc_strdup(ALLOC_WATCH, path);
+  if (!dir_copy || !name_copy)
+    goto failure;
+
+  wd = inotify_add_watch(w->fd, dirname(dir_copy), kWatchEvents);
+  if (wd < 0) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to watch %s for changes", path);
+    goto failure;
+  }
+
+  if (w->num_files == w->files_capacity) {
+    size_t new_capacity = w->files_capacity ? w->files_capacity * 2 : 8;
+    watchfile_t* new_files = (watchfile_t*)fetchdeps_alloc_realloc(ALLOC_WATCH, w->files, new_capacity * sizeof(watchfile_t));
+    if (!new_files)
+      goto failure;
+    w->files = new_files;
+    w->files_capacity = new_capacity;
+  }
+
+  file = &w->files[w->num_files];
+  file->name = fetchdeps_alloc_strdup(ALLOC_WATCH, basename(name_copy));
+  if (!file->name)
+    goto failure;
+  file->wd = wd;
+  ++w->num_files;
+
+  fetchdeps_alloc_free(dir_copy);
+  fetchdeps_alloc_free(name_copy);
+  return 1;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (dir_copy)
+    fetchdeps_alloc_free(dir_copy);
+  if (name_copy)
+    fetchdeps_alloc_free(name_copy);
+  return 0;
+}
+
+
+void
+fetchdeps_watch_clear(watcher_t* w)
+{
+  size_t i;
+
+  assert(w != NULL);
+
+  for (i = 0; i < w->num_files; ++i) {
+    if (w->num_stale == w->stale_capacity) {
+      size_t new_capacity = w->stale_capacity ? w->stale_capacity * 2 : 8;
+      int* new_stale = (int*)fetchdeps_alloc_realloc(ALLOC_WATCH, w->stale, new_capacity * sizeof(int));
+      // Without room to remember it, the watch just stays until we exit.
+      if (new_stale) {
+        w->stale = new_stale;
+        w->stale_capacity = new_capacity;
+      }
+    }
+    if (w->num_stale < w->stale_capacity)
+      w->stale[w->num_stale++] = w->files[i].wd;
+    fetchdeps_alloc_free(w->files[i].name);
+  }
+  w->num_files = 0;
+}
+
+
+bool_t
+fetchdeps_watch_wait(watcher_t* w)
+{
+  struct pollfd pfd;
+  int changed = 0;
+  int ready;
+
+  assert(w != NULL);
+
+  fetchdeps_watch_remove_stale(w);
+
+  pfd.fd = w->fd;
+  pfd.events = POLLIN;
+
+  // Wait for the first change to one of our files...
+  while (!changed) {
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      goto failure;
+    }
+    changed = fetchdeps_watch_read_events(w);
+    if (changed < 0)
+      goto failure;
+  }
+
+  // ...then for everything to settle down.
+  for (;;) {
+    ready = poll(&pfd, 1, kSettleMS);
+    if (ready == 0)
+      break;
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      goto failure;
+    }
+    if (fetchdeps_watch_read_events(w) < 0)
+      goto failure;
+  }
+  return 1;
+
+failure:
+  fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to watch for changes");
+  return 0;
+}
+
+
+//
+// Private functions
+//
+
+// Read whatever events are waiting. Returns 1 if any of them were for one of
+// our files, 0 if none were, or -1 if reading failed.
+int
+fetchdeps_watch_read_events(watcher_t* w)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event* event;
+  ssize_t len;
+  char* pos;
+  size_t i;
+  int changed = 0;
+
+  len = read(w->fd, buf, sizeof(buf));
+  if (len < 0)
+    return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+
+  for (pos = buf; pos < buf + len; pos += sizeof(struct inotify_event) + event->len) {
+    event = (const struct inotify_event*)pos;
+
+    // The kernel dropped some events, so anything could have changed.
+    if (event->mask & IN_Q_OVERFLOW) {
+      changed = 1;
+      continue;
+    }
+    if (event->len == 0)
+      continue;
+
+    for (i = 0; i < w->num_files && !changed; ++i) {
+      if (w->files[i].wd == event->wd && strcmp(w->files[i].name, event->name) == 0)
+        changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+void
+fetchdeps_watch_remove_stale(watcher_t* w)
+{
+  size_t i, j;
+
+  for (i = 0; i < w->num_stale; ++i) {
+    // Skip watches that are still in use, or that we've already removed.
+    for (j = 0; j < w->num_files && w->files[j].wd != w->stale[i]; ++j)
+      ;
+    if (j < w->num_files)
+      continue;
+    for (j = 0; j < i && w->stale[j] != w->stale[i]; ++j)
+      ;
+    if (j == i)
+      inotify_rm_watch(w->fd, w->stale[i]);
+  }
+  w->num_stale = 0;
+}
+
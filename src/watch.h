@@ -0,0 +1,45 @@
+#ifndef fetchdeps_watch_h
+#define fetchdeps_watch_h
+
+#include "common.h"
+
+//
+// Types
+//
+
+// Waits for any of a set of files to change. Editors and version control
+// tools often replace a file rather than writing to it, so it's the
+// directories containing the files that are watched, and a file counts as
+// changed when it's written, created, deleted or renamed over.
+struct _watcher;
+typedef struct _watcher watcher_t;
+
+
+//
+// Functions
+//
+
+// Allocate a new watcher which isn't watching anything. Returns NULL, with
+// the error set, if it couldn't be created. It must eventually be freed with
+// fetchdeps_watch_free.
+watcher_t* fetchdeps_watch_new();
+
+// Stop watching everything and deallocate the watcher.
+void fetchdeps_watch_free(watcher_t* w);
+
+// Add a file to the set being watched. The file doesn't need to exist, but
+// the directory containing it does. Returns false, with the error set, if the
+// directory couldn't be watched.
+bool_t fetchdeps_watch_add_file(watcher_t* w, char* path);
+
+// Stop watching all of the files, ready for a new set to be added.
+void fetchdeps_watch_clear(watcher_t* w);
+
+// Block until at least one of the files changes. Changes tend to come in
+// bursts, e.g. when switching branches, so this waits until things have been
+// quiet for a moment before returning. Returns false, with the error set, if
+// waiting failed.
+bool_t fetchdeps_watch_wait(watcher_t* w);
+
+#endif // fetchdeps_watch_h
+
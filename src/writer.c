@@ -0,0 +1,1048 @@
+#include "writer.h"
+
+#include "alloc.h"
+#include "errors.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>    // For openat() and the O_* flags.
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h> // For mkdirat(), futimens() and utimensat().
+#include <unistd.h>
+
+// io_uring is only available on Linux, and we talk to it through the raw
+// system calls so that there's no dependency on liburing.
+#if defined(__linux__) && defined(__has_include)
+  #if __has_include(<linux/io_uring.h>)
+    #define FETCHDEPS_HAVE_URING 1
+  #endif
+#endif
+
+#ifdef FETCHDEPS_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+
+//
+// Constants
+//
+
+static const int kOpenFlags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC;
+static const int kDirFlags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+
+#ifdef FETCHDEPS_HAVE_URING
+// Maximum number of files in one io_uring batch. Each file takes three linked
+// submissions (openat, write, close) and one direct descriptor slot.
+#define URING_BATCH_FILES 64
+static const unsigned int kUringEntries = 256;
+
+// File contents and paths for a batch are copied into a single buffer of this
+// size. Files which are too big to fit are written synchronously instead.
+static const size_t kUringArenaSize = 4 * 1024 * 1024;
+static const size_t kUringMaxFileSize = 256 * 1024;
+
+// Each submission's user_data holds the index of its file, shifted up, with
+// the step in the chain in the bottom bits.
+enum _uringstep {
+  URING_STEP_OPEN,
+  URING_STEP_WRITE,
+  URING_STEP_CLOSE
+};
+#define URING_STEP_BITS 2
+#define URING_STEP_MASK ((1u << URING_STEP_BITS) - 1)
+#endif
+
+
+//
+// Types
+//
+
+#ifdef FETCHDEPS_HAVE_URING
+struct _uringfile {
+  char* path;
+  char* data;
+  size_t len;
+  unsigned int mode;
+  time_t mtime;
+};
+typedef struct _uringfile uringfile_t;
+
+
+struct _uring {
+  int fd;
+  bool_t verified; // Set once a batch has completed successfully.
+
+  void* sq_ptr;
+  size_t sq_size;
+  void* cq_ptr;
+  size_t cq_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  unsigned int* sq_head;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  char* arena;
+  size_t arena_used;
+  uringfile_t files[URING_BATCH_FILES];
+  size_t num_files;
+};
+typedef struct _uring uring_t;
+#endif
+
+
+struct _writer {
+  writer_backend_t backend;
+  int root_fd;
+  size_t file_count;
+
+  // The file currently in progress.
+  bool_t in_file;
+  bool_t deferred;  // True if the current file is going into an io_uring batch.
+  int fd;           // Descriptor for the current file, when not deferred.
+  char* path;
+  time_t mtime;
+  size_t size;
+
+  // The directory most recently looked up by fetchdeps_writer_open_parent.
+  char* parent_path;
+  int parent_fd;
+
+#ifdef FETCHDEPS_HAVE_URING
+  uring_t* ring;
+#endif
+};
+
+
+//
+// Forward declarations
+//
+
+bool_t fetchdeps_writer_error(char* path);
+bool_t fetchdeps_writer_write_all(int fd, char* data, size_t len);
+int fetchdeps_writer_open_parent(writer_t* w, char* path, char** name, bool_t cache);
+void fetchdeps_writer_close_parent(writer_t* w, int fd);
+
+#ifdef FETCHDEPS_HAVE_URING
+uring_t* fetchdeps_writer_uring_new();
+void fetchdeps_writer_uring_free(uring_t* ring);
+bool_t fetchdeps_writer_uring_is_queued(writer_t* w, char* path);
+bool_t fetchdeps_writer_uring_flush(writer_t* w);
+bool_t fetchdeps_writer_uring_flush_posix(writer_t* w);
+void fetchdeps_writer_uring_release_slot(uring_t* ring, size_t i);
+#endif
+
+
+//
+// Public functions
+//
+
+writer_t*
+fetchdeps_writer_new(char* root, writer_backend_t backend)
+{
+  writer_t* w = NULL;
+
+  assert(root != NULL);
+  assert(backend != WRITER_UNKNOWN);
+
+  w = (writer_t*)fetchdeps_alloc_calloc(ALLOC_WRITER, 1, sizeof(writer_t));
+  if (!w)
+    goto failure;
+
+  w->fd = -1;
+  w->parent_fd = -1;
+  w->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (w->root_fd == -1) {
+    fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to open %s", root);
+    goto failure;
+  }
+
+  w->backend = WRITER_POSIX;
+#ifdef FETCHDEPS_HAVE_URING
+  if (backend != WRITER_POSIX) {
+    w->ring = fetchdeps_writer_uring_new();
+    if (w->ring)
+      w->backend = WRITER_URING;
+  }
+#endif
+
+  return w;
+
+failure:
+  fetchdeps_errors_trap_system_error();
+  if (w) {
+    if (w->root_fd != -1)
+      close(w->root_fd);
+    fetchdeps_alloc_free(w);
+  }
+  return NULL;
+}
+
+
+bool_t
+fetchdeps_writer_free(writer_t* w)
+{
+  bool_t ok;
+
+  assert(w != NULL);
+
+  if (w->in_file)
+    fetchdeps_writer_abort_file(w);
+  ok = fetchdeps_writer_flush(w);
+
+#ifdef FETCHDEPS_HAVE_URING
+  if (w->ring)
+    fetchdeps_writer_uring_free(w->ring);
+#endif
+  if (w->parent_path) {
+    close(w->parent_fd);
+    fetchdeps_alloc_free(w->parent_path);
+  }
+  close(w->root_fd);
+  fetchdeps_alloc_free(w);
+
+  return ok;
+}
+
+
+writer_backend_t
+fetchdeps_writer_backend(writer_t* w)
+{
+  assert(w != NULL);
+  return w->backend;
+}
+
+
+const char*
+fetchdeps_writer_backend_name(writer_backend_t backend)
+{
+  switch (backend) {
+  case WRITER_AUTO:   return "auto";
+  case WRITER_POSIX:  return "posix";
+  case WRITER_URING:  return "uring";
+  default:            return "unknown";
+  }
+}
+
+
+writer_backend_t
+fetchdeps_writer_lookup_backend(char* name)
+{
+  assert(name != NULL);
+
+  if (strcmp(name, "auto") == 0)
+    return WRITER_AUTO;
+  if (strcmp(name, "posix") == 0)
+    return WRITER_POSIX;
+  if (strcmp(name, "uring") == 0)
+    return WRITER_URING;
+  return WRITER_UNKNOWN;
+}
+
+
+bool_t
+fetchdeps_writer_make_dir(writer_t* w, char* path, unsigned int mode, bool_t* created)
+{
+  char* name;
+  int dir_fd;
+
+  assert(w != NULL);
+  assert(path != NULL);
+
+  if (created)
+    *created = 0;
+
+#ifdef FETCHDEPS_HAVE_URING
+  // A file with the same name which is still in the batch has to be created
+  // first, so that the directory fails to replace it just as it would have
+  // without the batching.
+  if (fetchdeps_writer_uring_is_queued(w, path) && !fetchdeps_writer_flush(w))
+    return 0;
+#endif
+
+  dir_fd = fetchdeps_writer_open_parent(w, path, &name, 1);
+  if (dir_fd == -1)
+    return fetchdeps_writer_error(path);
+
+  if (mkdirat(dir_fd, name, mode) == 0) {
+    if (created)
+      *created = 1;
+    fetchdeps_writer_close_parent(w, dir_fd);
+    return 1;
+  }
+
+  if (errno == EEXIST) {
+    struct stat buf;
+    if (fstatat(dir_fd, name, &buf, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(buf.st_mode)) {
+      fetchdeps_writer_close_parent(w, dir_fd);
+      errno = 0;
+      return 1;
+    }
+    errno = ENOTDIR;
+  }
+
+  fetchdeps_writer_close_parent(w, dir_fd);
+  return fetchdeps_writer_error(path);
+}
+
+
+bool_t
+fetchdeps_writer_make_symlink(writer_t* w, char* path, char* target)
+{
+  char* name;
+  int dir_fd;
+  bool_t ok;
+
+  assert(w != NULL);
+  assert(path != NULL);
+  assert(target != NULL);
+
+  if (!fetchdeps_writer_flush(w))
+    return 0;
+
+  dir_fd = fetchdeps_writer_open_parent(w, path, &name, 1);
+  if (dir_fd == -1)
+    return fetchdeps_writer_error(path);
+
+  ok = symlinkat(target, dir_fd, name) == 0 ||
+       (errno == EEXIST && unlinkat(dir_fd, name, 0) == 0 &&
+        symlinkat(target, dir_fd, name) == 0);
+  fetchdeps_writer_close_parent(w, dir_fd);
+  return ok ? 1 : fetchdeps_writer_error(path);
+}
+
+
+bool_t
+fetchdeps_writer_make_hardlink(writer_t* w, char* path, char* target)
+{
+  char* name;
+  char* target_name;
+  int dir_fd, target_fd;
+  bool_t ok;
+
+  assert(w != NULL);
+  assert(path != NULL);
+  assert(target != NULL);
+
+  if (!fetchdeps_writer_flush(w))
+    return 0;
+
+  // Look up the link's own directory first: looking up the target's doesn't
+  // touch the cache, so it can't close the descriptor out from under us.
+  dir_fd = fetchdeps_writer_open_parent(w, path, &name, 1);
+  if (dir_fd == -1)
+    return fetchdeps_writer_error(path);
+  target_fd = fetchdeps_writer_open_parent(w, target, &target_name, 0);
+  if (target_fd == -1) {
+    fetchdeps_writer_close_parent(w, dir_fd);
+    return fetchdeps_writer_error(target);
+  }
+
+  ok = linkat(target_fd, target_name, dir_fd, name, 0) == 0 ||
+       (errno == EEXIST && unlinkat(dir_fd, name, 0) == 0 &&
+        linkat(target_fd, target_name, dir_fd, name, 0) == 0);
+  fetchdeps_writer_close_parent(w, target_fd);
+  fetchdeps_writer_close_parent(w, dir_fd);
+  return ok ? 1 : fetchdeps_writer_error(path);
+}
+
+
+bool_t
+fetchdeps_writer_begin_file(writer_t* w, char* path, unsigned int mode,
+                            time_t mtime, size_t size)
+{
+  char* name;
+  int dir_fd;
+
+  assert(w != NULL);
+  assert(!w->in_file);
+  assert(path != NULL);
+
+  // Batched files are opened by their full path when the batch is flushed, so
+  // their directories are checked for links now. Anything which could put a
+  // link in the way afterwards flushes the batch first.
+  dir_fd = fetchdeps_writer_open_parent(w, path, &name, 1);
+  if (dir_fd == -1)
+    return fetchdeps_writer_error(path);
+
+  w->in_file = 1;
+  w->deferred = 0;
+  w->mtime = mtime;
+  w->size = size;
+
+#ifdef FETCHDEPS_HAVE_URING
+  if (w->ring && size <= kUringMaxFileSize) {
+    size_t path_len = strlen(path) + 1;
+
+    // Files in a batch can be written in any order, so one which replaces a
+    // file that's already in it has to wait for the next batch.
+    if (w->ring->num_files == URING_BATCH_FILES ||
+        w->ring->arena_used + path_len + size > kUringArenaSize ||
+        fetchdeps_writer_uring_is_queued(w, path)) {
+      if (!fetchdeps_writer_flush(w)) {
+        fetchdeps_writer_close_parent(w, dir_fd);
+        w->in_file = 0;
+        return 0;
+      }
+    }
+  }
+
+  // Check the ring again: the flush may have fallen back to POSIX.
+  if (w->ring && size <= kUringMaxFileSize) {
+    uring_t* ring = w->ring;
+    size_t path_len = strlen(path) + 1;
+    uringfile_t* file;
+
+    file = &ring->files[ring->num_files];
+    file->path = ring->arena + ring->arena_used;
+    memcpy(file->path, path, path_len);
+    ring->arena_used += path_len;
+    file->data = ring->arena + ring->arena_used;
+    file->len = 0;
+    file->mode = mode & 07777;
+    file->mtime = mtime;
+
+    w->path = file->path;
+    w->deferred = 1;
+    fetchdeps_writer_close_parent(w, dir_fd);
+    return 1;
+  }
+#endif
+
+  // Anything still in the batch was begun before this, so it goes first.
+  if (!fetchdeps_writer_flush(w)) {
+    fetchdeps_writer_close_parent(w, dir_fd);
+    w->in_file = 0;
+    return 0;
+  }
+
+  w->path = path;
+  w->fd = openat(dir_fd, name, kOpenFlags, mode & 07777);
+  fetchdeps_writer_close_parent(w, dir_fd);
+  if (w->fd == -1) {
+    w->in_file = 0;
+    return fetchdeps_writer_error(path);
+  }
+  return 1;
+}
+
+
+bool_t
+fetchdeps_writer_append(writer_t* w, void* data, size_t len)
+{
+  assert(w != NULL);
+  assert(w->in_file);
+  assert(data != NULL || len == 0);
+
+#ifdef FETCHDEPS_HAVE_URING
+  if (w->deferred) {
+    uring_t* ring = w->ring;
+    uringfile_t* file = &ring->files[ring->num_files];
+
+    if (file->len + len > w->size) {
+      errno = EFBIG;
+      return fetchdeps_writer_error(w->path);
+    }
+    memcpy(file->data + file->len, data, len);
+    file->len += len;
+    return 1;
+  }
+#endif
+
+  if (!fetchdeps_writer_write_all(w->fd, (char*)data, len))
+    return fetchdeps_writer_error(w->path);
+  return 1;
+}
+
+
+bool_t
+fetchdeps_writer_end_file(writer_t* w)
+{
+  struct timespec times[2];
+
+  assert(w != NULL);
+  assert(w->in_file);
+
+  w->in_file = 0;
+  ++w->file_count;
+
+#ifdef FETCHDEPS_HAVE_URING
+  if (w->deferred) {
+    uring_t* ring = w->ring;
+    uringfile_t* file = &ring->files[ring->num_files];
+
+    // The file is complete, so it joins the batch. Nothing touches the disk
+    // until the batch is flushed.
+    ring->arena_used += file->len;
+    ++ring->num_files;
+    w->deferred = 0;
+    return 1;
+  }
+#endif
+
+  times[0].tv_sec = w->mtime;
+  times[0].tv_nsec = 0;
+  times[1] = times[0];
+
+  if (futimens(w->fd, times) != 0) {
+    close(w->fd);
+    w->fd = -1;
+    return fetchdeps_writer_error(w->path);
+  }
+  if (close(w->fd) != 0) {
+    w->fd = -1;
+    return fetchdeps_writer_error(w->path);
+  }
+  w->fd = -1;
+  return 1;
+}
+
+
+void
+fetchdeps_writer_abort_file(writer_t* w)
+{
+  char* name;
+  int dir_fd;
+  int saved_errno = errno;
+
+  assert(w != NULL);
+  assert(w->in_file);
+
+  w->in_file = 0;
+
+#ifdef FETCHDEPS_HAVE_URING
+  if (w->deferred) {
+    // The file's data is only ever added to the batch when it's finished, so
+    // leaving it out is enough.
+    w->deferred = 0;
+    return;
+  }
+#endif
+
+  close(w->fd);
+  w->fd = -1;
+
+  // The file's directory was checked when it was begun and nothing can have
+  // changed it since, so this normally comes straight from the cache.
+  dir_fd = fetchdeps_writer_open_parent(w, w->path, &name, 1);
+  if (dir_fd != -1) {
+    unlinkat(dir_fd, name, 0);
+    fetchdeps_writer_close_parent(w, dir_fd);
+  }
+  errno = saved_errno;
+}
+
+
+bool_t
+fetchdeps_writer_flush(writer_t* w)
+{
+  assert(w != NULL);
+
+#ifdef FETCHDEPS_HAVE_URING
+  if (w->ring && w->ring->num_files > 0)
+    return fetchdeps_writer_uring_flush(w);
+#endif
+  return 1;
+}
+
+
+size_t
+fetchdeps_writer_file_count(writer_t* w)
+{
+  assert(w != NULL);
+  return w->file_count;
+}
+
+
+//
+// Private functions
+//
+
+bool_t
+fetchdeps_writer_error(char* path)
+{
+  fetchdeps_errors_set_with_msg(ERR_SYSTEM, "Unable to write %s", path);
+  return 0;
+}
+
+
+bool_t
+fetchdeps_writer_write_all(int fd, char* data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return 0;
+    }
+    data += n;
+    len -= n;
+  }
+  return 1;
+}
+
+
+// Open the directory which holds 'path', one component at a time and without
+// following symbolic links, so that a link in the archive or already on disk
+// can't take us outside the root. '*name' is set to the last component of
+// 'path'. Returns -1, with errno set, on failure; any other descriptor must be
+// handed back to fetchdeps_writer_close_parent.
+//
+// Archive entries are usually grouped by directory, so if 'cache' is set the
+// directory is kept open for next time. Lookups start from the cached
+// directory when it's a prefix of the new one, which keeps creating a deep
+// tree one level at a time from having to go back to the root at every step.
+int
+fetchdeps_writer_open_parent(writer_t* w, char* path, char** name, bool_t cache)
+{
+  char* slash = strrchr(path, '/');
+  char* dir = NULL;
+  char* comp;
+  char* next;
+  size_t len, cached_len = 0;
+  int fd = w->root_fd;
+
+  if (!slash) {
+    *name = path;
+    return w->root_fd;
+  }
+  *name = slash + 1;
+
+  len = slash - path;
+  if (w->parent_path) {
+    cached_len = strlen(w->parent_path);
+    if (cached_len == len && strncmp(w->parent_path, path, len) == 0)
+      return w->parent_fd;
+    if (cached_len < len && path[cached_len] == '/' &&
+        strncmp(w->parent_path, path, cached_len) == 0)
+      fd = w->parent_fd;
+  }
+
+  dir = fetchdeps_alloc_strndup(ALLOC_WRITER, path, len);
+  if (!dir)
+    return -1;
+
+  for (comp = dir + (fd == w->root_fd ? 0 : cached_len + 1); comp; comp = next) {
+    int next_fd;
+
+    next = strchr(comp, '/');
+    if (next)
+      *next++ = '\0';
+    if (*comp == '\0' || strcmp(comp, ".") == 0)
+      continue;
+    if (strcmp(comp, "..") == 0) {
+      errno = EPERM;
+      goto failure;
+    }
+
+    next_fd = openat(fd, comp, kDirFlags);
+    if (next_fd == -1)
+      goto failure;
+    fetchdeps_writer_close_parent(w, fd);
+    fd = next_fd;
+  }
+
+  // Components like "." can leave us where we started, and the root or the
+  // cached directory mustn't be closed while we're handing it back.
+  if (!cache || fd == w->root_fd) {
+    fetchdeps_alloc_free(dir);
+    return fd;
+  }
+  if (w->parent_path) {
+    if (w->parent_fd != fd)
+      close(w->parent_fd);
+    fetchdeps_alloc_free(w->parent_path);
+  }
+  w->parent_path = dir;
+  w->parent_fd = fd;
+  return fd;
+
+failure:
+  {
+    int saved_errno = errno;
+    fetchdeps_writer_close_parent(w, fd);
+    fetchdeps_alloc_free(dir);
+    errno = saved_errno;
+  }
+  return -1;
+}
+
+
+// Close a descriptor from fetchdeps_writer_open_parent, unless it's one the
+// writer keeps open anyway.
+void
+fetchdeps_writer_close_parent(writer_t* w, int fd)
+{
+  if (fd != w->root_fd && fd != w->parent_fd)
+    close(fd);
+}
+
+
+//
+// io_uring functions
+//
+
+#ifdef FETCHDEPS_HAVE_URING
+
+uring_t*
+fetchdeps_writer_uring_new()
+{
+  uring_t* ring = NULL;
+  struct io_uring_params params;
+  struct io_uring_probe* probe = NULL;
+  size_t probe_size;
+  int slots[URING_BATCH_FILES];
+  int i;
+
+  ring = (uring_t*)fetchdeps_alloc_calloc(ALLOC_WRITER, 1, sizeof(uring_t));
+  if (!ring)
+    goto failure;
+  ring->fd = -1;
+
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, kUringEntries, &params);
+  if (ring->fd < 0)
+    goto failure;
+
+  // Map the submission and completion rings. Newer kernels let us do both
+  // with a single mapping.
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_size > ring->sq_size)
+      ring->sq_size = ring->cq_size;
+    ring->cq_size = 0;
+  }
+
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {
+    ring->sq_ptr = NULL;
+    goto failure;
+  }
+
+  if (ring->cq_size == 0) {
+    ring->cq_ptr = ring->sq_ptr;
+  }
+  else {
+    ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {
+      ring->cq_ptr = NULL;
+      goto failure;
+    }
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto failure;
+  }
+
+  ring->sq_head = (unsigned int*)((char*)ring->sq_ptr + params.sq_off.head);
+  ring->sq_tail = (unsigned int*)((char*)ring->sq_ptr + params.sq_off.tail);
+  ring->sq_mask = (unsigned int*)((char*)ring->sq_ptr + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned int*)((char*)ring->sq_ptr + params.sq_off.array);
+  ring->cq_head = (unsigned int*)((char*)ring->cq_ptr + params.cq_off.head);
+  ring->cq_tail = (unsigned int*)((char*)ring->cq_ptr + params.cq_off.tail);
+  ring->cq_mask = (unsigned int*)((char*)ring->cq_ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ptr + params.cq_off.cqes);
+
+  // Check that the kernel supports every operation we need. MKDIRAT isn't
+  // used, but it arrived in the same release as opening into a direct
+  // descriptor slot, which is, and there's no other way to probe for that.
+  probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  probe = (struct io_uring_probe*)fetchdeps_alloc_calloc(ALLOC_WRITER, 1, probe_size);
+  if (!probe)
+    goto failure;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    goto failure;
+  if (probe->last_op < IORING_OP_MKDIRAT ||
+      !(probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) ||
+      !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) ||
+      !(probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED) ||
+      !(probe->ops[IORING_OP_MKDIRAT].flags & IO_URING_OP_SUPPORTED))
+    goto failure;
+  fetchdeps_alloc_free(probe);
+  probe = NULL;
+
+  // Reserve one empty direct descriptor slot per file in a batch. Each file's
+  // openat fills its slot and the linked write and close refer to it, so the
+  // whole chain can be submitted before the real descriptor is known.
+  for (i = 0; i < URING_BATCH_FILES; ++i)
+    slots[i] = -1;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, slots, URING_BATCH_FILES) < 0)
+    goto failure;
+
+  ring->arena = (char*)fetchdeps_alloc_malloc(ALLOC_WRITER, kUringArenaSize);
+  if (!ring->arena)
+    goto failure;
+
+  return ring;
+
+failure:
+  // Not being able to use io_uring isn't an error; the caller falls back to
+  // the POSIX backend.
+  errno = 0;
+  if (probe)
+    fetchdeps_alloc_free(probe);
+  if (ring)
+    fetchdeps_writer_uring_free(ring);
+  return NULL;
+}
+
+
+void
+fetchdeps_writer_uring_free(uring_t* ring)
+{
+  assert(ring != NULL);
+
+  if (ring->arena)
+    fetchdeps_alloc_free(ring->arena);
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    munmap(ring->cq_ptr, ring->cq_size);
+  if (ring->sq_ptr)
+    munmap(ring->sq_ptr, ring->sq_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+  fetchdeps_alloc_free(ring);
+}
+
+
+// Returns true if a file with exactly this path is waiting in the batch.
+bool_t
+fetchdeps_writer_uring_is_queued(writer_t* w, char* path)
+{
+  size_t i;
+
+  if (!w->ring)
+    return 0;
+  for (i = 0; i < w->ring->num_files; ++i) {
+    if (strcmp(w->ring->files[i].path, path) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+
+bool_t
+fetchdeps_writer_uring_flush(writer_t* w)
+{
+  uring_t* ring = w->ring;
+  unsigned int tail, head, mask;
+  unsigned int submitted = 0;
+  unsigned int completed = 0;
+  int first_error = 0;
+  size_t error_file = 0;
+  bool_t opened[URING_BATCH_FILES];
+  bool_t closed[URING_BATCH_FILES];
+  size_t i;
+
+  assert(ring != NULL);
+
+  // Queue up an openat -> write -> close chain for every file in the batch.
+  // The links mean each step only runs if the previous one succeeded.
+  tail = *ring->sq_tail;
+  mask = *ring->sq_mask;
+  for (i = 0; i < ring->num_files; ++i) {
+    uringfile_t* file = &ring->files[i];
+    struct io_uring_sqe* sqe;
+    unsigned int index;
+
+    index = tail & mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = w->root_fd;
+    sqe->addr = (unsigned long)file->path;
+    sqe->len = file->mode;
+    // Direct descriptors are never inherited, and the kernel rejects
+    // O_CLOEXEC for them.
+    sqe->open_flags = kOpenFlags & ~O_CLOEXEC;
+    sqe->file_index = i + 1;
+    sqe->user_data = (i << URING_STEP_BITS) | URING_STEP_OPEN;
+    ring->sq_array[index] = index;
+    ++tail;
+
+    index = tail & mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    sqe->fd = i;
+    sqe->addr = (unsigned long)file->data;
+    sqe->len = file->len;
+    sqe->off = 0;
+    sqe->user_data = (i << URING_STEP_BITS) | URING_STEP_WRITE;
+    ring->sq_array[index] = index;
+    ++tail;
+
+    index = tail & mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = i + 1;
+    sqe->user_data = (i << URING_STEP_BITS) | URING_STEP_CLOSE;
+    ring->sq_array[index] = index;
+    ++tail;
+
+    opened[i] = 0;
+    closed[i] = 0;
+    submitted += 3;
+  }
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  // Submit the lot and wait for every completion.
+  while (completed < submitted) {
+    int ret = (int)syscall(__NR_io_uring_enter, ring->fd,
+                           (completed == 0) ? submitted : 0,
+                           submitted - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno != EINTR) {
+      fetchdeps_errors_set_with_msg(ERR_SYSTEM, "io_uring submission failed");
+      return 0;
+    }
+
+    head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+      size_t file = (size_t)(cqe->user_data >> URING_STEP_BITS);
+      int err = 0;
+
+      switch (cqe->user_data & URING_STEP_MASK) {
+      case URING_STEP_OPEN:
+        opened[file] = (cqe->res >= 0);
+        break;
+      case URING_STEP_WRITE:
+        // A short write breaks the chain just like a failed one does, but
+        // doesn't say why. It's almost always a full disk.
+        if (cqe->res >= 0 && (size_t)cqe->res < ring->files[file].len)
+          err = ENOSPC;
+        break;
+      case URING_STEP_CLOSE:
+        closed[file] = (cqe->res >= 0);
+        break;
+      }
+      if (cqe->res < 0)
+        err = -cqe->res;
+
+      // Later steps in a chain are cancelled when an earlier one fails, so
+      // the original failure is the one worth reporting.
+      if (err && first_error == 0) {
+        first_error = err;
+        error_file = file;
+      }
+      ++head;
+      ++completed;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  // A chain which broke after the open leaves its file in the descriptor
+  // slot, where it would stay until the slot was next used.
+  for (i = 0; i < ring->num_files; ++i) {
+    if (opened[i] && !closed[i])
+      fetchdeps_writer_uring_release_slot(ring, i);
+  }
+
+  // A kernel which can't open into a direct descriptor slot rejects the
+  // openat. If that happens before any batch has worked, give up on io_uring
+  // and write this batch the slow way.
+  if (first_error == EINVAL && !ring->verified)
+    return fetchdeps_writer_uring_flush_posix(w);
+
+  if (first_error) {
+    errno = first_error;
+    fetchdeps_writer_error(ring->files[error_file].path);
+    ring->num_files = 0;
+    ring->arena_used = 0;
+    return 0;
+  }
+  ring->verified = 1;
+
+  // There's no io_uring operation for setting timestamps, so they're done in
+  // a pass after the batch has completed.
+  for (i = 0; i < ring->num_files; ++i) {
+    uringfile_t* file = &ring->files[i];
+    struct timespec times[2];
+
+    times[0].tv_sec = file->mtime;
+    times[0].tv_nsec = 0;
+    times[1] = times[0];
+    if (utimensat(w->root_fd, file->path, times, AT_SYMLINK_NOFOLLOW) != 0)
+      return fetchdeps_writer_error(file->path);
+  }
+
+  ring->num_files = 0;
+  ring->arena_used = 0;
+  return 1;
+}
+
+
+// Close whatever is in a direct descriptor slot by replacing it with nothing.
+void
+fetchdeps_writer_uring_release_slot(uring_t* ring, size_t i)
+{
+  struct io_uring_files_update update;
+  int fd = -1;
+
+  memset(&update, 0, sizeof(update));
+  update.offset = (unsigned int)i;
+  update.fds = (unsigned long)&fd;
+  syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+}
+
+
+bool_t
+fetchdeps_writer_uring_flush_posix(writer_t* w)
+{
+  uring_t* ring = w->ring;
+  size_t i;
+
+  w->ring = NULL;
+  w->backend = WRITER_POSIX;
+
+  for (i = 0; i < ring->num_files; ++i) {
+    uringfile_t* file = &ring->files[i];
+    struct timespec times[2];
+    int fd;
+
+    times[0].tv_sec = file->mtime;
+    times[0].tv_nsec = 0;
+    times[1] = times[0];
+
+    fd = openat(w->root_fd, file->path, kOpenFlags, file->mode);
+    if (fd == -1)
+      goto failure;
+    if (!fetchdeps_writer_write_all(fd, file->data, file->len) || futimens(fd, times) != 0) {
+      close(fd);
+      goto failure;
+    }
+    if (close(fd) != 0)
+      goto failure;
+  }
+
+  fetchdeps_writer_uring_free(ring);
+  return 1;
+
+failure:
+  fetchdeps_writer_error(ring->files[i].path);
+  fetchdeps_writer_uring_free(ring);
+  return 0;
+}
+
+#endif // FETCHDEPS_HAVE_URING
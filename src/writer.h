@@ -0,0 +1,109 @@
+#ifndef fetchdeps_writer_h
+#define fetchdeps_writer_h
+
+#include "common.h"
+
+#include <stddef.h>
+#include <time.h>
+
+//
+// Types
+//
+
+enum _writer_backend {
+  WRITER_AUTO,    // Use io_uring if the kernel supports it, otherwise POSIX.
+  WRITER_POSIX,   // Plain openat/write/futimens/close for every file.
+  WRITER_URING,   // Batched, linked io_uring submissions.
+  WRITER_UNKNOWN
+};
+typedef enum _writer_backend writer_backend_t;
+
+
+struct _writer;
+typedef struct _writer writer_t;
+
+
+//
+// Functions
+//
+
+// Create a writer which creates files and directories inside the directory
+// 'root'. The root directory must already exist. All paths passed to the
+// other writer functions are relative to it. Symbolic links are never
+// followed while looking a path up, so a path which leads through one is an
+// error rather than a way to write outside the root.
+//
+// If the backend is WRITER_URING or WRITER_AUTO and io_uring isn't available
+// (because this isn't Linux, the kernel is too old, or io_uring has been
+// disabled) the writer quietly falls back to WRITER_POSIX; use
+// fetchdeps_writer_backend to find out which one you got.
+//
+// The return value is NULL if the root directory couldn't be opened or memory
+// couldn't be allocated. Otherwise it must eventually be freed with
+// fetchdeps_writer_free.
+writer_t* fetchdeps_writer_new(char* root, writer_backend_t backend);
+
+// Flush any outstanding writes, then deallocate the writer. Returns false if
+// the flush failed; the writer is freed either way.
+bool_t fetchdeps_writer_free(writer_t* w);
+
+// Returns the backend the writer is actually using.
+writer_backend_t fetchdeps_writer_backend(writer_t* w);
+
+// Returns the name of a backend, as accepted by fetchdeps_writer_lookup_backend.
+const char* fetchdeps_writer_backend_name(writer_backend_t backend);
+
+// Look up a backend by name ("auto", "posix" or "uring"). Returns
+// WRITER_UNKNOWN if the name isn't recognised.
+writer_backend_t fetchdeps_writer_lookup_backend(char* name);
+
+// Create a directory. It isn't an error if the directory already exists. The
+// return value is true if the directory exists on completion. If 'created' is
+// not NULL, it's set to true when this call created the directory and false
+// if it was already there. A symbolic link to a directory doesn't count.
+bool_t fetchdeps_writer_make_dir(writer_t* w, char* path, unsigned int mode,
+                                 bool_t* created);
+
+// Create a symbolic link at 'path' pointing to 'target'. Any existing file at
+// 'path' is replaced. Outstanding writes are flushed first, so that they can't
+// land after the link and go through it.
+bool_t fetchdeps_writer_make_symlink(writer_t* w, char* path, char* target);
+
+// Create a hard link at 'path' to the existing file 'target', which is also
+// relative to the root. Any outstanding writes are flushed first, so that the
+// target is guaranteed to exist.
+bool_t fetchdeps_writer_make_hardlink(writer_t* w, char* path, char* target);
+
+// Start writing a regular file. Any existing file at 'path' is truncated. The
+// size is the total number of bytes which will be passed to
+// fetchdeps_writer_append before fetchdeps_writer_end_file is called; the
+// io_uring backend uses it to decide whether the file can be batched.
+//
+// Only one file may be in progress at a time. Writes may be deferred, so the
+// file isn't guaranteed to exist on disk until fetchdeps_writer_flush has
+// returned successfully. A file which isn't deferred flushes the outstanding
+// writes first, so files always reach the disk in the order they were begun.
+bool_t fetchdeps_writer_begin_file(writer_t* w, char* path, unsigned int mode,
+                                   time_t mtime, size_t size);
+
+// Append data to the file which is in progress. The writer copies the data if
+// it needs to keep it, so the buffer can be reused as soon as this returns.
+bool_t fetchdeps_writer_append(writer_t* w, void* data, size_t len);
+
+// Finish the file which is in progress.
+bool_t fetchdeps_writer_end_file(writer_t* w);
+
+// Give up on the file which is in progress, after an error. Whatever had been
+// written of it is removed rather than left behind looking complete. Any
+// error from the original failure is left as it was.
+void fetchdeps_writer_abort_file(writer_t* w);
+
+// Wait for all deferred writes to complete. Returns false if any of them
+// failed.
+bool_t fetchdeps_writer_flush(writer_t* w);
+
+// Returns the number of files written so far.
+size_t fetchdeps_writer_file_count(writer_t* w);
+
+#endif // fetchdeps_writer_h
+